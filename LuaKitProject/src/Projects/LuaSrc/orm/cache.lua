@@ -140,55 +140,79 @@ _cache = {
 
     _getInsertSqlAndBindValues = function (tablename, kv, needPrimaryKey)
         local t = Table(tablename)
-        local hasCacheSql = false
         local needPrimaryKeyNum = 0
         if needPrimaryKey then
             needPrimaryKeyNum = 1
         end
         local sqlKey = "insert_"..tablename..needPrimaryKeyNum
         local cache = _cache.getCacheSql(tablename,sqlKey)
+        -- columns are only built when the statement prefix is not cached yet
         local insert
-        if cache then
-            insert = cache
-            hasCacheSql = true
-        else
-            insert = "REPLACE INTO " .. tablename .. " ("
+        if not cache then
+            insert = lua_strbuf.new()
+            insert:append("REPLACE INTO ", tablename, " (")
         end
         local counter = 0
-        local values = ""
+        local values = lua_strbuf.new()
         local bindValues = {}
         for _, table_column in pairs(t.__colnames) do
             if needPrimaryKey and table_column.name == t.__primary_key.name then
             else
                 local colname = table_column.name
                 local value = kv[colname]
+                if counter ~= 0 then
+                    if insert then
+                        insert:append(", ")
+                    end
+                    values:append(", ")
+                end
                 if value then
                     table.insert(bindValues,value)
-                    value = "?"
+                    values:append("?")
                 else
-                    value = "NULL"
+                    values:append("NULL")
                 end
+                if insert then
+                    insert:append(colname)
+                end
+                counter = counter + 1
+            end
+        end
+
+        if insert then
+            insert:append(") \n\t    VALUES (")
+            cache = insert:tostring()
+            _cache.setCacheSql(tablename, sqlKey, cache)
+        end
+        values:append(")")
+        return cache .. values:tostring() , bindValues
+    end,
 
+    _getUpdateSqlAndBindValues = function (t, tablename, data, where)
+        local _update = lua_strbuf.new()
+        _update:append("UPDATE ", tablename, " SET")
+        local counter = 0
+        local setBindingValue = {}
+        for colname, new_value in pairs(data) do
+            local coltype = t:get_column(colname)
+            if coltype and coltype.field.validator(new_value) then
                 if counter ~= 0 then
-                    if not hasCacheSql then
-                        colname = ", " .. colname
-                    end
-                    value = ", " .. value
-                end
-                values = values .. value
-                if not hasCacheSql then
-                    insert = insert .. colname
+                    _update:append(",")
                 end
+                _update:append(" ", colname, " = ?")
                 counter = counter + 1
+                table.insert(setBindingValue, new_value)
+            else
+                BACKTRACE(WARNING, "Can't update value for column `" ..
+                                    Type.to.str(colname) .. "`")
             end
         end
-
-        if not hasCacheSql then
-            insert = insert .. ") \n\t    VALUES ("
-            _cache.setCacheSql(tablename, sqlKey, insert)
+        if counter == 0 then
+            BACKTRACE(WARNING, "No table columns for update")
+            return nil, setBindingValue
         end
-        insert = insert .. values .. ")"
-        return insert , bindValues
+        _update:append(" ", where)
+        return _update:tostring(), setBindingValue
     end,
 
 
@@ -233,25 +257,6 @@ _cache = {
 
     update = function (tablename, whereSql, whereBindingValues, data)
         local t = Table(tablename)
-        local _update = "UPDATE " .. tablename .. ""
-        local _set = ""
-        local coltype
-        local _set_tbl = {}
-        local setBindingValue = {}
-        local i=1
-
-        for colname, new_value in pairs(data) do
-            coltype = t:get_column(colname)
-            if coltype and coltype.field.validator(new_value) then
-                _set = _set .. " " .. colname .. " = ?"
-                _set_tbl[i] = " " .. colname .. " = ?"
-                i=i+1
-                table.insert(setBindingValue, new_value)
-            else
-                BACKTRACE(WARNING, "Can't update value for column `" ..
-                                    Type.to.str(colname) .. "`")
-            end
-        end
         if t.__primary_key then
             local selectSql = "SELECT "..t.__primary_key.name.." FROM "..tablename.." "..whereSql
             local results = lua_thread.postToThreadSync(_dbThreadId,"orm.model","rows",selectSql,whereBindingValues)
@@ -264,19 +269,13 @@ _cache = {
                 local s = require('orm.class.select')(t)
                 s:primaryKey(ids)
                 local where = s:_buildPrimaryKey()
-                if _set ~= "" then
-                    if #_set_tbl<2 then
-                        _update = _update .. " SET " .. _set .. " " .. where
-                    else
-                        _update = _update .. " SET " .. table.concat(_set_tbl,",") .. " " .. where
+                local _update, setBindingValue = _cache._getUpdateSqlAndBindValues(t, tablename, data, where)
+                if _update then
+                    for _,v in ipairs(ids) do
+                        table.insert(setBindingValue,v)
                     end
-                else
-                    BACKTRACE(WARNING, "No table columns for update")
-                end
-                for _,v in ipairs(ids) do
-                    table.insert(setBindingValue,v)
+                    lua_thread.postToThread(_dbThreadId,"orm.model","execute",_update,setBindingValue)
                 end
-                lua_thread.postToThread(_dbThreadId,"orm.model","execute",_update,setBindingValue)
                 -- remove cache
                 if _instanceCache[tablename] then
                     for _,v in ipairs(ids) do
@@ -289,18 +288,12 @@ _cache = {
                 end
             end
         else
-            if _set ~= "" then
-                if #_set_tbl<2 then
-                    _update = _update .. " SET " .. _set .. " " .. _where
-                else
-                    _update = _update .. " SET " .. table.concat(_set_tbl,",") .. " " .. _where
-                end
+            local _update, setBindingValue = _cache._getUpdateSqlAndBindValues(t, tablename, data, whereSql)
+            if _update then
                 for _,v in ipairs(whereBindingValues) do
                     table.insert(setBindingValue,v)
                 end
                 lua_thread.postToThread(_dbThreadId,"orm.model","execute",_update,setBindingValue)
-            else
-                BACKTRACE(WARNING, "No table columns for update")
             end
         end
 
@@ -314,43 +307,17 @@ _cache = {
 
     updateWithPrimaryKey = function (tablename,ids,data)
          if #ids > 0 then
-            local _update = "UPDATE " .. tablename .. ""
             local t = Table(tablename)
-            local _set = ""
-            local coltype
-            local _set_tbl = {}
-            local setBindingValue = {}
-            local i=1
-
-            for colname, new_value in pairs(data) do
-                coltype = t:get_column(colname)
-                if coltype and coltype.field.validator(new_value) then
-                    _set = _set .. " " .. colname .. " = ?"
-                    _set_tbl[i] = " " .. colname .. " = ?"
-                    i=i+1
-                    table.insert(setBindingValue, new_value)
-                else
-                    BACKTRACE(WARNING, "Can't update value for column `" ..
-                                        Type.to.str(colname) .. "`")
-                end
-            end
-           
             local s = require('orm.class.select')(t)
             s:primaryKey(ids)
             local where = s:_buildPrimaryKey()
-            if _set ~= "" then
-                if #_set_tbl<2 then
-                    _update = _update .. " SET " .. _set .. " " .. where
-                else
-                    _update = _update .. " SET " .. table.concat(_set_tbl,",") .. " " .. where
+            local _update, setBindingValue = _cache._getUpdateSqlAndBindValues(t, tablename, data, where)
+            if _update then
+                for _,v in ipairs(ids) do
+                    table.insert(setBindingValue,v)
                 end
-            else
-                BACKTRACE(WARNING, "No table columns for update")
-            end
-            for _,v in ipairs(ids) do
-                table.insert(setBindingValue,v)
+                lua_thread.postToThread(_dbThreadId,"orm.model","execute",_update,setBindingValue)
             end
-            lua_thread.postToThread(_dbThreadId,"orm.model","execute",_update,setBindingValue)
             -- remove cache
             if _instanceCache[tablename] then
                 for _,v in ipairs(ids) do
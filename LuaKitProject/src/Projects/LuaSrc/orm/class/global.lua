@@ -100,7 +100,8 @@ function table.has_value(array, value)
 end
 
 function table.join(array, separator)
-    local result = ""
+    -- 先收集再用 table.concat 一次拼接，避免逐个 .. 造成的二次复制
+    local values = {}
     local counter = 0
 
     if not separator then
@@ -108,13 +109,9 @@ function table.join(array, separator)
     end
 
     for _, value in pairs(array) do
-        if counter ~= 0 then
-            value = separator .. value
-        end
-
-        result = result .. value
         counter = counter + 1
+        values[counter] = value
     end
 
-    return result
+    return table.concat(values, separator)
 end
\ No newline at end of file
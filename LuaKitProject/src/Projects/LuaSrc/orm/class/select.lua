@@ -201,28 +201,25 @@ local Select = function(own_table)
         ---------------------------------------------------
         _condition = function (self, rules, start_with)
             local counter = 0
-            local condition = ""
-            local _equation
+            local condition = lua_strbuf.new()
 
-            condition = condition .. start_with
+            condition:append(start_with)
 
             for colname, value in pairs(rules) do
-                _equation = self:_build_equation(colname, value)
-
                 if counter ~= 0 then
-                     _equation = "AND " .. _equation
+                    condition:append(" AND ", self:_build_equation(colname, value))
+                else
+                    condition:append(" ", self:_build_equation(colname, value))
                 end
-
-                condition = condition .. " " .. _equation
                 counter = counter + 1
             end
 
-            return condition
+            return condition:tostring()
         end,
 
         -- BUild join tables rules
         _build_join = function (self)
-            local result_join = ""
+            local result_join = lua_strbuf.new()
             local unique_tables = {}
             local left_table, right_table, mode ,matchColumns, where, whereParams
             local join_mode, colname
@@ -256,8 +253,7 @@ local Select = function(own_table)
                 end
 
                 if where and #where > 0 then
-                    result_join = result_join .. " \n" .. join_mode .. " " ..
-                                          tablename .. " ON " .. where
+                    result_join:append(" \n", join_mode, " ", tablename, " ON ", where)
                     for _,v in ipairs(whereParams) do
                         table.insert(self._rules._bindValuse,v)
                     end
@@ -265,37 +261,35 @@ local Select = function(own_table)
                     local index = 0
                     for rightParam, leftParam  in pairs(matchColumns) do
                         if index == 0 then
-                            result_join = result_join .. " \n" .. join_mode .. " " ..
-                                      tablename .. " ON "
+                            result_join:append(" \n", join_mode, " ", tablename, " ON ")
                         else 
-                            result_join = result_join .. " AND "
+                            result_join:append(" AND ")
                         end
                         index = index + 1
                         parsed_column, _ = left_table:column(leftParam)
-                        result_join = result_join .. parsed_column
+                        result_join:append(parsed_column)
                         parsed_column, _ = right_table:column(rightParam)
-                        result_join = result_join .. " = " .. parsed_column
+                        result_join:append(" = ", parsed_column)
                     end
                 else
                     for _, key in pairs(right_table.__foreign_keys) do
                         if key.settings.to == left_table then
                             colname = key.name
 
-                            result_join = result_join .. " \n" .. join_mode .. " " ..
-                                          tablename .. " ON "
+                            result_join:append(" \n", join_mode, " ", tablename, " ON ")
 
                             parsed_column, _ = right_table:column(colname)
-                            result_join = result_join .. parsed_column
+                            result_join:append(parsed_column)
 
                             parsed_column, _ = left_table:column(left_table.__primary_key.name)
-                            result_join = result_join .. " = " .. parsed_column
+                            result_join:append(" = ", parsed_column)
 
                             break
                         end
                     end
                 end
             end
-            return result_join
+            return result_join:tostring()
         end,
 
         -- String with includin data in select
@@ -371,7 +365,8 @@ local Select = function(own_table)
             local join
 
             --------------------- Include Columns To Select ------------------
-            _select = "SELECT " .. including
+            _select = lua_strbuf.new()
+            _select:append("SELECT ", including)
 
             -- Add join rules
             if table.getn(self._rules.columns.join) > 0 then
@@ -387,13 +382,13 @@ local Select = function(own_table)
                     if not table.has_value(unique_tables, left_table) then
                         table.insert(unique_tables, left_table)
                         needColumns[left_table.__tablename__] = self._rules.columns.needColumns or {}
-                        _select = _select .. ", " .. self:_build_including(left_table,self._rules.columns.needColumns)
+                        _select:append(", ", self:_build_including(left_table,self._rules.columns.needColumns))
                     end
                   
                     if not table.has_value(unique_tables, right_table) then
                         table.insert(unique_tables, right_table)
                         needColumns[right_table.__tablename__] = self._rules.columns.needColumns or {}
-                        _select = _select .. ", " .. self:_build_including(right_table,self._rules.columns.needColumns)
+                        _select:append(", ", self:_build_including(right_table,self._rules.columns.needColumns))
                     end
                 end
 
@@ -410,14 +405,14 @@ local Select = function(own_table)
                     table.insert(aggregators, value[1] .. " AS " .. as)
                 end
 
-                _select = _select .. ", " .. table.join(aggregators)
+                _select:append(", ", table.join(aggregators))
             end
             ------------------- End Include Columns To Select ----------------
 
-            _select = _select .. " FROM " .. self.own_table.__tablename__
+            _select:append(" FROM ", self.own_table.__tablename__)
 
             if join then
-                _select = _select .. " " .. join
+                _select:append(" ", join)
             end
 
             -- Build WHERE
@@ -426,55 +421,55 @@ local Select = function(own_table)
                 for _,v in ipairs(self._rules.primaryKey) do
                     table.insert(self._rules._bindValuse,v)
                 end
-                _select = _select .. " " .. condition
+                _select:append(" ", condition)
             elseif self._rules.whereStr and self._rules.whereStr ~= "" then
                 condition = "\nWHERE ".. self._rules.whereStr
                 for _,v in ipairs(self._rules.whereBindValues) do
                     table.insert(self._rules._bindValuse,v)
                 end
-                _select = _select .. " " .. condition
+                _select:append(" ", condition)
             else
                 if next(self._rules.where) then
                     condition = self:_condition(self._rules.where, "\nWHERE")
-                    _select = _select .. " " .. condition
+                    _select:append(" ", condition)
                 end
             end
             -- Build GROUP BY
             if table.getn(self._rules.group) > 0 then
                 rule = table.join(self._rules.group)
-                _select = _select .. " \nGROUP BY " .. rule
+                _select:append(" \nGROUP BY ", rule)
             end
 
             -- Build HAVING
             if self._rules.havingStr and #self._rules.havingStr>0  then
                 condition = "\nHAVING ".. self._rules.havingStr
-                _select = _select .. " " .. condition
+                _select:append(" ", condition)
                 for _,v in ipairs(self._rules.havingBindValues) do
                     table.insert(self._rules._bindValuse,v)
                 end
             else
                 if next(self._rules.having) and self._rules.group then
                     condition = self:_condition(self._rules.having, "\nHAVING ")
-                    _select = _select .. " " .. condition
+                    _select:append(" ", condition)
                 end
             end
 
             -- Build ORDER BY
             if table.getn(self._rules.order) > 0 then
                 rule = table.join(self._rules.order)
-                _select = _select .. " \nORDER BY " .. rule
+                _select:append(" \nORDER BY ", rule)
             end
 
             -- Build LIMIT
             if self._rules.limit then
-                _select = _select .. " \nLIMIT " .. self._rules.limit
+                _select:append(" \nLIMIT ", self._rules.limit)
             end
 
             -- Build OFFSET
             if self._rules.offset then
-                _select = _select .. " \nOFFSET " .. self._rules.offset
+                _select:append(" \nOFFSET ", self._rules.offset)
             end
-            return lua_thread.postToThreadSync(self.own_table.cacheThreadId,"orm.cache","rows",self.own_table.__tablename__,_select,self._rules._bindValuse,needColumns,self._rules.primaryKey,self._rules.selectColumns)
+            return lua_thread.postToThreadSync(self.own_table.cacheThreadId,"orm.cache","rows",self.own_table.__tablename__,_select:tostring(),self._rules._bindValuse,needColumns,self._rules.primaryKey,self._rules.selectColumns)
         end,
 
         -- Add column to table
@@ -171,6 +171,9 @@ function Table.addTableInfo(params,callback)
         callback(nil)
     end
     local threadId = lua_thread.createThread(BusinessThreadLOGIC,"OrmsThread")
+    if callback == nil and lua_coroutine.isScheduled() then
+        return lua_coroutine.await(threadId,"orm.class.table","addTableInfoOnLogicThread",params)
+    end
     lua_thread.postToThread(threadId,"orm.class.table","addTableInfoOnLogicThread",params, c);
 end
 
@@ -188,6 +191,9 @@ function Table.saveOrm(params,callback)
         callback(result)
     end
     local threadId = lua_thread.createThread(BusinessThreadLOGIC,"OrmsThread")
+    if callback == nil and lua_coroutine.isScheduled() then
+        return lua_coroutine.await(threadId,"orm.class.table","saveOrmOnLogicThread",params)
+    end
     lua_thread.postToThread(threadId,"orm.class.table","saveOrmOnLogicThread",params, c);
 end
 
@@ -308,6 +314,9 @@ function Table.getAllByParams(params,callback)
         callback(d)
     end
     local threadId = lua_thread.createThread(BusinessThreadLOGIC,"OrmsThread")
+    if callback == nil and lua_coroutine.isScheduled() then
+        return lua_coroutine.await(threadId,"orm.class.table","getAllByParamsOnLogicThread",params)
+    end
     lua_thread.postToThread(threadId,"orm.class.table","getAllByParamsOnLogicThread",params, c);
 end
 
@@ -329,6 +338,9 @@ function Table.getFirstByParams(params,callback)
         callback(d)
     end
     local threadId = lua_thread.createThread(BusinessThreadLOGIC,"OrmsThread")
+    if callback == nil and lua_coroutine.isScheduled() then
+        return lua_coroutine.await(threadId,"orm.class.table","getFirstOnLogicThread",params)
+    end
     lua_thread.postToThread(threadId,"orm.class.table","getFirstOnLogicThread",params, c);
 end
 
@@ -351,6 +363,9 @@ function Table.deleteByParams(params,callback)
         callback(nil)
     end
     local threadId = lua_thread.createThread(BusinessThreadLOGIC,"OrmsThread")
+    if callback == nil and lua_coroutine.isScheduled() then
+        return lua_coroutine.await(threadId,"orm.class.table","deleteByParamsOnLogicThread",params)
+    end
     lua_thread.postToThread(threadId,"orm.class.table","deleteByParamsOnLogicThread",params, c);
 
 end
@@ -369,6 +384,9 @@ function Table.updateByParams(params,callback)
         callback(nil)
     end
     local threadId = lua_thread.createThread(BusinessThreadLOGIC,"OrmsThread")
+    if callback == nil and lua_coroutine.isScheduled() then
+        return lua_coroutine.await(threadId,"orm.class.table","updateByParamsOnLogicThread",params)
+    end
     lua_thread.postToThread(threadId,"orm.class.table","updateByParamsOnLogicThread",params, c);
 
 end
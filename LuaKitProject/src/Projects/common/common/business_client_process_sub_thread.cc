@@ -11,8 +11,9 @@
 #include "common/notification_service_impl.h"
 //#include "net/url_request/url_fetcher.h"
 
-BusinessProcessSubThread::BusinessProcessSubThread(BusinessThreadID identifier, const char * threadName)
-    : BusinessThreadImpl(identifier,threadName)/*,
+BusinessProcessSubThread::BusinessProcessSubThread(BusinessThreadID identifier, const char * threadName,
+                                                   ID type)
+    : BusinessThreadImpl(identifier,threadName,type)/*,
       notification_service_(NULL)*/ {
 }
 
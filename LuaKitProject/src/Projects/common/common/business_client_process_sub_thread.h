@@ -24,7 +24,8 @@ namespace content {
 // functions, so this class initializes COM for those users.
 class BusinessProcessSubThread : public BusinessThreadImpl {
  public:
-  explicit BusinessProcessSubThread(BusinessThreadID identifier, const char * threadName);
+  BusinessProcessSubThread(BusinessThreadID identifier, const char * threadName,
+                           ID type = ID_COUNT);
   virtual ~BusinessProcessSubThread();
 
  protected:
@@ -51,9 +51,11 @@ base::LazyInstance<BusinessThreadGlobals>::Leaky
 
 }  // namespace
 
-BusinessThreadImpl::BusinessThreadImpl(BusinessThreadID identifier,const char * thread_name)
+BusinessThreadImpl::BusinessThreadImpl(BusinessThreadID identifier,const char * thread_name,
+                                       ID type)
     : Thread(thread_name),
-      identifier_(identifier) {
+      identifier_(identifier),
+      type_(type == ID_COUNT ? static_cast<ID>(identifier) : type) {
   BusinessThreadGlobals& globals = g_globals.Get();
   globals.threads.push_back(NULL);
   globals.luaStates.push_back(NULL);
@@ -64,7 +66,8 @@ BusinessThreadImpl::BusinessThreadImpl(BusinessThreadID identifier,const char *
 BusinessThreadImpl::BusinessThreadImpl(BusinessThreadID identifier,
                                      base::MessageLoop* message_loop)
     : Thread(message_loop->thread_name().c_str()),
-      identifier_(identifier) {
+      identifier_(identifier),
+      type_(static_cast<ID>(identifier)) {
   BusinessThreadGlobals& globals = g_globals.Get();
   globals.threads.push_back(NULL);
   globals.luaStates.push_back(NULL);
@@ -114,7 +117,7 @@ void BusinessThreadImpl::Initialize() {
   globals.threads[identifier_] = this;
   if(identifier_ == UI){
       lua_State* luaState = luaL_newstate();
-      luaInit(luaState);
+      luaInit(luaState, type_);
       DLOG(INFO) << "UI luaL_newstate" << identifier_;
       globals.luaStates[identifier_] = luaState;
   }
@@ -142,7 +145,7 @@ void BusinessThreadImpl::ThreadMain(){
    
     BusinessThreadGlobals& globals = g_globals.Get();
     lua_State* luaState = luaL_newstate();
-    luaInit(luaState);
+    luaInit(luaState, type_);
     LOG(INFO) << "BusinessThreadImpl::ThreadMain luaL_newstate" << identifier_;
     globals.luaStates[identifier_] = luaState;
     Thread::ThreadMain();
@@ -13,8 +13,11 @@ class BusinessThreadImpl
     : public BusinessThread, public base::Thread {
  public:
   // Construct a BusinessThreadImpl with the supplied identifier.  It is an error
-  // to construct a BusinessThreadImpl that already exists.
-  explicit BusinessThreadImpl(BusinessThreadID identifier, const char * thread_name);
+  // to construct a BusinessThreadImpl that already exists. |type| is the kind of
+  // thread created through BusinessRuntime::createNewThread, it defaults to the
+  // identifier for the well-known threads.
+  BusinessThreadImpl(BusinessThreadID identifier, const char * thread_name,
+                     ID type = ID_COUNT);
 
   // Special constructor for the main (UI) thread and unittests. We use a dummy
   // thread here since the main thread already exists.
@@ -46,6 +49,10 @@ class BusinessThreadImpl
   // The identifier of this thread.  Only one thread can exist with a given
   // identifier at a given time.
   BusinessThreadID identifier_;
+
+  // The kind of this thread, used to choose which native lua modules its
+  // lua_State may load.
+  ID type_;
 };
 
 #endif  // CONTENT_BROWSER_BROWSER_THREAD_IMPL_H_
@@ -182,7 +182,7 @@ BusinessThreadID BusinessMainLoop::CreateNewThread(BusinessThread::ID type, cons
     }
     BusinessProcessSubThread * threadPtr;
     BusinessThreadID newId = BusinessThread::getThreadCount();
-    threadPtr = new BusinessProcessSubThread((BusinessThreadID)newId, threadName);
+    threadPtr = new BusinessProcessSubThread((BusinessThreadID)newId, threadName, type);
     threadPtr->StartWithOptions(*options);
     moreThreads.push_back(threadPtr);
     return newId;
@@ -3,169 +3,476 @@ extern "C" {
 #include "lauxlib.h"
 }
 #include "lua_async_socket.h"
+#include "lua_async_udp_socket.h"
+#include "lua_web_socket.h"
 #include "tools/lua_helpers.h"
+#include "network/async_server_socket.h"
 #include "network/async_socket.h"
 #include "network/net/io_buffer.h"
+#include "network/net/net_errors.h"
+#include "network/socket_stream_reader.h"
 #include "common/base_lambda_support.h"
+#include "common/business_runtime.h"
+#include "lua_coroutine.h"
 static int create(lua_State *L);
-static int __index(lua_State *L);
-static int __newindex(lua_State *L);
+static int listen(lua_State *L);
 static int __gc(lua_State *L);
 static int connect(lua_State *L);
 static int read(lua_State *L);
+static int readExactly(lua_State *L);
+static int readUntil(lua_State *L);
+static int readLine(lua_State *L);
 static int write(lua_State *L);
+static int setWriteHighWaterMark(lua_State *L);
+static int setFraming(lua_State *L);
+static int readFrame(lua_State *L);
+static int writeFrame(lua_State *L);
 static int disconnect(lua_State *L);
 static int isConnected(lua_State *L);
 
-static int create(lua_State *L)
+//readUntil/readLine 没有指定上限时最多缓存的字节数
+const static size_t DEFAULT_MAX_READ_LENGTH = 1024 * 1024;
+
+//reader 带着 socket 的接收缓冲，read 系列接口共用
+struct LuaAsyncSocket {
+    net::AsyncSocket *socket;
+    net::SocketStreamReader *reader;
+    net::LengthPrefixedCodec *codec;
+};
+
+//创建 socket 的 userdata 压栈，userdata 回收时删除 socket
+static void pushAsyncSocket(lua_State *L, net::AsyncSocket *socket)
 {
-    BEGIN_STACK_MODIFY(L);
-    const char * host = luaL_checkstring(L, 1);
-    int port = luaL_checkint(L, 2);
-    lua_pop(L, 2);
-    net::AsyncSocket * socket = new net::AsyncSocket(host,port);
-    size_t nbytes = sizeof(net::AsyncSocket **);
-    net::AsyncSocket ** instanceUserdata = (net::AsyncSocket **)lua_newuserdata(L, nbytes);
-    *instanceUserdata = socket;
+    size_t nbytes = sizeof(LuaAsyncSocket);
+    LuaAsyncSocket * instanceUserdata = (LuaAsyncSocket *)lua_newuserdata(L, nbytes);
+    instanceUserdata->socket = socket;
+    instanceUserdata->reader = new net::SocketStreamReader(socket);
+    instanceUserdata->codec = new net::LengthPrefixedCodec();
+    //写队列降到高水位一半以下时调用 drainCallback
+    socket->setWriteDrainCallback(base::BindLambda([=](){
+        lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+        pushUserdataInWeakTable(state,socket);
+        if (!lua_isnil(state, -1)) {
+            luaGetUserdataField(state, -1, "drainCallback");
+            if (lua_isfunction(state, -1)) {
+                int err = lua_pcall(state, 0, 0, 0);
+                if (err != 0) {
+                    luaL_error(state,"async_socket drainCallback error");
+                }
+            } else {
+                lua_pop(state, 1);
+            }
+        }
+        lua_pop(state, 1);
+    }));
     luaL_getmetatable(L, LUA_ASYNC_SOCKET_METATABLE_NAME);
     lua_setmetatable(L, -2);
-    lua_newtable(L);
-    
-    lua_pushcfunction(L, connect);
-    lua_setfield(L, -2, "connect");
-    lua_pushcfunction(L, read);
-    lua_setfield(L, -2, "read");
-    lua_pushcfunction(L, write);
-    lua_setfield(L, -2, "write");
-    lua_pushcfunction(L, disconnect);
-    lua_setfield(L, -2, "disconnect");
-    lua_pushcfunction(L, isConnected);
-    lua_setfield(L, -2, "isConnected");
-    
-    lua_setfenv(L, -2);
+    luaInitUserdataFields(L, -1);
     
     pushWeakUserdataTable(L);
-    lua_pushlightuserdata(L, *instanceUserdata);
+    lua_pushlightuserdata(L, socket);
     lua_pushvalue(L, -3);
     lua_rawset(L, -3);
     lua_pop(L, 1);
-    
+}
+
+static int create(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L);
+    const char * host = luaL_checkstring(L, 1);
+    int port = luaL_checkint(L, 2);
+    lua_pop(L, 2);
+    net::AsyncSocket * socket = new net::AsyncSocket(host,port);
+    pushAsyncSocket(L, socket);
     END_STACK_MODIFY(L, 1)
     return 1;
 }
 
-static int __newindex(lua_State *L)
+//在接受连接的线程上调用 require(moduleName)[methodName](socket, peerIp)
+static void onAccepted(const std::string& moduleName, const std::string& methodName,
+                       net::AsyncSocket *socket, const net::sockaddr_data& peer)
+{
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    BEGIN_STACK_MODIFY(state);
+    luaL_getmetatable(state, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    bool opened = !lua_isnil(state, -1);
+    lua_pop(state, 1);
+    if (!opened) {
+        luaopen_async_socket(state);
+    }
+    lua_getglobal(state, "require");
+    lua_pushstring(state, moduleName.c_str());
+    if (lua_pcall(state, 1, 1, 0) != 0) {
+        LOG(ERROR) << "async_socket accept require error:" << lua_tostring(state, -1);
+        lua_pop(state, 1);
+        delete socket;
+    } else {
+        lua_getfield(state, -1, methodName.c_str());
+        lua_remove(state, -2);
+        pushAsyncSocket(state, socket);
+        lua_pushstring(state, net::AsyncSocket::Sockaddr2IP((const sockaddr *)peer.data()).c_str());
+        if (lua_pcall(state, 2, 0, 0) != 0) {
+            LOG(ERROR) << "async_socket accept callback error:" << lua_tostring(state, -1);
+            lua_pop(state, 1);
+        }
+    }
+    END_STACK_MODIFY(state, 0)
+}
+
+//lua_asyncSocket.listen(host, port, moduleName, methodName[, threads])
+//threads 是线程 id 或者线程 id 的数组，连接轮流交给这些 IO 线程，不传时在当前线程处理
+static int listen(lua_State *L)
 {
     BEGIN_STACK_MODIFY(L);
-    // Add value to the userdata's environment table.
-    lua_getfenv(L, 1);
-    lua_insert(L, 2);
-    lua_rawset(L, 2);
-    END_STACK_MODIFY(L, 0);
-    return 0;
+    std::string host = luaL_checkstring(L, 1);
+    int port = luaL_checkint(L, 2);
+    std::string moduleName = luaL_checkstring(L, 3);
+    std::string methodName = luaL_checkstring(L, 4);
+    std::vector<BusinessThreadID> threads;
+    if (lua_isnumber(L, 5)) {
+        threads.push_back((BusinessThreadID)lua_tointeger(L, 5));
+    } else if (lua_istable(L, 5)) {
+        size_t count = lua_objlen(L, 5);
+        for (size_t i = 1; i <= count; i++) {
+            lua_rawgeti(L, 5, (int)i);
+            threads.push_back((BusinessThreadID)luaL_checkinteger(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+    if (base::MessageLoop::current()->type() != base::MessageLoop::TYPE_IO) {
+        return luaL_error(L, "lua_asyncSocket.listen must be called on an IO thread");
+    }
+    net::AsyncServerSocket *server = new net::AsyncServerSocket();
+    int rv = server->listen(host, (uint16_t)port, SOMAXCONN);
+    if (rv == net::OK) {
+        server->setAcceptThreads(threads);
+        rv = server->startAccepting(base::Bind(&onAccepted, moduleName, methodName));
+    }
+    lua_settop(L, 0);
+    if (rv != net::OK) {
+        delete server;
+        lua_pushnil(L);
+        lua_pushnumber(L, rv);
+        END_STACK_MODIFY(L, 2)
+        return 2;
+    }
+    net::AsyncServerSocket **instanceUserdata = (net::AsyncServerSocket **)lua_newuserdata(L, sizeof(net::AsyncServerSocket *));
+    *instanceUserdata = server;
+    luaL_getmetatable(L, LUA_ASYNC_SERVER_SOCKET_METATABLE_NAME);
+    lua_setmetatable(L, -2);
+    END_STACK_MODIFY(L, 1)
+    return 1;
 }
 
-static int __gc(lua_State *L)
+static int serverGc(lua_State *L)
 {
-    net::AsyncSocket **instanceUserdata = (net::AsyncSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    net::AsyncServerSocket **instanceUserdata = (net::AsyncServerSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SERVER_SOCKET_METATABLE_NAME);
     delete *instanceUserdata;
+    *instanceUserdata = NULL;
     return 0;
 }
 
-static int __index(lua_State *L)
+static int serverClose(lua_State *L)
 {
-    BEGIN_STACK_MODIFY(L);
-    lua_getfenv(L, -2);
-    lua_pushvalue(L, -2);
-    lua_rawget(L, 3);
-    lua_insert(L, 1);
-    lua_settop(L, 1);
-    END_STACK_MODIFY(L, 1);
+    net::AsyncServerSocket **instanceUserdata = (net::AsyncServerSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SERVER_SOCKET_METATABLE_NAME);
+    if (*instanceUserdata) {
+        (*instanceUserdata)->close();
+    }
+    return 0;
+}
+
+static int serverPort(lua_State *L)
+{
+    net::AsyncServerSocket **instanceUserdata = (net::AsyncServerSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SERVER_SOCKET_METATABLE_NAME);
+    lua_pushinteger(L, *instanceUserdata ? (*instanceUserdata)->localPort() : 0);
     return 1;
 }
 
+static int __gc(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    delete instanceUserdata->reader;
+    delete instanceUserdata->codec;
+    delete instanceUserdata->socket;
+    return 0;
+}
+
+//没有设置 callbackName 对应的回调且在调度协程里时挂起协程，返回协程引用
+static int suspendWithoutCallback(lua_State *L, const char *callbackName)
+{
+    luaGetUserdataField(L, 1, callbackName);
+    bool hasCallback = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (hasCallback) {
+        return LUA_NOREF;
+    }
+    return luaCoroutineSuspend(L);
+}
+
 static int connect(lua_State *L)
 {
     BEGIN_STACK_MODIFY(L);
-    net::AsyncSocket **instanceUserdata = (net::AsyncSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
-    (*instanceUserdata)->connect(base::BindLambda([=](int rv){
-        pushUserdataInWeakTable(L,*instanceUserdata);
-        if (!lua_isnil(L, -1)) {
-            lua_getfield(L, -1, "connectCallback");
-            if (lua_isfunction(L, -1)) {
-                lua_pushnumber(L, rv);
-                int err = lua_pcall(L, 1, 0, 0);
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    int coroutineRef = suspendWithoutCallback(L, "connectCallback");
+    instanceUserdata->socket->connect(base::BindLambda([=](int rv){
+        lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+        if (coroutineRef != LUA_NOREF) {
+            lua_pushnumber(state, rv);
+            luaCoroutineResume(state, coroutineRef, 1);
+            return;
+        }
+        pushUserdataInWeakTable(state,instanceUserdata->socket);
+        if (!lua_isnil(state, -1)) {
+            luaGetUserdataField(state, -1, "connectCallback");
+            if (lua_isfunction(state, -1)) {
+                lua_pushnumber(state, rv);
+                int err = lua_pcall(state, 1, 0, 0);
                 if (err != 0) {
-                    luaL_error(L,"async_socket connectCallback error");
+                    luaL_error(state,"async_socket connectCallback error");
                 }
             } else {
-                lua_pop(L, 1);
+                lua_pop(state, 1);
             }
         }
-        lua_pop(L, 1);
+        lua_pop(state, 1);
     }));
     END_STACK_MODIFY(L, 0)
+    if (coroutineRef != LUA_NOREF) {
+        return lua_yield(L, 0);
+    }
     return 0;
 }
 
-static int read(lua_State *L)
+//协程里读到数据返回字符串，出错或者连接关闭返回 nil, rv；回调方式只在读到数据时调用 readCallback
+static void deliverRead(net::AsyncSocket *socket, int coroutineRef, int rv, const std::string& data)
 {
-    BEGIN_STACK_MODIFY(L);
-    net::AsyncSocket **instanceUserdata = (net::AsyncSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
-    auto buffer = make_scoped_refptr(new net::IOBufferWithSize(8192));
-    (*instanceUserdata)->read(buffer, buffer->size(),base::BindLambda([=](int rv){
-        if (rv > 0) {
-            pushUserdataInWeakTable(L,*instanceUserdata);
-            if (!lua_isnil(L, -1)) {
-                lua_getfield(L, -1, "readCallback");
-                if (lua_isfunction(L, -1)) {
-                    lua_pushlstring(L, (char *)(buffer->data()), rv);
-                    int err = lua_pcall(L, 1, 0, 0);
-                    if (err != 0) {
-                        luaL_error(L,"async_socket readCallback error");
-                    }
-                } else {
-                    lua_pop(L, 1);
-                }
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    if (coroutineRef != LUA_NOREF) {
+        if (rv == net::OK) {
+            lua_pushlstring(state, data.data(), data.size());
+            luaCoroutineResume(state, coroutineRef, 1);
+        } else {
+            //连接关闭返回 nil, 0
+            lua_pushnil(state);
+            lua_pushnumber(state, rv == net::ERR_CONNECTION_CLOSED ? 0 : rv);
+            luaCoroutineResume(state, coroutineRef, 2);
+        }
+        return;
+    }
+    if (rv != net::OK) {
+        return;
+    }
+    pushUserdataInWeakTable(state,socket);
+    if (!lua_isnil(state, -1)) {
+        luaGetUserdataField(state, -1, "readCallback");
+        if (lua_isfunction(state, -1)) {
+            lua_pushlstring(state, data.data(), data.size());
+            int err = lua_pcall(state, 1, 0, 0);
+            if (err != 0) {
+                luaL_error(state,"async_socket readCallback error");
             }
-            lua_pop(L, 1);
+        } else {
+            lua_pop(state, 1);
+        }
+    }
+    lua_pop(state, 1);
+}
+
+typedef base::Callback<int(std::string*, const net::SocketStreamReader::ReadCallback&)> ReadFunction;
+
+//缓冲里已经有完整的数据时协程直接返回，不挂起；回调方式抛到下一个任务里调用，避免在 readCallback 里递归
+static int startRead(lua_State *L, LuaAsyncSocket *instanceUserdata, const ReadFunction& readFunction)
+{
+    int coroutineRef = suspendWithoutCallback(L, "readCallback");
+    net::AsyncSocket *socket = instanceUserdata->socket;
+    std::string result;
+    int rv = readFunction.Run(&result, base::BindLambda([=](int rv, const std::string& data){
+        deliverRead(socket, coroutineRef, rv, data);
+    }));
+    if (rv == net::ERR_IO_PENDING) {
+        if (coroutineRef != LUA_NOREF) {
+            return lua_yield(L, 0);
+        }
+        return 0;
+    }
+    if (coroutineRef != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, coroutineRef);
+        if (rv == net::OK) {
+            lua_pushlstring(L, result.data(), result.size());
+            return 1;
         }
+        lua_pushnil(L);
+        lua_pushnumber(L, rv == net::ERR_CONNECTION_CLOSED ? 0 : rv);
+        return 2;
+    }
+    base::MessageLoop::current()->PostTask(FROM_HERE, base::BindLambda([=](){
+        deliverRead(socket, LUA_NOREF, rv, result);
     }));
-    END_STACK_MODIFY(L, 0)
     return 0;
 }
 
-static int write(lua_State *L)
+static int read(lua_State *L)
 {
-    BEGIN_STACK_MODIFY(L);
-    net::AsyncSocket **instanceUserdata = (net::AsyncSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
-    std::string data = luaL_checkstring(L, 2);
-    auto buffer = make_scoped_refptr(new net::StringIOBuffer(data));
-    (*instanceUserdata)->write(buffer, data.length(),base::BindLambda([=](int rv){
-        pushUserdataInWeakTable(L,*instanceUserdata);
-        if (!lua_isnil(L, -1)) {
-            lua_getfield(L, -1, "writeCallback");
-            if (lua_isfunction(L, -1)) {
-                lua_pushnumber(L, rv);
-                int err = lua_pcall(L, 1, 0, 0);
-                if (err != 0) {
-                    luaL_error(L,"async_socket writeCallback error");
-                }
-            } else {
-                lua_pop(L, 1);
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    return startRead(L, instanceUserdata, base::Bind(&net::SocketStreamReader::ReadAvailable,
+                                                     base::Unretained(instanceUserdata->reader)));
+}
+
+static int readExactly(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    size_t length = (size_t)luaL_checkinteger(L, 2);
+    return startRead(L, instanceUserdata, base::Bind(&net::SocketStreamReader::ReadExactly,
+                                                     base::Unretained(instanceUserdata->reader), length));
+}
+
+static int readUntil(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    size_t delimiterLength = 0;
+    const char *delimiter = luaL_checklstring(L, 2, &delimiterLength);
+    size_t maxLength = (size_t)luaL_optinteger(L, 3, DEFAULT_MAX_READ_LENGTH);
+    return startRead(L, instanceUserdata, base::Bind(&net::SocketStreamReader::ReadUntil,
+                                                     base::Unretained(instanceUserdata->reader),
+                                                     std::string(delimiter, delimiterLength),
+                                                     maxLength));
+}
+
+static int readLine(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    size_t maxLength = (size_t)luaL_optinteger(L, 2, DEFAULT_MAX_READ_LENGTH);
+    return startRead(L, instanceUserdata, base::Bind(&net::SocketStreamReader::ReadLine,
+                                                     base::Unretained(instanceUserdata->reader),
+                                                     maxLength));
+}
+
+static void deliverWrite(net::AsyncSocket *socket, int coroutineRef, int rv)
+{
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    if (coroutineRef != LUA_NOREF) {
+        lua_pushnumber(state, rv);
+        luaCoroutineResume(state, coroutineRef, 1);
+        return;
+    }
+    pushUserdataInWeakTable(state,socket);
+    if (!lua_isnil(state, -1)) {
+        luaGetUserdataField(state, -1, "writeCallback");
+        if (lua_isfunction(state, -1)) {
+            lua_pushnumber(state, rv);
+            int err = lua_pcall(state, 1, 0, 0);
+            if (err != 0) {
+                luaL_error(state,"async_socket writeCallback error");
             }
+        } else {
+            lua_pop(state, 1);
         }
-        lua_pop(L, 1);
+    }
+    lua_pop(state, 1);
+}
+
+//写入 socket 的写队列，同一个任务里的多次 write 合并成一次发送
+//回调方式返回 false 表示排队的数据超过了高水位，应该等 drainCallback 再写
+static int startWrite(lua_State *L, LuaAsyncSocket *instanceUserdata, const std::string& data)
+{
+    int coroutineRef = suspendWithoutCallback(L, "writeCallback");
+    net::AsyncSocket *socket = instanceUserdata->socket;
+    auto buffer = make_scoped_refptr(new net::StringIOBuffer(data));
+    int rv = socket->write(buffer.get(), data.size(), base::BindLambda([=](int rv){
+        deliverWrite(socket, coroutineRef, rv);
     }));
-    END_STACK_MODIFY(L, 0)
+    if (rv != net::ERR_IO_PENDING) {
+        //没有连接或者空字符串，不会回调
+        if (coroutineRef != LUA_NOREF) {
+            luaL_unref(L, LUA_REGISTRYINDEX, coroutineRef);
+            lua_pushnumber(L, rv);
+            return 1;
+        }
+        base::MessageLoop::current()->PostTask(FROM_HERE, base::BindLambda([=](){
+            deliverWrite(socket, LUA_NOREF, rv);
+        }));
+    }
+    if (coroutineRef != LUA_NOREF) {
+        return lua_yield(L, 0);
+    }
+    lua_pushboolean(L, !socket->isWriteQueueFull());
+    return 1;
+}
+
+static int write(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    size_t length = 0;
+    const char *data = luaL_checklstring(L, 2, &length);
+    return startWrite(L, instanceUserdata, std::string(data, length));
+}
+
+//socket:setFraming({prefix = 4, bigEndian = true, includesPrefix = false, maxFrameSize = 16M})，没有给的字段保持原值
+static int setFraming(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    net::LengthPrefixedCodec codec = *instanceUserdata->codec;
+    lua_getfield(L, 2, "prefix");
+    codec.prefix_bytes = (int)luaL_optinteger(L, -1, codec.prefix_bytes);
+    lua_getfield(L, 2, "bigEndian");
+    if (!lua_isnil(L, -1)) {
+        codec.big_endian = lua_toboolean(L, -1);
+    }
+    lua_getfield(L, 2, "includesPrefix");
+    if (!lua_isnil(L, -1)) {
+        codec.length_includes_prefix = lua_toboolean(L, -1);
+    }
+    lua_getfield(L, 2, "maxFrameSize");
+    codec.max_frame_size = (size_t)luaL_optinteger(L, -1, codec.max_frame_size);
+    if (!codec.IsValid()) {
+        return luaL_error(L, "async_socket framing prefix must be 1, 2, 4 or 8");
+    }
+    *instanceUserdata->codec = codec;
+    return 0;
+}
+
+//读一个完整的帧，返回去掉长度前缀的数据
+static int readFrame(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    return startRead(L, instanceUserdata, base::Bind(&net::SocketStreamReader::ReadFrame,
+                                                     base::Unretained(instanceUserdata->reader),
+                                                     *instanceUserdata->codec));
+}
+
+//加上长度前缀后写入，数据超过 maxFrameSize 时返回 nil, rv
+static int writeFrame(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    size_t length = 0;
+    const char *data = luaL_checklstring(L, 2, &length);
+    std::string frame;
+    int rv = instanceUserdata->codec->Encode(std::string(data, length), &frame);
+    if (rv != net::OK) {
+        lua_pushnil(L);
+        lua_pushnumber(L, rv);
+        return 2;
+    }
+    return startWrite(L, instanceUserdata, frame);
+}
+
+static int setWriteHighWaterMark(lua_State *L)
+{
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    instanceUserdata->socket->setWriteHighWaterMark((size_t)luaL_checkinteger(L, 2));
     return 0;
 }
 
+static int disconnect(lua_State *L);
+static int isConnected(lua_State *L);
+
 static int disconnect(lua_State *L)
 {
     BEGIN_STACK_MODIFY(L);
-    net::AsyncSocket **instanceUserdata = (net::AsyncSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
-    (*instanceUserdata)->disconnect();
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    instanceUserdata->socket->disconnect();
+    instanceUserdata->reader->Reset();
     END_STACK_MODIFY(L, 0)
     return 0;
 }
@@ -173,22 +480,45 @@ static int disconnect(lua_State *L)
 static int isConnected(lua_State *L)
 {
     BEGIN_STACK_MODIFY(L);
-    net::AsyncSocket **instanceUserdata = (net::AsyncSocket **)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
+    LuaAsyncSocket *instanceUserdata = (LuaAsyncSocket *)luaL_checkudata(L, 1, LUA_ASYNC_SOCKET_METATABLE_NAME);
     lua_settop(L, 0);
-    lua_pushboolean(L, (*instanceUserdata)->isConnected());
+    lua_pushboolean(L, instanceUserdata->socket->isConnected());
     END_STACK_MODIFY(L, 1)
     return 1;
 }
 
 static const struct luaL_Reg metaFunctions[] = {
-    {"__newindex",__newindex},
-    {"__index",__index},
+    {"__newindex", luaUserdataNewindex},
     {"__gc", __gc},
     {NULL, NULL}
 };
 
+static const struct luaL_Reg methods[] = {
+    {"connect", connect},
+    {"read", read},
+    {"readExactly", readExactly},
+    {"readUntil", readUntil},
+    {"readLine", readLine},
+    {"write", write},
+    {"setWriteHighWaterMark", setWriteHighWaterMark},
+    {"setFraming", setFraming},
+    {"readFrame", readFrame},
+    {"writeFrame", writeFrame},
+    {"disconnect", disconnect},
+    {"isConnected", isConnected},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg serverMethods[] = {
+    {"__gc", serverGc},
+    {"close", serverClose},
+    {"port", serverPort},
+    {NULL, NULL}
+};
+
 static const struct luaL_Reg functions[] = {
     {"create", create},
+    {"listen", listen},
     {NULL, NULL}
 };
 
@@ -196,7 +526,16 @@ extern int luaopen_async_socket(lua_State* L){
     BEGIN_STACK_MODIFY(L);
     luaL_newmetatable(L, LUA_ASYNC_SOCKET_METATABLE_NAME);
     luaL_register(L, NULL, metaFunctions);
+    luaRegisterUserdataMethods(L, methods);
+    lua_pop(L, 1);
+    luaL_newmetatable(L, LUA_ASYNC_SERVER_SOCKET_METATABLE_NAME);
+    luaL_register(L, NULL, serverMethods);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
     luaL_register(L, LUA_ASYNC_SOCKET_METATABLE_NAME, functions);
+    luaopen_async_udp_socket(L);
+    luaopen_web_socket(L);
     END_STACK_MODIFY(L, 0)
     return 0;
 }
@@ -3,6 +3,7 @@ extern "C" {
 #include "lua.h"
 }
 #define LUA_ASYNC_SOCKET_METATABLE_NAME "lua_asyncSocket"
+#define LUA_ASYNC_SERVER_SOCKET_METATABLE_NAME "lua_asyncServerSocket"
 
 extern int luaopen_async_socket(lua_State* L);
 
@@ -0,0 +1,171 @@
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+#include "lua_async_udp_socket.h"
+#include "tools/lua_helpers.h"
+#include "network/async_udp_socket.h"
+#include "network/net/net_errors.h"
+#include "common/base_lambda_support.h"
+#include "common/business_runtime.h"
+#include <arpa/inet.h>
+static int createUdp(lua_State *L);
+static int __gc(lua_State *L);
+static int startReceiving(lua_State *L);
+static int stopReceiving(lua_State *L);
+static int sendTo(lua_State *L);
+static int port(lua_State *L);
+static int close(lua_State *L);
+
+//lua_asyncSocket.createUdp([host[, port]])，绑定失败返回 nil, rv
+static int createUdp(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L);
+    std::string host = luaL_optstring(L, 1, "");
+    int port = luaL_optint(L, 2, 0);
+    net::AsyncUdpSocket * socket = new net::AsyncUdpSocket();
+    int rv = socket->bind(host, (uint16_t)port);
+    lua_settop(L, 0);
+    if (rv != net::OK) {
+        delete socket;
+        lua_pushnil(L);
+        lua_pushnumber(L, rv);
+        END_STACK_MODIFY(L, 2)
+        return 2;
+    }
+    net::AsyncUdpSocket ** instanceUserdata = (net::AsyncUdpSocket **)lua_newuserdata(L, sizeof(net::AsyncUdpSocket *));
+    *instanceUserdata = socket;
+    luaL_getmetatable(L, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    lua_setmetatable(L, -2);
+    luaInitUserdataFields(L, -1);
+    
+    pushWeakUserdataTable(L);
+    lua_pushlightuserdata(L, socket);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    
+    END_STACK_MODIFY(L, 1)
+    return 1;
+}
+
+static int __gc(lua_State *L)
+{
+    net::AsyncUdpSocket **instanceUserdata = (net::AsyncUdpSocket **)luaL_checkudata(L, 1, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    delete *instanceUserdata;
+    return 0;
+}
+
+//收到的一批数据报作为数组传给 receiveCallback，每个元素是 {data = , ip = , port = }
+static void deliverDatagrams(net::AsyncUdpSocket *socket, int rv, const std::vector<net::AsyncUdpSocket::Datagram>& datagrams)
+{
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    pushUserdataInWeakTable(state,socket);
+    if (!lua_isnil(state, -1)) {
+        luaGetUserdataField(state, -1, "receiveCallback");
+        if (lua_isfunction(state, -1)) {
+            lua_createtable(state, (int)datagrams.size(), 0);
+            for (size_t i = 0; i < datagrams.size(); i++) {
+                const net::AsyncUdpSocket::Datagram& datagram = datagrams[i];
+                const sockaddr *addr = (const sockaddr *)datagram.addr.data();
+                uint16_t peerPort = addr->sa_family == AF_INET6 ? ntohs(((const sockaddr_in6 *)addr)->sin6_port)
+                                                                : ntohs(((const sockaddr_in *)addr)->sin_port);
+                lua_createtable(state, 0, 3);
+                lua_pushlstring(state, datagram.data.data(), datagram.data.size());
+                lua_setfield(state, -2, "data");
+                lua_pushstring(state, net::AsyncSocket::Sockaddr2IP(addr).c_str());
+                lua_setfield(state, -2, "ip");
+                lua_pushinteger(state, peerPort);
+                lua_setfield(state, -2, "port");
+                lua_rawseti(state, -2, (int)i + 1);
+            }
+            lua_pushnumber(state, rv);
+            int err = lua_pcall(state, 2, 0, 0);
+            if (err != 0) {
+                luaL_error(state,"async_udp_socket receiveCallback error");
+            }
+        } else {
+            lua_pop(state, 1);
+        }
+    }
+    lua_pop(state, 1);
+}
+
+static int startReceiving(lua_State *L)
+{
+    net::AsyncUdpSocket **instanceUserdata = (net::AsyncUdpSocket **)luaL_checkudata(L, 1, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    net::AsyncUdpSocket *socket = *instanceUserdata;
+    int rv = socket->startReceiving(base::BindLambda([=](int rv, const std::vector<net::AsyncUdpSocket::Datagram>& datagrams){
+        deliverDatagrams(socket, rv, datagrams);
+    }));
+    lua_pushnumber(L, rv);
+    return 1;
+}
+
+static int stopReceiving(lua_State *L)
+{
+    net::AsyncUdpSocket **instanceUserdata = (net::AsyncUdpSocket **)luaL_checkudata(L, 1, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    (*instanceUserdata)->stopReceiving();
+    return 0;
+}
+
+//udp:sendTo(ip, port, data)，只是排队，同一个任务里的数据报一起发出；成功返回 true，否则 nil, rv
+static int sendTo(lua_State *L)
+{
+    net::AsyncUdpSocket **instanceUserdata = (net::AsyncUdpSocket **)luaL_checkudata(L, 1, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    std::string ip = luaL_checkstring(L, 2);
+    int peerPort = luaL_checkint(L, 3);
+    size_t length = 0;
+    const char *data = luaL_checklstring(L, 4, &length);
+    net::sockaddr_data addr = ip.find(':') != std::string::npos ? net::AsyncSocket::IPV6toSockaddr(ip, (uint16_t)peerPort)
+                                                                : net::AsyncSocket::IPV4toSockaddr(ip, (uint16_t)peerPort);
+    int rv = (*instanceUserdata)->sendTo(addr, std::string(data, length));
+    if (rv != net::OK) {
+        lua_pushnil(L);
+        lua_pushnumber(L, rv);
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int port(lua_State *L)
+{
+    net::AsyncUdpSocket **instanceUserdata = (net::AsyncUdpSocket **)luaL_checkudata(L, 1, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    lua_pushinteger(L, (*instanceUserdata)->localPort());
+    return 1;
+}
+
+static int close(lua_State *L)
+{
+    net::AsyncUdpSocket **instanceUserdata = (net::AsyncUdpSocket **)luaL_checkudata(L, 1, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    (*instanceUserdata)->close();
+    return 0;
+}
+
+static const struct luaL_Reg metaFunctions[] = {
+    {"__newindex", luaUserdataNewindex},
+    {"__gc", __gc},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg methods[] = {
+    {"startReceiving", startReceiving},
+    {"stopReceiving", stopReceiving},
+    {"sendTo", sendTo},
+    {"port", port},
+    {"close", close},
+    {NULL, NULL}
+};
+
+extern int luaopen_async_udp_socket(lua_State* L){
+    BEGIN_STACK_MODIFY(L);
+    luaL_newmetatable(L, LUA_ASYNC_UDP_SOCKET_METATABLE_NAME);
+    luaL_register(L, NULL, metaFunctions);
+    luaRegisterUserdataMethods(L, methods);
+    lua_pop(L, 1);
+    lua_pushcfunction(L, createUdp);
+    lua_setfield(L, -2, "createUdp");
+    END_STACK_MODIFY(L, 0)
+    return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+extern "C" {
+#include "lua.h"
+}
+#define LUA_ASYNC_UDP_SOCKET_METATABLE_NAME "lua_asyncUdpSocket"
+
+//注册 udp socket 的元表，并把 createUdp 放到栈顶的模块表里
+extern int luaopen_async_udp_socket(lua_State* L);
@@ -0,0 +1,363 @@
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+#include "lua_web_socket.h"
+#include <deque>
+#include "tools/lua_helpers.h"
+#include "network/web_socket.h"
+#include "network/net/net_errors.h"
+#include "common/base_lambda_support.h"
+#include "common/business_runtime.h"
+#include "lua_coroutine.h"
+static int createWebSocket(lua_State *L);
+static int __gc(lua_State *L);
+static int open(lua_State *L);
+static int send(lua_State *L);
+static int receive(lua_State *L);
+static int ping(lua_State *L);
+static int close(lua_State *L);
+static int isOpen(lua_State *L);
+static int protocol(lua_State *L);
+
+typedef std::pair<bool, std::string> LuaWebSocketMessage; //isBinary, data
+
+//没有设置 messageCallback 时消息排队，由 receive 取走
+struct LuaWebSocket {
+    net::WebSocket *socket;
+    std::deque<LuaWebSocketMessage> *messages;
+    int receiveRef;   //receive 挂起的协程
+    bool closed;
+    int closeRv;      //关闭后 receive 返回 nil, closeRv，正常关闭是 0
+};
+
+static void pushMessage(lua_State *L, const LuaWebSocketMessage& message)
+{
+    lua_pushlstring(L, message.second.data(), message.second.size());
+    lua_pushboolean(L, message.first);
+}
+
+static void deliverMessage(net::WebSocket *socket, net::WebSocket::MessageType type, const std::string& data)
+{
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    pushUserdataInWeakTable(state,socket);
+    if (!lua_isnil(state, -1)) {
+        LuaWebSocket *instanceUserdata = (LuaWebSocket *)lua_touserdata(state, -1);
+        LuaWebSocketMessage message(type == net::WebSocket::MESSAGE_BINARY, data);
+        luaGetUserdataField(state, -1, "messageCallback");
+        if (lua_isfunction(state, -1)) {
+            pushMessage(state, message);
+            int err = lua_pcall(state, 2, 0, 0);
+            if (err != 0) {
+                luaL_error(state,"web_socket messageCallback error");
+            }
+        } else {
+            lua_pop(state, 1);
+            if (instanceUserdata->receiveRef != LUA_NOREF) {
+                int coroutineRef = instanceUserdata->receiveRef;
+                instanceUserdata->receiveRef = LUA_NOREF;
+                pushMessage(state, message);
+                luaCoroutineResume(state, coroutineRef, 2);
+            } else {
+                instanceUserdata->messages->push_back(message);
+            }
+        }
+    }
+    lua_pop(state, 1);
+}
+
+static void deliverClose(net::WebSocket *socket, int rv, int code, const std::string& reason)
+{
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    pushUserdataInWeakTable(state,socket);
+    if (!lua_isnil(state, -1)) {
+        LuaWebSocket *instanceUserdata = (LuaWebSocket *)lua_touserdata(state, -1);
+        instanceUserdata->closed = true;
+        instanceUserdata->closeRv = rv;
+        if (instanceUserdata->receiveRef != LUA_NOREF) {
+            int coroutineRef = instanceUserdata->receiveRef;
+            instanceUserdata->receiveRef = LUA_NOREF;
+            lua_pushnil(state);
+            lua_pushnumber(state, rv);
+            luaCoroutineResume(state, coroutineRef, 2);
+        }
+        luaGetUserdataField(state, -1, "closeCallback");
+        if (lua_isfunction(state, -1)) {
+            lua_pushnumber(state, rv);
+            lua_pushinteger(state, code);
+            lua_pushlstring(state, reason.data(), reason.size());
+            int err = lua_pcall(state, 3, 0, 0);
+            if (err != 0) {
+                luaL_error(state,"web_socket closeCallback error");
+            }
+        } else {
+            lua_pop(state, 1);
+        }
+    }
+    lua_pop(state, 1);
+}
+
+//lua_asyncSocket.createWebSocket(url[, {protocols = {}, headers = {}, deflate = true, maxMessageSize = 16M, fragmentSize = 0, pingInterval = 0}])
+static int createWebSocket(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L);
+    std::string url = luaL_checkstring(L, 1);
+    net::WebSocket::Options options;
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "protocols");
+        if (lua_istable(L, -1)) {
+            size_t count = lua_objlen(L, -1);
+            for (size_t i = 1; i <= count; i++) {
+                lua_rawgeti(L, -1, (int)i);
+                options.protocols.push_back(luaL_checkstring(L, -1));
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "headers");
+        if (lua_istable(L, -1)) {
+            lua_pushnil(L);
+            while (lua_next(L, -2)) {
+                lua_pushvalue(L, -2);
+                options.headers.push_back(std::make_pair(std::string(lua_tostring(L, -1)), std::string(luaL_checkstring(L, -2))));
+                lua_pop(L, 2);
+            }
+        }
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "deflate");
+        if (!lua_isnil(L, -1)) {
+            options.permessage_deflate = lua_toboolean(L, -1);
+        }
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "maxMessageSize");
+        options.max_message_size = (size_t)luaL_optinteger(L, -1, options.max_message_size);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "fragmentSize");
+        options.fragment_size = (size_t)luaL_optinteger(L, -1, options.fragment_size);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "pingInterval");
+        options.ping_interval_ms = (int)luaL_optinteger(L, -1, options.ping_interval_ms);
+        lua_pop(L, 1);
+    }
+    lua_settop(L, 0);
+    net::WebSocket * socket = new net::WebSocket(url, options);
+    socket->setMessageCallback(base::BindLambda([=](net::WebSocket::MessageType type, const std::string& data){
+        deliverMessage(socket, type, data);
+    }));
+    socket->setCloseCallback(base::BindLambda([=](int rv, int code, const std::string& reason){
+        deliverClose(socket, rv, code, reason);
+    }));
+    LuaWebSocket * instanceUserdata = (LuaWebSocket *)lua_newuserdata(L, sizeof(LuaWebSocket));
+    instanceUserdata->socket = socket;
+    instanceUserdata->messages = new std::deque<LuaWebSocketMessage>();
+    instanceUserdata->receiveRef = LUA_NOREF;
+    instanceUserdata->closed = false;
+    instanceUserdata->closeRv = net::OK;
+    luaL_getmetatable(L, LUA_WEB_SOCKET_METATABLE_NAME);
+    lua_setmetatable(L, -2);
+    luaInitUserdataFields(L, -1);
+
+    pushWeakUserdataTable(L);
+    lua_pushlightuserdata(L, socket);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+
+    END_STACK_MODIFY(L, 1)
+    return 1;
+}
+
+static int __gc(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    delete instanceUserdata->socket;
+    delete instanceUserdata->messages;
+    return 0;
+}
+
+//打开失败后 receive 返回 nil, rv，已经在等的 receive 也一起恢复
+static void failOpen(lua_State *L, LuaWebSocket *instanceUserdata, int rv)
+{
+    instanceUserdata->closed = true;
+    instanceUserdata->closeRv = rv;
+    if (instanceUserdata->receiveRef != LUA_NOREF) {
+        int coroutineRef = instanceUserdata->receiveRef;
+        instanceUserdata->receiveRef = LUA_NOREF;
+        lua_pushnil(L);
+        lua_pushnumber(L, rv);
+        luaCoroutineResume(L, coroutineRef, 2);
+    }
+}
+
+static void deliverOpen(net::WebSocket *socket, int coroutineRef, int rv)
+{
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    pushUserdataInWeakTable(state,socket);
+    if (!lua_isnil(state, -1) && rv != net::OK) {
+        failOpen(state, (LuaWebSocket *)lua_touserdata(state, -1), rv);
+    }
+    if (coroutineRef != LUA_NOREF) {
+        lua_pop(state, 1);
+        lua_pushnumber(state, rv);
+        luaCoroutineResume(state, coroutineRef, 1);
+        return;
+    }
+    if (!lua_isnil(state, -1)) {
+        luaGetUserdataField(state, -1, "openCallback");
+        if (lua_isfunction(state, -1)) {
+            lua_pushnumber(state, rv);
+            int err = lua_pcall(state, 1, 0, 0);
+            if (err != 0) {
+                luaL_error(state,"web_socket openCallback error");
+            }
+        } else {
+            lua_pop(state, 1);
+        }
+    }
+    lua_pop(state, 1);
+}
+
+//连接并握手，协程里没有设置 openCallback 时返回 rv
+static int open(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    luaGetUserdataField(L, 1, "openCallback");
+    bool hasCallback = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    int coroutineRef = hasCallback ? LUA_NOREF : luaCoroutineSuspend(L);
+    net::WebSocket *socket = instanceUserdata->socket;
+    int rv = socket->open(base::BindLambda([=](int rv){
+        deliverOpen(socket, coroutineRef, rv);
+    }));
+    if (rv != net::ERR_IO_PENDING) {
+        //ERR_UNEXPECTED 是重复 open，不影响已经打开的连接
+        if (rv != net::ERR_UNEXPECTED) {
+            failOpen(L, instanceUserdata, rv);
+        }
+        if (coroutineRef != LUA_NOREF) {
+            luaL_unref(L, LUA_REGISTRYINDEX, coroutineRef);
+            lua_pushnumber(L, rv);
+            return 1;
+        }
+        base::MessageLoop::current()->PostTask(FROM_HERE, base::BindLambda([=](){
+            deliverOpen(socket, LUA_NOREF, rv);
+        }));
+        return 0;
+    }
+    if (coroutineRef != LUA_NOREF) {
+        return lua_yield(L, 0);
+    }
+    return 0;
+}
+
+//ws:send(data[, isBinary])，只是排队；返回 false 表示写队列超过了高水位，出错返回 nil, rv
+static int send(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    size_t length = 0;
+    const char *data = luaL_checklstring(L, 2, &length);
+    net::WebSocket::MessageType type = lua_toboolean(L, 3) ? net::WebSocket::MESSAGE_BINARY : net::WebSocket::MESSAGE_TEXT;
+    int rv = instanceUserdata->socket->send(type, std::string(data, length));
+    if (rv != net::OK) {
+        lua_pushnil(L);
+        lua_pushnumber(L, rv);
+        return 2;
+    }
+    lua_pushboolean(L, !instanceUserdata->socket->socket()->isWriteQueueFull());
+    return 1;
+}
+
+//返回排队的消息 data, isBinary；没有时协程里挂起等下一条，已经关闭返回 nil, rv
+static int receive(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    if (!instanceUserdata->messages->empty()) {
+        pushMessage(L, instanceUserdata->messages->front());
+        instanceUserdata->messages->pop_front();
+        return 2;
+    }
+    if (instanceUserdata->closed || instanceUserdata->receiveRef != LUA_NOREF) {
+        lua_pushnil(L);
+        lua_pushnumber(L, instanceUserdata->closed ? instanceUserdata->closeRv : net::ERR_UNEXPECTED);
+        return 2;
+    }
+    int coroutineRef = luaCoroutineSuspend(L);
+    if (coroutineRef == LUA_NOREF) {
+        lua_pushnil(L);
+        lua_pushnumber(L, net::ERR_IO_PENDING);
+        return 2;
+    }
+    instanceUserdata->receiveRef = coroutineRef;
+    return lua_yield(L, 0);
+}
+
+static int ping(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    size_t length = 0;
+    const char *payload = luaL_optlstring(L, 2, "", &length);
+    int rv = instanceUserdata->socket->ping(std::string(payload, length));
+    if (rv != net::OK) {
+        lua_pushnil(L);
+        lua_pushnumber(L, rv);
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+//ws:close([code[, reason]])，关闭握手完成后调用 closeCallback
+static int close(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    int code = luaL_optint(L, 2, 1000);
+    size_t length = 0;
+    const char *reason = luaL_optlstring(L, 3, "", &length);
+    instanceUserdata->socket->close(code, std::string(reason, length));
+    return 0;
+}
+
+static int isOpen(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    lua_pushboolean(L, instanceUserdata->socket->isOpen());
+    return 1;
+}
+
+//服务器选中的子协议，没有时是空字符串
+static int protocol(lua_State *L)
+{
+    LuaWebSocket *instanceUserdata = (LuaWebSocket *)luaL_checkudata(L, 1, LUA_WEB_SOCKET_METATABLE_NAME);
+    const std::string& selected = instanceUserdata->socket->protocol();
+    lua_pushlstring(L, selected.data(), selected.size());
+    return 1;
+}
+
+static const struct luaL_Reg metaFunctions[] = {
+    {"__newindex", luaUserdataNewindex},
+    {"__gc", __gc},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg methods[] = {
+    {"open", open},
+    {"send", send},
+    {"receive", receive},
+    {"ping", ping},
+    {"close", close},
+    {"isOpen", isOpen},
+    {"protocol", protocol},
+    {NULL, NULL}
+};
+
+extern int luaopen_web_socket(lua_State* L){
+    BEGIN_STACK_MODIFY(L);
+    luaL_newmetatable(L, LUA_WEB_SOCKET_METATABLE_NAME);
+    luaL_register(L, NULL, metaFunctions);
+    luaRegisterUserdataMethods(L, methods);
+    lua_pop(L, 1);
+    lua_pushcfunction(L, createWebSocket);
+    lua_setfield(L, -2, "createWebSocket");
+    END_STACK_MODIFY(L, 0)
+    return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+extern "C" {
+#include "lua.h"
+}
+#define LUA_WEB_SOCKET_METATABLE_NAME "lua_webSocket"
+
+//注册 websocket 的元表，并把 createWebSocket 放到栈顶的模块表里
+extern int luaopen_web_socket(lua_State* L);
@@ -5,45 +5,46 @@ extern "C" {
 #include "tools/lua_helpers.h"
 #include "lua_http.h"
 #include "network/async_cgi_task_dispatcher.h"
+#include "network/network_metrics.h"
 #include "common/base_lambda_support.h"
 #include "lua_http_task.h"
+#include "lua_coroutine.h"
 #include "base/synchronization/waitable_event.h"
 #include "base/threading/thread_restrictions.h"
+#include <string.h>
 
 static scoped_refptr<network::HttpCgiTaskDispatcher> dispatcher = NULL;
+//只在IO线程读写，dispatcher创建时使用
+static int multiplexStreams = 0;
+static std::string cachePath;
+static size_t cacheMemoryBytes = 0;
+//连接池默认在 2 到 8 个连接之间按排队和网络情况伸缩
+static int poolMinConnections = 2;
+static int poolMaxConnections = 8;
+static int poolHostConnections = ASYNC_CURL_MAX_HOST_CONNECTIONS;
 static int request(lua_State *L);
+static int setMultiplex(lua_State *L);
+static int setCache(lua_State *L);
+static int cancel(lua_State *L);
+static int setPoolLimits(lua_State *L);
+static int getMetrics(lua_State *L);
+static int dumpMetrics(lua_State *L);
 
-static int __newindex(lua_State *L)
-{
-    BEGIN_STACK_MODIFY(L);
-    // Add value to the userdata's environment table.
-    lua_getfenv(L, 1);
-    lua_insert(L, 2);
-    lua_rawset(L, 2);
-    END_STACK_MODIFY(L, 0);
-    return 0;
-}
-
-static int __index(lua_State *L)
-{
-    BEGIN_STACK_MODIFY(L);
-    lua_getfenv(L, -2);
-    lua_pushvalue(L, -2);
-    lua_rawget(L, 3);
-    lua_insert(L, 1);
-    lua_settop(L, 1);
-    END_STACK_MODIFY(L, 1)
-    return 1;
-}
-
+//任务没有方法，__index 只读 fenv 里的字段
 static const struct luaL_Reg metaFunctions[] = {
-    {"__newindex",__newindex},
-    {"__index",__index},
+    {"__newindex", luaUserdataNewindex},
+    {"__index", luaUserdataIndex},
     {NULL, NULL}
 };
 
 static const struct luaL_Reg functions[] = {
     {"request", request},
+    {"setMultiplex", setMultiplex},
+    {"setCache", setCache},
+    {"cancel", cancel},
+    {"setPoolLimits", setPoolLimits},
+    {"getMetrics", getMetrics},
+    {"dumpMetrics", dumpMetrics},
     {NULL, NULL}
 };
 
@@ -60,6 +61,13 @@ static HTTP_HEADERS getHeaders(lua_State *L) {
     return headers;
 }
 
+static int getCachePolicy(const char *policy) {
+    if (strcmp(policy, "default") == 0) return network::HTTP_CACHE_DEFAULT;
+    if (strcmp(policy, "revalidate") == 0) return network::HTTP_CACHE_REVALIDATE;
+    if (strcmp(policy, "preferCache") == 0) return network::HTTP_CACHE_PREFER_CACHE;
+    return network::HTTP_CACHE_NONE;
+}
+
 static bool pushCallback(lua_State *L, const char *callbackName, int tableIndex) {
     lua_getfield(L, tableIndex, callbackName);
     if (lua_isnil(L, -1)) {
@@ -129,6 +137,48 @@ static int request(lua_State *L) {
     }
     lua_pop(L, 1);
     
+    uint32_t chunkSize = 64 * 1024;
+    lua_getfield(L, 1, "chunkSize");
+    if(!lua_isnil(L, -1)){
+        chunkSize = luaL_checknumber(L, -1);
+    }
+    lua_pop(L, 1);
+    
+    int cachePolicy = network::HTTP_CACHE_NONE;
+    lua_getfield(L, 1, "cachePolicy");
+    if(!lua_isnil(L, -1)){
+        cachePolicy = getCachePolicy(luaL_checkstring(L, -1));
+    }
+    lua_pop(L, 1);
+    
+    int64 progressInterval = 100;
+    lua_getfield(L, 1, "progressInterval");
+    if(!lua_isnil(L, -1)){
+        progressInterval = luaL_checknumber(L, -1);
+    }
+    lua_pop(L, 1);
+    
+    int64 progressBytes = 0;
+    lua_getfield(L, 1, "progressBytes");
+    if(!lua_isnil(L, -1)){
+        progressBytes = luaL_checknumber(L, -1);
+    }
+    lua_pop(L, 1);
+    
+    int segments = 0;
+    lua_getfield(L, 1, "segments");
+    if(!lua_isnil(L, -1)){
+        segments = (int)luaL_checkinteger(L, -1);
+    }
+    lua_pop(L, 1);
+    
+    int priority = 1;
+    lua_getfield(L, 1, "priority");
+    if(!lua_isnil(L, -1)){
+        priority = (int)luaL_checkinteger(L, -1);
+    }
+    lua_pop(L, 1);
+    
     network::LuaHttpTask *task = new network::LuaHttpTask(taskName);
     
     BusinessThreadID now_thread_identifier;
@@ -141,44 +191,170 @@ static int request(lua_State *L) {
     task->download_path = downloadPath;
     task->socket_watcher_timeout = socketWatcherTimeout;
     task->headers = headers;
+    task->cache_policy = cachePolicy;
+    task->priority = priority;
     
-    size_t nbytes = sizeof(network::LuaHttpTask *);
-    network::LuaHttpTask ** instanceUserdata = (network::LuaHttpTask **)lua_newuserdata(L, nbytes);
-    *instanceUserdata = task;
-    
-    luaL_getmetatable(L, LUA_HTTP_METATABLE_NAME);
-    lua_setmetatable(L, -2);
-    
-    // give it a nice clean environment
-    lua_newtable(L);
-    lua_setfenv(L, -2);
-    pushStrongUserdataTable(L);
-    lua_pushlightuserdata(L, task);
-    lua_pushvalue(L, -3);
-    lua_rawset(L, -3);
+    //在调度协程里没有传 onResponse 时挂起协程，响应作为 request 的返回值
+    lua_getfield(L, 1, "onResponse");
+    bool awaitResponse = lua_isnil(L, -1) && luaCoroutineIsScheduled(L);
     lua_pop(L, 1);
-    
-    if (pushCallback(L, "onResponse", 1)) {
-        lua_setfield(L, -2, "onResponse");
+    lua_getfield(L, 1, "onProgress");
+    bool hasProgress = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    //有 onData 时响应体按块交给 onData，onResponse 里的 response 为空
+    lua_getfield(L, 1, "onData");
+    bool hasData = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (hasData) {
+        task->data_chunk_size = chunkSize;
     }
+    //没有 onProgress 时 IO 线程不再产生进度回调
+    task->progress_interval_ms = hasProgress ? progressInterval : -1;
+    task->progress_min_bytes = progressBytes;
     
-    if (pushCallback(L, "onProgress", 1)) {
-        lua_setfield(L, -2, "onProgress");
+    if (!awaitResponse || hasProgress || hasData) {
+        size_t nbytes = sizeof(network::LuaHttpTask *);
+        network::LuaHttpTask ** instanceUserdata = (network::LuaHttpTask **)lua_newuserdata(L, nbytes);
+        *instanceUserdata = task;
+        
+        luaL_getmetatable(L, LUA_HTTP_METATABLE_NAME);
+        lua_setmetatable(L, -2);
+        
+        luaInitUserdataFields(L, -1);
+        pushStrongUserdataTable(L);
+        lua_pushlightuserdata(L, task);
+        lua_pushvalue(L, -3);
+        lua_rawset(L, -3);
+        lua_pop(L, 1);
+        
+        if (pushCallback(L, "onResponse", 1)) {
+            lua_setfield(L, -2, "onResponse");
+        }
+        
+        if (pushCallback(L, "onProgress", 1)) {
+            lua_setfield(L, -2, "onProgress");
+        }
+        
+        if (pushCallback(L, "onData", 1)) {
+            lua_setfield(L, -2, "onData");
+        }
+        
+        lua_pop(L, 1);
     }
     
-    lua_pop(L, 1);
+    if (awaitResponse) {
+        task->coroutineRef = luaCoroutineSuspend(L);
+    }
     
+    std::string taskId = task->task_id;
     BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, base::BindLambda([=]()
     {
         if (dispatcher == NULL) {
             dispatcher = new network::HttpCgiTaskDispatcher(LUA_HTTP_METATABLE_NAME, true);
+            dispatcher->SetPoolLimits(poolMinConnections, poolMaxConnections, poolHostConnections);
+            if (multiplexStreams > 0) {
+                dispatcher->SetMultiplex(multiplexStreams);
+            }
+            if (!cachePath.empty()) {
+                dispatcher->EnableCache(base::FilePath(cachePath), cacheMemoryBytes);
+            }
+        }
+        //有 downloadPath 和 segments 时分段并行下载，可以断点续传
+        if (segments > 0 && !downloadPath.empty()) {
+            dispatcher->ScheduleDownload(make_scoped_refptr(task), segments);
+        } else {
+            dispatcher->ScheduleTask(make_scoped_refptr(task));
         }
-        dispatcher->ScheduleTask(make_scoped_refptr(task));
     })) ;
     END_STACK_MODIFY(L, 0)
+    if (awaitResponse) {
+        return lua_yield(L, 0);
+    }
+    //返回 taskId，用于 lua_http.cancel
+    lua_pushstring(L, taskId.c_str());
+    return 1;
+}
+
+//maxStreams 大于 0 时同一个 origin 的请求作为 HTTP/2 stream 复用连接，0 恢复固定连接池
+static int setMultiplex(lua_State *L) {
+    int maxStreams = (int)luaL_checkinteger(L, 1);
+    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, base::BindLambda([=]()
+    {
+        multiplexStreams = maxStreams;
+        if (dispatcher != NULL) {
+            dispatcher->SetMultiplex(maxStreams);
+        }
+    })) ;
+    return 0;
+}
+
+//打开响应缓存，path 是磁盘缓存目录，memoryBytes 是内存缓存大小，默认 4M
+static int setCache(lua_State *L) {
+    std::string path = luaL_checkstring(L, 1);
+    size_t memoryBytes = (size_t)luaL_optinteger(L, 2, 4 * 1024 * 1024);
+    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, base::BindLambda([=]()
+    {
+        cachePath = path;
+        cacheMemoryBytes = memoryBytes;
+        if (dispatcher != NULL) {
+            dispatcher->EnableCache(base::FilePath(cachePath), cacheMemoryBytes);
+        }
+    })) ;
     return 0;
 }
 
+//取消还没有响应的请求，onResponse 收到 error_code 为 PEC_ABORTED 的 response
+static int cancel(lua_State *L) {
+    std::string taskId = luaL_checkstring(L, 1);
+    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, base::BindLambda([=]()
+    {
+        if (dispatcher != NULL) {
+            dispatcher->CancelTask(taskId);
+        }
+    })) ;
+    return 0;
+}
+
+//连接池在 minConnections 到 maxConnections 之间伸缩，同一个 origin 最多 hostConnections 个请求同时进行
+static int setPoolLimits(lua_State *L) {
+    int minConnections = (int)luaL_checkinteger(L, 1);
+    int maxConnections = (int)luaL_checkinteger(L, 2);
+    int hostConnections = (int)luaL_optinteger(L, 3, ASYNC_CURL_MAX_HOST_CONNECTIONS);
+    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, base::BindLambda([=]()
+    {
+        poolMinConnections = minConnections;
+        poolMaxConnections = maxConnections;
+        poolHostConnections = hostConnections;
+        if (dispatcher != NULL) {
+            dispatcher->SetPoolLimits(minConnections, maxConnections, hostConnections);
+        }
+    })) ;
+    return 0;
+}
+
+//返回 host 各指标的 {count, sum}，时间是毫秒
+static int getMetrics(lua_State *L) {
+    std::string host = luaL_checkstring(L, 1);
+    std::map<std::string, network::MetricSummary> metrics = network::GetRequestMetrics(host);
+    lua_createtable(L, 0, (int)metrics.size());
+    for (auto& it : metrics) {
+        lua_createtable(L, 0, 2);
+        lua_pushnumber(L, it.second.count);
+        lua_setfield(L, -2, "count");
+        lua_pushnumber(L, it.second.sum);
+        lua_setfield(L, -2, "sum");
+        lua_setfield(L, -2, it.first.c_str());
+    }
+    return 1;
+}
+
+//host 为空时输出所有 host 的直方图
+static int dumpMetrics(lua_State *L) {
+    std::string host = luaL_optstring(L, 1, "");
+    std::string output = network::DumpRequestMetrics(host);
+    lua_pushlstring(L, output.data(), output.size());
+    return 1;
+}
 
 extern int luaopen_http(lua_State *L) {
     BEGIN_STACK_MODIFY(L);
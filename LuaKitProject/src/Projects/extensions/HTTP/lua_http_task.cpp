@@ -1,13 +1,72 @@
 extern "C" {
 #include "lua.h"
+#include "lauxlib.h"
 }
 #include "tools/lua_helpers.h"
 #include "lua_http_task.h"
+#include "lua_coroutine.h"
 #include "common/base_lambda_support.h"
 #include "base/guid.h"
+#include <string.h>
 namespace network {
+
+static void pushTiming(lua_State *state, const RequestTiming& timing) {
+    lua_createtable(state, 0, 8);
+    lua_pushnumber(state, timing.dns_ms);
+    lua_setfield(state, -2, "dns");
+    lua_pushnumber(state, timing.connect_ms);
+    lua_setfield(state, -2, "connect");
+    lua_pushnumber(state, timing.tls_ms);
+    lua_setfield(state, -2, "tls");
+    lua_pushnumber(state, timing.first_byte_ms);
+    lua_setfield(state, -2, "firstByte");
+    lua_pushnumber(state, timing.total_ms);
+    lua_setfield(state, -2, "total");
+    lua_pushnumber(state, timing.request_bytes);
+    lua_setfield(state, -2, "requestBytes");
+    lua_pushnumber(state, timing.response_bytes);
+    lua_setfield(state, -2, "responseBytes");
+    lua_pushboolean(state, timing.reused);
+    lua_setfield(state, -2, "reused");
+}
+
+static void pushResponse(lua_State *state, const scoped_refptr<HttpResponse>& response) {
+    lua_createtable(state, 0, 5);
+    
+    //push error_code
+    lua_pushstring(state, "error_code");
+    lua_pushnumber(state, response->error_code);
+    lua_rawset(state, -3);
     
-LuaHttpTask::LuaHttpTask(const std::string& name) : HttpTask(name){
+    //push headers
+    lua_pushstring(state, "headers");
+    lua_createtable(state, 0, (int)response->headers.size());
+    for(const std::pair<std::string, std::string>& p : response->headers){
+        lua_pushlstring(state, p.first.data(), p.first.size());
+        lua_pushlstring(state, p.second.data(), p.second.size());
+        lua_rawset(state, -3);
+    }
+    lua_rawset(state, -3);
+    
+    //push resp，响应体可能是二进制，带长度压栈
+    const std::string& body = response->body->data();
+    lua_pushstring(state, "response");
+    lua_pushlstring(state, body.data(), body.size());
+    lua_rawset(state, -3);
+    
+    //push http_code
+    lua_pushstring(state, "http_code");
+    lua_pushnumber(state, response->http_code);
+    lua_rawset(state, -3);
+    
+    //push timing，各阶段耗时(毫秒)和收发字节数
+    lua_pushstring(state, "timing");
+    pushTiming(state, response->timing);
+    lua_rawset(state, -3);
+}
+    
+LuaHttpTask::LuaHttpTask(const std::string& name) : HttpTask(name), coroutineRef(LUA_NOREF), progressPosted(false){
+    memset(progressValues, 0, sizeof(progressValues));
 }
     
 LuaHttpTask::~LuaHttpTask() {
@@ -15,6 +74,73 @@ LuaHttpTask::~LuaHttpTask() {
 }
 
 void LuaHttpTask::ProgressFeedBack(network::BaseConnection* connection, int64 dltotal, int64 dlnow, int64 ultotal, int64 ulnow) {
+    {
+        base::AutoLock lock(progressLock);
+        progressValues[0] = dltotal;
+        progressValues[1] = dlnow;
+        progressValues[2] = ultotal;
+        progressValues[3] = ulnow;
+        if (progressPosted) {
+            return;
+        }
+        progressPosted = true;
+    }
+    scoped_refptr<network::LuaHttpTask> ref = make_scoped_refptr(this);
+    BusinessThread::PostTask(threadId, FROM_HERE, base::BindLambda([=](){
+        ref->DeliverProgress();
+    }));
+}
+
+void LuaHttpTask::DeliverProgress() {
+    int64 values[4];
+    {
+        base::AutoLock lock(progressLock);
+        memcpy(values, progressValues, sizeof(values));
+        progressPosted = false;
+    }
+    lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+    BEGIN_STACK_MODIFY(state);
+    pushStrongUserdataTable(state);
+    lua_pushlightuserdata(state, this);
+    lua_rawget(state, -2);
+    lua_remove(state, -2);//盏顶是userdata
+    if (lua_isuserdata(state, -1)) {
+        luaGetUserdataField(state, -1, "onProgress");//盏顶是onProgress函数
+        if (lua_isnil(state, -1)) {
+            lua_pop(state, 1);
+        } else {
+            //-1 function -2 userdata
+            lua_createtable(state, 0, 4);
+            //push dltotal
+            lua_pushstring(state, "dltotal");
+            lua_pushnumber(state, values[0]);
+            lua_rawset(state, -3);
+            
+            //push dlnow
+            lua_pushstring(state, "dlnow");
+            lua_pushnumber(state, values[1]);
+            lua_rawset(state, -3);
+            
+            //push ultotal
+            lua_pushstring(state, "ultotal");
+            lua_pushnumber(state, values[2]);
+            lua_rawset(state, -3);
+            
+            //push ulnow
+            lua_pushstring(state, "ulnow");
+            lua_pushnumber(state, values[3]);
+            lua_rawset(state, -3);
+            
+            lua_pcall(state, 1, 0, 0);
+        }
+        lua_pop(state, 1);
+    } else {
+        lua_pop(state, 1);
+    }
+    END_STACK_MODIFY(state, 0);
+}
+
+void LuaHttpTask::OnData(const scoped_refptr<base::RefCountedString>& chunk, const base::Closure& consumed) {
     scoped_refptr<network::LuaHttpTask> ref = make_scoped_refptr(this);
     BusinessThread::PostTask(threadId, FROM_HERE, base::BindLambda([=](){
         lua_State * state = BusinessThread::GetCurrentThreadLuaState();
@@ -24,47 +150,24 @@ void LuaHttpTask::ProgressFeedBack(network::BaseConnection* connection, int64 dl
         lua_rawget(state, -2);
         lua_remove(state, -2);//盏顶是userdata
         if (lua_isuserdata(state, -1)) {
-            lua_getfield(state, -1, "onProgress");//盏顶是onResponse函数
+            luaGetUserdataField(state, -1, "onData");//盏顶是onData函数
             if (lua_isnil(state, -1)) {
                 lua_pop(state, 1);
             } else {
-                //-1 function -2 userdata
-                lua_newtable(state);
-                //push dltotal
-                lua_pushstring(state, "dltotal");
-                lua_pushnumber(state, dltotal);
-                lua_rawset(state, -3);
-                
-                //push dlnow
-                lua_pushstring(state, "dlnow");
-                lua_pushnumber(state, dlnow);
-                lua_rawset(state, -3);
-                
-                //push ultotal
-                lua_pushstring(state, "ultotal");
-                lua_pushnumber(state, ultotal);
-                lua_rawset(state, -3);
-                
-                //push ulnow
-                lua_pushstring(state, "ulnow");
-                lua_pushnumber(state, ulnow);
-                lua_rawset(state, -3);
-                
+                const std::string& data = chunk->data();
+                lua_pushlstring(state, data.data(), data.size());
                 lua_pcall(state, 1, 0, 0);
             }
-            lua_pop(state, 1);
-        } else {
-            lua_pop(state, 1);
         }
+        lua_pop(state, 1);
         END_STACK_MODIFY(state, 0);
+        //onData 返回后才让 IO 线程继续收数据
+        BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, consumed);
     }));
 }
 
-int LuaHttpTask::OnResponse(network::ProtocolErrorCode error_code,
-                         const HTTP_HEADERS& h,
-                         const std::string& resp, long http_code) {
-    std::string response = resp;
-    HTTP_HEADERS headers = h;
+int LuaHttpTask::OnResponse(const scoped_refptr<HttpResponse>& response) {
+    //只传递response的引用，响应体在IO线程生成后不再拷贝
     scoped_refptr<network::LuaHttpTask> ref = make_scoped_refptr(this);
     BusinessThread::PostTask(threadId, FROM_HERE, base::BindLambda([=](){
         lua_State * state = BusinessThread::GetCurrentThreadLuaState();
@@ -74,38 +177,12 @@ int LuaHttpTask::OnResponse(network::ProtocolErrorCode error_code,
         lua_rawget(state, -2);
         lua_remove(state, -2);//盏顶是userdata
         if (lua_isuserdata(state, -1)) {
-            lua_getfield(state, -1, "onResponse");//盏顶是onResponse函数
+            luaGetUserdataField(state, -1, "onResponse");//盏顶是onResponse函数
             if (lua_isnil(state, -1)) {
                 lua_pop(state, 1);
             } else {
                 //-1 function -2 userdata
-                lua_newtable(state);
-                
-                //push error_code
-                lua_pushstring(state, "error_code");
-                lua_pushnumber(state, error_code);
-                lua_rawset(state, -3);
-                
-                //push headers
-                lua_pushstring(state, "headers");
-                lua_newtable(state);
-                for(std::pair<std::string, std::string> p : h){
-                    lua_pushstring(state, p.first.c_str());
-                    lua_pushstring(state, p.second.c_str());
-                    lua_rawset(state, -3);
-                }
-                lua_rawset(state, -3);
-                
-                //push resp
-                lua_pushstring(state, "response");
-                lua_pushstring(state, response.c_str());
-                lua_rawset(state, -3);
-                
-                //push http_code
-                lua_pushstring(state, "http_code");
-                lua_pushnumber(state, http_code);
-                lua_rawset(state, -3);
-                
+                pushResponse(state, response);
                 lua_pcall(state, 1, 0, 0);
             }
             lua_pop(state, 1);
@@ -118,6 +195,12 @@ int LuaHttpTask::OnResponse(network::ProtocolErrorCode error_code,
         } else {
             lua_pop(state, 1);
         }
+        if (ref->coroutineRef != LUA_NOREF) {
+            int coroutineRef = ref->coroutineRef;
+            ref->coroutineRef = LUA_NOREF;
+            pushResponse(state, response);
+            luaCoroutineResume(state, coroutineRef, 1);
+        }
         END_STACK_MODIFY(state, 0)
     }));
     return 0;
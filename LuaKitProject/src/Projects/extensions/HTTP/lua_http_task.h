@@ -1,14 +1,23 @@
 #pragma once
 #include "network/async_cgi_task_dispatcher.h"
+#include "base/synchronization/lock.h"
 namespace network {
     class LuaHttpTask : public HttpTask{
         public :
         BusinessThreadID threadId;
+        //request 在调度协程里且没有 onResponse 时，挂起协程的引用，响应直接恢复协程
+        int coroutineRef;
         explicit LuaHttpTask(const std::string& name);
         virtual ~LuaHttpTask();
         virtual void ProgressFeedBack(network::BaseConnection* connection, int64 dltotal, int64 dlnow, int64 ultotal, int64 ulnow);
-        virtual int OnResponse(network::ProtocolErrorCode error_code,
-                               const HTTP_HEADERS& headers,
-                               const std::string& resp, long http_code);
+        using HttpTask::OnResponse;
+        virtual int OnResponse(const scoped_refptr<HttpResponse>& response);
+        virtual void OnData(const scoped_refptr<base::RefCountedString>& chunk, const base::Closure& consumed);
+        private :
+        void DeliverProgress();
+        //lua 线程还没处理上一次进度时只更新数值，不再 post，lua 线程取最新的值
+        base::Lock progressLock;
+        int64 progressValues[4];
+        bool progressPosted;
     };
 }
@@ -46,7 +46,7 @@ void LuaNotificationListener::Observe(int type, const content::NotificationSourc
                     pushUserdataInWeakTable(d.ptr(),this);
                     if (!lua_isnil(d.ptr(), -1)) {
                         lua_pushinteger(d.ptr(), type);
-                        lua_gettable(d.ptr(), -2);
+                        luaGetUserdataField(d.ptr(), -2);
                         if (lua_isfunction(d.ptr(), -1)) {
                             if (params) {
                                 lua_pushcfunction(d.ptr(), seri_unpack);
@@ -79,7 +79,7 @@ void LuaNotificationListener::Observe(int type, const content::NotificationSourc
                         pushUserdataInWeakTable(state,l.get());
                         if (!lua_isnil(state, -1)) {
                             lua_pushinteger(state, type);
-                            lua_gettable(state, -2);
+                            luaGetUserdataField(state, -2);
                             if (lua_isfunction(state, -1)) {
                                 if (params) {
                                     lua_pushcfunction(state, seri_unpack);
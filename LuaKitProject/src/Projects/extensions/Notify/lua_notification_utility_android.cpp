@@ -22,7 +22,7 @@ extern void notification_call_to_lua(LuaNotificationListener * l, int type, cons
         pushUserdataInWeakTable(state,l);
         if (!lua_isnil(state, -1)) {
             lua_pushinteger(state, type);
-            lua_gettable(state, -2);
+            luaGetUserdataField(state, -2);
             if (lua_isfunction(state, -1)) {
                 if (data) {
                     JniEnvWrapper env;
@@ -54,7 +54,7 @@ extern void notification_call_to_lua(LuaNotificationListener * l, int type, cons
             pushUserdataInWeakTable(state,listener.get());
             if (!lua_isnil(state, -1)) {
                 lua_pushinteger(state, type);
-                lua_gettable(state, -2);
+                luaGetUserdataField(state, -2);
                 if (lua_isfunction(state, -1)) {
                     if (dataPtr.get()) {
                         JniEnvWrapper env;
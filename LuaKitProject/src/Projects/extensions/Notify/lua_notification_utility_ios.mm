@@ -20,7 +20,7 @@ extern void notification_call_to_lua(LuaNotificationListener * l, int type, cons
         pushUserdataInWeakTable(state,l);
         if (!lua_isnil(state, -1)) {
             lua_pushinteger(state, type);
-            lua_gettable(state, -2);
+            luaGetUserdataField(state, -2);
             if (lua_isfunction(state, -1)) {
                 if (data) {
                     oc_fromObjc(state, data);
@@ -47,7 +47,7 @@ extern void notification_call_to_lua(LuaNotificationListener * l, int type, cons
             pushUserdataInWeakTable(state,listener.get());
             if (!lua_isnil(state, -1)) {
                 lua_pushinteger(state, type);
-                lua_gettable(state, -2);
+                luaGetUserdataField(state, -2);
                 if (lua_isfunction(state, -1)) {
                     if (data) {
                         oc_fromObjc(state, data);
@@ -12,8 +12,6 @@ static int postNotification(lua_State *L);
 static int createListener(lua_State *L);
 static int AddObserver(lua_State *L);
 static int RemoveObserver(lua_State *L);
-static int __index(lua_State *L);
-static int __newindex(lua_State *L);
 static int __gc(lua_State *L);
 
 static int postNotification(lua_State *L)
@@ -112,12 +110,7 @@ static int createListener(lua_State *L)
         luaL_getmetatable(L, LUA_NOTIFICATION_METATABLE_NAME);
         lua_setmetatable(L, -2);
         
-        lua_newtable(L);
-        lua_pushcfunction(L, AddObserver);
-        lua_setfield(L, -2, "AddObserver");
-        lua_pushcfunction(L, RemoveObserver);
-        lua_setfield(L, -2, "RemoveObserver");
-        lua_setfenv(L, -2);
+        luaInitUserdataFields(L, -1);
         
         pushWeakUserdataTable(L);
         lua_pushlightuserdata(L, l.get());
@@ -158,12 +151,7 @@ static int createListener(lua_State *L)
                 luaL_getmetatable(fromState, LUA_NOTIFICATION_METATABLE_NAME);
                 lua_setmetatable(fromState, -2);
                 
-                lua_newtable(fromState);
-                lua_pushcfunction(fromState, AddObserver);
-                lua_setfield(fromState, -2, "AddObserver");
-                lua_pushcfunction(fromState, RemoveObserver);
-                lua_setfield(fromState, -2, "RemoveObserver");
-                lua_setfenv(fromState, -2);
+                luaInitUserdataFields(fromState, -1);
                 
                 pushWeakUserdataTable(fromState);
                 lua_pushlightuserdata(fromState, l.get());
@@ -196,17 +184,6 @@ static int createListener(lua_State *L)
     return 0;
 }
 
-static int __newindex(lua_State *L)
-{
-    BEGIN_STACK_MODIFY(L);
-    // Add value to the userdata's environment table.
-    lua_getfenv(L, 1);
-    lua_insert(L, 2);
-    lua_rawset(L, 2);
-    END_STACK_MODIFY(L, 0)
-    return 0;
-}
-
 static int __gc(lua_State *L)
 {
     listenerWrapper **instanceUserdata = (listenerWrapper **)luaL_checkudata(L, 1, LUA_NOTIFICATION_METATABLE_NAME);
@@ -223,25 +200,18 @@ static int __gc(lua_State *L)
     return 0;
 }
 
-static int __index(lua_State *L)
-{
-    BEGIN_STACK_MODIFY(L);
-    lua_getfenv(L, -2);
-    lua_pushvalue(L, -2);
-    lua_rawget(L, 3);
-    lua_insert(L, 1);
-    lua_settop(L, 1);
-    END_STACK_MODIFY(L, 1)
-    return 1;
-}
-
 static const struct luaL_Reg metaFunctions[] = {
-    {"__newindex",__newindex},
-    {"__index",__index},
+    {"__newindex", luaUserdataNewindex},
     {"__gc", __gc},
     {NULL, NULL}
 };
 
+static const struct luaL_Reg methods[] = {
+    {"AddObserver", AddObserver},
+    {"RemoveObserver", RemoveObserver},
+    {NULL, NULL}
+};
+
 static const struct luaL_Reg functions[] = {
     {"createListener",createListener},
     {"postNotification",postNotification},
@@ -252,6 +222,7 @@ extern int luaopen_notification(lua_State* L){
     BEGIN_STACK_MODIFY(L);
     luaL_newmetatable(L, LUA_NOTIFICATION_METATABLE_NAME);
     luaL_register(L, NULL, metaFunctions);
+    luaRegisterUserdataMethods(L, methods);
     luaL_register(L, LUA_NOTIFICATION_METATABLE_NAME, functions);
     END_STACK_MODIFY(L, 0)
     return 0;
@@ -0,0 +1,345 @@
+extern "C" {
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+}
+#include "tools/lua_helpers.h"
+#include "lua_coroutine.h"
+#include "serialize.h"
+#include "common/base_lambda_support.h"
+#include "common/business_runtime.h"
+
+static int spawn(lua_State *L);
+static int isScheduled(lua_State *L);
+static int sleepFor(lua_State *L);
+static int call(lua_State *L);
+static int await(lua_State *L);
+static int resumerCall(lua_State *L);
+static int resumerGc(lua_State *L);
+
+namespace {
+//await 时作为最后一个参数传给目标线程的方法，被调用时把参数带回发起线程并恢复协程
+struct Resumer {
+    BusinessThreadID fromThread;
+    int ref;
+    bool fired;
+};
+
+struct Invocation {
+    std::string moduleName;
+    std::string methodName;
+    block * params;
+};
+}
+
+static const char* scheduledTableName = "__scheduled";
+
+static void pushScheduledTable(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L)
+    luaL_getmetatable(L, LUA_COROUTINE_METATABLE_NAME);
+    lua_getfield(L, -1, scheduledTableName);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setmetatable(L, -2);
+        lua_pushstring(L, "k");
+        lua_setfield(L, -2, "__mode");
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, scheduledTableName);
+    }
+    END_STACK_MODIFY(L, 1)
+}
+
+extern bool luaCoroutineIsScheduled(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L)
+    pushScheduledTable(L);
+    if (lua_pushthread(L)) {
+        //主线程不能挂起
+        END_STACK_MODIFY(L, 0)
+        return false;
+    }
+    lua_rawget(L, -2);
+    bool scheduled = lua_toboolean(L, -1);
+    END_STACK_MODIFY(L, 0)
+    return scheduled;
+}
+
+extern int luaCoroutineSuspend(lua_State *L)
+{
+    if (!luaCoroutineIsScheduled(L)) {
+        return LUA_NOREF;
+    }
+    lua_pushthread(L);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+extern void luaCoroutineResume(lua_State *L, int ref, int nargs)
+{
+    int top = lua_gettop(L) - nargs;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    lua_State *co = lua_tothread(L, -1);
+    if (co == NULL || lua_status(co) != LUA_YIELD) {
+        LOG(ERROR)<<"lua_coroutine resume a coroutine which is not suspended";
+        lua_settop(L, top);
+        return;
+    }
+    //协程运行期间留在 L 的栈上，避免被回收
+    lua_insert(L, top + 1);
+    lua_xmove(L, co, nargs);
+    int status = lua_resume(co, nargs);
+    if (status != 0 && status != LUA_YIELD) {
+        LOG(ERROR)<<"lua_coroutine error:"<<lua_tostring(co, -1);
+    }
+    lua_settop(L, top);
+}
+
+static void trackCallbacks(std::list<thread::CallbackContext *> &callbackContexts, BusinessThreadID from, BusinessThreadID to)
+{
+    std::list<thread::CallbackContext *>::iterator it;
+    for (it = callbackContexts.begin(); it != callbackContexts.end(); it++) {
+        thread::CallbackContext * callback = *it;
+        if (callback->fromThread != to) {
+            std::lock_guard<std::recursive_mutex> guard(callback->lock);
+            thread::CallbackInfo info;
+            info.threadId = from;
+            callback->toTheadList[to] = info;
+        }
+    }
+}
+
+//把栈顶 count 个值打包带回 toThread，在那里恢复 ref 对应的协程
+static void resumeOnThread(lua_State *L, BusinessThreadID toThread, int ref, int count)
+{
+    block * result = NULL;
+    if (count > 0) {
+        BusinessThreadID now_thread_identifier;
+        BusinessThread::GetCurrentThreadIdentifier(&now_thread_identifier);
+        std::list<thread::CallbackContext *> callbackContexts;
+        result = seri_pack(L, callbackContexts, count);
+        trackCallbacks(callbackContexts, now_thread_identifier, toThread);
+    }
+    BusinessThread::PostTask(toThread, FROM_HERE, base::BindLambda([=](){
+        lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+        int top = lua_gettop(state);
+        if (result != NULL) {
+            lua_pushcfunction(state, seri_unpack);
+            lua_pushlightuserdata(state, result);
+            if (lua_pcall(state, 1, LUA_MULTRET, 0) != 0) {
+                LOG(ERROR)<<"lua_coroutine unpack error:"<<lua_tostring(state, -1);
+                lua_settop(state, top);
+            }
+        }
+        luaCoroutineResume(state, ref, lua_gettop(state) - top);
+    }));
+}
+
+static void fireResumer(lua_State *L, Resumer *resumer, int count)
+{
+    resumer->fired = true;
+    resumeOnThread(L, resumer->fromThread, resumer->ref, count);
+}
+
+static Resumer * pushResumer(lua_State *L, BusinessThreadID fromThread, int ref)
+{
+    Resumer * resumer = (Resumer *)lua_newuserdata(L, sizeof(Resumer));
+    resumer->fromThread = fromThread;
+    resumer->ref = ref;
+    resumer->fired = false;
+    luaL_getmetatable(L, LUA_COROUTINE_RESUMER_METATABLE_NAME);
+    lua_setmetatable(L, -2);
+    return resumer;
+}
+
+static int resumerCall(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L)
+    Resumer * resumer = (Resumer *)luaL_checkudata(L, 1, LUA_COROUTINE_RESUMER_METATABLE_NAME);
+    if (!resumer->fired) {
+        fireResumer(L, resumer, lua_gettop(L) - 1);
+    }
+    END_STACK_MODIFY(L, 0)
+    return 0;
+}
+
+static int resumerGc(lua_State *L)
+{
+    Resumer * resumer = (Resumer *)luaL_checkudata(L, 1, LUA_COROUTINE_RESUMER_METATABLE_NAME);
+    if (!resumer->fired) {
+        //回调没有被调用就被回收了，不带返回值恢复协程，避免协程永远挂起
+        fireResumer(L, resumer, 0);
+    }
+    return 0;
+}
+
+//在目标线程执行 require(moduleName)[methodName](params...)，await 时 resumer 作为第二个参数传入并追加在参数最后
+static int invoke(lua_State *L)
+{
+    Invocation * invocation = (Invocation *)lua_touserdata(L, 1);
+    lua_remove(L, 1);
+    bool passResumer = lua_gettop(L) > 0;
+    lua_getglobal(L, "require");
+    lua_pushstring(L, invocation->moduleName.c_str());
+    lua_call(L, 1, 1);
+    lua_getfield(L, -1, invocation->methodName.c_str());
+    lua_remove(L, -2);
+    lua_insert(L, 1);
+    if (invocation->params != NULL) {
+        lua_pushcfunction(L, seri_unpack);
+        lua_pushlightuserdata(L, invocation->params);
+        invocation->params = NULL;
+        lua_call(L, 1, LUA_MULTRET);
+    }
+    if (passResumer) {
+        lua_pushvalue(L, 2);
+        lua_remove(L, 2);
+        lua_call(L, lua_gettop(L) - 1, 0);
+        return 0;
+    }
+    lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+    return lua_gettop(L);
+}
+
+static int postAndSuspend(lua_State *L, bool passResumer)
+{
+    int toThread = luaL_checkint(L, 1);
+    std::string moduleName = luaL_checkstring(L, 2);
+    std::string methodName = luaL_checkstring(L, 3);
+    int ref = luaCoroutineSuspend(L);
+    if (ref == LUA_NOREF) {
+        return luaL_error(L, "lua_coroutine.%s must be called in lua_coroutine.spawn", passResumer ? "await" : "call");
+    }
+    BusinessThreadID from_thread_identifier;
+    BusinessThread::GetCurrentThreadIdentifier(&from_thread_identifier);
+
+    Invocation * invocation = new Invocation();
+    invocation->moduleName = moduleName;
+    invocation->methodName = methodName;
+    invocation->params = NULL;
+    //参数留在挂起协程的栈上，被传出去的 callback userdata 在协程恢复前不会被回收
+    int count = lua_gettop(L) - 3;
+    if (count > 0) {
+        std::list<thread::CallbackContext *> callbackContexts;
+        invocation->params = seri_pack(L, callbackContexts, count);
+        trackCallbacks(callbackContexts, from_thread_identifier, (BusinessThreadID)toThread);
+    }
+
+    BusinessThread::PostTask((BusinessThreadID)toThread, FROM_HERE, base::BindLambda([=](){
+        lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+        int top = lua_gettop(state);
+        Resumer * resumer = NULL;
+        if (passResumer) {
+            //在栈上多留一份，方法出错时还能检查 resumer 是否已经被调用过
+            resumer = pushResumer(state, from_thread_identifier, ref);
+        }
+        int base = lua_gettop(state);
+        lua_pushcfunction(state, invoke);
+        lua_pushlightuserdata(state, invocation);
+        if (passResumer) {
+            lua_pushvalue(state, base);
+        }
+        int err = lua_pcall(state, passResumer ? 2 : 1, LUA_MULTRET, 0);
+        if (err != 0) {
+            LOG(ERROR)<<"lua_coroutine "<<moduleName<<"."<<methodName<<" error:"<<lua_tostring(state, -1);
+            if (resumer == NULL || !resumer->fired) {
+                if (resumer != NULL) {
+                    resumer->fired = true;
+                }
+                //出错时返回 nil, error
+                lua_pushnil(state);
+                lua_insert(state, -2);
+                resumeOnThread(state, from_thread_identifier, ref, 2);
+            }
+        } else if (!passResumer) {
+            resumeOnThread(state, from_thread_identifier, ref, lua_gettop(state) - base);
+        }
+        lua_settop(state, top);
+        delete invocation;
+    }));
+    return lua_yield(L, 0);
+}
+
+static int call(lua_State *L)
+{
+    return postAndSuspend(L, false);
+}
+
+static int await(lua_State *L)
+{
+    return postAndSuspend(L, true);
+}
+
+static int sleepFor(lua_State *L)
+{
+    int milliseconds = luaL_checkint(L, 1);
+    int ref = luaCoroutineSuspend(L);
+    if (ref == LUA_NOREF) {
+        return luaL_error(L, "lua_coroutine.sleep must be called in lua_coroutine.spawn");
+    }
+    BusinessThreadID now_thread_identifier;
+    BusinessThread::GetCurrentThreadIdentifier(&now_thread_identifier);
+    BusinessThread::PostDelayedTask(now_thread_identifier, FROM_HERE, base::BindLambda([=](){
+        lua_State * state = BusinessThread::GetCurrentThreadLuaState();
+        luaCoroutineResume(state, ref, 0);
+    }), base::TimeDelta::FromMilliseconds(milliseconds));
+    return lua_yield(L, 0);
+}
+
+static int isScheduled(lua_State *L)
+{
+    lua_pushboolean(L, luaCoroutineIsScheduled(L));
+    return 1;
+}
+
+static int spawn(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    int nargs = lua_gettop(L) - 1;
+    lua_State *co = lua_newthread(L);
+    pushScheduledTable(L);
+    lua_pushvalue(L, -2);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    lua_insert(L, 1);
+    lua_xmove(L, co, nargs + 1);
+    int status = lua_resume(co, nargs);
+    if (status != 0 && status != LUA_YIELD) {
+        LOG(ERROR)<<"lua_coroutine error:"<<lua_tostring(co, -1);
+    }
+    return 1;
+}
+
+static const struct luaL_Reg metaFunctions[] = {
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg functions[] = {
+    {"spawn", spawn},
+    {"isScheduled", isScheduled},
+    {"sleep", sleepFor},
+    {"call", call},
+    {"await", await},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg resumerMetaFunctions[] = {
+    {"__call", resumerCall},
+    {"__gc", resumerGc},
+    {NULL, NULL}
+};
+
+extern int luaopen_coroutine_scheduler(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L);
+    luaL_newmetatable(L, LUA_COROUTINE_RESUMER_METATABLE_NAME);
+    luaL_register(L, NULL, resumerMetaFunctions);
+    luaL_newmetatable(L, LUA_COROUTINE_METATABLE_NAME);
+    luaL_register(L, NULL, metaFunctions);
+    luaL_register(L, LUA_COROUTINE_METATABLE_NAME, functions);
+    END_STACK_MODIFY(L, 0)
+    return 0;
+}
@@ -0,0 +1,18 @@
+#pragma once
+extern "C" {
+#include "lua.h"
+}
+#define LUA_COROUTINE_METATABLE_NAME "lua_coroutine"
+#define LUA_COROUTINE_RESUMER_METATABLE_NAME "lua_coroutine_resumer"
+
+extern int luaopen_coroutine_scheduler(lua_State* L);
+
+//L 是否运行在 lua_coroutine.spawn 创建的协程里，只有这种协程可以被异步接口挂起
+extern bool luaCoroutineIsScheduled(lua_State* L);
+
+//挂起前调用，返回协程的引用；L 不是调度协程时返回 LUA_NOREF
+//调用方随后 return lua_yield(L, 0)，完成时用返回的引用调用 luaCoroutineResume
+extern int luaCoroutineSuspend(lua_State* L);
+
+//在线程的 lua_State 上恢复协程，栈顶 nargs 个值作为挂起函数的返回值
+extern void luaCoroutineResume(lua_State* L, int ref, int nargs);
@@ -1639,6 +1639,22 @@ static luaL_Reg luasocket_scripts_modules[] = {
     {NULL, NULL}
 };
 
+/* preload 里只登记加载函数，脚本在第一次 require 时才编译 */
+static int preload_script(lua_State *L)
+{
+    lua_CFunction open = lua_tocfunction(L, lua_upvalueindex(1));
+    lua_settop(L, 1);
+    open(L);
+    if (lua_type(L, -1) == LUA_TSTRING) {
+        return lua_error(L);
+    }
+    if (lua_isfunction(L, -1)) {
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 1);
+    }
+    return 1;
+}
+
 void luaopen_mobdebug_scripts(void* L)
 {
     
@@ -1650,7 +1666,8 @@ void luaopen_mobdebug_scripts(void* L)
     lua_getfield(L, -1, "preload");
     for (; lib->func; lib++)
     {
-        lib->func(L);
+        lua_pushcfunction(L, lib->func);
+        lua_pushcclosure(L, preload_script, 1);
         lua_setfield(L, -2, lib->name);
     }
     lua_pop(L, 2);
@@ -0,0 +1,145 @@
+#include <string.h>
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+#include "strbuf.h"
+}
+#include "lua_strbuf.h"
+#include "tools/lua_helpers.h"
+
+static int create(lua_State *L);
+static int append(lua_State *L);
+static int appendf(lua_State *L);
+static int reserve(lua_State *L);
+static int reset(lua_State *L);
+static int tostring(lua_State *L);
+static int length(lua_State *L);
+static int __gc(lua_State *L);
+
+static strbuf_t * checkStrbuf(lua_State *L)
+{
+    return (strbuf_t *)luaL_checkudata(L, 1, LUA_STRBUF_METATABLE_NAME);
+}
+
+static int create(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L)
+    int size = luaL_optint(L, 1, 0);
+    strbuf_t *s = (strbuf_t *)lua_newuserdata(L, sizeof(strbuf_t));
+    strbuf_init(s, size);
+    luaL_getmetatable(L, LUA_STRBUF_METATABLE_NAME);
+    lua_setmetatable(L, -2);
+    END_STACK_MODIFY(L, 1)
+    return 1;
+}
+
+//append(...) 依次追加字符串或数字，返回自身方便链式调用
+static int append(lua_State *L)
+{
+    strbuf_t *s = checkStrbuf(L);
+    int top = lua_gettop(L);
+    for (int i = 2; i <= top; i++) {
+        size_t len;
+        const char *str = lua_tolstring(L, i, &len);
+        if (str == NULL) {
+            return luaL_argerror(L, i, "string or number expected");
+        }
+        strbuf_append_mem(s, str, (int)len);
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+//appendf(fmt, ...) 按 string.format 的规则格式化后追加
+static int appendf(lua_State *L)
+{
+    strbuf_t *s = checkStrbuf(L);
+    luaL_checkstring(L, 2);
+    int top = lua_gettop(L);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 2);
+    lua_call(L, top - 1, 1);
+    size_t len;
+    const char *str = lua_tolstring(L, -1, &len);
+    strbuf_append_mem(s, str, (int)len);
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int reserve(lua_State *L)
+{
+    strbuf_t *s = checkStrbuf(L);
+    int len = luaL_checkint(L, 2);
+    if (len > 0) {
+        strbuf_ensure_empty_length(s, len);
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int reset(lua_State *L)
+{
+    strbuf_t *s = checkStrbuf(L);
+    strbuf_reset(s);
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int tostring(lua_State *L)
+{
+    strbuf_t *s = checkStrbuf(L);
+    int len;
+    const char *str = strbuf_string(s, &len);
+    lua_pushlstring(L, str, len);
+    return 1;
+}
+
+static int length(lua_State *L)
+{
+    strbuf_t *s = checkStrbuf(L);
+    lua_pushinteger(L, strbuf_length(s));
+    return 1;
+}
+
+static int __gc(lua_State *L)
+{
+    strbuf_t *s = checkStrbuf(L);
+    strbuf_free(s);
+    return 0;
+}
+
+static const struct luaL_Reg metaFunctions[] = {
+    {"append", append},
+    {"reserve", reserve},
+    {"reset", reset},
+    {"tostring", tostring},
+    {"len", length},
+    {"__tostring", tostring},
+    {"__len", length},
+    {"__gc", __gc},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg functions[] = {
+    {"new", create},
+    {NULL, NULL}
+};
+
+extern int luaopen_strbuf(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L)
+    luaL_newmetatable(L, LUA_STRBUF_METATABLE_NAME);
+    luaL_register(L, NULL, metaFunctions);
+    //appendf 以 string.format 作为 upvalue
+    lua_getglobal(L, "string");
+    lua_getfield(L, -1, "format");
+    lua_remove(L, -2);
+    lua_pushcclosure(L, appendf, 1);
+    lua_setfield(L, -2, "appendf");
+    //方法直接放在元表里，所有实例共用
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_register(L, LUA_STRBUF_METATABLE_NAME, functions);
+    END_STACK_MODIFY(L, 0)
+    return 0;
+}
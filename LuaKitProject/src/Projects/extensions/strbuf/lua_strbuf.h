@@ -0,0 +1,7 @@
+#pragma once
+extern "C" {
+#include "lua.h"
+}
+#define LUA_STRBUF_METATABLE_NAME "lua_strbuf"
+
+extern int luaopen_strbuf(lua_State* L);
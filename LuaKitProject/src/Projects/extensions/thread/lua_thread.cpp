@@ -238,7 +238,7 @@ static int postToThreadSync(lua_State *L){
                 if (lua_isnil(L, -1)) {//queue为空，初始化
                     lua_pop(L, 1);
                     lua_pushinteger(L, toThread);
-                    lua_newtable(L);
+                    lua_createtable(L, 0, 2);
                     lua_pushstring(L, "start");
                     lua_pushinteger(L, 0);
                     lua_rawset(L, -3);
@@ -463,7 +463,7 @@ static int postToThread(lua_State *L)
             if (lua_isnil(L, -1)) {//queue为空，初始化
                 lua_pop(L, 1);
                 lua_pushinteger(L, toThread);
-                lua_newtable(L);
+                lua_createtable(L, 0, 2);
                 lua_pushstring(L, "start");
                 lua_pushinteger(L, 0);
                 lua_rawset(L, -3);
@@ -665,7 +665,7 @@ static int callbackCall(lua_State *L) {
             lua_pop(L, 1);
             pushStrongUserdataTable(L);
             lua_pushlightuserdata(L, localCallbackContext);
-            lua_newtable(L);
+            lua_createtable(L, 0, 2);
             lua_rawset(L, -3);
             lua_pushlightuserdata(L, localCallbackContext);
             lua_rawget(L, -2);
@@ -682,7 +682,7 @@ static int callbackCall(lua_State *L) {
         lua_rawget(L, -2);
         long n = lua_tointeger(L, -1);
         lua_pop(L, 1);
-        lua_newtable(L);
+        lua_createtable(L, 0, 1);
         lua_pushlightuserdata(L, localCallbackContext);
         lua_pushvalue(L, 1);
         lua_rawset(L, -3);
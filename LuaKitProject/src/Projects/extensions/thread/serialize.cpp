@@ -301,6 +301,24 @@ wb_string(struct write_block *wb, const char *str, int len) {
 
 static void _pack_one(lua_State *L, struct write_block *b, int index, int depth, std::list<thread::CallbackContext *> & callbackContext);
 
+static int
+wb_table_hash_size(lua_State *L, int index, int array_size) {
+	int hash_size = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		lua_pop(L, 1);
+		if (lua_type(L,-1) == LUA_TNUMBER) {
+			lua_Number k = lua_tonumber(L,-1);
+			int32_t x = (int32_t)lua_tointeger(L,-1);
+			if (k == (lua_Number)x && x>0 && x<=array_size) {
+				continue;
+			}
+		}
+		++hash_size;
+	}
+	return hash_size;
+}
+
 static int
 wb_table_array(lua_State *L, struct write_block * wb, int index, int depth, std::list<thread::CallbackContext *> & callbackContext) {
 	int array_size = (int)lua_objlen(L,index);
@@ -312,6 +330,8 @@ wb_table_array(lua_State *L, struct write_block * wb, int index, int depth, std:
 		int n = COMBINE_TYPE(TYPE_TABLE, array_size);
 		wb_push(wb, &n, 1);
 	}
+	// hash size goes ahead of the elements so that unpack can presize the table
+	wb_integer(wb, wb_table_hash_size(L, index, array_size));
 
 	int i;
 	for (i=1;i<=array_size;i++) {
@@ -339,7 +359,6 @@ wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int a
 		_pack_one(L,wb,-1,depth,callbackContext);
 		lua_pop(L, 1);
 	}
-	wb_nil(wb);
 }
 
 static void
@@ -540,34 +559,36 @@ _get_buffer(lua_State *L, struct read_block *rb, int len) {
 
 static void _unpack_one(lua_State *L, struct read_block *rb);
 
+static int
+_get_size(lua_State *L, struct read_block *rb) {
+	uint8_t type;
+	uint8_t *t = (uint8_t *)rb_read(rb, &type, sizeof(type));
+	if (t==NULL) {
+		invalid_stream(L,rb);
+	}
+	type = *t;
+	int cookie = type >> 3;
+	if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
+		invalid_stream(L,rb);
+	}
+	return (int)get_integer(L,rb,cookie);
+}
+
 static void
 _unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	if (array_size == MAX_COOKIE-1) {
-		uint8_t type;
-		uint8_t *t = (uint8_t *)rb_read(rb, &type, sizeof(type));
-		if (t==NULL) {
-			invalid_stream(L,rb);
-		}
-		type = *t;
-		int cookie = type >> 3;
-		if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
-			invalid_stream(L,rb);
-		}
-		array_size = get_integer(L,rb,cookie);
+		array_size = _get_size(L,rb);
 	}
+	int hash_size = _get_size(L,rb);
 	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	lua_createtable(L,array_size,hash_size);
 	int i;
 	for (i=1;i<=array_size;i++) {
 		_unpack_one(L,rb);
 		lua_rawseti(L,-2,i);
 	}
-	for (;;) {
+	for (i=0;i<hash_size;i++) {
 		_unpack_one(L,rb);
-		if (lua_isnil(L,-1)) {
-			lua_pop(L,1);
-			return;
-		}
 		_unpack_one(L,rb);
 		lua_rawset(L,-3);
 	}
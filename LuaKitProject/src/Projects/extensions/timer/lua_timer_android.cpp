@@ -105,7 +105,7 @@ static void timerCallJni(jlong ref, jint threadId) {
         lua_State * state = BusinessThread::GetCurrentThreadLuaState();
         pushUserdataInWeakTable(state,(jobject)ref);
         if (!lua_isnil(state, -1)) {
-            lua_getfield(state, -1, "callback");
+            luaGetUserdataField(state, -1, "callback");
             if (lua_isfunction(state, -1)) {
                 int err = lua_pcall(state, 0, 0, 0);
                 if (err != 0) {
@@ -145,17 +145,6 @@ extern bool RegisterTimerUtil(JNIEnv* env) {
   return true;
 }
 
-static int __newindex(lua_State *L)
-{
-    BEGIN_STACK_MODIFY(L);
-    // Add value to the userdata's environment table.
-    lua_getfenv(L, 1);
-    lua_insert(L, 2);
-    lua_rawset(L, 2);
-    END_STACK_MODIFY(L, 0);
-    return 0;
-}
-
 static int __gc(lua_State *L)
 {
     AndroidTimer *instanceUserdata = (AndroidTimer *)luaL_checkudata(L, 1, LUA_TIMER_METATABLE_NAME);
@@ -200,28 +189,6 @@ static int stop(lua_State *L)
     return 0;
 }
 
-static int __index(lua_State *L)
-{
-    BEGIN_STACK_MODIFY(L)
-    lua_getfenv(L, -2);
-    lua_pushvalue(L, -2);
-    lua_rawget(L, 3);
-    if (!lua_isnil(L, -1)) {
-        lua_insert(L, 1);
-        lua_settop(L, 1);
-        return 1;
-    } else {
-        lua_settop(L, 2);
-    }
-    const char *c = lua_tostring(L, 2);
-    lua_settop(L, 0);
-    luaL_getmetatable(L, LUA_TIMER_METATABLE_NAME);
-    lua_getfield(L, -1, c);
-    lua_remove(L, 1);
-    END_STACK_MODIFY(L, 1)
-    return 1;
-}
-
 static int createTimer(lua_State *L)
 {
     BEGIN_STACK_MODIFY(L)
@@ -243,9 +210,8 @@ static int createTimer(lua_State *L)
     luaL_getmetatable(L, LUA_TIMER_METATABLE_NAME);
     lua_setmetatable(L, -2);
     
-    // give it a nice clean environment
-    lua_newtable(L);
-    lua_setfenv(L, -2);
+    // callback 在 start 时才写入 fenv
+    luaInitUserdataFields(L, -1);
     
     pushWeakUserdataTable(L);
     lua_pushlightuserdata(L, timer);
@@ -258,9 +224,12 @@ static int createTimer(lua_State *L)
 }
 
 static const struct luaL_Reg metaFunctions[] = {
-    {"__index", __index},
-    {"__newindex", __newindex},
+    {"__newindex", luaUserdataNewindex},
     {"__gc", __gc},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg methods[] = {
     {"start", start},
     {"reset", reset},
     {"stop", stop},
@@ -277,6 +246,7 @@ extern int luaopen_timer(lua_State* L)
     BEGIN_STACK_MODIFY(L);
     luaL_newmetatable(L, LUA_TIMER_METATABLE_NAME);
     luaL_register(L, NULL, metaFunctions);
+    luaRegisterUserdataMethods(L, methods);
     luaL_register(L, LUA_TIMER_METATABLE_NAME, functions);
     END_STACK_MODIFY(L, 0)
 
@@ -10,7 +10,7 @@ LOCAL_CFLAGS := -DANDROID -DOS_ANDROID
 MY_FILES_PATH  :=  $(LOCAL_PATH)\
 				  
 				   
-MY_FILTER_OUT_CONTAIN := %shell.c %.h %.hpp %.mm %.proto %test.cpp %mock_server.cpp %tests.cpp %_win.cc %_ios.cpp %.txt %html_utils.cpp %wwhttpapi.cpp %authhttpapi.cpp
+MY_FILTER_OUT_CONTAIN := %shell.c %.h %.hpp %.mm %.proto %test.cpp %mock_server.cpp %tests.cpp %_unittest.cc %_win.cc %_ios.cpp %.txt %html_utils.cpp %wwhttpapi.cpp %authhttpapi.cpp
 
 # login_protocol_handler.cpp && mail_login_protocol_handler.cpp  ->  %login_protocol_handler.cpp 只合并这一个,task系列不太好用简化
 
@@ -40,6 +40,8 @@ LOCAL_C_INCLUDES += $(LOCAL_PATH)/.././ \
                     $(LOCAL_PATH)/../extensions/HTTP \
                     $(LOCAL_PATH)/../extensions/lua-cjson-master \
                     $(LOCAL_PATH)/../extensions/thread \
+                    $(LOCAL_PATH)/../extensions/coroutine \
+                    $(LOCAL_PATH)/../extensions/strbuf \
                     $(LOCAL_PATH)/../extensions/timer \
                     $(LOCAL_PATH)/../extensions/AsyncSocket \
                     $(LOCAL_PATH)/../extensions/File \
@@ -75,6 +75,16 @@ static int getn (lua_State *L) {
 }
 
 
+static int tnew (lua_State *L) {
+  int narray = luaL_optint(L, 1, 0);
+  int nhash = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narray >= 0, 1, "negative size");
+  luaL_argcheck(L, nhash >= 0, 2, "negative size");
+  lua_createtable(L, narray, nhash);  /* preallocate array and hash parts */
+  return 1;
+}
+
+
 static int setn (lua_State *L) {
   luaL_checktype(L, 1, LUA_TTABLE);
 #ifndef luaL_setn
@@ -272,6 +282,7 @@ static const luaL_Reg tab_funcs[] = {
   {"foreachi", foreachi},
   {"getn", getn},
   {"maxn", maxn},
+  {"new", tnew},
   {"insert", tinsert},
   {"remove", tremove},
   {"setn", setn},
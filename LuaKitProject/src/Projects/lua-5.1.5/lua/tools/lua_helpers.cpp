@@ -14,6 +14,8 @@ extern "C" {
 #include "lua_async_socket.h"
 #include "lua_timer.h"
 #include "lua_thread.h"
+#include "lua_coroutine.h"
+#include "lua_strbuf.h"
 #include "base/path_service.h"
 #include "base/files/file_path.h"
 #include "lua_file.h"
@@ -21,6 +23,8 @@ extern "C" {
 #include "lua_language.h"
 #include "LuakitLoader.h"
 #include "xxtea.h"
+#include <map>
+#include <set>
 
 static bool  _xxteaEnabled = false;
 static char* _xxteaKey = NULL;
@@ -40,6 +44,30 @@ static std::string packagePath = "";
 
 static LuaErrorFun luaErrorFun = NULL;
 
+struct LuaNativeModule {
+    const char *name;      // require 用的模块名
+    const char *global;    // 模块打开时设置的全局变量，第一次访问时自动 require
+    lua_CFunction open;
+};
+
+//这些模块只登记到 package.preload，用到时才打开
+static const LuaNativeModule nativeModules[] = {
+    {"lua_file", LUA_FILE_METATABLE_NAME, luaopen_file},
+    {"sqlite3", "sqlite3", luaopen_lsqlite3},
+    {"lua_http", LUA_HTTP_METATABLE_NAME, luaopen_http},
+    {"lua_strbuf", LUA_STRBUF_METATABLE_NAME, luaopen_strbuf},
+    {"lua_timer", LUA_TIMER_METATABLE_NAME, luaopen_timer},
+    {"lua_language", LUA_LANGUAGE_METATABLE_NAME, luaopen_language},
+    {"cjson", "cjson", luaopen_cjson},
+    {"cjson.safe", NULL, luaopen_cjson_safe},
+    {"lua_asyncSocket", LUA_ASYNC_SOCKET_METATABLE_NAME, luaopen_async_socket},
+    {"lua_notification", LUA_NOTIFICATION_METATABLE_NAME, luaopen_notification},
+    {NULL, NULL, NULL}
+};
+
+//线程类型 -> 允许的原生模块，没有设置的线程类型可以使用全部模块
+static std::map<int, std::set<std::string> > threadNativeModules;
+
 extern void pushWeakUserdataTable(lua_State *L)
 {
     BEGIN_STACK_MODIFY(L)
@@ -256,23 +284,106 @@ static void addLuaLoader(lua_State* L, lua_CFunction func)
     lua_pop(L, 1);
 }
 
+extern void luaSetThreadNativeModules(int threadType, const char **modules)
+{
+    std::set<std::string> &allowed = threadNativeModules[threadType];
+    allowed.clear();
+    for (; modules != NULL && *modules != NULL; modules++) {
+        allowed.insert(*modules);
+    }
+}
+
+static bool isNativeModuleAllowed(int threadType, const char *name)
+{
+    std::map<int, std::set<std::string> >::const_iterator it = threadNativeModules.find(threadType);
+    return it == threadNativeModules.end() || it->second.count(name) > 0;
+}
+
+static int openNativeModule(lua_State *L)
+{
+    const LuaNativeModule *module = &nativeModules[lua_tointeger(L, lua_upvalueindex(1))];
+    lua_settop(L, 0);
+    lua_pushcfunction(L, module->open);
+    lua_call(L, 0, 1);
+    if (lua_isnil(L, -1) && module->global != NULL) {
+        lua_pop(L, 1);
+        lua_getglobal(L, module->global);
+    }
+    return 1;
+}
+
+//_G 的 __index，upvalue 1 是 全局变量名 -> 模块名，upvalue 2 是 _G 原来的 __index
+static int autoloadGlobal(lua_State *L)
+{
+    lua_settop(L, 2);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    if (lua_isnil(L, -1)) { // 不是原生模块，交给原来的 __index
+        if (lua_isfunction(L, lua_upvalueindex(2))) {
+            lua_pushvalue(L, lua_upvalueindex(2));
+            lua_pushvalue(L, 1);
+            lua_pushvalue(L, 2);
+            lua_call(L, 2, 1);
+        } else if (lua_istable(L, lua_upvalueindex(2))) {
+            lua_pushvalue(L, 2);
+            lua_gettable(L, lua_upvalueindex(2));
+        }
+        return 1;
+    }
+    lua_pushstring(L, "require");
+    lua_rawget(L, LUA_GLOBALSINDEX);
+    lua_insert(L, -2);
+    lua_call(L, 1, 0);
+    lua_rawget(L, 1);
+    return 1;
+}
+
+static void registerNativeModules(lua_State *L, int threadType)
+{
+    BEGIN_STACK_MODIFY(L)
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "preload");
+    lua_newtable(L);
+    for (int i = 0; nativeModules[i].name != NULL; i++) {
+        const LuaNativeModule *module = &nativeModules[i];
+        if (!isNativeModuleAllowed(threadType, module->name)) {
+            continue;
+        }
+        lua_pushinteger(L, i);
+        lua_pushcclosure(L, openNativeModule, 1);
+        lua_setfield(L, -3, module->name);
+        if (module->global != NULL) {
+            lua_pushstring(L, module->name);
+            lua_setfield(L, -2, module->global);
+        }
+    }
+    //_G 已经有元表（比如 strict.lua）时不替换，接在原来的 __index 前面
+    if (!lua_getmetatable(L, LUA_GLOBALSINDEX)) {
+        lua_createtable(L, 0, 1);
+    }
+    lua_insert(L, -2);
+    lua_getfield(L, -2, "__index");
+    lua_pushcclosure(L, autoloadGlobal, 2);
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, LUA_GLOBALSINDEX);
+    END_STACK_MODIFY(L, 0)
+}
+
 extern int luaInit(lua_State* L)
+{
+    return luaInit(L, -1);
+}
+
+extern int luaInit(lua_State* L, int threadType)
 {
     lua_atpanic(L, &lua_panic);
     lua_aterr(L, &lua_err);
     luaL_openlibs(L);
-    luaopen_file(L);
     luaopen_mobdebug_scripts(L);
-    luaopen_lsqlite3(L);
-    luaopen_http(L);
     luaopen_callback(L);
     luaopen_thread(L);
-    luaopen_timer(L);
-    luaopen_language(L);
-    luaopen_cjson(L);
-    luaopen_cjson_safe(L);
-    luaopen_async_socket(L);
-    luaopen_notification(L);
+    luaopen_coroutine_scheduler(L);
+    registerNativeModules(L, threadType);
     addLuaLoader(L,luakit_loader);
     base::FilePath documentDir;
     PathService::Get(PATH_SERVICE_KEY, &documentDir);
@@ -307,3 +418,97 @@ extern void pushUserdataInWeakTable(lua_State *L, void * object){
     END_STACK_MODIFY(L, 1)
 }
 
+static void pushEmptyUserdataFields(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L)
+    static const char* emptyTableName = "__empty_userdata_fields";
+    luaL_getmetatable(L, LUA_CALLBACK_METATABLE_NAME);
+    lua_getfield(L, -1, emptyTableName);
+    if (lua_isnil(L, -1)) { // 所有还没有写过字段的 userdata 共用这张空表
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, emptyTableName);
+    }
+    END_STACK_MODIFY(L, 1)
+}
+
+extern void luaInitUserdataFields(lua_State *L, int index)
+{
+    BEGIN_STACK_MODIFY(L)
+    if (index < 0) {
+        index = lua_gettop(L) + index + 1;
+    }
+    pushEmptyUserdataFields(L);
+    lua_setfenv(L, index);
+    END_STACK_MODIFY(L, 0)
+}
+
+extern int luaUserdataNewindex(lua_State *L)
+{
+    BEGIN_STACK_MODIFY(L)
+    if (lua_type(L, 1) != LUA_TUSERDATA) {
+        lua_rawset(L, 1);
+        return 0;
+    }
+    lua_getfenv(L, 1);
+    pushEmptyUserdataFields(L);
+    bool shared = lua_rawequal(L, -1, -2) || !lua_istable(L, -2);
+    lua_pop(L, 1);
+    if (shared) { // 第一次写字段时才分配实例自己的 fenv
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 2);
+        lua_pushvalue(L, -1);
+        lua_setfenv(L, 1);
+    }
+    lua_insert(L, 2);
+    lua_rawset(L, 2);
+    END_STACK_MODIFY(L, 0)
+    return 0;
+}
+
+extern void luaGetUserdataField(lua_State *L, int index)
+{
+    if (index < 0) {
+        index = lua_gettop(L) + index + 1;
+    }
+    lua_getfenv(L, index);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 2);
+        lua_pushnil(L);
+        return;
+    }
+    lua_insert(L, -2);
+    lua_rawget(L, -2);
+    lua_remove(L, -2);
+}
+
+extern void luaGetUserdataField(lua_State *L, int index, const char *k)
+{
+    if (index < 0) {
+        index = lua_gettop(L) + index + 1;
+    }
+    lua_pushstring(L, k);
+    luaGetUserdataField(L, index);
+}
+
+extern int luaUserdataIndex(lua_State *L)
+{
+    lua_settop(L, 2);
+    luaGetUserdataField(L, 1);
+    return 1;
+}
+
+extern void luaRegisterUserdataMethods(lua_State *L, const luaL_Reg *methods)
+{
+    BEGIN_STACK_MODIFY(L)
+    int size = 0;
+    for (const luaL_Reg *l = methods; l->name != NULL; l++) {
+        size++;
+    }
+    lua_createtable(L, 0, size);
+    luaL_register(L, NULL, methods);
+    lua_setfield(L, -2, "__index"); // 方法调用只查一次表，不经过 C 函数
+    END_STACK_MODIFY(L, 0)
+}
+
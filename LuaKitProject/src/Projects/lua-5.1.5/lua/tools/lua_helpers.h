@@ -17,7 +17,25 @@ extern void pushWeakUserdataTable(lua_State *L);
 extern void pushStrongUserdataTable(lua_State *L);
 extern void pushUserdataInStrongTable(lua_State *L, void * object);
 extern void pushUserdataInWeakTable(lua_State *L, void * object);
+
+//userdata 的方法放在元表 __index 指向的共享表里，实例字段（回调等）放在 fenv 里
+//新建的 userdata 先共用一张空 fenv，第一次通过 __newindex 写字段时才分配自己的表
+extern void luaInitUserdataFields(lua_State *L, int index);
+extern int  luaUserdataNewindex(lua_State *L);
+//只读 fenv 里的实例字段，给没有方法的 userdata 用作 __index
+extern int  luaUserdataIndex(lua_State *L);
+//栈顶的 key 替换成 index 处 userdata 的字段值，不经过 __index
+extern void luaGetUserdataField(lua_State *L, int index);
+extern void luaGetUserdataField(lua_State *L, int index, const char *k);
+//栈顶是元表，用 methods 创建共享方法表直接设为 __index；实例字段只写不读，native 用 luaGetUserdataField 读
+extern void luaRegisterUserdataMethods(lua_State *L, const struct luaL_Reg *methods);
 extern int  luaInit(lua_State* L);
+//threadType 是 BusinessThread::ID，决定这个 lua_State 可以 require 哪些原生模块
+extern int  luaInit(lua_State* L, int threadType);
+//设置某类线程可以使用的原生模块（lua_http、sqlite3、cjson 等），modules 以 NULL 结尾
+//原生模块都登记在 package.preload 里，第一次 require 或访问对应的全局变量时才打开
+//需要在 BusinessRuntime 创建线程前调用
+extern void luaSetThreadNativeModules(int threadType, const char **modules);
 extern void luaSetPackagePath(const char * path);
 extern void setLuaErrorFun(LuaErrorFun func);
 extern std::string luaGetPackagePath();
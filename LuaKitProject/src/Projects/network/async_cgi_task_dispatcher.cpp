@@ -1,8 +1,14 @@
 
+#include <algorithm>
+#include <string.h>
 #include "base/strings/string_number_conversions.h"
+#include "base/strings/string_util.h"
 #include "base/guid.h"
 #include "network/async_cgi_task_dispatcher.h"
 #include "network/curl_connection.h"
+#include "network/curl_multi.h"
+#include "network/network_metrics.h"
+#include "network/segmented_download.h"
 
 namespace network {
     
@@ -10,7 +16,19 @@ HttpTask::HttpTask(const std::string& name) :
 task_name(name){
     task_id = base::GenerateGUID();
     socket_watcher_timeout = 0;
+    data_chunk_size = 0;
+    download_offset = -1;
+    download_limit = 0;
+    cache_policy = HTTP_CACHE_NONE;
+    priority = 1;
+    canceled = false;
+    progress_interval_ms = 100;
+    progress_min_bytes = 0;
+    memset(progress_, 0, sizeof(progress_));
+    progress_pending_ = false;
+    last_progress_bytes_ = 0;
     is_post = true;
+    is_head = false;
 }
     
 HttpTask::~HttpTask() {
@@ -20,16 +38,60 @@ void HttpTask::ProgressFeedBack(network::BaseConnection* connection, int64 dltot
     ;
 }
     
+void HttpTask::ReportProgress(network::BaseConnection* connection, int64 dltotal, int64 dlnow, int64 ultotal, int64 ulnow) {
+    if (progress_interval_ms < 0) {
+        return;
+    }
+    if (progress_[0] == dltotal && progress_[1] == dlnow && progress_[2] == ultotal && progress_[3] == ulnow) {
+        return; // curl在没有数据时也会定时回调
+    }
+    // 只在某个方向刚传完的那一次立即回调，上传完之后的下载进度仍然按间隔合并
+    bool download_finished = dltotal > 0 && dlnow == dltotal && progress_[1] != dlnow;
+    bool upload_finished = ultotal > 0 && ulnow == ultotal && progress_[3] != ulnow;
+    bool finished = download_finished || upload_finished;
+    progress_[0] = dltotal;
+    progress_[1] = dlnow;
+    progress_[2] = ultotal;
+    progress_[3] = ulnow;
+    progress_pending_ = true;
+    bool due = (base::TimeTicks::Now() - last_progress_time_).InMilliseconds() >= progress_interval_ms ||
+               (progress_min_bytes > 0 && dlnow + ulnow - last_progress_bytes_ >= progress_min_bytes);
+    if (finished || due) {
+        FlushProgress(connection);
+    }
+}
+
+void HttpTask::FlushProgress(network::BaseConnection* connection) {
+    if (!progress_pending_) {
+        return;
+    }
+    progress_pending_ = false;
+    last_progress_time_ = base::TimeTicks::Now();
+    last_progress_bytes_ = progress_[1] + progress_[3];
+    ProgressFeedBack(connection, progress_[0], progress_[1], progress_[2], progress_[3]);
+}
+
 int HttpTask::OnResponse(network::ProtocolErrorCode error_code,
                    const HTTP_HEADERS& headers,
                          const std::string& resp, long http_code) {
     return 0;
 }
 
+int HttpTask::OnResponse(const scoped_refptr<HttpResponse>& response) {
+    return OnResponse(response->error_code, response->headers, response->body->data(), response->http_code);
+}
+
+void HttpTask::OnData(const scoped_refptr<base::RefCountedString>& chunk, const base::Closure& consumed) {
+    // 不能在curl的写回调里直接恢复传输
+    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, consumed);
+}
+
 HttpCgiTaskDispatcher::HttpCgiTaskDispatcher(const std::string& name,
                                                  bool fifo,
                                                  int connection_count) :
-AsyncTaskDispatcher(name, fifo) {
+AsyncTaskDispatcher(name, fifo),
+max_streams_(0),
+max_host_tasks_(ASYNC_CURL_MAX_HOST_CONNECTIONS) {
   DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
   CreateFixedConnections(connection_count);
 }
@@ -41,27 +103,437 @@ HttpCgiTaskDispatcher::~HttpCgiTaskDispatcher(){
 void HttpCgiTaskDispatcher::ScheduleTask(const scoped_refptr<HttpTask>& task,
                                            const HandlerCallback& handler_callback) {
   DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-  ScheduleTasksWithPriority(base::Bind(&HttpCgiTaskDispatcher::RunTask,
+  task->cache_entry = NULL;
+  active_tasks_[task->task_id] = task;
+  std::string coalesce_key = GetCoalesceKey(task);
+  if (!coalesce_key.empty()) {
+    auto it = inflight_tasks_.find(coalesce_key);
+    if (it != inflight_tasks_.end()) {
+      // 相同的GET正在传输，不再占用连接，等它的响应
+      it->second.push_back(std::make_pair(task, handler_callback));
+      return;
+    }
+    inflight_tasks_[coalesce_key];
+    task->coalesce_key = coalesce_key;
+  }
+  if (IsCacheable(task)) {
+    http_cache_->Lookup(task->url, base::Bind(&HttpCgiTaskDispatcher::OnCacheLookup,
+                                              this,
+                                              task,
+                                              handler_callback));
+    return;
+  }
+  ScheduleNetworkTask(task, handler_callback);
+}
+
+void HttpCgiTaskDispatcher::ScheduleNetworkTask(const scoped_refptr<HttpTask>& task,
+                                                const HandlerCallback& handler_callback) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  if (max_streams_ > 0) {
+    ScheduleStream(task, handler_callback);
+    return;
+  }
+  std::string host_key = GetOrigin(task->url);
+  HostTasks& host_tasks = host_tasks_[host_key];
+  if (host_tasks.active >= max_host_tasks_) {
+    // 这个origin的并发已满，不占用空闲连接，让其他origin的请求先走
+    host_tasks.pending.push_back(std::make_pair(task, handler_callback));
+    return;
+  }
+  host_tasks.active++;
+  task->host_key = host_key;
+  EnqueueTask(task, handler_callback);
+}
+
+void HttpCgiTaskDispatcher::EnqueueTask(const scoped_refptr<HttpTask>& task,
+                                        const HandlerCallback& handler_callback) {
+  task->queued_task = ScheduleTasksWithPriority(base::Bind(&HttpCgiTaskDispatcher::RunTask,
+                                                          this,
+                                                          task,
+                                                          handler_callback),
+                                               task->priority,
+                                               base::Bind(&HttpCgiTaskDispatcher::RespondCanceled,
+                                                          this,
+                                                          task,
+                                                          handler_callback));
+}
+
+void HttpCgiTaskDispatcher::RunTask(const scoped_refptr<HttpTask>& task,
+                                      const HandlerCallback& handler_callback) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  task->queued_task = NULL;
+  if (ShouldAbortTask(task)) {
+    // 出队之后才取消，把连接还回去
+    ReleaseBusyConnection(GetFlaggedConnection());
+    RespondCanceled(task, handler_callback);
+    return;
+  }
+  ConfigTaskAndConnection(task, GetFlaggedConnection(), handler_callback);
+}
+
+bool HttpCgiTaskDispatcher::CancelTask(const std::string& task_id) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  auto download = downloads_.find(task_id);
+  if (download != downloads_.end()) {
+    download->second->Cancel();
+    return true;
+  }
+  auto active = active_tasks_.find(task_id);
+  if (active == active_tasks_.end() || active->second->canceled) {
+    return false;
+  }
+  scoped_refptr<HttpTask> task = active->second;
+  task->canceled = true;
+  if (!task->coalesce_key.empty()) {
+    auto inflight = inflight_tasks_.find(task->coalesce_key);
+    if (inflight != inflight_tasks_.end() && !inflight->second.empty()) {
+      // 还有请求合并在上面，不管是否还在等origin并发名额都照常传输，结束时只有这个task收到PEC_ABORTED
+      return true;
+    }
+  }
+  // 合并在别的请求上的和等origin并发名额的只需要移出等待列表
+  std::vector<WAITING_TASKS*> waiting_lists;
+  for (auto& inflight : inflight_tasks_) {
+    waiting_lists.push_back(&inflight.second);
+  }
+  for (auto& host_tasks : host_tasks_) {
+    waiting_lists.push_back(&host_tasks.second.pending);
+  }
+  for (WAITING_TASKS* waiting : waiting_lists) {
+    for (auto it = waiting->begin(); it != waiting->end(); ++it) {
+      if (it->first == task) {
+        HandlerCallback handler_callback = it->second;
+        waiting->erase(it);
+        RespondCanceled(task, handler_callback);
+        return true;
+      }
+    }
+  }
+  if (!task->coalesce_key.empty()) {
+    // 之后相同的请求不再合并到这个要取消的传输上
+    inflight_tasks_.erase(task->coalesce_key);
+    task->coalesce_key.clear();
+  }
+  if (task->queued_task.get()) {
+    CancelScheduledTask(task->queued_task);
+    task->queued_task = NULL;
+  }
+  // 其他状态在下一个检查点处理：传输中由abort回调中止，查缓存、排队等stream、已出队的在执行前检查
+  return true;
+}
+
+void HttpCgiTaskDispatcher::ReleaseHostSlot(const scoped_refptr<HttpTask>& task) {
+  if (task->host_key.empty()) {
+    return;
+  }
+  auto it = host_tasks_.find(task->host_key);
+  task->host_key.clear();
+  if (it == host_tasks_.end()) {
+    return;
+  }
+  HostTasks& host_tasks = it->second;
+  host_tasks.active--;
+  while (host_tasks.active < max_host_tasks_ && !host_tasks.pending.empty()) {
+    scoped_refptr<HttpTask> next = host_tasks.pending.front().first;
+    HandlerCallback handler_callback = host_tasks.pending.front().second;
+    host_tasks.pending.erase(host_tasks.pending.begin());
+    host_tasks.active++;
+    next->host_key = it->first;
+    EnqueueTask(next, handler_callback);
+  }
+  if (host_tasks.active <= 0 && host_tasks.pending.empty()) {
+    host_tasks_.erase(it);
+  }
+}
+
+void HttpCgiTaskDispatcher::SetPoolLimits(int min_connections, int max_connections, int max_host_connections) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  SetPoolBounds(min_connections, max_connections);
+  max_host_tasks_ = std::max(max_host_connections, 1);
+  SetMaxHostConnections(max_host_tasks_);
+  // 上限调大之后排队的请求可以马上开始
+  for (auto it = host_tasks_.begin(); it != host_tasks_.end();) {
+    HostTasks& host_tasks = (it++)->second;
+    while (host_tasks.active < max_host_tasks_ && !host_tasks.pending.empty()) {
+      scoped_refptr<HttpTask> next = host_tasks.pending.front().first;
+      HandlerCallback handler_callback = host_tasks.pending.front().second;
+      host_tasks.pending.erase(host_tasks.pending.begin());
+      host_tasks.active++;
+      next->host_key = GetOrigin(next->url);
+      EnqueueTask(next, handler_callback);
+    }
+  }
+}
+
+void HttpCgiTaskDispatcher::ScheduleDownload(const scoped_refptr<HttpTask>& task, int max_segments) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  scoped_refptr<SegmentedDownload> download(new SegmentedDownload(this, task, max_segments));
+  downloads_[task->task_id] = download;
+  download->Start();
+}
+
+void HttpCgiTaskDispatcher::OnDownloadFinished(const std::string& task_id) {
+  downloads_.erase(task_id);
+}
+
+bool HttpCgiTaskDispatcher::ShouldAbortTask(const scoped_refptr<HttpTask>& task) {
+  return task->canceled && task->coalesce_key.empty();
+}
+
+void HttpCgiTaskDispatcher::RespondCanceled(const scoped_refptr<HttpTask>& task,
+                                            const HandlerCallback& handler_callback) {
+  scoped_refptr<HttpResponse> response(new HttpResponse());
+  response->error_code = network::PEC_ABORTED;
+  response->body = new base::RefCountedString();
+  DispatchResponse(task, handler_callback, response);
+}
+
+bool HttpCgiTaskDispatcher::SetMultiplex(int max_streams) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  if (max_streams > 0 && !CurlMulti::SupportsHttp2()) {
+    LOG(WARNING) << "HttpCgiTaskDispatcher curl没有编译HTTP/2支持(nghttp2)，继续使用固定连接池";
+    max_streams = 0;
+  }
+  max_streams_ = max_streams > 0 ? max_streams : 0;
+  curl_multi()->SetMultiplex(max_streams_ > 0);
+  return max_streams_ > 0;
+}
+
+void HttpCgiTaskDispatcher::EnableCache(const base::FilePath& disk_path, size_t memory_capacity) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  http_cache_.reset(new HttpCache(disk_path, memory_capacity));
+}
+
+std::string HttpCgiTaskDispatcher::GetCoalesceKey(const scoped_refptr<HttpTask>& task) {
+  // 只合并幂等并且把完整响应体交给回调的GET
+  if (task->is_post ||
+      task->is_head ||
+      !task->upload_content.empty() ||
+      !task->upload_path.empty() ||
+      !task->download_path.empty() ||
+      task->data_chunk_size > 0) {
+    return std::string();
+  }
+  HTTP_HEADERS headers = task->headers;
+  headers.sort();
+  // 缓存策略不同的请求可能一个用缓存一个走网络，不能合并
+  std::string key = "GET " + task->url + "\n" + base::IntToString(task->cache_policy);
+  for (auto& it : headers) {
+    key += "\n" + it.first + ": " + it.second;
+  }
+  return key;
+}
+
+int HttpCgiTaskDispatcher::DispatchResponse(const scoped_refptr<HttpTask>& task,
+                                            const HandlerCallback& handler_callback,
+                                            const scoped_refptr<HttpResponse>& response) {
+  WAITING_TASKS waiting;
+  if (!task->coalesce_key.empty()) {
+    auto it = inflight_tasks_.find(task->coalesce_key);
+    if (it != inflight_tasks_.end()) {
+      waiting.swap(it->second);
+      inflight_tasks_.erase(it);
+    }
+    task->coalesce_key.clear();
+  }
+  int ret = RunResponse(task, handler_callback, response);
+  // 响应体共享同一份，每个请求在自己的线程里回调
+  for (auto& it : waiting) {
+    RunResponse(it.first, it.second, response);
+  }
+  return ret;
+}
+
+int HttpCgiTaskDispatcher::RunResponse(const scoped_refptr<HttpTask>& task,
+                                       const HandlerCallback& handler_callback,
+                                       const scoped_refptr<HttpResponse>& response) {
+  active_tasks_.erase(task->task_id);
+  ReleaseHostSlot(task);
+  scoped_refptr<HttpResponse> result = response;
+  if (task->canceled && response->error_code != network::PEC_ABORTED) {
+    // 取消之后传输为了合并的请求继续完成，取消的task只收到PEC_ABORTED
+    result = new HttpResponse();
+    result->error_code = network::PEC_ABORTED;
+    result->body = new base::RefCountedString();
+  }
+  if (!handler_callback.is_null()) {
+    return handler_callback.Run(result->error_code, result->headers, result->body->data());
+  }
+  return task->OnResponse(result);
+}
+
+bool HttpCgiTaskDispatcher::IsCacheable(const scoped_refptr<HttpTask>& task) const {
+  // 只缓存完整交付响应体的GET
+  // 缓存按URL查找，带Authorization的响应可能只属于这个用户
+  for (auto& it : task->headers) {
+    if (LowerCaseEqualsASCII(it.first, "authorization")) {
+      return false;
+    }
+  }
+  return http_cache_.get() &&
+         task->cache_policy != HTTP_CACHE_NONE &&
+         !task->is_post &&
+         !task->is_head &&
+         task->upload_content.empty() &&
+         task->upload_path.empty() &&
+         task->download_path.empty() &&
+         task->data_chunk_size == 0;
+}
+
+void HttpCgiTaskDispatcher::OnCacheLookup(const scoped_refptr<HttpTask>& task,
+                                          const HandlerCallback& handler_callback,
+                                          const scoped_refptr<HttpCacheEntry>& entry) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  if (ShouldAbortTask(task)) {
+    RespondCanceled(task, handler_callback);
+    return;
+  }
+  if (entry.get()) {
+    if (task->cache_policy == HTTP_CACHE_PREFER_CACHE ||
+        (task->cache_policy == HTTP_CACHE_DEFAULT && entry->IsFresh())) {
+      RespondFromCache(task, handler_callback, entry);
+      return;
+    }
+    task->cache_entry = entry;
+    HttpCache::AddConditionalHeaders(entry, &task->headers);
+  }
+  ScheduleNetworkTask(task, handler_callback);
+}
+
+void HttpCgiTaskDispatcher::RespondFromCache(const scoped_refptr<HttpTask>& task,
+                                             const HandlerCallback& handler_callback,
+                                             const scoped_refptr<HttpCacheEntry>& entry) {
+  scoped_refptr<HttpResponse> response(new HttpResponse());
+  response->error_code = network::PEC_OK;
+  response->http_code = entry->http_code;
+  response->headers = entry->headers;
+  response->body = entry->body;
+  DispatchResponse(task, handler_callback, response);
+}
+
+void HttpCgiTaskDispatcher::UpdateCache(const scoped_refptr<HttpTask>& task,
+                                        const scoped_refptr<HttpResponse>& response) {
+  if (!IsCacheable(task)) {
+    return;
+  }
+  if (response->http_code == 304 && task->cache_entry.get()) {
+    // 服务器确认缓存仍然有效，用缓存的响应体代替空的304
+    scoped_refptr<HttpCacheEntry> entry = HttpCache::RefreshEntry(task->cache_entry, response->headers);
+    if (!entry.get()) {
+      entry = task->cache_entry;
+      http_cache_->Remove(task->url);
+    } else {
+      http_cache_->Store(entry);
+    }
+    response->http_code = entry->http_code;
+    response->headers = entry->headers;
+    response->body = entry->body;
+  } else if (response->http_code == 200) {
+    scoped_refptr<HttpCacheEntry> entry = HttpCache::CreateEntry(task->url,
+                                                                 response->http_code,
+                                                                 response->headers,
+                                                                 response->body);
+    if (entry.get()) {
+      http_cache_->Store(entry);
+    } else if (task->cache_entry.get()) {
+      http_cache_->Remove(task->url);
+    }
+  }
+  task->cache_entry = NULL;
+}
+
+std::string HttpCgiTaskDispatcher::GetOrigin(const std::string& url) {
+  size_t begin = url.find("://");
+  if (begin == std::string::npos) {
+    return url;
+  }
+  size_t end = url.find_first_of("/?#", begin + 3);
+  return url.substr(0, end);
+}
+
+void HttpCgiTaskDispatcher::ScheduleStream(const scoped_refptr<HttpTask>& task,
+                                           const HandlerCallback& handler_callback) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  task->stream_origin = GetOrigin(task->url);
+  OriginStreams& streams = origin_streams_[task->stream_origin];
+  if (streams.active < max_streams_) {
+    streams.active++;
+    EnqueueStream(task, handler_callback);
+  } else {
+    streams.pending.push_back(base::Bind(&HttpCgiTaskDispatcher::EnqueueStream,
                                          this,
                                          task,
-                                         handler_callback),
-                              1);
-  
+                                         handler_callback));
+    LOG(WARNING) << task->stream_origin << " stream数达到上限，当前排队任务数: " << streams.pending.size();
+  }
 }
 
-void HttpCgiTaskDispatcher::RunTask(const scoped_refptr<HttpTask>& task,
+void HttpCgiTaskDispatcher::EnqueueStream(const scoped_refptr<HttpTask>& task,
+                                          const HandlerCallback& handler_callback) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  if (ShouldAbortTask(task)) {
+    CancelStream(task, handler_callback);
+    return;
+  }
+  // 每个stream也占一个easy handle，和固定槽位的任务一样从连接池取，连接池不会超过max_connections_
+  task->queued_task = ScheduleTasksWithPriority(base::Bind(&HttpCgiTaskDispatcher::RunStream,
+                                                          this,
+                                                          task,
+                                                          handler_callback),
+                                               task->priority,
+                                               base::Bind(&HttpCgiTaskDispatcher::CancelStream,
+                                                          this,
+                                                          task,
+                                                          handler_callback));
+}
+
+void HttpCgiTaskDispatcher::RunStream(const scoped_refptr<HttpTask>& task,
                                       const HandlerCallback& handler_callback) {
   DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-  ConfigTaskAndConnection(task, handler_callback);
+  task->queued_task = NULL;
+  if (ShouldAbortTask(task)) {
+    ReleaseBusyConnection(GetFlaggedConnection());
+    CancelStream(task, handler_callback);
+    return;
+  }
+  ConfigTaskAndConnection(task, GetFlaggedConnection(), handler_callback);
+}
+
+void HttpCgiTaskDispatcher::CancelStream(const scoped_refptr<HttpTask>& task,
+                                         const HandlerCallback& handler_callback) {
+  RespondCanceled(task, handler_callback);
+  // 让出stream名额
+  ReleaseConnection(task, NULL);
+}
+
+void HttpCgiTaskDispatcher::ReleaseConnection(const scoped_refptr<HttpTask>& task,
+                                              CurlConnection* connection) {
+  DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+  ReleaseBusyConnection(connection);
+  if (task->stream_origin.empty()) {
+    return;
+  }
+  auto it = origin_streams_.find(task->stream_origin);
+  if (it == origin_streams_.end()) {
+    return;
+  }
+  OriginStreams& streams = it->second;
+  if (!streams.pending.empty()) {
+    // stream直接交给同一个origin排队的下一个任务
+    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, streams.pending.front());
+    streams.pending.pop_front();
+  } else if (--streams.active <= 0) {
+    origin_streams_.erase(it);
+  }
 }
 
 
 void HttpCgiTaskDispatcher::ConfigTaskAndConnection(const scoped_refptr<HttpTask>& task,
+                                                     CurlConnection* connection,
                                                      const HandlerCallback& handler_callback) {
     DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-    CurlConnection* connection = GetFlaggedConnection() ;
     if (NULL == connection) {
-        LOG(ERROR) << "HttpCgiTaskDispatcher ConfigTaskAndConnection GetFlaggedConnection pConnection is NULL!";
+        LOG(ERROR) << "HttpCgiTaskDispatcher ConfigTaskAndConnection connection is NULL!";
         NOTREACHED();
     }
     if(!connection->Init(true)) {
@@ -78,11 +550,21 @@ void HttpCgiTaskDispatcher::ConfigTaskAndConnection(const scoped_refptr<HttpTask
         connection->SetBufferReadContent(new network::NetWorkFileBuffer(task->upload_path,false,false));
     }
     connection->SetSocketWatcherTimeoutMs(task->socket_watcher_timeout);
-    if(task->download_path.length() > 0){
+    if(task->download_path.length() > 0 && task->download_offset >= 0){
+        connection->SetBufferWriteContent(new network::NetWorkRangeFileBuffer(task->download_path,
+                                                                              task->download_offset,
+                                                                              task->download_limit));
+        connection->SetDownloadRangeStart(task->download_offset);
+    } else if(task->download_path.length() > 0){
         connection->SetBufferWriteContent(new network::NetWorkFileBuffer(task->download_path,false,false));
+    } else if(task->data_chunk_size > 0) {
+        connection->SetDataCallback(base::Bind(&HttpTask::OnData, task), task->data_chunk_size);
     }
     connection->SetPost(task->is_post);
-    connection->SetProgressCallback(base::Bind(&HttpTask::ProgressFeedBack, task));
+    connection->SetNoBody(task->is_head);
+    connection->SetMultiplex(!task->stream_origin.empty());
+    connection->SetProgressCallback(base::Bind(&HttpTask::ReportProgress, task));
+    connection->SetAbortCallback(base::Bind(&HttpCgiTaskDispatcher::ShouldAbortTask, task));
     ConfigCompleteCallback(task, connection, handler_callback);
     AsyncProcess(connection);
 }
@@ -105,22 +587,28 @@ void HttpCgiTaskDispatcher::OnCompleteCallback(
     const HandlerCallback& handler_callback,
     network::ProtocolErrorCode error_code) {
     DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+    task->FlushProgress(connection);
   
     uint64_t req_size = connection->GetBufferRead()->getContentSize() + CalcHttpHeaderBytesSize(connection->GetRequestHttpHeaders());
     uint64_t resp_size = connection->GetBufferWrite()->getCompletedSize() + connection->GetRawHeader().size();
 #ifdef PERFORMTEST
     LOG(WARNING) << "[TrafficLOG] NetType: " << g_net_type << " " << task->TaskName() << " req size: " << req_size << " resp size: " << resp_size;
 #endif
+    RequestTiming timing;
+    connection->GetTiming(&timing);
+    timing.request_bytes = req_size;
+    timing.response_bytes = resp_size;
+    RecordRequestMetrics(connection->Host(), timing);
     if(error_code != PEC_OK) {
-        if (!handler_callback.is_null()) {
-          handler_callback.Run(error_code, HTTP_HEADERS(), "");
-        } else {
-          task->OnResponse(error_code, HTTP_HEADERS(), "", 0);
-        }
-        ReleaseBusyConnection(connection);
+        scoped_refptr<HttpResponse> response(new HttpResponse());
+        response->error_code = error_code;
+        response->body = new base::RefCountedString();
+        response->timing = timing;
+        DispatchResponse(task, handler_callback, response);
+        ReleaseConnection(task, connection);
         return;
     }
-    ParseResponse(task, connection, handler_callback);
+    ParseResponse(task, connection, handler_callback, timing);
 }
 
 void HttpCgiTaskDispatcher::ConfigCompleteCallback(
@@ -134,26 +622,30 @@ void HttpCgiTaskDispatcher::ConfigCompleteCallback(
                                       connection,
                                       handler_callback);
   
-  CreateSocketWatcher(connection, complete_callback);
+  connection->SetCompleteCallback(complete_callback);
 }
 
 int HttpCgiTaskDispatcher::ParseResponse(const scoped_refptr<HttpTask>& task,
                                            CurlConnection* pConnection,
-                                           const HandlerCallback& handler_callback) {
+                                           const HandlerCallback& handler_callback,
+                                           const RequestTiming& timing) {
     DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-    long response_code = pConnection->GetHttpCode();
-    HTTP_HEADERS headers = pConnection->GetHttpHeaders();
-    const std::string& original = pConnection->GetBufferWrite()->getContent();
+    // 响应体从connection的buffer里取走，之后只传递引用
+    scoped_refptr<HttpResponse> response(new HttpResponse());
+    response->timing = timing;
+    response->http_code = pConnection->GetHttpCode();
+    response->headers = pConnection->GetHttpHeaders();
+    response->body = pConnection->TakeResponseContent();
+    UpdateCache(task, response);
+    long response_code = response->http_code;
+    const HTTP_HEADERS& headers = response->headers;
+    const std::string& original = response->body->data();
     int error = 0;
 
     if (response_code >= 200 && response_code < 300) {
         // 让回调去做实际的解析
-        int ret = 0;
-        if (!handler_callback.is_null()) {
-          ret = handler_callback.Run(network::PEC_OK, headers, original);
-        } else {
-          ret = task->OnResponse(network::PEC_OK, headers, original, response_code);
-        }
+        response->error_code = network::PEC_OK;
+        int ret = DispatchResponse(task, handler_callback, response);
 
         if (ret) {
           error = 1;
@@ -168,15 +660,12 @@ int HttpCgiTaskDispatcher::ParseResponse(const scoped_refptr<HttpTask>& task,
         
         LOG(ERROR) << "response is : " << original;
         
-        if (!handler_callback.is_null()) {
-          handler_callback.Run(network::PEC_FAILED_RESPONSE, headers, original);
-        } else {
-          task->OnResponse(network::PEC_FAILED_RESPONSE, headers, original, response_code);
-        }
+        response->error_code = network::PEC_FAILED_RESPONSE;
+        DispatchResponse(task, handler_callback, response);
         error = 4;
     }
     
-    ReleaseBusyConnection(pConnection);
+    ReleaseConnection(task, pConnection);
     return error;
 }
 
@@ -1,8 +1,27 @@
 #pragma once
 
+#include <deque>
+#include "base/time/time.h"
 #include "network/async_task_dispatcher.h"
+#include "network/http_cache.h"
 
 namespace network {
+
+class SegmentedDownload;
+
+// 一次请求的结果，在IO线程生成后只转移引用，不再拷贝响应体
+class HttpResponse : public base::RefCountedThreadSafe<HttpResponse> {
+    public:
+    HttpResponse() : error_code(PEC_OK), http_code(0) {}
+    ProtocolErrorCode error_code;
+    long http_code;
+    HTTP_HEADERS headers;
+    scoped_refptr<base::RefCountedString> body;
+    RequestTiming timing; // 缓存或者取消的响应全为0
+    private:
+    friend class base::RefCountedThreadSafe<HttpResponse>;
+    ~HttpResponse() {}
+};
     
 class HttpTask : public base::RefCountedThreadSafe<HttpTask> {
     public:
@@ -13,15 +32,52 @@ class HttpTask : public base::RefCountedThreadSafe<HttpTask> {
     std::string url;
     HTTP_HEADERS headers;
     bool is_post;
+    bool is_head; // 只要响应头(HEAD)，不合并也不缓存
     //upload_content,upload_path二者选一
     std::string upload_content;
     std::string upload_path;
     std::string download_path;
+    int64 download_offset; // 大于等于0时响应写到download_path的[download_offset, download_limit)，文件需要已经分配好大小
+    int64 download_limit;
     uint32_t socket_watcher_timeout;
+    size_t data_chunk_size; // 大于0时响应体按块交给OnData，不再缓存完整响应，download_path优先
+    std::string stream_origin; // 作为HTTP/2 stream调度时所属的origin，为空表示占用固定连接槽位
+    int cache_policy; // HttpCachePolicy，只对GET生效，dispatcher需要先EnableCache
+    scoped_refptr<HttpCacheEntry> cache_entry; // 正在验证的缓存，收到304时用它响应
+    std::string coalesce_key; // 作为相同GET的第一个请求在传输时不为空，完成后响应同时交给等待的请求
+    int priority; // 没有空闲连接时数值大的先执行，默认1
+    bool canceled;
+    scoped_refptr<NetWorkTask> queued_task; // 在dispatcher队列里排队时不为空
+    std::string host_key; // 占用了这个origin的并发名额时不为空，响应后归还
+    int64 progress_interval_ms; // 两次ProgressFeedBack的最小间隔，小于0时不回调进度，默认100
+    int64 progress_min_bytes;   // 大于0时传输字节数增加这么多也回调，不等间隔
+    /**
+     * @brief curl的每次进度回调，按progress_interval_ms/progress_min_bytes合并后调用ProgressFeedBack
+     */
+    void ReportProgress(network::BaseConnection* connection, int64 dltotal, int64 dlnow, int64 ultotal, int64 ulnow);
+    /**
+     * @brief 传输结束时把被合并掉的最新进度交给ProgressFeedBack
+     */
+    void FlushProgress(network::BaseConnection* connection);
     virtual void ProgressFeedBack(network::BaseConnection* connection, int64 dltotal, int64 dlnow, int64 ultotal, int64 ulnow);
     virtual int OnResponse(network::ProtocolErrorCode error_code,
                            const HTTP_HEADERS& headers,
                            const std::string& resp, long http_code);
+    /**
+     * @brief 没有HandlerCallback时调用，默认转给上面的OnResponse，子类可以直接持有response跨线程传递
+     */
+    virtual int OnResponse(const scoped_refptr<HttpResponse>& response);
+    /**
+     * @brief 在IO线程收到一块响应体，处理完之后需要在IO线程执行consumed，否则传输会被暂停
+     */
+    virtual void OnData(const scoped_refptr<base::RefCountedString>& chunk, const base::Closure& consumed);
+    
+    private:
+    // 只在IO线程读写
+    int64 progress_[4]; // dltotal, dlnow, ultotal, ulnow
+    bool progress_pending_;
+    base::TimeTicks last_progress_time_;
+    int64 last_progress_bytes_;
 };
 
 
@@ -34,11 +90,45 @@ public:
   
   virtual void ScheduleTask(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback = HandlerCallback());
   
+  /**
+   * @brief max_streams大于0时打开HTTP/2多路复用，同一个origin最多max_streams个请求同时作为stream复用连接，超出的按origin排队；
+   *       每个stream占连接池的一个handle，所有origin的stream加起来不超过连接池上限
+   * @return curl没有HTTP/2支持时返回false，继续使用固定连接池
+   */
+  bool SetMultiplex(int max_streams);
+  
+  /**
+   * @brief 打开响应缓存，memory_capacity是内存LRU的字节数，磁盘缓存放在disk_path目录；
+   *        重复调用时替换旧的缓存，正在读旧缓存磁盘的请求仍然会用读到的结果继续
+   */
+  void EnableCache(const base::FilePath& disk_path, size_t memory_capacity);
+  
+  /**
+   * @brief 取消还没有响应的请求，排队的直接移出队列，传输中的通过abort回调中止，task收到PEC_ABORTED
+   * @note 其他相同GET合并在这个请求上时传输继续，只有这个task收到PEC_ABORTED
+   */
+  bool CancelTask(const std::string& task_id);
+  
+  /**
+   * @brief 把task->download_path的下载分成最多max_segments段并行下载，进度保存在download_path.segments，中断后再次下载从断点继续
+   * @note 服务器不支持Range时退化为普通下载；进度通过task的ProgressFeedBack(dltotal, dlnow)，结果通过task的OnResponse
+   */
+  void ScheduleDownload(const scoped_refptr<HttpTask>& task, int max_segments);
+  void OnDownloadFinished(const std::string& task_id);
+  
+  /**
+   * @brief 连接池在[min_connections, max_connections]之间伸缩，同一个origin最多max_host_connections个请求同时占用连接，超出的按origin排队
+   */
+  void SetPoolLimits(int min_connections, int max_connections, int max_host_connections);
+  
 protected:
-  void ConfigTaskAndConnection(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  void ConfigTaskAndConnection(const scoped_refptr<HttpTask>& task,
+                               CurlConnection* connection,
+                               const HandlerCallback& handler_callback);
   int ParseResponse(const scoped_refptr<HttpTask>& task,
                     CurlConnection* pConnection,
-                    const HandlerCallback& handler_callback);
+                    const HandlerCallback& handler_callback,
+                    const RequestTiming& timing);
   
   void RunTask(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
   
@@ -55,6 +145,57 @@ protected:
     const HandlerCallback& handler_callback);
 
   void OnTaskAuthCallback(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+
+  static std::string GetCoalesceKey(const scoped_refptr<HttpTask>& task);
+  /**
+   * @brief 把响应交给task，再交给合并到它上面的请求，返回task的处理结果
+   */
+  int DispatchResponse(const scoped_refptr<HttpTask>& task,
+                       const HandlerCallback& handler_callback,
+                       const scoped_refptr<HttpResponse>& response);
+  int RunResponse(const scoped_refptr<HttpTask>& task,
+                  const HandlerCallback& handler_callback,
+                  const scoped_refptr<HttpResponse>& response);
+  void RespondCanceled(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  static bool ShouldAbortTask(const scoped_refptr<HttpTask>& task);
+  bool IsCacheable(const scoped_refptr<HttpTask>& task) const;
+  void OnCacheLookup(const scoped_refptr<HttpTask>& task,
+                     const HandlerCallback& handler_callback,
+                     const scoped_refptr<HttpCacheEntry>& entry);
+  void RespondFromCache(const scoped_refptr<HttpTask>& task,
+                        const HandlerCallback& handler_callback,
+                        const scoped_refptr<HttpCacheEntry>& entry);
+  void UpdateCache(const scoped_refptr<HttpTask>& task, const scoped_refptr<HttpResponse>& response);
+  void ScheduleNetworkTask(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  void EnqueueTask(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  void ReleaseHostSlot(const scoped_refptr<HttpTask>& task);
+  void ScheduleStream(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  void EnqueueStream(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  void RunStream(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  void CancelStream(const scoped_refptr<HttpTask>& task, const HandlerCallback& handler_callback);
+  void ReleaseConnection(const scoped_refptr<HttpTask>& task, CurlConnection* connection);
+  static std::string GetOrigin(const std::string& url);
+
+  typedef std::vector<std::pair<scoped_refptr<HttpTask>, HandlerCallback> > WAITING_TASKS;
+
+  struct OriginStreams {
+    OriginStreams() : active(0) {}
+    int active;
+    std::deque<base::Closure> pending;
+  };
+  int max_streams_; // 每个origin同时进行的stream数，0表示不使用多路复用
+  std::map<std::string, OriginStreams> origin_streams_;
+  struct HostTasks {
+    HostTasks() : active(0) {}
+    int active;
+    WAITING_TASKS pending;
+  };
+  int max_host_tasks_; // 不使用多路复用时每个origin同时占用连接的请求数
+  std::map<std::string, HostTasks> host_tasks_;
+  scoped_ptr<HttpCache> http_cache_;
+  std::map<std::string, WAITING_TASKS> inflight_tasks_; // coalesce_key -> 等待同一个传输的请求
+  std::map<std::string, scoped_refptr<HttpTask> > active_tasks_; // task_id -> 还没有响应的请求
+  std::map<std::string, scoped_refptr<SegmentedDownload> > downloads_; // task_id -> 进行中的分段下载
 };
 
 }
@@ -0,0 +1,174 @@
+#include "async_server_socket.h"
+#include "base/bind.h"
+#include "base/posix/eintr_wrapper.h"
+#include "net/net_errors.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace net {
+
+// 一次可读事件里最多accept的连接数，避免一直占着监听线程
+const static int MAX_ACCEPTS_PER_EVENT = 64;
+// 文件描述符用完后暂停accept的时间，监听socket一直可读，不暂停会空转
+const static int ACCEPT_RETRY_DELAY_MS = 200;
+
+// 在目标线程上创建AsyncSocket，线程不是IO类型时关掉连接
+static void AcceptOnThread(int fd, const sockaddr_data& peer, const AsyncServerSocket::AcceptCallback& callback) {
+    if (base::MessageLoop::current()->type() != base::MessageLoop::TYPE_IO) {
+        LOG(ERROR) << "AsyncServerSocket accept thread is not an IO thread";
+        ::close(fd);
+        return;
+    }
+    callback.Run(new AsyncSocket(fd, peer), peer);
+}
+
+AsyncServerSocket::AsyncServerSocket()
+    : socket_fd_(-1), next_thread_(0) {
+}
+
+AsyncServerSocket::~AsyncServerSocket() {
+    close();
+}
+
+int AsyncServerSocket::listen(const std::string& host, uint16_t port, int backlog) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    DCHECK(socket_fd_ < 0);
+
+    sockaddr_data address;
+    if (host.empty()) {
+        address = AsyncSocket::IPV6toSockaddr("::", port);
+    } else if (host.find(':') != std::string::npos) {
+        address = AsyncSocket::IPV6toSockaddr(host, port);
+    } else {
+        address = AsyncSocket::IPV4toSockaddr(host, port);
+    }
+    const sockaddr* addr = (const sockaddr*)address.data();
+    socket_fd_ = socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (socket_fd_ < 0) {
+        PLOG(ERROR) << "AsyncServerSocket create socket failed";
+        return MapSystemError(errno);
+    }
+    int on = 1;
+    setsockopt(socket_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (host.empty()) {
+        // 同时监听IPv4
+        int off = 0;
+        setsockopt(socket_fd_, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    }
+    int flags = fcntl(socket_fd_, F_GETFL, 0);
+    if (flags == -1 || fcntl(socket_fd_, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        bind(socket_fd_, addr, (socklen_t)address.size()) != 0 ||
+        ::listen(socket_fd_, backlog) != 0) {
+        int ret = MapSystemError(errno);
+        PLOG(ERROR) << "AsyncServerSocket listen on " << host << ":" << port << " failed";
+        ::close(socket_fd_);
+        socket_fd_ = -1;
+        return ret;
+    }
+    return OK;
+}
+
+void AsyncServerSocket::setAcceptThreads(const std::vector<BusinessThreadID>& threads) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    accept_threads_ = threads;
+    next_thread_ = 0;
+}
+
+int AsyncServerSocket::startAccepting(const AcceptCallback& callback) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    if (socket_fd_ < 0) {
+        return ERR_SOCKET_NOT_CONNECTED;
+    }
+    accept_callback_ = callback;
+    accept_retry_timer_.Stop();
+    if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
+            socket_fd_, true, base::MessageLoopForIO::WATCH_READ,
+            &accept_socket_watcher_, this)) {
+        PLOG(ERROR) << "WatchFileDescriptor failed on accept, errno " << errno;
+        return MapSystemError(errno);
+    }
+    return OK;
+}
+
+void AsyncServerSocket::close() {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    accept_socket_watcher_.StopWatchingFileDescriptor();
+    accept_retry_timer_.Stop();
+    if (socket_fd_ >= 0) {
+        ::close(socket_fd_);
+        socket_fd_ = -1;
+    }
+    accept_callback_.Reset();
+}
+
+uint16_t AsyncServerSocket::localPort() const {
+    struct sockaddr_storage storage;
+    socklen_t len = sizeof(storage);
+    if (socket_fd_ < 0 || getsockname(socket_fd_, (sockaddr*)&storage, &len) != 0) {
+        return 0;
+    }
+    if (storage.ss_family == AF_INET6) {
+        return ntohs(((sockaddr_in6*)&storage)->sin6_port);
+    }
+    return ntohs(((sockaddr_in*)&storage)->sin_port);
+}
+
+void AsyncServerSocket::OnFileCanReadWithoutBlocking(int fd) {
+    for (int i = 0; i < MAX_ACCEPTS_PER_EVENT && socket_fd_ >= 0; i++) {
+        struct sockaddr_storage storage;
+        socklen_t len = sizeof(storage);
+        int new_fd = HANDLE_EINTR(accept(socket_fd_, (sockaddr*)&storage, &len));
+        if (new_fd < 0) {
+            // 客户端在accept前断开，接着accept下一个
+            if (errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                PLOG(ERROR) << "AsyncServerSocket accept failed, retry in " << ACCEPT_RETRY_DELAY_MS << "ms";
+                accept_socket_watcher_.StopWatchingFileDescriptor();
+                accept_retry_timer_.Start(FROM_HERE, base::TimeDelta::FromMilliseconds(ACCEPT_RETRY_DELAY_MS),
+                                          this, &AsyncServerSocket::resumeAccepting);
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                PLOG(ERROR) << "AsyncServerSocket accept failed";
+            }
+            return;
+        }
+        dispatch(new_fd, sockaddr_data((const char*)&storage, len));
+    }
+}
+
+void AsyncServerSocket::resumeAccepting() {
+    if (socket_fd_ < 0 || accept_callback_.is_null()) {
+        return;
+    }
+    if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
+            socket_fd_, true, base::MessageLoopForIO::WATCH_READ,
+            &accept_socket_watcher_, this)) {
+        PLOG(ERROR) << "WatchFileDescriptor failed on accept, errno " << errno;
+    }
+}
+
+void AsyncServerSocket::OnFileCanWriteWithoutBlocking(int fd) {
+    NOTREACHED();
+}
+
+void AsyncServerSocket::dispatch(int fd, const sockaddr_data& peer) {
+    if (accept_threads_.empty()) {
+        AcceptOnThread(fd, peer, accept_callback_);
+        return;
+    }
+    BusinessThreadID thread = accept_threads_[next_thread_];
+    next_thread_ = (next_thread_ + 1) % accept_threads_.size();
+    if (!BusinessThread::PostTask(thread, FROM_HERE, base::Bind(&AcceptOnThread, fd, peer, accept_callback_))) {
+        LOG(ERROR) << "AsyncServerSocket accept thread " << thread << " not found";
+        ::close(fd);
+    }
+}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "base/callback.h"
+#include "base/memory/weak_ptr.h"
+#include "base/message_loop/message_loop.h"
+#include "base/threading/thread_checker.h"
+#include "base/timer/timer.h"
+#include "common/business_client_thread.h"
+#include "network/async_socket.h"
+
+namespace net {
+
+/**
+ * @brief 非阻塞的监听socket，在当前IO线程的MessageLoopForIO上accept
+ * @note 每次可读时最多连续accept MAX_ACCEPTS_PER_EVENT个连接，接受的连接按顺序轮流交给setAcceptThreads设置的线程，
+ *       在那个线程上创建AsyncSocket并调用AcceptCallback；目标线程必须是IO类型。
+ *       文件描述符用完时暂停监听，过一会儿再继续accept，不会一直被可读事件唤醒
+ */
+class AsyncServerSocket : public base::MessagePumpLibevent::Watcher {
+public:
+    // 在目标线程上调用，socket归callback所有，peer是对端地址
+    typedef base::Callback<void(AsyncSocket* socket, const sockaddr_data& peer)> AcceptCallback;
+
+    AsyncServerSocket();
+    ~AsyncServerSocket();
+
+    // host为空时监听所有地址，port为0时由系统分配，用localPort取；返回net错误码
+    int listen(const std::string& host, uint16_t port, int backlog);
+    // 为空时在监听的线程上处理连接
+    void setAcceptThreads(const std::vector<BusinessThreadID>& threads);
+    int startAccepting(const AcceptCallback& callback);
+    void close();
+    uint16_t localPort() const;
+
+    virtual void OnFileCanReadWithoutBlocking(int fd);
+    virtual void OnFileCanWriteWithoutBlocking(int fd);
+
+private:
+    void dispatch(int fd, const sockaddr_data& peer);
+    void resumeAccepting();
+
+    int socket_fd_;
+    std::vector<BusinessThreadID> accept_threads_;
+    size_t next_thread_;
+    AcceptCallback accept_callback_;
+    base::MessageLoopForIO::FileDescriptorWatcher accept_socket_watcher_;
+    base::OneShotTimer<AsyncServerSocket> accept_retry_timer_;
+    base::ThreadChecker thread_checker_;
+
+    DISALLOW_COPY_AND_ASSIGN(AsyncServerSocket);
+};
+}
@@ -11,6 +11,7 @@
 #include <netdb.h>
 #include <errno.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
 #if defined(OS_ANDROID)
 #include <asm/fcntl.h>
 #endif
@@ -116,37 +117,63 @@ int MapConnectError(int os_error) {
     }
 }
 
-size_t WriteWrapper(int fd, const void * buf, size_t size) {
+// 把多段数据一次发出去，Android上没有SO_NOSIGPIPE，用MSG_NOSIGNAL避免对端关闭时SIGPIPE
+ssize_t SendmsgWrapper(int fd, struct iovec* iov, int iovcnt) {
 #if defined(OS_ANDROID)
   int flags = MSG_NOSIGNAL;
 #else
   int flags = 0;
 #endif
 
-  return ::send(fd, buf, size, flags);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  return ::sendmsg(fd, &msg, flags);
 }
 
 const std::string AsyncSocket::UseDefaultResolver = "default";
 
+// RFC 8305建议的Connection Attempt Delay
+const static int64 CONNECTION_ATTEMPT_DELAY_MS = 250;
+// 一次sendmsg最多带的数据段
+const static int MAX_WRITE_IOVECS = 64;
+const static size_t DEFAULT_WRITE_HIGH_WATER_MARK = 1024 * 1024;
+
 //
 // class AsyncSocket
 //
 AsyncSocket::AsyncSocket(const sockaddr* addr, const socklen_t addrlen)
     : socket_fd_(-1), hostaddr_((const char*)addr, addrlen),
-      connect_state_(CONNECT_STATE_NONE), weak_factory_(this) {
+      connect_state_(CONNECT_STATE_NONE), last_connect_error_(OK), weak_factory_(this),
+      write_queue_bytes_(0), write_high_water_mark_(DEFAULT_WRITE_HIGH_WATER_MARK),
+      write_queue_full_(false), write_flush_scheduled_(false), write_watching_(false),
+      resolving_(false), is_dns_resolver_callback_sync_(false) {
     
 }
 
+AsyncSocket::AsyncSocket(int connected_fd, const sockaddr_data& peer)
+    : socket_fd_(connected_fd), hostaddr_(peer),
+      connect_state_(CONNECT_STATE_CONNECT_COMPLETE), last_connect_error_(OK), weak_factory_(this),
+      write_queue_bytes_(0), write_high_water_mark_(DEFAULT_WRITE_HIGH_WATER_MARK),
+      write_queue_full_(false), write_flush_scheduled_(false), write_watching_(false),
+      resolving_(false), is_dns_resolver_callback_sync_(false) {
+    SetNonBlocking(socket_fd_);
+    SetTCPNoDelay(socket_fd_, true);
+    SetTCPNoSigPipe(socket_fd_);
+}
+
 AsyncSocket::AsyncSocket(const std::string& hostname, const uint16_t port, const DnsResolverCallback& dns_resolver_callback, bool is_dns_resolver_callback_sync)
     : socket_fd_(-1), hostname_(hostname), port_(port),
-      connect_state_(CONNECT_STATE_NONE), weak_factory_(this),
-      dns_resolver_callback_(dns_resolver_callback), is_dns_resolver_callback_sync_(is_dns_resolver_callback_sync) {
+      connect_state_(CONNECT_STATE_NONE), last_connect_error_(OK), weak_factory_(this),
+      write_queue_bytes_(0), write_high_water_mark_(DEFAULT_WRITE_HIGH_WATER_MARK),
+      write_queue_full_(false), write_flush_scheduled_(false), write_watching_(false),
+      resolving_(false), dns_resolver_callback_(dns_resolver_callback), is_dns_resolver_callback_sync_(is_dns_resolver_callback_sync) {
     
 }
 
 AsyncSocket::~AsyncSocket() {
-    // dnsthread要先析构，因为dnsthread会在后台线程使用this的成员
-    dns_thread_.reset();
+    closeConnectAttempts();
     if (socket_fd_ > 0) {
         disconnect();
     }
@@ -165,14 +192,50 @@ int AsyncSocket::connect(const CompletionCallback& callback, const BeforeConnect
         if (ret != 0) return ERR_IO_PENDING;
     }
     
+    if (sockaddrs_.empty() && !hostaddr_.empty()) {
+        sockaddrs_.push_back(hostaddr_);
+    }
+    sockaddrs_ = interleaveAddressFamilies(sockaddrs_);
+    last_connect_error_ = ERR_ADDRESS_INVALID;
+    
+    int ret = startConnectAttempt();
+    if (ret != ERR_IO_PENDING) {
+        finishConnect(ret);
+    }
+    return ret;
+}
+
+// RFC 8305: 地址按协议族交替排列，第一个地址的协议族优先
+std::vector<sockaddr_data> AsyncSocket::interleaveAddressFamilies(const std::vector<sockaddr_data>& addrs) {
+    if (addrs.size() < 2) {
+        return addrs;
+    }
+    sa_family_t preferred = ((const sockaddr*)addrs[0].data())->sa_family;
+    std::vector<sockaddr_data> preferred_addrs, other_addrs, results;
+    for (auto& addr : addrs) {
+        if (((const sockaddr*)addr.data())->sa_family == preferred) {
+            preferred_addrs.push_back(addr);
+        } else {
+            other_addrs.push_back(addr);
+        }
+    }
+    for (size_t i = 0; i < preferred_addrs.size() || i < other_addrs.size(); i++) {
+        if (i < preferred_addrs.size()) results.push_back(preferred_addrs[i]);
+        if (i < other_addrs.size()) results.push_back(other_addrs[i]);
+    }
+    return results;
+}
+
+// 发起下一个地址的连接，返回OK表示已经连上，ERR_IO_PENDING表示有连接在进行，其他值表示所有地址都失败了
+int AsyncSocket::startConnectAttempt() {
     while (!sockaddrs_.empty()) {
-        hostaddr_ = sockaddrs_.front();
+        sockaddr_data addr = sockaddrs_.front();
         sockaddrs_.erase(sockaddrs_.begin());
         
-        struct sockaddr_storage *addr = (struct sockaddr_storage *)hostaddr_.data();
-        LOG(WARNING) << "AsyncSocket connect IP: " << Sockaddr2IP((const sockaddr*)addr);
-        socket_fd_ = socket(addr->ss_family, SOCK_STREAM, IPPROTO_TCP);
-        if (socket_fd_ < 0) {
+        struct sockaddr_storage *storage = (struct sockaddr_storage *)addr.data();
+        LOG(WARNING) << "AsyncSocket connect IP: " << Sockaddr2IP((const sockaddr*)storage);
+        int fd = socket(storage->ss_family, SOCK_STREAM, IPPROTO_TCP);
+        if (fd < 0) {
             switch errno {
             case EAFNOSUPPORT:
                 LOG(ERROR) << "AsyncSocket create socket encounter EAFNOSUPPORT";
@@ -190,38 +253,127 @@ int AsyncSocket::connect(const CompletionCallback& callback, const BeforeConnect
                 LOG(ERROR) << "AsyncSocket create socket returned an error, errno=" << errno;
                 break;
             }
-        } else {
-            break;
+            continue;
+        }
+        
+        SetNonBlocking(fd);
+        SetTCPNoDelay(fd, true);
+        SetTCPKeepAlive(fd, true, 900);
+        SetTCPNoSigPipe(fd);
+        
+        if (!before_connect_callback_.is_null()) {
+            base::ResetAndReturn(&before_connect_callback_).Run(true);
+        }
+        int rv = ::connect(fd, (sockaddr *)addr.data(), (socklen_t)addr.length());
+        int ret = rv == 0 ? OK : MapConnectError(errno);
+        if (ret == OK) {
+            closeConnectAttempts();
+            socket_fd_ = fd;
+            hostaddr_ = addr;
+            return OK;
+        }
+        if (ret != ERR_IO_PENDING) {
+            close(fd);
+            last_connect_error_ = ret;
+            continue;
         }
+        
+        connect_attempts_.push_back(ConnectAttempt());
+        ConnectAttempt& attempt = connect_attempts_.back();
+        attempt.fd = fd;
+        attempt.addr = addr;
+        if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
+                fd, true, base::MessageLoopForIO::WATCH_WRITE,
+                attempt.watcher.get(), this)) {
+            PLOG(ERROR) << "WatchFileDescriptor failed on connect, errno " << errno;
+            close(fd);
+            connect_attempts_.pop_back();
+            last_connect_error_ = MapSystemError(errno);
+            continue;
+        }
+        // 一段时间内没有连上就同时尝试下一个地址
+        if (!sockaddrs_.empty()) {
+            connect_attempt_timer_.Start(FROM_HERE,
+                                         base::TimeDelta::FromMilliseconds(CONNECTION_ATTEMPT_DELAY_MS),
+                                         this, &AsyncSocket::onConnectAttemptDelay);
+        }
+        return ERR_IO_PENDING;
     }
     
-    if (socket_fd_ < 0) {
-        if (!beforeConnectCallback.is_null()) beforeConnectCallback.Run(false);
-        if (!callback.is_null()) callback.Run(ERR_ADDRESS_INVALID);
-        return socket_fd_;
+    if (!connect_attempts_.empty()) {
+        return ERR_IO_PENDING;
+    }
+    if (!before_connect_callback_.is_null()) {
+        base::ResetAndReturn(&before_connect_callback_).Run(false);
+    }
+    return last_connect_error_;
+}
+
+void AsyncSocket::onConnectAttemptDelay() {
+    int ret = startConnectAttempt();
+    if (ret != ERR_IO_PENDING) {
+        finishConnect(ret);
+    }
+}
+
+void AsyncSocket::onConnectAttemptWritable(int fd) {
+    auto attempt = connect_attempts_.begin();
+    while (attempt != connect_attempts_.end() && attempt->fd != fd) {
+        ++attempt;
+    }
+    if (attempt == connect_attempts_.end()) {
+        return;
     }
     
-    SetNonBlocking(socket_fd_);
-    SetTCPNoDelay(socket_fd_, true);
-    SetTCPKeepAlive(socket_fd_, true, 900);
-    SetTCPNoSigPipe(socket_fd_);
+    // Get the error that connect() completed with.
+    int os_error = 0;
+    socklen_t len = sizeof(os_error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &os_error, &len) == 0) {
+        // TCPSocketLibevent expects errno to be set.
+        errno = os_error;
+    }
+    int ret = MapConnectError(errno);
+    if (ret == ERR_IO_PENDING)
+        return;
     
-    if (!beforeConnectCallback.is_null()) beforeConnectCallback.Run(true);
-    int rv = ::connect(socket_fd_, (sockaddr *)hostaddr_.data(), (socklen_t)hostaddr_.length());
-    int ret = rv == 0 ? OK : MapConnectError(errno);
+    if (ret == OK) {
+        // 留下第一个连上的，其余的取消
+        socket_fd_ = attempt->fd;
+        hostaddr_ = attempt->addr;
+        attempt->fd = -1;
+        closeConnectAttempts();
+        finishConnect(OK);
+        return;
+    }
     
+    LOG(WARNING) << "AsyncSocket connect IP: " << Sockaddr2IP((const sockaddr*)attempt->addr.data()) << " failed: " << ret;
+    last_connect_error_ = ret;
+    close(attempt->fd);
+    connect_attempts_.erase(attempt);
+    // 失败后马上尝试下一个地址，不等定时器
+    connect_attempt_timer_.Stop();
+    ret = startConnectAttempt();
     if (ret != ERR_IO_PENDING) {
-        callback.Run(ret);
-        return ret;
+        finishConnect(ret);
     }
-    
-    if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
-            socket_fd_, true, base::MessageLoopForIO::WATCH_WRITE,
-            &write_socket_watcher_, this)) {
-        PLOG(ERROR) << "WatchFileDescriptor failed on connect, errno " << errno;
-        return errno;
+}
+
+void AsyncSocket::closeConnectAttempts() {
+    connect_attempt_timer_.Stop();
+    for (auto& attempt : connect_attempts_) {
+        attempt.watcher->StopWatchingFileDescriptor();
+        if (attempt.fd >= 0) {
+            close(attempt.fd);
+        }
+    }
+    connect_attempts_.clear();
+}
+
+void AsyncSocket::finishConnect(int result) {
+    connect_state_ = result == OK ? CONNECT_STATE_CONNECT_COMPLETE : CONNECT_STATE_NONE;
+    if (!write_callback_.is_null()) {
+        base::ResetAndReturn(&write_callback_).Run(result);
     }
-    return ret;
 }
 
 int AsyncSocket::resolveHostBeforeConnect() {
@@ -244,42 +396,16 @@ int AsyncSocket::resolveHostBeforeConnect() {
             return ERR_NAME_NOT_RESOLVED;
         }
     }
-    // Default route
-    auto current_loop = base::MessageLoopProxy::current();
-    std::string hostname = hostname_;
-    uint16_t port = port_;
-    dns_thread_.reset(new base::Thread("AsyncSocketDNSThread"));
-    dns_thread_->Start();
-    dns_thread_->message_loop()->PostTask(FROM_HERE, base::BindLambda([=](base::WeakPtr<AsyncSocket> weak_this){
-        auto callback = fallback_to_default ? DefaultDnsResolver() : dns_resolver_callback_;
-        std::vector<sockaddr_data> results = callback.Run(hostname, port);
-        if (!fallback_to_default && results.size() == 1 && results[0] == UseDefaultResolver) {
-            results = DefaultDnsResolver().Run(hostname, port);
-        }
-        if (!results.empty()) {
-            current_loop->PostTask(FROM_HERE, base::BindLambda(weak_this, [=](){
-                dns_thread_->StopSoon();
-                dns_thread_.reset();
-                sockaddrs_ = results;
-                hostname_ = "";
-                connect_state_ = CONNECT_STATE_NONE;
-                connect(write_callback_, before_connect_callback_);
-            }));
-        } else {
-            current_loop->PostTask(FROM_HERE, base::BindLambda(weak_this, [=](){
-                dns_thread_->StopSoon();
-                dns_thread_.reset();
-                connect_state_ = CONNECT_STATE_NONE;
-                if (!before_connect_callback_.is_null()) {
-                    before_connect_callback_.Run(true);
-                    before_connect_callback_.Reset();
-                }
-                write_callback_.Run(ERR_NAME_RESOLUTION_FAILED);
-            }));
-        }
-    }, weak_factory_.GetWeakPtr()));
-    current_loop->PostDelayedTask(FROM_HERE, base::BindLambda([=](base::WeakPtr<AsyncSocket> weak_this){
-        if (weak_this && dns_thread_) {
+    // 在共用的线程池里解析，同一个域名的并发解析会合并，结果有缓存
+    resolving_ = true;
+    DnsResolver::ResolveCallback callback = base::Bind(&AsyncSocket::onHostResolved, weak_factory_.GetWeakPtr());
+    if (fallback_to_default) {
+        DnsResolver::GetInstance()->Resolve(hostname_, port_, callback);
+    } else {
+        DnsResolver::GetInstance()->RunResolver(dns_resolver_callback_, hostname_, port_, callback);
+    }
+    base::MessageLoopProxy::current()->PostDelayedTask(FROM_HERE, base::BindLambda([=](base::WeakPtr<AsyncSocket> weak_this){
+        if (weak_this && resolving_) {
             if (!before_connect_callback_.is_null()) {
                 before_connect_callback_.Run(true);
                 before_connect_callback_.Reset();
@@ -289,6 +415,23 @@ int AsyncSocket::resolveHostBeforeConnect() {
     return ERR_IO_PENDING;
 }
 
+void AsyncSocket::onHostResolved(const std::vector<sockaddr_data>& results) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    resolving_ = false;
+    connect_state_ = CONNECT_STATE_NONE;
+    if (!results.empty()) {
+        sockaddrs_ = results;
+        hostname_ = "";
+        connect(write_callback_, before_connect_callback_);
+    } else {
+        if (!before_connect_callback_.is_null()) {
+            before_connect_callback_.Run(true);
+            before_connect_callback_.Reset();
+        }
+        write_callback_.Run(ERR_NAME_RESOLUTION_FAILED);
+    }
+}
+
 int AsyncSocket::read(IOBuffer* buf, size_t buf_len, const CompletionCallback& callback) {
     DCHECK(thread_checker_.CalledOnValidThread());
     CHECK(read_callback_.is_null());
@@ -323,39 +466,164 @@ int AsyncSocket::read(IOBuffer* buf, size_t buf_len, const CompletionCallback& c
 
 int AsyncSocket::write(IOBuffer* buf, size_t buf_len, const CompletionCallback& callback) {
     DCHECK(thread_checker_.CalledOnValidThread());
-    DCHECK(connect_state_ == CONNECT_STATE_CONNECT_COMPLETE);
-    CHECK(write_callback_.is_null());
-    // Synchronous operation not supported
-    DCHECK(!callback.is_null());
-    DCHECK_LT(0, buf_len);
     
-    ssize_t rv = WriteWrapper(socket_fd_, buf->data(), buf_len);
-    int ret = rv >= 0 ? (int)rv : MapSystemError(errno);
-    if (ret != 0 && ret != ERR_IO_PENDING) {
-        callback.Run(ret);
-        return ret;
+    if (connect_state_ != CONNECT_STATE_CONNECT_COMPLETE) {
+        return ERR_SOCKET_NOT_CONNECTED;
+    }
+    if (buf_len == 0) {
+        return 0;
     }
     
-    if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
-        socket_fd_, true, base::MessageLoopForIO::WATCH_WRITE,
-        &write_socket_watcher_, this)) {
-        PLOG(ERROR) << "WatchFileDescriptor failed on write, errno " << errno;
-        return errno;
+    PendingWrite pending;
+    pending.buf = buf;
+    pending.len = buf_len;
+    pending.offset = 0;
+    pending.callback = callback;
+    write_queue_.push_back(pending);
+    write_queue_bytes_ += buf_len;
+    if (write_queue_bytes_ >= write_high_water_mark_) {
+        write_queue_full_ = true;
     }
     
-    write_buf_ = buf;
-    write_buf_len_ = buf_len;
-    write_callback_ = callback;
+    // 等socket可写时会一起发，否则等当前任务里的写都排进来后再发
+    if (!write_watching_ && !write_flush_scheduled_) {
+        write_flush_scheduled_ = true;
+        base::MessageLoop::current()->PostTask(FROM_HERE, base::Bind(&AsyncSocket::flushWriteQueue, weak_factory_.GetWeakPtr()));
+    }
     return ERR_IO_PENDING;
 }
 
+void AsyncSocket::setWriteHighWaterMark(size_t bytes) {
+    write_high_water_mark_ = bytes;
+}
+
+void AsyncSocket::setWriteDrainCallback(const base::Closure& drain_callback) {
+    write_drain_callback_ = drain_callback;
+}
+
+bool AsyncSocket::isWriteQueueFull() const {
+    return write_queue_full_;
+}
+
+size_t AsyncSocket::pendingWriteBytes() const {
+    return write_queue_bytes_;
+}
+
+void AsyncSocket::flushWriteQueue() {
+    write_flush_scheduled_ = false;
+    if (connect_state_ != CONNECT_STATE_CONNECT_COMPLETE) {
+        return;
+    }
+    
+    std::vector<base::Closure> completed;
+    bool blocked = false;
+    while (!write_queue_.empty()) {
+        struct iovec iov[MAX_WRITE_IOVECS];
+        int iovcnt = 0;
+        size_t total = 0;
+        for (auto it = write_queue_.begin(); it != write_queue_.end() && iovcnt < MAX_WRITE_IOVECS; ++it, ++iovcnt) {
+            iov[iovcnt].iov_base = it->buf->data() + it->offset;
+            iov[iovcnt].iov_len = it->len - it->offset;
+            total += iov[iovcnt].iov_len;
+        }
+        
+        ssize_t rv = SendmsgWrapper(socket_fd_, iov, iovcnt);
+        if (rv < 0) {
+            int ret = MapSystemError(errno);
+            if (ret != ERR_IO_PENDING) {
+                failWriteQueue(ret);
+                return;
+            }
+            blocked = true;
+            break;
+        }
+        
+        size_t written = (size_t)rv;
+        write_queue_bytes_ -= written;
+        while (written > 0) {
+            PendingWrite& front = write_queue_.front();
+            size_t remaining = front.len - front.offset;
+            if (written < remaining) {
+                front.offset += written;
+                break;
+            }
+            written -= remaining;
+            if (!front.callback.is_null()) {
+                completed.push_back(base::Bind(front.callback, (int)front.len));
+            }
+            write_queue_.pop_front();
+        }
+        if ((size_t)rv < total) {
+            // 内核缓冲满了
+            blocked = true;
+            break;
+        }
+    }
+    
+    if (blocked && !write_watching_) {
+        if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
+                socket_fd_, true, base::MessageLoopForIO::WATCH_WRITE,
+                &write_socket_watcher_, this)) {
+            PLOG(ERROR) << "WatchFileDescriptor failed on write, errno " << errno;
+            failWriteQueue(MapSystemError(errno));
+            return;
+        }
+        write_watching_ = true;
+    } else if (!blocked && write_watching_) {
+        write_socket_watcher_.StopWatchingFileDescriptor();
+        write_watching_ = false;
+    }
+    
+    bool drained = false;
+    if (write_queue_full_ && write_queue_bytes_ <= write_high_water_mark_ / 2) {
+        write_queue_full_ = false;
+        drained = true;
+    }
+    
+    // 回调里可能再写或者断开连接
+    base::WeakPtr<AsyncSocket> weak_this = weak_factory_.GetWeakPtr();
+    for (auto& callback : completed) {
+        callback.Run();
+        if (!weak_this) {
+            return;
+        }
+    }
+    if (drained && !write_drain_callback_.is_null()) {
+        write_drain_callback_.Run();
+    }
+}
+
+void AsyncSocket::failWriteQueue(int error) {
+    std::deque<PendingWrite> failed;
+    failed.swap(write_queue_);
+    write_queue_bytes_ = 0;
+    write_queue_full_ = false;
+    if (write_watching_) {
+        write_socket_watcher_.StopWatchingFileDescriptor();
+        write_watching_ = false;
+    }
+    base::WeakPtr<AsyncSocket> weak_this = weak_factory_.GetWeakPtr();
+    for (auto& pending : failed) {
+        if (!pending.callback.is_null()) {
+            pending.callback.Run(error);
+            if (!weak_this) {
+                return;
+            }
+        }
+    }
+}
+
 void AsyncSocket::disconnect() {
     DCHECK(thread_checker_.CalledOnValidThread());
     
     stopWatchingAndCleanUp();
-    close(socket_fd_);
+    closeConnectAttempts();
+    if (socket_fd_ >= 0)
+        close(socket_fd_);
     socket_fd_ = -1;
     connect_state_ = CONNECT_STATE_NONE;
+    // fd关闭之后再回调，回调里再写会直接失败，等写完成的协程也能恢复
+    failWriteQueue(ERR_CONNECTION_CLOSED);
 }
 
 bool AsyncSocket::isConnected() const {
@@ -395,40 +663,11 @@ void AsyncSocket::OnFileCanReadWithoutBlocking(int fd) {
 }
 
 void AsyncSocket::OnFileCanWriteWithoutBlocking(int fd) {
-    DCHECK(!write_callback_.is_null());
-    
     if (connect_state_ == CONNECT_STATE_CONNECT) {
-        // Get the error that connect() completed with.
-        int os_error = 0;
-        socklen_t len = sizeof(os_error);
-        if (getsockopt(socket_fd_, SOL_SOCKET, SO_ERROR, &os_error, &len) == 0) {
-            // TCPSocketLibevent expects errno to be set.
-            errno = os_error;
-        }
-        
-        int ret = MapConnectError(errno);
-        if (ret == ERR_IO_PENDING)
-            return;
-
-        bool ok = write_socket_watcher_.StopWatchingFileDescriptor();
-        DCHECK(ok);
-        if (ret == OK) {
-            connect_state_ = CONNECT_STATE_CONNECT_COMPLETE;
-        } else {
-            connect_state_ = CONNECT_STATE_NONE;
-        }
-        base::ResetAndReturn(&write_callback_).Run(ret);
+        DCHECK(!write_callback_.is_null());
+        onConnectAttemptWritable(fd);
     } else {
-        ssize_t rv = WriteWrapper(socket_fd_, write_buf_->data(), write_buf_len_);
-        int ret = rv >= 0 ? (int)rv : MapSystemError(errno);
-        if (ret == ERR_IO_PENDING)
-            return;
-        
-        bool ok = write_socket_watcher_.StopWatchingFileDescriptor();
-        DCHECK(ok);
-        write_buf_ = NULL;
-        write_buf_len_ = 0;
-        base::ResetAndReturn(&write_callback_).Run(ret);
+        flushWriteQueue();
     }
 }
 
@@ -444,11 +683,10 @@ void AsyncSocket::stopWatchingAndCleanUp() {
         read_callback_.Reset();
     }
     
-    if (!write_callback_.is_null()) {
-        write_buf_ = NULL;
-        write_buf_len_ = 0;
-        write_callback_.Reset();
-    }
+    write_callback_.Reset();
+    // 没写完的数据由disconnect回调ERR_CONNECTION_CLOSED
+    write_flush_scheduled_ = false;
+    write_watching_ = false;
 }
 
 DnsResolverCallback AsyncSocket::DefaultDnsResolver() {
@@ -1,11 +1,16 @@
 #pragma once
 
 #include "base/callback.h"
+#include "base/memory/linked_ptr.h"
 #include "base/memory/weak_ptr.h"
 #include "base/message_loop/message_loop.h"
 #include "base/threading/thread.h"
 #include "base/threading/thread_checker.h"
+#include "base/timer/timer.h"
 #include "net/io_buffer.h"
+#include "network/dns_resolver.h"
+#include <deque>
+#include <list>
 #include <netinet/in.h>
 #include <sys/socket.h>
 
@@ -15,8 +20,6 @@ namespace net {
 // used to report a byte count or network error code.
 typedef base::Callback<void(int)> CompletionCallback;
 typedef base::Callback<void(bool)> BeforeConnectCallback;
-typedef std::string sockaddr_data;
-typedef base::Callback<std::vector<sockaddr_data>(const std::string&, uint16_t port)> DnsResolverCallback;
 
 //#ifdef OS_IOS
 //class AsyncSocket : public base::MessagePumpIOSForIO::Watcher {
@@ -27,12 +30,21 @@ class AsyncSocket : public base::MessagePumpLibevent::Watcher {
 public:
     static const std::string UseDefaultResolver;
     AsyncSocket(const sockaddr* addr, const socklen_t addrlen);
+    // 已经连上的fd，比如AsyncServerSocket accept的连接，析构时关闭
+    AsyncSocket(int connected_fd, const sockaddr_data& peer);
     AsyncSocket(const std::string& hostname, const uint16_t port, const DnsResolverCallback& dns_resolver_callback = DnsResolverCallback(), bool is_dns_resolver_callback_sync = false);
     ~AsyncSocket();
     
     int connect(const CompletionCallback& callback, const BeforeConnectCallback& beforeConnectionCallback = BeforeConnectCallback());
     int read(IOBuffer* buf, size_t buf_len, const CompletionCallback& callback);
+    // 写入排队，可以同时有多个写，同一个任务里的写合并成一次sendmsg发出；
+    // 返回ERR_IO_PENDING，整条数据写完后回调buf_len，写出错或者disconnect时回调错误码，callback可以为空
     int write(IOBuffer* buf, size_t buf_len, const CompletionCallback& callback);
+    // 排队的字节数超过高水位后isWriteQueueFull返回true，降到一半以下时调用drain_callback
+    void setWriteHighWaterMark(size_t bytes);
+    void setWriteDrainCallback(const base::Closure& drain_callback);
+    bool isWriteQueueFull() const;
+    size_t pendingWriteBytes() const;
     void disconnect();
     bool isConnected() const;
     sockaddr_data currentSockaddr() const;
@@ -47,6 +59,15 @@ public:
   
 private:
     int resolveHostBeforeConnect();
+    void onHostResolved(const std::vector<sockaddr_data>& results);
+    int startConnectAttempt();
+    void onConnectAttemptDelay();
+    void onConnectAttemptWritable(int fd);
+    void closeConnectAttempts();
+    void finishConnect(int result);
+    void flushWriteQueue();
+    void failWriteQueue(int error);
+    static std::vector<sockaddr_data> interleaveAddressFamilies(const std::vector<sockaddr_data>& addrs);
     void stopWatchingAndCleanUp();
 
     // State machine for connecting the socket.
@@ -63,6 +84,17 @@ private:
     uint16_t port_;
     ConnectState connect_state_;
     
+    // 同时进行中的连接，第一个连上的成为socket_fd_
+    struct ConnectAttempt {
+        ConnectAttempt() : fd(-1), watcher(new base::MessageLoopForIO::FileDescriptorWatcher()) {}
+        int fd;
+        sockaddr_data addr;
+        linked_ptr<base::MessageLoopForIO::FileDescriptorWatcher> watcher;
+    };
+    std::list<ConnectAttempt> connect_attempts_;
+    base::OneShotTimer<AsyncSocket> connect_attempt_timer_;
+    int last_connect_error_;
+    
     base::WeakPtrFactory<AsyncSocket> weak_factory_;
     base::MessageLoopForIO::FileDescriptorWatcher read_socket_watcher_;
     scoped_refptr<IOBuffer> read_buf_;
@@ -71,14 +103,25 @@ private:
     CompletionCallback read_callback_;
     
     base::MessageLoopForIO::FileDescriptorWatcher write_socket_watcher_;
-    scoped_refptr<IOBuffer> write_buf_;
-    size_t write_buf_len_;
-    // External callback; called when write or connect is complete.
+    struct PendingWrite {
+        scoped_refptr<IOBuffer> buf;
+        size_t len;
+        size_t offset; // 已经写出的字节数
+        CompletionCallback callback;
+    };
+    std::deque<PendingWrite> write_queue_;
+    size_t write_queue_bytes_;
+    size_t write_high_water_mark_;
+    bool write_queue_full_;
+    bool write_flush_scheduled_;
+    bool write_watching_;
+    base::Closure write_drain_callback_;
+    // External callback; called when connect is complete.
     CompletionCallback write_callback_;
     
     BeforeConnectCallback before_connect_callback_;
     
-    scoped_ptr<base::Thread> dns_thread_;
+    bool resolving_;
     DnsResolverCallback dns_resolver_callback_;
     bool is_dns_resolver_callback_sync_;
     
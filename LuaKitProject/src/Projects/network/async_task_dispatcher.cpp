@@ -1,14 +1,23 @@
 #include "network/async_task_dispatcher.h"
+#include <algorithm>
+#include "base/bind.h"
 #include "common/common/notification_service.h"
 #include "common/business_client_thread.h"
-#include "network/socket_watcher.h"
 #include "network/curl_connection.h"
+#include "network/curl_multi.h"
 #include "common/common/network_monitor.h"
 namespace network {
     
 AsyncTaskDispatcher::AsyncTaskDispatcher(const std::string& name, bool fifo) :
+    pending_task_count_(0),
+    task_sequence_(0),
+    min_connections_(0),
+    max_connections_(0),
+    first_byte_ms_(0),
+    trim_pending_(false),
     dispatcher_name_(name),
-    fifo_queue_(fifo) {
+    fifo_queue_(fifo),
+    auto_reset_(true) {
   DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
   registrar_.reset(new content::NotificationRegistrar);
   registrar_->Add(this, NOTIFICATION_NETWORK_CHANGED, content::NotificationService::AllSources());
@@ -22,8 +31,8 @@ AsyncTaskDispatcher::~AsyncTaskDispatcher() {
         }
     }
     connection_pool_.clear();
-    if(network_task_priority_list_.size() > 0) {
-        LOG(ERROR) << "悲剧了！dispatcher析构了，还有task没有跑完！这些东西不会有回调了！dispatcher name: " << dispatcher_name_ << " task list size: " << network_task_priority_list_.size();
+    if(pending_task_count_ > 0) {
+        LOG(ERROR) << "悲剧了！dispatcher析构了，还有task没有跑完！这些东西不会有回调了！dispatcher name: " << dispatcher_name_ << " task list size: " << pending_task_count_;
     }
 }
 
@@ -43,7 +52,7 @@ void AsyncTaskDispatcher::ResetConnection(const scoped_refptr<AsyncTaskDispatche
       if(finish_doing &&
          conn->ApplyStatus() == CurlConnection::APPLYSTATUS_BUSY) {
           LOG(WARNING) << conn->Name() << " 强制关闭正在进行的连接(#" << value.first << ")，触发失败回调逻辑。Dispatcher: " << dispatcher->dispatcher_name_;
-          conn->ForceFinish(true);
+          conn->ForceFinish();
       }
       conn->SetForceNewConnection(true);
     }
@@ -56,14 +65,14 @@ ProtocolErrorCode AsyncTaskDispatcher::AsyncProcess(CurlConnection* pConnection)
     int ret = pConnection->Perform();
     if(ret != CURLM_OK) {
         LOG(ERROR) << "AsyncTaskDispatcher AsyncProcess connection perform failed! curl multi error code: " << ret;
-        pConnection->ForceFinish(false);
+        pConnection->ForceFinish();
         return PEC_UNKNOW_ERROR;
     }
     ret = pConnection->CurlCode();
     LOG(INFO) << "AsyncTaskDispatcher AsyncProcess CurlCode: " << ret;
     if(ret != CURLE_OK) {
         LOG(ERROR) << "AsyncTaskDispatcher AsyncProcess failed! curl error code: " << ret;
-        pConnection->ForceFinish(false);
+        pConnection->ForceFinish();
         return PEC_UNKNOW_ERROR;
     }
     return PEC_OK;
@@ -72,42 +81,66 @@ ProtocolErrorCode AsyncTaskDispatcher::AsyncProcess(CurlConnection* pConnection)
 void AsyncTaskDispatcher::CreateFixedConnections(int count, bool auto_reset, const std::string& name) {
     DCHECK(connection_pool_.empty());
     connection_pool_.clear() ;
+    idle_connections_.clear() ;
+    flagged_connections_.clear() ;
+    connection_name_ = name;
+    auto_reset_ = auto_reset;
+    min_connections_ = max_connections_ = count;
+    curl_multi_.reset(new CurlMulti(name.empty() ? dispatcher_name_ : name, count, ASYNC_CURL_MAX_HOST_CONNECTIONS));
     for (int i = 0; i < count; ++i) {
-        CurlConnection* pConnection = new CurlConnection(i, name, auto_reset, this) ;
-        connection_pool_.insert(std::make_pair(i, pConnection)) ;
+        AddConnection();
     }
 }
 
+void AsyncTaskDispatcher::SetPoolBounds(int min_count, int max_count) {
+    DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+    min_connections_ = std::max(min_count, 1);
+    max_connections_ = std::max(max_count, min_connections_);
+    LOG(INFO) << dispatcher_name_ << " 连接池范围: [" << min_connections_ << ", " << max_connections_ << "]";
+    curl_multi_->SetMaxTotalConnections(max_connections_);
+    while ((int)connection_pool_.size() < min_connections_) {
+        AddConnection();
+    }
+    ScheduleTasksWithPriority();
+    if ((int)connection_pool_.size() > min_connections_ && !trim_pending_) {
+        trim_pending_ = true;
+        BusinessThread::PostTask(BusinessThread::IO, FROM_HERE,
+                                 base::Bind(&AsyncTaskDispatcher::TrimIdleConnections, this));
+    }
+}
+
+int AsyncTaskDispatcher::AddConnection() {
+    int nIndex = connection_pool_.empty() ? 0 : connection_pool_.rbegin()->first + 1;
+    CurlConnection* pConnection = new CurlConnection(nIndex, connection_name_, auto_reset_, this) ;
+    connection_pool_.insert(std::make_pair(nIndex, pConnection)) ;
+    idle_connections_.push_back(nIndex);
+    return nIndex;
+}
+
 int AsyncTaskDispatcher::GetIdleConnection() {
     DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-    CurlConnection* pConnection = NULL ;
-    
-    for (MAP_CONNECTION_BUNDLE::iterator it = connection_pool_.begin();
-         connection_pool_.end() != it;
-         ++it) {
-        pConnection = it->second;
-        if (pConnection && CurlConnection::APPLYSTATUS_IDLE == pConnection->ApplyStatus()) {
-            pConnection->SetStatus(CurlConnection::APPLYSTATUS_FLAGGED);
-            return it->first ;
-        }
+    if (idle_connections_.empty()) {
+        return -1 ;
     }
-    
-    return -1 ;
+    int nIndex = idle_connections_.front();
+    idle_connections_.pop_front();
+    CurlConnection* pConnection = connection_pool_[nIndex];
+    DCHECK(pConnection && CurlConnection::APPLYSTATUS_IDLE == pConnection->ApplyStatus());
+    pConnection->SetStatus(CurlConnection::APPLYSTATUS_FLAGGED);
+    flagged_connections_.push_back(nIndex);
+    return nIndex ;
 }
 
 CurlConnection* AsyncTaskDispatcher::GetFlaggedConnection() {
     DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-    MAP_CONNECTION_BUNDLE::iterator it = connection_pool_.begin() ;
-    for (; connection_pool_.end() != it; ++it) {
-        CurlConnection* pConnection = it->second ;
-        if (pConnection && CurlConnection::APPLYSTATUS_FLAGGED == pConnection->ApplyStatus())
-        {
-            pConnection->SetStatus(CurlConnection::APPLYSTATUS_BUSY);
-            return pConnection ;
-        }
+    if (flagged_connections_.empty()) {
+        NOTREACHED() << "逻辑错误了!";
+        return NULL ;
     }
-    NOTREACHED() << "逻辑错误了!";
-    return NULL ;
+    CurlConnection* pConnection = connection_pool_[flagged_connections_.front()];
+    flagged_connections_.pop_front();
+    pConnection->SetStatus(CurlConnection::APPLYSTATUS_BUSY);
+    return pConnection ;
 }
 
 void AsyncTaskDispatcher::ReleaseBusyConnection(CurlConnection* pConnection) {
@@ -115,54 +148,142 @@ void AsyncTaskDispatcher::ReleaseBusyConnection(CurlConnection* pConnection) {
     if (NULL == pConnection) {
         return ;
     }
+    RecordFirstByteTime(pConnection);
     pConnection->Clean();
     pConnection->SetStatus(CurlConnection::APPLYSTATUS_IDLE);
+    idle_connections_.push_back(pConnection->Index());
+    if ((int)connection_pool_.size() > min_connections_ && (IsNetworkSlow() || 0 == pending_task_count_)) {
+        // 不能在连接自己的回调里删除它，先放回空闲列表再收缩
+        if (!trim_pending_) {
+            trim_pending_ = true;
+            BusinessThread::PostTask(BusinessThread::IO, FROM_HERE,
+                                     base::Bind(&AsyncTaskDispatcher::TrimIdleConnections, this));
+        }
+        return;
+    }
     ScheduleTasksWithPriority() ;
 }
 
+void AsyncTaskDispatcher::RecordFirstByteTime(CurlConnection* pConnection) {
+    int64 ms = pConnection->GetFirstByteTimeMs();
+    if (ms <= 0) {
+        return;
+    }
+    // 新样本占1/4，避免偶尔一个慢请求让连接池抖动
+    first_byte_ms_ = first_byte_ms_ == 0 ? ms : (first_byte_ms_ * 3 + ms) / 4;
+}
+
+bool AsyncTaskDispatcher::IsNetworkSlow() const {
+    return first_byte_ms_ > ASYNC_POOL_SLOW_FIRST_BYTE_MS;
+}
+
+bool AsyncTaskDispatcher::ShouldGrowPool() const {
+    return (int)connection_pool_.size() < max_connections_ && !IsNetworkSlow();
+}
+
+void AsyncTaskDispatcher::TrimIdleConnections() {
+    DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+    trim_pending_ = false;
+    // 网络好并且还有任务排队时空闲连接留给排队的任务
+    if (IsNetworkSlow() || 0 == pending_task_count_) {
+        while ((int)connection_pool_.size() > min_connections_ && !idle_connections_.empty()) {
+            int nIndex = idle_connections_.back();
+            idle_connections_.pop_back();
+            delete connection_pool_[nIndex];
+            connection_pool_.erase(nIndex);
+        }
+        LOG(INFO) << dispatcher_name_ << " 连接池收缩到: " << connection_pool_.size();
+    }
+    ScheduleTasksWithPriority() ;
+}
+
+bool AsyncTaskDispatcher::HasHigherPriority(const scoped_refptr<NetWorkTask>& a, const scoped_refptr<NetWorkTask>& b) const {
+    if (a->priority_ != b->priority_) {
+        return a->priority_ > b->priority_;
+    }
+    return fifo_queue_ ? a->sequence_ < b->sequence_ : a->sequence_ > b->sequence_;
+}
+
+scoped_refptr<NetWorkTask> AsyncTaskDispatcher::PopScheduledTask() {
+    // std::*_heap把"小于"的元素放到后面，比较时反过来
+    auto compare = [this](const scoped_refptr<NetWorkTask>& a, const scoped_refptr<NetWorkTask>& b) {
+        return HasHigherPriority(b, a);
+    };
+    while (!network_task_priority_heap_.empty()) {
+        std::pop_heap(network_task_priority_heap_.begin(), network_task_priority_heap_.end(), compare);
+        scoped_refptr<NetWorkTask> task = network_task_priority_heap_.back();
+        network_task_priority_heap_.pop_back();
+        if (!task->canceled_) {
+            pending_task_count_--;
+            return task;
+        }
+    }
+    return NULL;
+}
 
 void AsyncTaskDispatcher::ScheduleTasksWithPriority() {
     DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-    if (network_task_priority_list_.empty()) {
+    if (0 == pending_task_count_) {
+        network_task_priority_heap_.clear();
         return;
     }
     
-    NETWORK_TASK_PRIORITY_LIST::iterator it = network_task_priority_list_.begin() ;
-  
     int nIndex = GetIdleConnection() ;
     if (-1 == nIndex) {
         return ;
     }
-    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, (*it)->closure_) ;
-    network_task_priority_list_.erase(it) ;
-    LOG(WARNING) << dispatcher_name_ << " 连接池连接空闲，剩余任务数: " << network_task_priority_list_.size();
+    scoped_refptr<NetWorkTask> task = PopScheduledTask();
+    DCHECK(task.get());
+    BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, task->closure_) ;
+    task->closure_.Reset(); // 已经出队，不能再取消
+    LOG(WARNING) << dispatcher_name_ << " 连接池连接空闲，剩余任务数: " << pending_task_count_;
     return;
 }
 
-void AsyncTaskDispatcher::ScheduleTasksWithPriority(const base::Closure& f, int nPriority) {
+scoped_refptr<NetWorkTask> AsyncTaskDispatcher::ScheduleTasksWithPriority(const base::Closure& f,
+                                                                         int nPriority,
+                                                                         const base::Closure& cancel_closure) {
     DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
     int nIndex = GetIdleConnection() ;
+    if (-1 == nIndex && ShouldGrowPool()) {
+        AddConnection();
+        nIndex = GetIdleConnection();
+        LOG(INFO) << dispatcher_name_ << " 任务排队，连接池扩充到: " << connection_pool_.size();
+    }
     if (-1 == nIndex) {
-        LOG(WARNING) << dispatcher_name_ << " 连接池暂时没有空闲连接，当前堆积任务数: " << network_task_priority_list_.size();
-        NETWORK_TASK_PRIORITY_LIST::iterator it = network_task_priority_list_.begin() ;
-        for (; network_task_priority_list_.end() != it; ++it) {
-            if (fifo_queue_) {
-                if (nPriority <= (*it)->priority_) continue ;
-            } else {
-                if (nPriority < (*it)->priority_) continue ;
-            }
-            network_task_priority_list_.insert(it, scoped_refptr<NetWorkTask>(new NetWorkTask(nPriority, f))) ;
-            return;
-        }
-        network_task_priority_list_.push_back( scoped_refptr<NetWorkTask>(new NetWorkTask(nPriority, f))) ;
-        return;
+        LOG(WARNING) << dispatcher_name_ << " 连接池暂时没有空闲连接，当前堆积任务数: " << pending_task_count_;
+        scoped_refptr<NetWorkTask> task(new NetWorkTask(nPriority, f));
+        task->sequence_ = task_sequence_++;
+        task->cancel_closure_ = cancel_closure;
+        network_task_priority_heap_.push_back(task);
+        std::push_heap(network_task_priority_heap_.begin(), network_task_priority_heap_.end(),
+                       [this](const scoped_refptr<NetWorkTask>& a, const scoped_refptr<NetWorkTask>& b) {
+                           return HasHigherPriority(b, a);
+                       });
+        pending_task_count_++;
+        return task;
     }
     BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, f) ;
+    return NULL;
+}
+
+bool AsyncTaskDispatcher::CancelScheduledTask(const scoped_refptr<NetWorkTask>& task) {
+    DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+    if (!task.get() || task->canceled_ || task->closure_.is_null()) {
+        return false;
+    }
+    task->canceled_ = true;
+    pending_task_count_--;
+    if (!task->cancel_closure_.is_null()) {
+        BusinessThread::PostTask(BusinessThread::IO, FROM_HERE, task->cancel_closure_) ;
+    }
+    return true;
 }
 
-void AsyncTaskDispatcher::CreateSocketWatcher(CurlConnection* pConnection, const CompleteCallback& complete_callback) {
+void AsyncTaskDispatcher::SetMaxHostConnections(int count) {
   DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
-  pConnection->CreateSocketWatcher(complete_callback);
+  DCHECK(curl_multi_.get());
+  curl_multi_->SetMaxHostConnections(count);
 }
 
 } // end of namespace network
@@ -3,16 +3,23 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <deque>
 
 #include "base/memory/ref_counted.h"
+#include "base/memory/scoped_ptr.h"
 #include "common/notification_observer.h"
 #include "common/notification_registrar.h"
 #include "common/business_client_thread.h"
 #include "network/network_define.h"
 
+#define ASYNC_CURL_MAX_HOST_CONNECTIONS 4
+// 首字节时间的平滑值超过这个毫秒数认为网络差，连接池不再扩充并收缩到下限
+#define ASYNC_POOL_SLOW_FIRST_BYTE_MS 1500
+
 namespace network {
 
 class CurlConnection;
+class CurlMulti;
 
 class AsyncTaskDispatcher : public base::RefCountedThreadSafe<AsyncTaskDispatcher, BusinessThread::DeleteOnIOThread>,
                             public content::NotificationObserver {
@@ -23,34 +30,77 @@ public:
     explicit AsyncTaskDispatcher(const std::string& name, bool fifo);
     virtual ~AsyncTaskDispatcher();
 
+    CurlMulti* curl_multi() { return curl_multi_.get(); }
+
 protected:
     // fix: dox 此方法可能触发上层逻辑把this析构，所以需要保护一下this的引用计数
     static void ResetConnection(const scoped_refptr<AsyncTaskDispatcher>& dispatcher, bool finish_doing);
     
     virtual ProtocolErrorCode AsyncProcess(CurlConnection* pConnection) ;
 
+    /**
+     * @brief 创建连接池，所有连接共用一个multi handle和连接缓存
+     */
     void CreateFixedConnections(int count, bool auto_reset = true, const std::string& name = "") ;
+    /**
+     * @brief 同一个host同时打开的连接数上限，默认ASYNC_CURL_MAX_HOST_CONNECTIONS
+     */
+    void SetMaxHostConnections(int count) ;
+    /**
+     * @brief 连接池在[min_count, max_count]之间伸缩：有任务排队并且网络好时扩充，网络差或者空闲时收缩到min_count
+     * @note CreateFixedConnections之后上下限都是创建的连接数，也就是固定大小
+     */
+    void SetPoolBounds(int min_count, int max_count) ;
     int GetIdleConnection() ;
     CurlConnection* GetFlaggedConnection() ;
     void ReleaseBusyConnection(CurlConnection* pConnection) ;
     
     void ScheduleTasksWithPriority() ;
-    void ScheduleTasksWithPriority(const base::Closure& closure, int priority) ;
+    /**
+     * @brief 有空闲连接时马上执行closure，否则按priority排队，数值大的先执行
+     * @return 排队时返回队列里的任务，可以用CancelScheduledTask取消，马上执行时返回NULL
+     */
+    scoped_refptr<NetWorkTask> ScheduleTasksWithPriority(const base::Closure& closure,
+                                                        int priority,
+                                                        const base::Closure& cancel_closure = base::Closure()) ;
+    /**
+     * @brief 从队列里取消任务并执行它的cancel_closure，任务已经出队时返回false
+     */
+    bool CancelScheduledTask(const scoped_refptr<NetWorkTask>& task) ;
 
     typedef base::Callback<void(ProtocolErrorCode)> FinishCallback;
-    void CreateSocketWatcher(CurlConnection* pConnection, const CompleteCallback& complete_callback);
   
     void Observe(int type, const content::NotificationSource& source, const content::NotificationDetails& details) override;
   
 private:
-    typedef std::list<scoped_refptr<NetWorkTask> > NETWORK_TASK_PRIORITY_LIST ;
-    NETWORK_TASK_PRIORITY_LIST network_task_priority_list_ ;
+    int AddConnection() ;
+    void RecordFirstByteTime(CurlConnection* pConnection) ;
+    bool IsNetworkSlow() const ;
+    bool ShouldGrowPool() const ;
+    void TrimIdleConnections() ;
+    bool HasHigherPriority(const scoped_refptr<NetWorkTask>& a, const scoped_refptr<NetWorkTask>& b) const ;
+    scoped_refptr<NetWorkTask> PopScheduledTask() ;
+
+    // 二叉堆，堆顶是最先执行的任务，取消的任务出队时丢弃
+    typedef std::vector<scoped_refptr<NetWorkTask> > NETWORK_TASK_PRIORITY_HEAP ;
+    NETWORK_TASK_PRIORITY_HEAP network_task_priority_heap_ ;
+    size_t pending_task_count_ ; // 堆里没有取消的任务数
+    int64 task_sequence_ ;
     
     typedef std::map<int, CurlConnection*> MAP_CONNECTION_BUNDLE;
     MAP_CONNECTION_BUNDLE connection_pool_ ;
+    std::deque<int> idle_connections_ ;    // 空闲连接的index，取用和归还都是O(1)
+    std::deque<int> flagged_connections_ ; // 已经分配给任务还没有开始的连接
+    int min_connections_ ;
+    int max_connections_ ;
+    int64 first_byte_ms_ ; // 首字节时间的指数平滑值，0表示还没有样本
+    bool trim_pending_ ;
+    scoped_ptr<CurlMulti> curl_multi_ ;
     
     std::string dispatcher_name_;
     bool fifo_queue_;
+    std::string connection_name_;
+    bool auto_reset_;
   
     std::unique_ptr<content::NotificationRegistrar> registrar_;
 };
@@ -0,0 +1,292 @@
+#include "async_udp_socket.h"
+#include <algorithm>
+#include "base/bind.h"
+#include "base/posix/eintr_wrapper.h"
+#include "net/net_errors.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Android的recvmmsg/sendmmsg从API 21开始才有
+#if defined(OS_LINUX) || (defined(OS_ANDROID) && __ANDROID_API__ >= 21)
+#define HAVE_MMSG 1
+#endif
+
+namespace net {
+
+const static int RECV_BATCH_SIZE = 16;
+const static int MAX_RECV_BATCHES_PER_EVENT = 4; // 一次可读事件最多收这么多批，避免一直占着线程
+const static size_t MAX_DATAGRAM_SIZE = 8192;    // 更大的数据报会被截断丢弃
+const static int SEND_BATCH_SIZE = 32;
+const static size_t MAX_SEND_QUEUE = 1024;
+
+AsyncUdpSocket::AsyncUdpSocket()
+    : socket_fd_(-1),
+      send_flush_scheduled_(false),
+      send_watching_(false),
+      weak_factory_(this) {
+}
+
+AsyncUdpSocket::~AsyncUdpSocket() {
+    close();
+}
+
+int AsyncUdpSocket::bind(const std::string& host, uint16_t port) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    DCHECK(socket_fd_ < 0);
+
+    sockaddr_data address;
+    if (host.find(':') != std::string::npos) {
+        address = AsyncSocket::IPV6toSockaddr(host, port);
+    } else {
+        address = AsyncSocket::IPV4toSockaddr(host.empty() ? "0.0.0.0" : host, port);
+    }
+    const sockaddr* addr = (const sockaddr*)address.data();
+    socket_fd_ = socket(addr->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (socket_fd_ < 0) {
+        PLOG(ERROR) << "AsyncUdpSocket create socket failed";
+        return MapSystemError(errno);
+    }
+    int flags = fcntl(socket_fd_, F_GETFL, 0);
+    if (flags == -1 || fcntl(socket_fd_, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        ::bind(socket_fd_, addr, (socklen_t)address.size()) != 0) {
+        int ret = MapSystemError(errno);
+        PLOG(ERROR) << "AsyncUdpSocket bind " << host << ":" << port << " failed";
+        ::close(socket_fd_);
+        socket_fd_ = -1;
+        return ret;
+    }
+    return OK;
+}
+
+uint16_t AsyncUdpSocket::localPort() const {
+    struct sockaddr_storage storage;
+    socklen_t len = sizeof(storage);
+    if (socket_fd_ < 0 || getsockname(socket_fd_, (sockaddr*)&storage, &len) != 0) {
+        return 0;
+    }
+    if (storage.ss_family == AF_INET6) {
+        return ntohs(((sockaddr_in6*)&storage)->sin6_port);
+    }
+    return ntohs(((sockaddr_in*)&storage)->sin_port);
+}
+
+int AsyncUdpSocket::startReceiving(const ReceiveCallback& callback) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    if (socket_fd_ < 0) {
+        return ERR_SOCKET_NOT_CONNECTED;
+    }
+    receive_callback_ = callback;
+    if (receive_buffer_.empty()) {
+        receive_buffer_.resize(RECV_BATCH_SIZE * MAX_DATAGRAM_SIZE);
+    }
+    if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
+            socket_fd_, true, base::MessageLoopForIO::WATCH_READ,
+            &read_socket_watcher_, this)) {
+        PLOG(ERROR) << "WatchFileDescriptor failed on receive, errno " << errno;
+        return MapSystemError(errno);
+    }
+    return OK;
+}
+
+void AsyncUdpSocket::stopReceiving() {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    read_socket_watcher_.StopWatchingFileDescriptor();
+    receive_callback_.Reset();
+}
+
+int AsyncUdpSocket::sendTo(const sockaddr_data& addr, const std::string& data) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    if (socket_fd_ < 0) {
+        return ERR_SOCKET_NOT_CONNECTED;
+    }
+    if (send_queue_.size() >= MAX_SEND_QUEUE) {
+        return ERR_INSUFFICIENT_RESOURCES;
+    }
+    Datagram datagram;
+    datagram.addr = addr;
+    datagram.data = data;
+    send_queue_.push_back(datagram);
+    if (!send_watching_ && !send_flush_scheduled_) {
+        send_flush_scheduled_ = true;
+        base::MessageLoop::current()->PostTask(FROM_HERE, base::Bind(&AsyncUdpSocket::flushSendQueue, weak_factory_.GetWeakPtr()));
+    }
+    return OK;
+}
+
+void AsyncUdpSocket::close() {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    read_socket_watcher_.StopWatchingFileDescriptor();
+    write_socket_watcher_.StopWatchingFileDescriptor();
+    weak_factory_.InvalidateWeakPtrs();
+    receive_callback_.Reset();
+    send_queue_.clear();
+    send_flush_scheduled_ = false;
+    send_watching_ = false;
+    if (socket_fd_ >= 0) {
+        ::close(socket_fd_);
+        socket_fd_ = -1;
+    }
+}
+
+// 收一批，返回收到的个数，没有数据时返回0，出错返回net错误码
+int AsyncUdpSocket::receiveBatch(std::vector<Datagram>* datagrams) {
+    struct sockaddr_storage addrs[RECV_BATCH_SIZE];
+    struct iovec iovs[RECV_BATCH_SIZE];
+#if defined(HAVE_MMSG)
+    struct mmsghdr msgs[RECV_BATCH_SIZE];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < RECV_BATCH_SIZE; i++) {
+        iovs[i].iov_base = &receive_buffer_[i * MAX_DATAGRAM_SIZE];
+        iovs[i].iov_len = MAX_DATAGRAM_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+    int count = HANDLE_EINTR(recvmmsg(socket_fd_, msgs, RECV_BATCH_SIZE, MSG_DONTWAIT, NULL));
+    if (count < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : MapSystemError(errno);
+    }
+    for (int i = 0; i < count; i++) {
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            LOG(WARNING) << "AsyncUdpSocket drop truncated datagram";
+            continue;
+        }
+        Datagram datagram;
+        datagram.addr.assign((const char*)&addrs[i], msgs[i].msg_hdr.msg_namelen);
+        datagram.data.assign((const char*)iovs[i].iov_base, msgs[i].msg_len);
+        datagrams->push_back(datagram);
+    }
+    return count;
+#else
+    int count = 0;
+    for (; count < RECV_BATCH_SIZE; count++) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        iovs[0].iov_base = &receive_buffer_[0];
+        iovs[0].iov_len = MAX_DATAGRAM_SIZE;
+        msg.msg_iov = &iovs[0];
+        msg.msg_iovlen = 1;
+        msg.msg_name = &addrs[0];
+        msg.msg_namelen = sizeof(addrs[0]);
+        ssize_t rv = HANDLE_EINTR(recvmsg(socket_fd_, &msg, MSG_DONTWAIT));
+        if (rv < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return count > 0 ? count : MapSystemError(errno);
+        }
+        // 和recvmmsg一样，截断的数据报算在个数里但不回调
+        if (msg.msg_flags & MSG_TRUNC) {
+            LOG(WARNING) << "AsyncUdpSocket drop truncated datagram";
+            continue;
+        }
+        Datagram datagram;
+        datagram.addr.assign((const char*)&addrs[0], msg.msg_namelen);
+        datagram.data.assign(&receive_buffer_[0], rv);
+        datagrams->push_back(datagram);
+    }
+    return count;
+#endif
+}
+
+void AsyncUdpSocket::OnFileCanReadWithoutBlocking(int fd) {
+    DCHECK(!receive_callback_.is_null());
+    std::vector<Datagram> datagrams;
+    int rv = OK;
+    for (int i = 0; i < MAX_RECV_BATCHES_PER_EVENT; i++) {
+        rv = receiveBatch(&datagrams);
+        if (rv < RECV_BATCH_SIZE) {
+            break;
+        }
+    }
+    if (rv < 0) {
+        // ICMP端口不可达之类的错误只影响之前发的数据报，不停止接收
+        if (rv == ERR_CONNECTION_REFUSED || rv == ERR_CONNECTION_RESET) {
+            rv = OK;
+        } else {
+            read_socket_watcher_.StopWatchingFileDescriptor();
+            ReceiveCallback callback = receive_callback_;
+            receive_callback_.Reset();
+            callback.Run(rv, datagrams);
+            return;
+        }
+    }
+    if (!datagrams.empty()) {
+        receive_callback_.Run(OK, datagrams);
+    }
+}
+
+void AsyncUdpSocket::OnFileCanWriteWithoutBlocking(int fd) {
+    flushSendQueue();
+}
+
+void AsyncUdpSocket::flushSendQueue() {
+    send_flush_scheduled_ = false;
+    if (socket_fd_ < 0) {
+        return;
+    }
+    bool blocked = false;
+    while (!send_queue_.empty()) {
+        int batch = (int)std::min<size_t>(send_queue_.size(), SEND_BATCH_SIZE);
+        int sent = 0;
+#if defined(HAVE_MMSG)
+        struct mmsghdr msgs[SEND_BATCH_SIZE];
+        struct iovec iovs[SEND_BATCH_SIZE];
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < batch; i++) {
+            Datagram& datagram = send_queue_[i];
+            iovs[i].iov_base = (void*)datagram.data.data();
+            iovs[i].iov_len = datagram.data.size();
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = (void*)datagram.addr.data();
+            msgs[i].msg_hdr.msg_namelen = (socklen_t)datagram.addr.size();
+        }
+        sent = HANDLE_EINTR(sendmmsg(socket_fd_, msgs, batch, MSG_DONTWAIT));
+#else
+        for (; sent < batch; sent++) {
+            Datagram& datagram = send_queue_[sent];
+            ssize_t rv = HANDLE_EINTR(sendto(socket_fd_, datagram.data.data(), datagram.data.size(), MSG_DONTWAIT,
+                                             (const sockaddr*)datagram.addr.data(), (socklen_t)datagram.addr.size()));
+            if (rv < 0) {
+                if (sent == 0) {
+                    sent = -1;
+                }
+                break;
+            }
+        }
+#endif
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                blocked = true;
+                break;
+            }
+            // 这一个数据报发不出去，丢掉接着发后面的
+            PLOG(WARNING) << "AsyncUdpSocket send datagram failed";
+            send_queue_.pop_front();
+            continue;
+        }
+        send_queue_.erase(send_queue_.begin(), send_queue_.begin() + sent);
+    }
+
+    if (blocked && !send_watching_) {
+        if (!base::MessageLoopForIO::current()->WatchFileDescriptor(
+                socket_fd_, true, base::MessageLoopForIO::WATCH_WRITE,
+                &write_socket_watcher_, this)) {
+            PLOG(ERROR) << "WatchFileDescriptor failed on send, errno " << errno;
+            send_queue_.clear();
+            return;
+        }
+        send_watching_ = true;
+    } else if (!blocked && send_watching_) {
+        write_socket_watcher_.StopWatchingFileDescriptor();
+        send_watching_ = false;
+    }
+}
+}
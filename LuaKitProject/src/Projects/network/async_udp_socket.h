@@ -0,0 +1,61 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "base/callback.h"
+#include "base/memory/weak_ptr.h"
+#include "base/message_loop/message_loop.h"
+#include "base/threading/thread_checker.h"
+#include "network/async_socket.h"
+
+namespace net {
+
+/**
+ * @brief 非阻塞UDP socket，在当前线程的MessageLoopForIO上收发
+ * @note 每次可读时用recvmmsg把socket里的数据报一批收完再一起回调；sendTo只排队，
+ *       同一个任务里发的数据报用sendmmsg一起发出。没有recvmmsg/sendmmsg的平台(iOS、API 21以下的Android)用recvmsg/sendto逐个收发，回调仍然按批
+ */
+class AsyncUdpSocket : public base::MessagePumpLibevent::Watcher {
+public:
+    struct Datagram {
+        sockaddr_data addr;
+        std::string data;
+    };
+    // rv为OK时datagrams是这次收到的所有数据报，否则是net错误码，之后不再接收
+    typedef base::Callback<void(int rv, const std::vector<Datagram>& datagrams)> ReceiveCallback;
+
+    AsyncUdpSocket();
+    ~AsyncUdpSocket();
+
+    // host为空时绑定0.0.0.0，IPv6地址绑定对应的IPv6 socket；port为0时由系统分配
+    int bind(const std::string& host, uint16_t port);
+    uint16_t localPort() const;
+    int startReceiving(const ReceiveCallback& callback);
+    void stopReceiving();
+    // 排队发送，返回OK；队列满时返回ERR_INSUFFICIENT_RESOURCES
+    int sendTo(const sockaddr_data& addr, const std::string& data);
+    void close();
+    bool isOpen() const { return socket_fd_ >= 0; }
+
+    virtual void OnFileCanReadWithoutBlocking(int fd);
+    virtual void OnFileCanWriteWithoutBlocking(int fd);
+
+private:
+    int receiveBatch(std::vector<Datagram>* datagrams);
+    void flushSendQueue();
+
+    int socket_fd_;
+    ReceiveCallback receive_callback_;
+    std::vector<char> receive_buffer_; // RECV_BATCH_SIZE个MAX_DATAGRAM_SIZE的缓冲，只分配一次
+    std::deque<Datagram> send_queue_;
+    bool send_flush_scheduled_;
+    bool send_watching_;
+    base::MessageLoopForIO::FileDescriptorWatcher read_socket_watcher_;
+    base::MessageLoopForIO::FileDescriptorWatcher write_socket_watcher_;
+    base::ThreadChecker thread_checker_;
+    base::WeakPtrFactory<AsyncUdpSocket> weak_factory_;
+
+    DISALLOW_COPY_AND_ASSIGN(AsyncUdpSocket);
+};
+}
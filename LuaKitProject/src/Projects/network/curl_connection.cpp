@@ -4,6 +4,8 @@
 #include "base/strings/string_util.h"
 #include "curl_connection.h"
 #include "network/async_task_dispatcher.h"
+#include "network/curl_multi.h"
+#include "network/curl_share.h"
 #include "common/base_lambda_support.h"
 #include "base/thread_task_runner_handle.h"
 bool OPEN_CURL_LOG = true;
@@ -11,6 +13,7 @@ bool OPEN_CURL_LOG = true;
 namespace network {
 
     const static long CURLCONNECTION_TIMEOUT_MS = 15*1000; // 15s
+    const static int MAX_PENDING_DATA_CHUNKS = 2; // 流式响应最多交出还没消费的块数，超过就暂停传输
     
     CurlConnection::CurlConnection(int nIndex, const std::string& name, bool auto_reset, AsyncTaskDispatcher* dispatcher):
     ignore_force_fail_(false),
@@ -18,6 +21,11 @@ namespace network {
     curl_code_(CURLE_OK),
     force_new_(false),
     auto_reset_(auto_reset),
+    running_(false),
+    data_chunk_size_(0),
+    pending_chunks_(0),
+    data_paused_(false),
+    transfer_serial_(0),
     weakptr_factory_(this) {
         download_total_ = 0;
         download_now_ = 0;
@@ -28,21 +36,17 @@ namespace network {
         index_ = nIndex ;
         name_ = name;
         curl_easy_handler_ = NULL;
-        curl_multi_handler_ = curl_multi_init();
-        // share SSL Session
-        curl_share_handler_ = curl_share_init();
-        curl_share_setopt(curl_share_handler_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
         curl_headers_ = NULL;
         curl_resolve_ = NULL;
-        socket_watcher_ = NULL;
         dispatcher_ = dispatcher;
+        multi_ = dispatcher->curl_multi();
         apply_status_ = APPLYSTATUS_IDLE;
     }
 
     CurlConnection::~CurlConnection() {
-        timeout_timer_.Stop();
-        if(socket_watcher_) {
-            socket_watcher_->FinishWatching();
+        if(running_) {
+            multi_->RemoveConnection(curl_easy_handler_);
+            running_ = false;
         }
         
         if(curl_headers_) {
@@ -55,57 +59,31 @@ namespace network {
             curl_resolve_ = NULL;
         }
       
-        if(curl_multi_handler_) {
-            curl_multi_remove_handle(curl_multi_handler_, curl_easy_handler_);
-            curl_multi_cleanup(curl_multi_handler_) ;
-            curl_multi_handler_ = NULL;
-        }
         if (curl_easy_handler_) {
             curl_easy_cleanup(curl_easy_handler_) ;
             curl_easy_handler_ = NULL;
         }
-        if(curl_share_handler_) {
-            curl_share_setopt(curl_share_handler_, CURLSHOPT_UNSHARE, CURL_LOCK_DATA_SSL_SESSION);
-            curl_share_cleanup(curl_share_handler_);
-            curl_share_handler_ = NULL;
-        }
     }
 
     bool CurlConnection::Init(bool need_read_func) {
         curl_code_ = CURLE_OK;
-        if (NULL == curl_multi_handler_) {
+        if (NULL == multi_ || running_) {
           return false ;
         }
+        // 连接缓存在dispatcher共用的multi handle里，easy handle只需要重置选项
         if (NULL != curl_easy_handler_) {
-            curl_easy_cleanup(curl_easy_handler_) ;
-            curl_easy_handler_ = NULL;
+            curl_easy_reset(curl_easy_handler_) ;
+        } else {
+            curl_easy_handler_ = curl_easy_init() ;
         }
-        curl_easy_handler_ = curl_easy_init() ;
         if (NULL == curl_easy_handler_) {
             return false ;
         }
-        curl_multi_setopt(curl_multi_handler_, CURLMOPT_SOCKETFUNCTION, CurlSocketCallback) ;
-        curl_multi_setopt(curl_multi_handler_, CURLMOPT_TIMERFUNCTION, CurlTimerCallback) ;
-        curl_multi_setopt(curl_multi_handler_, CURLMOPT_SOCKETDATA, this) ;
-        curl_multi_setopt(curl_multi_handler_, CURLMOPT_TIMERDATA, this) ;
-        // Connection
-        curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAXCONNECTS, 1L); // the size of connection cache
-        curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAX_TOTAL_CONNECTIONS, 1L); // max simultaneously open connections
         
         if (need_read_func) {
           curl_easy_setopt(curl_easy_handler_, CURLOPT_READFUNCTION, CurlReadCallback);
           curl_easy_setopt(curl_easy_handler_, CURLOPT_READDATA, this);
         }
-      
-        // 注意重置last_recv_time_的时机
-        const time_t TOO_OLD_THRESHOLD = 60; // 60秒后使用新连接
-        bool too_old = (time(NULL) - last_recv_time_) > TOO_OLD_THRESHOLD;
-//        LOG_IF(WARNING, too_old && auto_reset_) << "60秒后使用新连接";
-      
-        if(force_new_ || (too_old && auto_reset_)) {
-            force_new_ = false;
-          curl_easy_setopt(curl_easy_handler_, CURLOPT_FRESH_CONNECT, 1L);
-        }
         curl_easy_setopt(curl_easy_handler_, CURLOPT_WRITEFUNCTION, CurlWriteCallback);
         curl_easy_setopt(curl_easy_handler_, CURLOPT_WRITEDATA, this);
         curl_easy_setopt(curl_easy_handler_, CURLOPT_SEEKFUNCTION, CurlSeekCallback);
@@ -119,7 +97,9 @@ namespace network {
         curl_easy_setopt(curl_easy_handler_, CURLOPT_SSL_VERIFYPEER, 0L) ;
         curl_easy_setopt(curl_easy_handler_, CURLOPT_SSL_VERIFYHOST, 0L) ;
         curl_easy_setopt(curl_easy_handler_, CURLOPT_SSLVERSION, CURL_SSLVERSION_DEFAULT) ;
-        curl_easy_setopt(curl_easy_handler_, CURLOPT_SSL_SESSIONID_CACHE, 0L) ;
+        // 进程内共享SSL session和DNS缓存，https请求可以复用session，省掉完整握手
+        curl_easy_setopt(curl_easy_handler_, CURLOPT_SSL_SESSIONID_CACHE, 1L) ;
+        curl_easy_setopt(curl_easy_handler_, CURLOPT_SHARE, GetCurlShareHandle()) ;
         curl_easy_setopt(curl_easy_handler_, CURLOPT_CONNECTTIMEOUT_MS, CURLCONNECTION_TIMEOUT_MS);
         curl_easy_setopt(curl_easy_handler_, CURLOPT_LOW_SPEED_TIME, 60L);
         curl_easy_setopt(curl_easy_handler_, CURLOPT_LOW_SPEED_LIMIT, 1L); // 默认60秒内传输速度小于 1 bytes/sec则失败. 如果需要修改请使用SetLowSpeedLimit
@@ -133,9 +113,6 @@ namespace network {
             curl_easy_setopt(curl_easy_handler_, CURLOPT_DEBUGDATA, this);
         }
       
-        // 重置last_recv_time_
-        last_recv_time_ = time(NULL);
-      
         request_headers_.clear();
 
         // 默认读写内存缓存
@@ -144,13 +121,6 @@ namespace network {
         return true ;
     }
     
-    void CurlConnection::CreateSocketWatcher(const CompleteCallback &complete_callback) {
-        complete_callback_ = complete_callback;
-        socket_watcher_ = new SocketWatcher(base::Bind(&CurlConnection::SocketEventCallback,
-                                                       this));
-        socket_watcher_->SetTimeoutMs(socket_watcher_timeout_ms_);
-    }
-    
     ProtocolErrorCode CurlConnection::GetCurlErrorCode(CURLcode curl_code) {
         ProtocolErrorCode error_code = PEC_UNKNOW_ERROR;
         switch(curl_code) {
@@ -210,50 +180,16 @@ namespace network {
         return error_code;
     }
     
-    ProtocolErrorCode CurlConnection::CheckSocketCompleted(int socket, SocketEvent event) {
-      if (-1 == socket) {
-        LOG(ERROR) << name_ << " CurlConnection CheckSocketCompleted socket is invalid! curl code: " << curl_code_;
-        CURLMcode mcode = curl_multi_remove_handle(curl_multi_handler_, curl_easy_handler_) ;
-        LOG_IF(ERROR, mcode != CURLM_OK) << name_ << " CurlConnection CheckSocketCompleted socket is invalid curl_multi_remove_handle failed! mcode: " << mcode;
-        ProtocolErrorCode code = GetCurlErrorCode(curl_code_);
-        return code == PEC_OK ? PEC_NETWORK_ERROR : code ;
-      }
-      
-      if (socket_watcher_->is_io_timeout_) {
-        LOG(ERROR) << name_ << " CurlConnection CheckSocketCompleted IO timeout! completed size: " << buffer_write_->getCompletedSize() << " bytes!";
-        CURLMcode mcode = curl_multi_remove_handle(curl_multi_handler_, curl_easy_handler_) ;
-        LOG_IF(ERROR, mcode != CURLM_OK) << name_ << " CurlConnection CheckSocketCompleted IO timeout curl_multi_remove_handle failed! mcode: " << mcode;
-        socket_watcher_->FinishWatching() ;
-        return PEC_OPERATION_TIMEOUT ;
-      }
-
-      int nStillRunning = 0 ;
-      DCHECK(event != Event_None) << "执行到这个地方应该有读写事件发生!";
-      int action = (event&Event_Read?CURL_POLL_IN:0)|(event&Event_Write?CURL_POLL_OUT:0);
-      CURLMcode rc = curl_multi_socket_action(curl_multi_handler_,
-                                              socket,
-                                              action,
-                                              &nStillRunning) ;
-      if(rc != CURLM_OK) {
-        LOG(ERROR) << name_ << " CurlConnection CheckSocketCompleted curl_multi_socket_action failed! mcode: " << rc;
-        curl_code_ = curl_code_ != CURLE_OK ? curl_code_ : CURLE_FAILED_INIT;
-      }
-      if (nStillRunning > 0) {
-        return PEC_NOT_COMPLETE ;
-      }
-      if (curl_code_ != CURLE_OK) {
-        LOG(ERROR) << name_ << " CurlConnection CheckSocketCompleted failed! curl_code_: " << curl_code_;
-        CURLMcode mcode = curl_multi_remove_handle(curl_multi_handler_, curl_easy_handler_) ;
-        LOG_IF(ERROR, mcode != CURLM_OK) << name_ << " CurlConnection CheckSocketCompleted curl_multi_remove_handle failed! mcode: " << mcode;
-        socket_watcher_->FinishWatching() ;
-        return PEC_UNKNOW_ERROR ;
-      }
-      
-      return ReadCurlMultiInfo();
-    }
-    
     CURLMcode CurlConnection::Perform() {
-        return curl_multi_add_handle(curl_multi_handler_, curl_easy_handler_) ;
+        // 连接缓存由dispatcher里所有connection共用，host空闲太久时缓存的连接可能已经失效
+        const time_t TOO_OLD_THRESHOLD = 60; // 60秒后使用新连接
+        if(force_new_ || (auto_reset_ && multi_->IsHostIdleTooLong(host_, TOO_OLD_THRESHOLD))) {
+            force_new_ = false;
+            curl_easy_setopt(curl_easy_handler_, CURLOPT_FRESH_CONNECT, 1L);
+        }
+        CURLMcode rc = multi_->AddConnection(this, curl_easy_handler_);
+        running_ = (rc == CURLM_OK);
+        return rc;
     }
     
     void CurlConnection::Clean() {
@@ -271,13 +207,17 @@ namespace network {
         socket_watcher_timeout_ms_ = 0;
         buffer_read_->clean() ;
         buffer_write_->clean() ;
-        socket_watcher_ = NULL;
         curl_code_ = CURLE_OK;
         curl_errmsg_.clear();
         response_headers_.clear();
         complete_callback_.Reset();
         progress_callback_.Reset();
         abort_callback_.Reset();
+        data_callback_.Reset();
+        std::string().swap(data_chunk_);
+        pending_chunks_ = 0;
+        data_paused_ = false;
+        transfer_serial_++;
         if (curl_headers_) {
             curl_slist_free_all(curl_headers_);
             curl_headers_ = NULL;
@@ -286,19 +226,25 @@ namespace network {
             curl_slist_free_all(curl_resolve_);
             curl_resolve_ = NULL;
         }
-        // clean share SSL Session
-        curl_easy_setopt(curl_easy_handler_, CURLOPT_SHARE, NULL);
     }
     
-    void CurlConnection::ForceFinish(bool finish_watching) {
-        if(finish_watching) {
-            socket_watcher_->FinishWatching();
+    void CurlConnection::ForceFinish() {
+        LOG(ERROR) << name_ << " CurlConnection ForceFinish! curl code: " << curl_code_;
+        StopTransfer();
+        ProtocolErrorCode code = GetCurlErrorCode(curl_code_);
+        DoCompleteCallback(code == PEC_OK ? PEC_NETWORK_ERROR : code);
+    }
+
+    void CurlConnection::StopTransfer() {
+        if(running_) {
+            running_ = false;
+            multi_->RemoveConnection(curl_easy_handler_);
         }
-        socket_watcher_->OnSocketEvent(-1, Event_None);
     }
 
     void CurlConnection::SetUrl(const std::string& url) {
         url_ = url;
+        GetHostAndPort(url_, host_, port_);
         curl_easy_setopt(curl_easy_handler_, CURLOPT_URL, url.c_str());
         LOG(WARNING) << "Curl SetUrl: " << url;
     }
@@ -420,15 +366,28 @@ namespace network {
 
     void CurlConnection::SetShareSSLSession(bool value) {
         if(value) {
-            curl_easy_setopt(curl_easy_handler_, CURLOPT_SHARE, curl_share_handler_);
+            curl_easy_setopt(curl_easy_handler_, CURLOPT_SHARE, GetCurlShareHandle());
+            curl_easy_setopt(curl_easy_handler_, CURLOPT_SSL_SESSIONID_CACHE, 1L);
         }
         else {
             curl_easy_setopt(curl_easy_handler_, CURLOPT_SHARE, NULL);
+            curl_easy_setopt(curl_easy_handler_, CURLOPT_SSL_SESSIONID_CACHE, 0L);
         }
     }
+    void CurlConnection::SetMultiplex(bool value) {
+        curl_easy_setopt(curl_easy_handler_, CURLOPT_HTTP_VERSION, value ? CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_NONE);
+        curl_easy_setopt(curl_easy_handler_, CURLOPT_PIPEWAIT, value ? 1L : 0L);
+    }
+    void CurlConnection::SetDataCallback(const DataCallback& callback, size_t chunk_size) {
+        data_callback_ = callback;
+        data_chunk_size_ = chunk_size > 0 ? chunk_size : CURL_MAX_WRITE_SIZE;
+    }
     void CurlConnection::SetPost(bool post) {
         curl_easy_setopt(curl_easy_handler_, CURLOPT_POST, post ? 1L : 0L);
     }
+    void CurlConnection::SetNoBody(bool no_body) {
+        curl_easy_setopt(curl_easy_handler_, CURLOPT_NOBODY, no_body ? 1L : 0L);
+    }
     void CurlConnection::SetPostFields(const std::string &post_fields) {
         curl_easy_setopt(curl_easy_handler_, CURLOPT_POSTFIELDS, post_fields.c_str());
         curl_easy_setopt(curl_easy_handler_, CURLOPT_POSTFIELDSIZE, post_fields.size());
@@ -470,6 +429,34 @@ namespace network {
         return code;
     }
 
+    int64 CurlConnection::GetFirstByteTimeMs() {
+        double seconds = 0;
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_STARTTRANSFER_TIME, &seconds);
+        return (int64)(seconds * 1000);
+    }
+
+    void CurlConnection::GetTiming(RequestTiming* timing) {
+        // curl的时间都是从开始请求算起的累计值，换算成各阶段的耗时
+        double namelookup = 0, connect = 0, appconnect = 0, starttransfer = 0, total = 0;
+        long connects = 0;
+        char* primary_ip = NULL;
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_CONNECT_TIME, &connect);
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_APPCONNECT_TIME, &appconnect);
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_STARTTRANSFER_TIME, &starttransfer);
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_TOTAL_TIME, &total);
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_NUM_CONNECTS, &connects);
+        curl_easy_getinfo(curl_easy_handler_, CURLINFO_PRIMARY_IP, &primary_ip);
+        timing->dns_ms = (int64)(namelookup * 1000);
+        timing->connect_ms = connect > namelookup ? (int64)((connect - namelookup) * 1000) : 0;
+        timing->tls_ms = appconnect > connect ? (int64)((appconnect - connect) * 1000) : 0;
+        timing->first_byte_ms = (int64)(starttransfer * 1000);
+        timing->total_ms = (int64)(total * 1000);
+        // 连接之前就失败的请求也没有新建连接，不能算复用
+        timing->connected = primary_ip && primary_ip[0] != '\0';
+        timing->reused = timing->connected && connects == 0;
+    }
+
     const std::string& CurlConnection::GetRawHeader() const {
         return response_headers_;
     }
@@ -504,68 +491,19 @@ namespace network {
     }
   
 #pragma mark - curl callback
-    void CurlConnection::OnCurlSocketCallback(CURL *easy, curl_socket_t s, int what, void *socketp) {
-      if(what == CURL_POLL_REMOVE) {
-        if(!name_.empty()) {
-          LOG(INFO) << name_ << " curlconnection socket finish watching! socket: " << s; // just for logging
-        }
-        socket_watcher_->FinishWatching();
-        return;
-      }
-      if (NULL == socketp) {
-        if(!name_.empty()) {
-          LOG(INFO) << name_ << " curlconnection socket start watching! socket: " << s; // just for logging
-        }
-        curl_multi_assign(curl_multi_handler_, s, dispatcher_) ;
-      } else {
-        socket_watcher_->FinishWatching() ;
-      }
-      base::MessageLoopForIO::Mode mode ;
-      if(ConvertMode(what, s, mode)) {
-        socket_watcher_->Init(s, mode) ;
-        socket_watcher_->StartWatching() ;
-      }
-    }
-    
-    void CurlConnection::OnCurlTimerCallback(CURLM *multi, long timeout_ms) {
-      timeout_timer_.Stop();
-      LOG_IF(INFO, timeout_ms == 0) << "[DEBUG]CurlConnection CurlTimer Start! 时间: 0ms";
-      if (timeout_ms >= 0) {
-        auto closure = base::Bind(&CurlConnection::OnCurlTimerTimeout, weakptr_factory_.GetWeakPtr(), timeout_ms);
-        timeout_timer_.Start(FROM_HERE,
-                             base::TimeDelta::FromMilliseconds(timeout_ms),
-                             closure);
-      }
-    }
-    
-    void CurlConnection::OnCurlTimerTimeout(long timeout_ms) {
-      LOG_IF(INFO, timeout_ms == 0) << "[DEBUG]CurlConnection CurlTimer Running! 时间: 0ms";
-      int nStillRunning = 0 ;
-      CURLMcode rc = curl_multi_socket_action(curl_multi_handler_, CURL_SOCKET_TIMEOUT, 0, &nStillRunning) ;
-      if (rc > CURLM_OK) {
-        // curl发生了不可逆的错误
-        LOG(ERROR) << name_ << " CurlConnection TimerCallback curl_multi_socket_action fatal error: " << rc;
-        rc = curl_multi_remove_handle(curl_multi_handler_, curl_easy_handler_) ;
-        LOG_IF(ERROR, rc != CURLM_OK) << name_ << " CurlConnection TimerCallback curl_multi_remove_handle failed! mcode: " << rc;
-        curl_code_ = CURLE_FAILED_INIT;
-        return ;
-      }
-      if(nStillRunning > 0) {
-        return;
-      }
-      ProtocolErrorCode pec = ReadCurlMultiInfo();
-      DoCompleteCallback(pec);
-    }
-    
     void CurlConnection::OnCurlReadCallback(char* buffer, size_t& read_length) {
         buffer_read_->read(buffer, read_length);
     }
     
     bool CurlConnection::OnCurlWriteCallback(char* ptr, size_t size, size_t nmemb) {
       if(ptr) {
-        last_recv_time_ = time(NULL);
         if(!force_fail_ || ignore_force_fail_) {
-          buffer_write_->append(ptr, size*nmemb);
+          if(!data_callback_.is_null()) {
+            AppendDataChunk(ptr, size*nmemb);
+          } else if (!buffer_write_->append(ptr, size*nmemb)) {
+            LOG(ERROR) << name_ << " CurlConnection OnCurlWriteCallback 写入本地失败!";
+            return false;
+          }
           return true;
         } else {
           LOG(ERROR) << name_ << " CurlConnection OnCurlWriteCallback 强制失败标志为true，数据不会写入本地!";
@@ -652,22 +590,78 @@ namespace network {
     }
     
     bool CurlConnection::OnCurlProgressCallback() {
+        if(!progress_callback_.is_null()) {
+            progress_callback_.Run(this, download_total_, download_now_, upload_total_, upload_now_);
+        }
         if(!abort_callback_.is_null()) {
             return abort_callback_.Run();
         }
         return false;
     }
   
-    void CurlConnection::OnSocketEventCallback(int socket, SocketEvent event) {
-        ProtocolErrorCode pec = CheckSocketCompleted(socket, event) ;
-        if(!progress_callback_.is_null()) {
-            progress_callback_.Run(this, download_total_, download_now_, upload_total_, upload_now_);
+    void CurlConnection::OnTransferDone(CURLcode result) {
+        // CurlMulti已经把easy handle移出multi
+        running_ = false;
+        multi_->TouchHost(host_);
+        if(result != CURLE_OK) {
+            LOG(ERROR) << name_ << " CurlConnection transfer failed! curl code: " << result;
+        } else {
+            // 最后不满一块的数据在完成回调之前交出
+            FlushDataChunk();
+        }
+        DoCompleteCallback(CURLE_OK == result ? PEC_OK : GetCurlErrorCode(result));
+    }
+
+    bool CurlConnection::ShouldPauseData() {
+        if(data_callback_.is_null() || pending_chunks_ < MAX_PENDING_DATA_CHUNKS) {
+            return false;
         }
-        if (PEC_NOT_COMPLETE == pec) {
-            return ;
+        data_paused_ = true;
+        return true;
+    }
+
+    void CurlConnection::AppendDataChunk(const char* ptr, size_t length) {
+        while(length > 0) {
+            size_t len = std::min(length, data_chunk_size_ - data_chunk_.size());
+            data_chunk_.append(ptr, len);
+            ptr += len;
+            length -= len;
+            if(data_chunk_.size() >= data_chunk_size_) {
+                FlushDataChunk();
+            }
         }
-        timeout_timer_.Stop();
-        DoCompleteCallback(pec);
+    }
+
+    void CurlConnection::FlushDataChunk() {
+        if(data_chunk_.empty() || data_callback_.is_null()) {
+            return;
+        }
+        scoped_refptr<base::RefCountedString> chunk(base::RefCountedString::TakeString(&data_chunk_));
+        pending_chunks_++;
+        data_callback_.Run(chunk, base::Bind(&CurlConnection::OnDataConsumed,
+                                             weakptr_factory_.GetWeakPtr(),
+                                             transfer_serial_));
+    }
+
+    void CurlConnection::OnDataConsumed(int transfer_serial) {
+        if(transfer_serial != transfer_serial_) {
+            return;
+        }
+        pending_chunks_--;
+        if(data_paused_ && running_ && pending_chunks_ < MAX_PENDING_DATA_CHUNKS) {
+            data_paused_ = false;
+            curl_easy_pause(curl_easy_handler_, CURLPAUSE_CONT);
+            multi_->Wakeup();
+        }
+    }
+
+    void CurlConnection::OnIOTimeout() {
+        if(!running_) {
+            return;
+        }
+        LOG(ERROR) << name_ << " CurlConnection IO timeout! completed size: " << buffer_write_->getCompletedSize() << " bytes!";
+        StopTransfer();
+        DoCompleteCallback(PEC_OPERATION_TIMEOUT);
     }
   
     void CurlConnection::OnDebugCallback(curl_infotype type, const std::string& log) {
@@ -686,49 +680,13 @@ namespace network {
           }
           begin += 3;
           if(begin < url.size()) {
-            size_t end = url.find("/", begin);
-            if(end != std::string::npos) {
-              host = url.substr(begin, end-begin);
-            }
+            size_t end = url.find_first_of("/?#", begin);
+            host = url.substr(begin, end == std::string::npos ? std::string::npos : end-begin);
           }
         }
       }
     }
   
-    bool CurlConnection::ConvertMode(int what, curl_socket_t s, base::MessageLoopForIO::Mode& mode) {
-      if(CURL_POLL_NONE == what) {
-        return false;
-      } else if(CURL_POLL_INOUT == what) {
-        LOG(INFO) << name_ << " CurlConnection SocketCallback CURL_POLL_INOUT FD: " << s;
-        mode = base::MessageLoopForIO::WATCH_READ_WRITE ;
-      } else if(CURL_POLL_IN == what) {
-        LOG(INFO) << name_ << " CurlConnection SocketCallback CURL_POLL_IN FD: " << s;
-        mode = base::MessageLoopForIO::WATCH_READ ;
-      } else if(CURL_POLL_OUT == what) {
-        LOG(INFO) << name_ << " CurlConnection SocketCallback CURL_POLL_OUT FD: " << s;
-        mode = base::MessageLoopForIO::WATCH_WRITE ;
-      } else if(CURL_POLL_REMOVE == what) {
-        LOG(INFO) << name_ << " CurlConnection SocketCallback CURL_POLL_REMOVE FD: " << s;
-        return false;
-      }
-      return true;
-    }
-  
-    ProtocolErrorCode CurlConnection::ReadCurlMultiInfo() {
-      ProtocolErrorCode ret = PEC_OK ;
-      int msgs_in_queue = 0 ;
-      CURLMsg* msg = curl_multi_info_read(curl_multi_handler_, &msgs_in_queue) ;
-      if(msg && msg->msg == CURLMSG_DONE) {
-        CURLcode res = msg->data.result ;
-        ret = (CURLE_OK == res) ? PEC_OK : GetCurlErrorCode(res) ;
-      }
-      
-      CURLMcode mcode = curl_multi_remove_handle(curl_multi_handler_, curl_easy_handler_) ;
-      LOG_IF(ERROR, mcode != CURLM_OK) << name_ << " CurlConnection ReadCurlMultiInfo curl_multi_remove_handle failed! mcode: " << mcode;
-      socket_watcher_->FinishWatching() ;
-      return ret ;
-    }
-    
     void CurlConnection::DoCompleteCallback(ProtocolErrorCode err_code) {
         if(!complete_callback_.is_null()) {
             auto callback = complete_callback_;
@@ -737,30 +695,6 @@ namespace network {
     }
     
 #pragma mark - static callback
-    int CurlConnection::CurlSocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp) {
-        CurlConnection* pConnection = (CurlConnection*)userp ;
-        if (NULL == pConnection) {
-            NOTREACHED();
-            LOG(ERROR) << "CurlConnection CurlSocketCallback connection is NULL!";
-        }
-        else {
-            pConnection->OnCurlSocketCallback(easy, s, what, socketp);
-        }
-        return CURLM_OK;
-    }
-    
-    int CurlConnection::CurlTimerCallback(CURLM *multi, long timeout_ms, void *userp) {
-        CurlConnection* pConnection = (CurlConnection*)userp ;
-        if (NULL == pConnection) {
-            NOTREACHED();
-            LOG(ERROR) << "CurlConnection CurlTimerCallback connection is NULL!";
-        }
-        else {
-            pConnection->OnCurlTimerCallback(multi, timeout_ms);
-        }
-        return CURLM_OK;
-    }
-    
     size_t CurlConnection::CurlReadCallback(char *buffer, size_t size, size_t nitems, void *instream) {
         size_t ret = size * nitems ;
         if (ret < 1) {
@@ -789,6 +723,9 @@ namespace network {
           LOG(ERROR) << "CurlConnection CurlWriteCallback CurlConnection NULL!";
           return -1;
         } else {
+          if(pConnection->ShouldPauseData()) {
+            return CURL_WRITEFUNC_PAUSE; // curl保留这次的数据，恢复后重新回调
+          }
           if(pConnection->OnCurlWriteCallback(ptr, size, nmemb)) {
             pConnection->download_now_ += ret;
           } else {
@@ -830,16 +767,6 @@ namespace network {
         return 0;
     }
 
-    void CurlConnection::SocketEventCallback(void* connection, int socket, SocketEvent event) {
-        CurlConnection* pConnection = (CurlConnection*)connection;
-        if(NULL == pConnection) {
-            NOTREACHED();
-            LOG(ERROR) << "CurlConnection SocketEventCallback Connection is NULL!!!";
-        } else {
-            pConnection->OnSocketEventCallback(socket, event);
-        }
-    }
-  
     int CurlConnection::DebugCallback(CURL* e,
                                       curl_infotype info_type,
                                       char * ptr,
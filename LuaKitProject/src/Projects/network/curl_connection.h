@@ -3,7 +3,7 @@
 #include <list>
 #include <string>
 #include "curl/curl.h"
-#include "base/timer/timer.h"
+#include "base/memory/weak_ptr.h"
 
 #include "base_connection.h"
 #include "socket_watcher.h"
@@ -11,6 +11,7 @@
 
 namespace network {
   class AsyncTaskDispatcher;
+  class CurlMulti;
   class CurlConnection : public BaseConnectionImpl {
   public:
     enum APPLYSTATUS {
@@ -25,12 +26,13 @@ namespace network {
     ~CurlConnection();
     
     bool Init(bool need_read_func = true);
-    void CreateSocketWatcher(const CompleteCallback& complete_callback);
     ProtocolErrorCode GetCurlErrorCode(CURLcode curl_code);
-    ProtocolErrorCode CheckSocketCompleted(int socket, SocketEvent event);
     CURLMcode Perform();
     void Clean();
-    void ForceFinish(bool finish_watching);
+    /**
+     * @brief 把easy handle移出multi，并以失败结束当前请求
+     */
+    void ForceFinish();
     
     std::string Name() {return name_;}
     void SetUrl(const std::string& url);
@@ -54,7 +56,18 @@ namespace network {
     void SetProxy(const NetworkProxyInfo& info);
     void SetEnableCompress(bool value);
     void SetShareSSLSession(bool value);
+    /**
+     * @brief https请求协商HTTP/2，并等待同一个origin正在建立的连接以便作为stream复用
+     */
+    void SetMultiplex(bool value);
+    /**
+     * @brief 响应体不再写入buffer，每满chunk_size字节交给callback一次
+     * @note 未消费的块达到上限时暂停传输，consumed回调后恢复，内存占用只和chunk_size有关
+     */
+    void SetDataCallback(const DataCallback& callback, size_t chunk_size);
     void SetPost(bool post);
+    // HEAD请求，只收响应头
+    void SetNoBody(bool no_body);
     void SetPostFields(const std::string& post_fields);
 
     void SetPostForm(CurlHttpForm* form);
@@ -62,11 +75,22 @@ namespace network {
     void SetHttpHeaders(const std::list<std::pair<std::string, std::string>>& http_headers);
     void AddHttpHeader(const std::string& field, const std::string& value);
     long GetHttpCode();
+    /**
+     * @brief 从开始请求到收到第一个字节的毫秒数，没有收到响应时为0
+     */
+    int64 GetFirstByteTimeMs();
+    /**
+     * @brief 传输结束后取curl记录的各阶段耗时，字节数由调用者填
+     */
+    void GetTiming(RequestTiming* timing);
+    inline const std::string& Host() const { return host_; }
     std::string GetCurlErrMsg() const { return curl_errmsg_; }
     const std::string& GetRawHeader() const;
+    inline scoped_refptr<base::RefCountedString> TakeResponseContent() { return buffer_write_->takeContent(); }
     std::list<std::pair<std::string, std::string>> GetHttpHeaders();
     const std::list<std::string>& GetRequestHttpHeaders() { return request_headers_; }
     
+    inline int Index() const { return index_; }
     inline APPLYSTATUS ApplyStatus() { return apply_status_; }
     inline void SetStatus(APPLYSTATUS status) { apply_status_ = status; }
     inline void SetForceNewConnection(const bool value = true) { force_new_ = value; }
@@ -76,19 +100,22 @@ namespace network {
     inline void SetDownloadContentLength(int64_t value) { download_content_length_ = value; }
   
     inline CURLcode CurlCode() { return curl_code_; }
+    inline int64_t SocketWatcherTimeoutMs() const { return socket_watcher_timeout_ms_; }
     
   protected:
     std::list<std::pair<std::string, std::string>> ParseHttpHeaders();
       
   protected:
-    static int CurlSocketCallback(CURL *easy,      /* easy handle */
-                                  curl_socket_t s, /* socket */
-                                  int what,        /* see above */
-                                  void *userp,     /* private callback pointer */
-                                  void *socketp);  /* private socket pointer */
-    static int CurlTimerCallback(CURLM *multi,     /* multi handle */
-                                 long timeout_ms,  /* see above */
-                                 void *userp);     /* private callback pointer */
+    friend class CurlMulti;
+    /**
+     * @brief CurlMulti读到CURLMSG_DONE时调用，此时easy handle已经移出multi
+     */
+    void OnTransferDone(CURLcode result);
+    /**
+     * @brief 正在使用的socket超过SocketWatcherTimeoutMs没有读写事件
+     */
+    void OnIOTimeout();
+
     static size_t CurlReadCallback(char *buffer, size_t size, size_t nitems, void *instream);
     static size_t CurlWriteCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
     static size_t CurlHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata);
@@ -98,15 +125,8 @@ namespace network {
                                     double dlnow,
                                     double ultotal,
                                     double ulnow);
-    static void SocketEventCallback(void* connection, int socket, SocketEvent event);
     static int DebugCallback (CURL* e, curl_infotype info_type, char * ptr, size_t size, void * whatever);
     
-    void OnCurlSocketCallback(CURL *easy,
-                              curl_socket_t s,
-                              int what,
-                              void *socketp);
-    void OnCurlTimerCallback(CURLM *multi, long timeout_ms);
-    void OnCurlTimerTimeout(long timeout_ms);
     void OnCurlReadCallback(char* buffer, size_t& read_length);
     bool OnCurlWriteCallback(char* ptr, size_t size, size_t nmemb);
     void OnCurlHeaderCallback(char* buffer, size_t length);
@@ -115,13 +135,15 @@ namespace network {
      * @return true代表task被中止，需要停止传输数据，反之继续
      */
     bool OnCurlProgressCallback();
-    void OnSocketEventCallback(int socket, SocketEvent event);
     void OnDebugCallback(curl_infotype type, const std::string& log);
       
   private:
     void GetHostAndPort(const std::string& url, std::string& host, std::string& port);
-    bool ConvertMode(int what, curl_socket_t s, base::MessageLoopForIO::Mode& mode);
-    ProtocolErrorCode ReadCurlMultiInfo();
+    void StopTransfer();
+    bool ShouldPauseData();
+    void AppendDataChunk(const char* ptr, size_t length);
+    void FlushDataChunk();
+    void OnDataConsumed(int transfer_serial);
     void DoCompleteCallback(ProtocolErrorCode err_code);
       
   private:
@@ -148,30 +170,32 @@ namespace network {
     curl_slist* curl_headers_;
     curl_slist* curl_resolve_; // 用于设置host对应的ip
     CURL*       curl_easy_handler_;
-    CURLM*      curl_multi_handler_;
-    CURLSH*     curl_share_handler_;
+    CurlMulti*  multi_; // dispatcher共用的multi handle
     
     APPLYSTATUS apply_status_;
 
     scoped_ptr<CurlHttpForm> form_;
     
     bool force_new_; // 为true表示需要重新建立网络连接
-    bool auto_reset_; // 是否在connection空闲一段时间后自动使用新连接
-    
-    std::string curl_errmsg_;
+    bool auto_reset_; // 是否在host空闲一段时间后自动使用新连接
+    bool running_; // easy handle是否在multi里
     
-    scoped_refptr<SocketWatcher> socket_watcher_ ;
-  
-    base::OneShotTimer<CurlConnection> timeout_timer_;
+    // 流式响应
+    DataCallback data_callback_;
+    size_t data_chunk_size_;
+    std::string data_chunk_;
+    int pending_chunks_; // 已经交出但还没有被消费的块数
+    bool data_paused_;
+    int transfer_serial_; // 每次Clean加一，丢弃上一个请求迟到的consumed
     base::WeakPtrFactory<CurlConnection> weakptr_factory_;
     
+    std::string curl_errmsg_;
+    
     std::list<std::string> request_headers_;
       
     AsyncTaskDispatcher* dispatcher_ ;
       
     std::string response_headers_;
     
-    time_t last_recv_time_;
-    
   } ;
 }
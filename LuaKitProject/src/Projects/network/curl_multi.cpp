@@ -0,0 +1,224 @@
+#include "curl_multi.h"
+#include <vector>
+#include "base/bind.h"
+#include "base/message_loop/message_loop.h"
+#include "curl_connection.h"
+
+namespace network {
+
+    CurlMulti::CurlMulti(const std::string& name, int max_total_connections, int max_host_connections) :
+    name_(name),
+    max_total_connections_(max_total_connections),
+    multiplex_(false),
+    weakptr_factory_(this) {
+        curl_multi_handler_ = curl_multi_init();
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_SOCKETFUNCTION, CurlSocketCallback);
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_TIMERFUNCTION, CurlTimerCallback);
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_TIMERDATA, this);
+        // Connection
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAXCONNECTS, (long)max_total_connections); // the size of connection cache
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)max_total_connections); // max simultaneously open connections
+        SetMaxHostConnections(max_host_connections);
+    }
+
+    CurlMulti::~CurlMulti() {
+        timeout_timer_.Stop();
+        for(auto& it : connections_) {
+            curl_multi_remove_handle(curl_multi_handler_, it.first);
+        }
+        connections_.clear();
+        for(auto& it : sockets_) {
+            it.second.watcher->FinishWatching();
+        }
+        sockets_.clear();
+        curl_multi_cleanup(curl_multi_handler_);
+        curl_multi_handler_ = NULL;
+    }
+
+    CURLMcode CurlMulti::AddConnection(CurlConnection* connection, CURL* easy) {
+        connections_[easy] = connection;
+        CURLMcode rc = curl_multi_add_handle(curl_multi_handler_, easy);
+        if(rc != CURLM_OK) {
+            connections_.erase(easy);
+        }
+        return rc;
+    }
+
+    void CurlMulti::RemoveConnection(CURL* easy) {
+        auto it = connections_.find(easy);
+        if(it == connections_.end()) {
+            return;
+        }
+        CurlConnection* connection = it->second;
+        connections_.erase(it);
+        CURLMcode rc = curl_multi_remove_handle(curl_multi_handler_, easy);
+        LOG_IF(ERROR, rc != CURLM_OK) << name_ << " CurlMulti curl_multi_remove_handle failed! mcode: " << rc;
+        // 连接留在缓存里，socket不再属于这个connection
+        for(auto& socket : sockets_) {
+            if(socket.second.owner == connection) {
+                socket.second.owner = NULL;
+            }
+        }
+    }
+
+    void CurlMulti::SetMaxHostConnections(int count) {
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAX_HOST_CONNECTIONS, (long)count);
+    }
+
+    void CurlMulti::SetMaxTotalConnections(int count) {
+        max_total_connections_ = count;
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAXCONNECTS, (long)count);
+        if(!multiplex_) {
+            curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)count);
+        }
+    }
+
+    void CurlMulti::Wakeup() {
+        OnCurlTimerCallback(0);
+    }
+
+    void CurlMulti::SetMultiplex(bool multiplex) {
+        multiplex_ = multiplex;
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_PIPELINING, multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+        curl_multi_setopt(curl_multi_handler_, CURLMOPT_MAX_TOTAL_CONNECTIONS, multiplex ? 0L : (long)max_total_connections_);
+    }
+
+    bool CurlMulti::SupportsHttp2() {
+        curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+        return info && (info->features & CURL_VERSION_HTTP2);
+    }
+
+    bool CurlMulti::IsHostIdleTooLong(const std::string& host, time_t threshold) {
+        auto it = host_active_time_.find(host);
+        if(it == host_active_time_.end()) {
+            return false;
+        }
+        return (time(NULL) - it->second) > threshold;
+    }
+
+    void CurlMulti::TouchHost(const std::string& host) {
+        if(!host.empty()) {
+            host_active_time_[host] = time(NULL);
+        }
+    }
+
+    void CurlMulti::OnCurlSocketCallback(CURL *easy, curl_socket_t s, int what) {
+        if(what == CURL_POLL_REMOVE) {
+            auto it = sockets_.find(s);
+            if(it != sockets_.end()) {
+                LOG(INFO) << name_ << " CurlMulti socket finish watching! socket: " << s;
+                it->second.watcher->FinishWatching();
+                sockets_.erase(it);
+            }
+            return;
+        }
+        SocketInfo& info = sockets_[s];
+        auto connection = connections_.find(easy);
+        info.owner = connection != connections_.end() ? connection->second : NULL;
+        if(!info.watcher.get()) {
+            LOG(INFO) << name_ << " CurlMulti socket start watching! socket: " << s;
+            info.watcher = new SocketWatcher(base::Bind(&CurlMulti::OnSocketEvent,
+                                                        weakptr_factory_.GetWeakPtr()));
+        } else {
+            info.watcher->StopWatching();
+        }
+        if(info.owner) {
+            info.watcher->SetTimeoutMs(info.owner->SocketWatcherTimeoutMs());
+        }
+        base::MessageLoopForIO::Mode mode;
+        if(CURL_POLL_INOUT == what) {
+            mode = base::MessageLoopForIO::WATCH_READ_WRITE;
+        } else if(CURL_POLL_IN == what) {
+            mode = base::MessageLoopForIO::WATCH_READ;
+        } else if(CURL_POLL_OUT == what) {
+            mode = base::MessageLoopForIO::WATCH_WRITE;
+        } else {
+            return;
+        }
+        info.watcher->Init(s, mode);
+        info.watcher->StartWatching();
+    }
+
+    void CurlMulti::OnCurlTimerCallback(long timeout_ms) {
+        timeout_timer_.Stop();
+        if(timeout_ms >= 0) {
+            timeout_timer_.Start(FROM_HERE,
+                                 base::TimeDelta::FromMilliseconds(timeout_ms),
+                                 this,
+                                 &CurlMulti::OnCurlTimerTimeout);
+        }
+    }
+
+    void CurlMulti::OnCurlTimerTimeout() {
+        int running = 0;
+        CURLMcode rc = curl_multi_socket_action(curl_multi_handler_, CURL_SOCKET_TIMEOUT, 0, &running);
+        LOG_IF(ERROR, rc != CURLM_OK) << name_ << " CurlMulti TimerCallback curl_multi_socket_action failed! mcode: " << rc;
+        ReadMultiInfo();
+    }
+
+    void CurlMulti::OnSocketEvent(int socket, SocketEvent event) {
+        if(Event_None == event) {
+            // IO超时，只失败最近使用这个socket的connection
+            auto it = sockets_.find(socket);
+            if(it != sockets_.end() && it->second.owner) {
+                LOG(ERROR) << name_ << " CurlMulti IO timeout! socket: " << socket;
+                it->second.owner->OnIOTimeout();
+            }
+            return;
+        }
+        int running = 0;
+        int action = (event&Event_Read?CURL_CSELECT_IN:0)|(event&Event_Write?CURL_CSELECT_OUT:0);
+        CURLMcode rc = curl_multi_socket_action(curl_multi_handler_, socket, action, &running);
+        LOG_IF(ERROR, rc != CURLM_OK) << name_ << " CurlMulti curl_multi_socket_action failed! mcode: " << rc;
+        ReadMultiInfo();
+    }
+
+    void CurlMulti::ReadMultiInfo() {
+        std::vector<std::pair<CURL*, CURLcode> > done;
+        int msgs_in_queue = 0;
+        CURLMsg* msg = NULL;
+        while((msg = curl_multi_info_read(curl_multi_handler_, &msgs_in_queue)) != NULL) {
+            if(msg->msg == CURLMSG_DONE) {
+                done.push_back(std::make_pair(msg->easy_handle, msg->data.result));
+            }
+        }
+        // 完成回调可能让上层析构dispatcher，也就析构了this
+        base::WeakPtr<CurlMulti> weak_this = weakptr_factory_.GetWeakPtr();
+        for(auto& it : done) {
+            if(!weak_this.get()) {
+                return;
+            }
+            auto connection = connections_.find(it.first);
+            if(connection == connections_.end()) {
+                continue;
+            }
+            CurlConnection* pConnection = connection->second;
+            RemoveConnection(it.first);
+            pConnection->OnTransferDone(it.second);
+        }
+    }
+
+#pragma mark - static callback
+    int CurlMulti::CurlSocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp) {
+        CurlMulti* multi = (CurlMulti*)userp;
+        if(NULL == multi) {
+            NOTREACHED();
+            LOG(ERROR) << "CurlMulti CurlSocketCallback multi is NULL!";
+        } else {
+            multi->OnCurlSocketCallback(easy, s, what);
+        }
+        return CURLM_OK;
+    }
+
+    int CurlMulti::CurlTimerCallback(CURLM *multi, long timeout_ms, void *userp) {
+        CurlMulti* pMulti = (CurlMulti*)userp;
+        if(NULL == pMulti) {
+            NOTREACHED();
+            LOG(ERROR) << "CurlMulti CurlTimerCallback multi is NULL!";
+        } else {
+            pMulti->OnCurlTimerCallback(timeout_ms);
+        }
+        return CURLM_OK;
+    }
+}
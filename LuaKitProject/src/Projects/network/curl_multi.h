@@ -0,0 +1,81 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include "curl/curl.h"
+#include "base/memory/weak_ptr.h"
+#include "base/timer/timer.h"
+
+#include "socket_watcher.h"
+
+namespace network {
+  class CurlConnection;
+
+  /**
+   * @brief 一个dispatcher里所有CurlConnection共用的multi handle
+   * @note 连接缓存、socket监听和curl定时器都只有一份，同一个后台的请求可以复用已经建立好的连接，只能在IO线程使用
+   */
+  class CurlMulti {
+  public:
+    /**
+     * @param max_total_connections 同时打开的连接数上限，也是连接缓存的大小
+     * @param max_host_connections 同一个host同时打开的连接数上限，超出的请求由curl排队
+     */
+    CurlMulti(const std::string& name, int max_total_connections, int max_host_connections);
+    ~CurlMulti();
+
+    CURLMcode AddConnection(CurlConnection* connection, CURL* easy);
+    void RemoveConnection(CURL* easy);
+
+    void SetMaxHostConnections(int count);
+    /**
+     * @brief 连接池伸缩时同步同时打开的连接数上限，多路复用时不限制
+     */
+    void SetMaxTotalConnections(int count);
+    /**
+     * @brief 马上驱动一次multi，用于curl_easy_pause恢复传输之后
+     */
+    void Wakeup();
+    /**
+     * @brief 打开后同一个origin的请求作为HTTP/2 stream复用一个连接，不再限制同时打开的连接数
+     */
+    void SetMultiplex(bool multiplex);
+    /**
+     * @brief curl是否编译了HTTP/2支持(nghttp2)
+     */
+    static bool SupportsHttp2();
+
+    /**
+     * @brief host上次完成请求距今超过threshold秒，缓存里的连接可能已经被中间设备断开
+     */
+    bool IsHostIdleTooLong(const std::string& host, time_t threshold);
+    void TouchHost(const std::string& host);
+
+  private:
+    struct SocketInfo {
+      SocketInfo() : owner(NULL) {}
+      scoped_refptr<SocketWatcher> watcher;
+      CurlConnection* owner; // 最近一次操作这个socket的connection，IO超时由它失败
+    };
+
+    static int CurlSocketCallback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp);
+    static int CurlTimerCallback(CURLM *multi, long timeout_ms, void *userp);
+
+    void OnCurlSocketCallback(CURL *easy, curl_socket_t s, int what);
+    void OnCurlTimerCallback(long timeout_ms);
+    void OnCurlTimerTimeout();
+    void OnSocketEvent(int socket, SocketEvent event);
+    void ReadMultiInfo();
+
+  private:
+    std::string name_; // for logging
+    int max_total_connections_;
+    bool multiplex_;
+    CURLM* curl_multi_handler_;
+    std::map<CURL*, CurlConnection*> connections_;
+    std::map<curl_socket_t, SocketInfo> sockets_;
+    std::map<std::string, time_t> host_active_time_;
+    base::OneShotTimer<CurlMulti> timeout_timer_;
+    base::WeakPtrFactory<CurlMulti> weakptr_factory_;
+  };
+}
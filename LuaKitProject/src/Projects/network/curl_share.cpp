@@ -0,0 +1,42 @@
+#include "curl_share.h"
+#include "base/lazy_instance.h"
+#include "base/synchronization/lock.h"
+
+namespace network {
+
+  class CurlShare {
+  public:
+    CurlShare() {
+      share_handler_ = curl_share_init();
+      curl_share_setopt(share_handler_, CURLSHOPT_LOCKFUNC, LockCallback);
+      curl_share_setopt(share_handler_, CURLSHOPT_UNLOCKFUNC, UnlockCallback);
+      curl_share_setopt(share_handler_, CURLSHOPT_USERDATA, this);
+      curl_share_setopt(share_handler_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+      curl_share_setopt(share_handler_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      // 连接缓存不共享，每个dispatcher的multi handle各自缓存，大小受CURLMOPT_MAXCONNECTS限制
+    }
+
+    CURLSH* handler() { return share_handler_; }
+
+  private:
+    static void LockCallback(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+      CurlShare* share = (CurlShare*)userptr;
+      share->locks_[data < CURL_LOCK_DATA_LAST ? data : CURL_LOCK_DATA_SHARE].Acquire();
+    }
+
+    static void UnlockCallback(CURL* handle, curl_lock_data data, void* userptr) {
+      CurlShare* share = (CurlShare*)userptr;
+      share->locks_[data < CURL_LOCK_DATA_LAST ? data : CURL_LOCK_DATA_SHARE].Release();
+    }
+
+    CURLSH* share_handler_;
+    base::Lock locks_[CURL_LOCK_DATA_LAST]; // 每种共享数据一把锁
+  };
+
+  // 进程退出前可能还有easy handle在用，不析构
+  static base::LazyInstance<CurlShare>::Leaky g_curl_share = LAZY_INSTANCE_INITIALIZER;
+
+  CURLSH* GetCurlShareHandle() {
+    return g_curl_share.Get().handler();
+  }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "curl/curl.h"
+
+namespace network {
+  /**
+   * @brief 进程内所有CurlConnection共用的share handle，共享SSL session和DNS缓存
+   * @note 带锁回调，可以在任意线程的easy handle上使用
+   */
+  CURLSH* GetCurlShareHandle();
+}
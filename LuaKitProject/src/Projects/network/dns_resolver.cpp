@@ -0,0 +1,160 @@
+#include "dns_resolver.h"
+#include "base/bind.h"
+#include "base/lazy_instance.h"
+#include "network/async_socket.h"
+#include <netinet/in.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace net {
+
+const static size_t DNS_RESOLVER_THREADS = 4;
+const static size_t DNS_CACHE_MAX_ENTRIES = 256;
+const static int64 DNS_POSITIVE_TTL_SECONDS = 60;  // getaddrinfo拿不到记录的TTL，用固定值
+const static int64 DNS_NEGATIVE_TTL_SECONDS = 5;
+
+// 进程退出时线程池里可能还有getaddrinfo没返回，不析构
+static base::LazyInstance<DnsResolver>::Leaky g_dns_resolver = LAZY_INSTANCE_INITIALIZER;
+
+static void SetSockaddrPort(sockaddr_data* addr, uint16_t port) {
+    uint16_t net_port = htons(port);
+    const sockaddr* sa = (const sockaddr*)addr->data();
+    if (sa->sa_family == AF_INET && addr->size() >= sizeof(sockaddr_in)) {
+        memcpy(&(*addr)[offsetof(sockaddr_in, sin_port)], &net_port, sizeof(net_port));
+    } else if (sa->sa_family == AF_INET6 && addr->size() >= sizeof(sockaddr_in6)) {
+        memcpy(&(*addr)[offsetof(sockaddr_in6, sin6_port)], &net_port, sizeof(net_port));
+    }
+}
+
+DnsResolver* DnsResolver::GetInstance() {
+    return g_dns_resolver.Pointer();
+}
+
+DnsResolver::DnsResolver()
+    : pool_(new base::SequencedWorkerPool(DNS_RESOLVER_THREADS, "AsyncSocketDNS")),
+      positive_ttl_(base::TimeDelta::FromSeconds(DNS_POSITIVE_TTL_SECONDS)),
+      negative_ttl_(base::TimeDelta::FromSeconds(DNS_NEGATIVE_TTL_SECONDS)) {
+}
+
+DnsResolver::~DnsResolver() {
+}
+
+void DnsResolver::Resolve(const std::string& hostname, uint16_t port, const ResolveCallback& callback) {
+    Waiter waiter;
+    waiter.loop = base::MessageLoopProxy::current();
+    waiter.port = port;
+    waiter.callback = callback;
+    AddWaiter(hostname, waiter);
+}
+
+void DnsResolver::RunResolver(const DnsResolverCallback& resolver,
+                              const std::string& hostname,
+                              uint16_t port,
+                              const ResolveCallback& callback) {
+    Waiter waiter;
+    waiter.loop = base::MessageLoopProxy::current();
+    waiter.port = port;
+    waiter.callback = callback;
+    pool_->PostWorkerTaskWithShutdownBehavior(FROM_HERE,
+                                              base::Bind(&DnsResolver::DoRunResolver, base::Unretained(this), resolver, hostname, waiter),
+                                              base::SequencedWorkerPool::CONTINUE_ON_SHUTDOWN);
+}
+
+void DnsResolver::SetCacheTtl(base::TimeDelta positive_ttl, base::TimeDelta negative_ttl) {
+    base::AutoLock lock(lock_);
+    positive_ttl_ = positive_ttl;
+    negative_ttl_ = negative_ttl;
+}
+
+void DnsResolver::Invalidate(const std::string& hostname) {
+    base::AutoLock lock(lock_);
+    cache_.erase(hostname);
+}
+
+void DnsResolver::ClearCache() {
+    base::AutoLock lock(lock_);
+    cache_.clear();
+}
+
+void DnsResolver::AddWaiter(const std::string& hostname, const Waiter& waiter) {
+    std::vector<sockaddr_data> addrs;
+    {
+        base::AutoLock lock(lock_);
+        auto cached = cache_.find(hostname);
+        if (cached != cache_.end() && cached->second.expires <= base::TimeTicks::Now()) {
+            cache_.erase(cached);
+            cached = cache_.end();
+        }
+        if (cached == cache_.end()) {
+            auto pending = pending_.find(hostname);
+            if (pending != pending_.end()) {
+                // 已经在解析，等这次的结果
+                pending->second.push_back(waiter);
+                return;
+            }
+            pending_[hostname].push_back(waiter);
+            pool_->PostWorkerTaskWithShutdownBehavior(FROM_HERE,
+                                                      base::Bind(&DnsResolver::DoResolve, base::Unretained(this), hostname),
+                                                      base::SequencedWorkerPool::CONTINUE_ON_SHUTDOWN);
+            return;
+        }
+        addrs = cached->second.addrs;
+    }
+    Reply(waiter, addrs);
+}
+
+void DnsResolver::DoResolve(const std::string& hostname) {
+    // 端口在回调前按各自的请求填
+    std::vector<sockaddr_data> addrs = AsyncSocket::DefaultDnsResolver().Run(hostname, 0);
+    std::vector<Waiter> waiters;
+    {
+        base::AutoLock lock(lock_);
+        StoreLocked(hostname, addrs);
+        auto pending = pending_.find(hostname);
+        if (pending != pending_.end()) {
+            waiters.swap(pending->second);
+            pending_.erase(pending);
+        }
+    }
+    for (auto& waiter : waiters) {
+        Reply(waiter, addrs);
+    }
+}
+
+void DnsResolver::DoRunResolver(const DnsResolverCallback& resolver, const std::string& hostname, const Waiter& waiter) {
+    std::vector<sockaddr_data> results = resolver.Run(hostname, waiter.port);
+    if (results.size() == 1 && results[0] == AsyncSocket::UseDefaultResolver) {
+        AddWaiter(hostname, waiter);
+        return;
+    }
+    waiter.loop->PostTask(FROM_HERE, base::Bind(waiter.callback, results));
+}
+
+void DnsResolver::StoreLocked(const std::string& hostname, const std::vector<sockaddr_data>& addrs) {
+    lock_.AssertAcquired();
+    base::TimeTicks now = base::TimeTicks::Now();
+    if (cache_.size() >= DNS_CACHE_MAX_ENTRIES) {
+        for (auto it = cache_.begin(); it != cache_.end();) {
+            if (it->second.expires <= now) {
+                cache_.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        if (cache_.size() >= DNS_CACHE_MAX_ENTRIES) {
+            cache_.erase(cache_.begin());
+        }
+    }
+    CacheEntry& entry = cache_[hostname];
+    entry.addrs = addrs;
+    entry.expires = now + (addrs.empty() ? negative_ttl_ : positive_ttl_);
+}
+
+void DnsResolver::Reply(const Waiter& waiter, const std::vector<sockaddr_data>& addrs) {
+    std::vector<sockaddr_data> results = addrs;
+    for (auto& addr : results) {
+        SetSockaddrPort(&addr, waiter.port);
+    }
+    waiter.loop->PostTask(FROM_HERE, base::Bind(waiter.callback, results));
+}
+}
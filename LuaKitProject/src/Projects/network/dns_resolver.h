@@ -0,0 +1,77 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "base/callback.h"
+#include "base/memory/ref_counted.h"
+#include "base/message_loop/message_loop_proxy.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/sequenced_worker_pool.h"
+#include "base/time/time.h"
+
+namespace net {
+
+// AsyncSocket和DnsResolver共用的类型只在这里定义，async_socket.h通过include使用
+typedef std::string sockaddr_data;
+typedef base::Callback<std::vector<sockaddr_data>(const std::string&, uint16_t port)> DnsResolverCallback;
+
+/**
+ * @brief 进程内共用的域名解析，在固定大小的线程池里调用getaddrinfo
+ * @note 成功和失败的结果都按TTL缓存，同一个域名同时只解析一次，其他请求等这次的结果；
+ *       可以在任意有MessageLoop的线程调用，结果回调到调用线程
+ */
+class DnsResolver {
+public:
+    typedef base::Callback<void(const std::vector<sockaddr_data>&)> ResolveCallback;
+
+    static DnsResolver* GetInstance();
+
+    /**
+     * @brief 用系统解析，结果里的地址端口都设为port，失败时结果为空
+     */
+    void Resolve(const std::string& hostname, uint16_t port, const ResolveCallback& callback);
+
+    /**
+     * @brief 在线程池里执行自定义的resolver，返回UseDefaultResolver时改用Resolve
+     * @note 自定义resolver的结果不缓存
+     */
+    void RunResolver(const DnsResolverCallback& resolver,
+                     const std::string& hostname,
+                     uint16_t port,
+                     const ResolveCallback& callback);
+
+    void SetCacheTtl(base::TimeDelta positive_ttl, base::TimeDelta negative_ttl);
+    void Invalidate(const std::string& hostname);
+    void ClearCache();
+
+    DnsResolver();
+    ~DnsResolver();
+
+private:
+    struct Waiter {
+        scoped_refptr<base::MessageLoopProxy> loop;
+        uint16_t port;
+        ResolveCallback callback;
+    };
+    struct CacheEntry {
+        std::vector<sockaddr_data> addrs;
+        base::TimeTicks expires;
+    };
+
+    void AddWaiter(const std::string& hostname, const Waiter& waiter);
+    void DoResolve(const std::string& hostname);
+    void DoRunResolver(const DnsResolverCallback& resolver, const std::string& hostname, const Waiter& waiter);
+    void StoreLocked(const std::string& hostname, const std::vector<sockaddr_data>& addrs);
+    static void Reply(const Waiter& waiter, const std::vector<sockaddr_data>& addrs);
+
+    scoped_refptr<base::SequencedWorkerPool> pool_;
+    base::Lock lock_; // 保护下面的成员
+    std::map<std::string, CacheEntry> cache_;
+    std::map<std::string, std::vector<Waiter> > pending_;
+    base::TimeDelta positive_ttl_;
+    base::TimeDelta negative_ttl_;
+
+    DISALLOW_COPY_AND_ASSIGN(DnsResolver);
+};
+}
@@ -0,0 +1,290 @@
+#include "http_cache.h"
+#include "curl/curl.h"
+#include "base/bind.h"
+#include "base/file_util.h"
+#include "base/files/file_enumerator.h"
+#include "base/md5.h"
+#include "base/pickle.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_util.h"
+#include "common/business_client_thread.h"
+
+namespace network {
+
+    const static int DISK_FORMAT_VERSION = 1;
+    const static int64 DISK_CACHE_MAX_AGE = 7*24*3600; // 磁盘上7天没有更新的缓存在启动时删除
+
+    // name必须是小写
+    static bool FindHeader(const HTTP_HEADERS& headers, const char* name, std::string* value) {
+        for(auto& it : headers) {
+            if(LowerCaseEqualsASCII(it.first, name)) {
+                *value = it.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 返回过期时间，0表示每次都要验证，storable为false表示不能缓存
+    static int64 ComputeExpires(const HTTP_HEADERS& headers, int64 now, bool* storable) {
+        *storable = true;
+        std::string value;
+        // 缓存只按URL查找，响应随请求头变化(Vary)时不能缓存，否则会把一个请求的响应交给另一个
+        if(FindHeader(headers, "vary", &value)) {
+            *storable = false;
+            return 0;
+        }
+        if(FindHeader(headers, "cache-control", &value)) {
+            std::string cache_control = StringToLowerASCII(value);
+            if(cache_control.find("no-store") != std::string::npos) {
+                *storable = false;
+                return 0;
+            }
+            if(cache_control.find("no-cache") != std::string::npos) {
+                return 0;
+            }
+            size_t found = cache_control.find("max-age=");
+            if(found != std::string::npos) {
+                found += strlen("max-age=");
+                size_t end = cache_control.find_first_of(", ", found);
+                int64 max_age = 0;
+                base::StringToInt64(cache_control.substr(found, end == std::string::npos ? std::string::npos : end-found), &max_age);
+                int64 age = 0;
+                if(FindHeader(headers, "age", &value)) {
+                    base::StringToInt64(value, &age);
+                }
+                return now + max_age - age;
+            }
+        }
+        if(FindHeader(headers, "expires", &value)) {
+            time_t expires = curl_getdate(value.c_str(), NULL);
+            if(expires < 0) {
+                return 0;
+            }
+            // 按服务器的Date换算，避免本地时钟不准
+            time_t date = -1;
+            if(FindHeader(headers, "date", &value) && (date = curl_getdate(value.c_str(), NULL)) >= 0) {
+                return now + (expires - date);
+            }
+            return expires;
+        }
+        return 0;
+    }
+
+    static void WriteEntryToDisk(const base::FilePath& path, const scoped_refptr<HttpCacheEntry>& entry) {
+        Pickle pickle;
+        pickle.WriteInt(DISK_FORMAT_VERSION);
+        pickle.WriteString(entry->url);
+        pickle.WriteInt64(entry->http_code);
+        pickle.WriteInt64(entry->expires);
+        pickle.WriteString(entry->etag);
+        pickle.WriteString(entry->last_modified);
+        pickle.WriteInt((int)entry->headers.size());
+        for(auto& it : entry->headers) {
+            pickle.WriteString(it.first);
+            pickle.WriteString(it.second);
+        }
+        pickle.WriteString(entry->body->data());
+        if(!base::CreateDirectory(path.DirName())) {
+            LOG(ERROR) << "HttpCache create directory failed! " << path.DirName().value();
+            return;
+        }
+        // 先写临时文件再替换，读的时候不会看到写了一半的缓存
+        base::FilePath temp = path.AddExtension("tmp");
+        int size = (int)pickle.size();
+        if(file_util::WriteFile(temp, (const char*)pickle.data(), size) != size ||
+           !base::ReplaceFile(temp, path, NULL)) {
+            LOG(ERROR) << "HttpCache write failed! " << path.value();
+            base::DeleteFile(temp, false);
+        }
+    }
+
+    static scoped_refptr<HttpCacheEntry> ReadEntryFromDisk(const base::FilePath& path, const std::string& url) {
+        std::string data;
+        if(!base::ReadFileToString(path, &data)) {
+            return NULL;
+        }
+        Pickle pickle(data.data(), (int)data.size());
+        PickleIterator iter(pickle);
+        scoped_refptr<HttpCacheEntry> entry(new HttpCacheEntry());
+        int version = 0;
+        int64 http_code = 0;
+        int count = 0;
+        std::string body;
+        if(!iter.ReadInt(&version) || version != DISK_FORMAT_VERSION ||
+           !iter.ReadString(&entry->url) || entry->url != url ||
+           !iter.ReadInt64(&http_code) ||
+           !iter.ReadInt64(&entry->expires) ||
+           !iter.ReadString(&entry->etag) ||
+           !iter.ReadString(&entry->last_modified) ||
+           !iter.ReadLength(&count)) {
+            return NULL;
+        }
+        for(int i = 0; i < count; i++) {
+            std::string key, value;
+            if(!iter.ReadString(&key) || !iter.ReadString(&value)) {
+                return NULL;
+            }
+            entry->headers.push_back(std::make_pair(key, value));
+        }
+        if(!iter.ReadString(&body)) {
+            return NULL;
+        }
+        entry->http_code = (long)http_code;
+        entry->body = base::RefCountedString::TakeString(&body);
+        return entry;
+    }
+
+    static void TrimDiskCache(const base::FilePath& disk_path) {
+        base::Time expired = base::Time::Now() - base::TimeDelta::FromSeconds(DISK_CACHE_MAX_AGE);
+        base::FileEnumerator enumerator(disk_path, false, base::FileEnumerator::FILES);
+        for(base::FilePath name = enumerator.Next(); !name.empty(); name = enumerator.Next()) {
+            if(enumerator.GetInfo().GetLastModifiedTime() < expired) {
+                base::DeleteFile(name, false);
+            }
+        }
+    }
+
+    bool HttpCacheEntry::IsFresh() const {
+        return time(NULL) < expires;
+    }
+
+    size_t HttpCacheEntry::Size() const {
+        size_t size = url.size() + etag.size() + last_modified.size() + body->size();
+        for(auto& it : headers) {
+            size += it.first.size() + it.second.size();
+        }
+        return size;
+    }
+
+    HttpCache::HttpCache(const base::FilePath& disk_path, size_t memory_capacity) :
+    disk_path_(disk_path),
+    memory_capacity_(memory_capacity),
+    memory_size_(0),
+    weakptr_factory_(this) {
+        DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+        BusinessThread::PostTask(BusinessThread::FILE, FROM_HERE, base::Bind(&TrimDiskCache, disk_path_));
+    }
+
+    HttpCache::~HttpCache() {
+    }
+
+    void HttpCache::Lookup(const std::string& url, const LookupCallback& callback) {
+        DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+        auto it = memory_entries_.find(url);
+        if(it != memory_entries_.end()) {
+            // 移到LRU最前面
+            lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+            callback.Run(*it->second);
+            return;
+        }
+        BusinessThread::PostTaskAndReplyWithResult<scoped_refptr<HttpCacheEntry> >(
+            BusinessThread::FILE,
+            FROM_HERE,
+            base::Bind(&ReadEntryFromDisk, GetDiskPath(url), url),
+            base::Bind(&HttpCache::OnDiskLookup, weakptr_factory_.GetWeakPtr(), url, callback));
+    }
+
+    void HttpCache::OnDiskLookup(const base::WeakPtr<HttpCache>& cache,
+                                 const std::string& url,
+                                 const LookupCallback& callback,
+                                 scoped_refptr<HttpCacheEntry> entry) {
+        if(cache && entry.get()) {
+            cache->PutMemory(entry);
+        }
+        callback.Run(entry);
+    }
+
+    void HttpCache::Store(const scoped_refptr<HttpCacheEntry>& entry) {
+        DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+        PutMemory(entry);
+        BusinessThread::PostTask(BusinessThread::FILE, FROM_HERE,
+                                 base::Bind(&WriteEntryToDisk, GetDiskPath(entry->url), entry));
+    }
+
+    void HttpCache::Remove(const std::string& url) {
+        DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+        RemoveMemory(url);
+        BusinessThread::PostTask(BusinessThread::FILE, FROM_HERE,
+                                 base::Bind(base::IgnoreResult(&base::DeleteFile), GetDiskPath(url), false));
+    }
+
+    void HttpCache::PutMemory(const scoped_refptr<HttpCacheEntry>& entry) {
+        RemoveMemory(entry->url);
+        size_t size = entry->Size();
+        if(size > memory_capacity_) {
+            return;
+        }
+        lru_list_.push_front(entry);
+        memory_entries_[entry->url] = lru_list_.begin();
+        memory_size_ += size;
+        while(memory_size_ > memory_capacity_ && !lru_list_.empty()) {
+            RemoveMemory(lru_list_.back()->url);
+        }
+    }
+
+    void HttpCache::RemoveMemory(const std::string& url) {
+        auto it = memory_entries_.find(url);
+        if(it == memory_entries_.end()) {
+            return;
+        }
+        memory_size_ -= (*it->second)->Size();
+        lru_list_.erase(it->second);
+        memory_entries_.erase(it);
+    }
+
+    base::FilePath HttpCache::GetDiskPath(const std::string& url) const {
+        return disk_path_.AppendASCII(base::MD5String(url));
+    }
+
+    scoped_refptr<HttpCacheEntry> HttpCache::CreateEntry(const std::string& url,
+                                                         long http_code,
+                                                         const HTTP_HEADERS& headers,
+                                                         const scoped_refptr<base::RefCountedString>& body) {
+        bool storable = true;
+        int64 expires = ComputeExpires(headers, time(NULL), &storable);
+        if(!storable) {
+            return NULL;
+        }
+        scoped_refptr<HttpCacheEntry> entry(new HttpCacheEntry());
+        entry->url = url;
+        entry->http_code = http_code;
+        entry->headers = headers;
+        entry->body = body;
+        entry->expires = expires;
+        FindHeader(headers, "etag", &entry->etag);
+        FindHeader(headers, "last-modified", &entry->last_modified);
+        // 没有过期时间也没有验证字段的响应缓存了也用不上
+        if(expires == 0 && entry->etag.empty() && entry->last_modified.empty()) {
+            return NULL;
+        }
+        return entry;
+    }
+
+    scoped_refptr<HttpCacheEntry> HttpCache::RefreshEntry(const scoped_refptr<HttpCacheEntry>& entry,
+                                                          const HTTP_HEADERS& headers) {
+        HTTP_HEADERS merged = entry->headers;
+        for(auto& header : headers) {
+            bool replaced = false;
+            for(auto& it : merged) {
+                if(LowerCaseEqualsASCII(it.first, StringToLowerASCII(header.first).c_str())) {
+                    it.second = header.second;
+                    replaced = true;
+                }
+            }
+            if(!replaced) {
+                merged.push_back(header);
+            }
+        }
+        return CreateEntry(entry->url, entry->http_code, merged, entry->body);
+    }
+
+    void HttpCache::AddConditionalHeaders(const scoped_refptr<HttpCacheEntry>& entry, HTTP_HEADERS* headers) {
+        if(!entry->etag.empty()) {
+            headers->push_back(std::make_pair("If-None-Match", entry->etag));
+        }
+        if(!entry->last_modified.empty()) {
+            headers->push_back(std::make_pair("If-Modified-Since", entry->last_modified));
+        }
+    }
+}
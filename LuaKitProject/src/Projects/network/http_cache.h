@@ -0,0 +1,93 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "base/memory/weak_ptr.h"
+#include "network_define.h"
+
+namespace network {
+
+  enum HttpCachePolicy {
+    HTTP_CACHE_NONE = 0,      // 不读也不写缓存
+    HTTP_CACHE_DEFAULT,       // 新鲜的缓存直接返回，过期的用ETag/Last-Modified向服务器验证
+    HTTP_CACHE_REVALIDATE,    // 有缓存也总是向服务器验证
+    HTTP_CACHE_PREFER_CACHE,  // 有缓存就返回，不管是否过期，没有才请求网络
+  };
+
+  // 一条缓存，创建之后不再修改，可以在线程之间共享
+  class HttpCacheEntry : public base::RefCountedThreadSafe<HttpCacheEntry> {
+  public:
+    HttpCacheEntry() : http_code(0), expires(0) {}
+    std::string url;
+    long http_code;
+    HTTP_HEADERS headers;
+    scoped_refptr<base::RefCountedString> body;
+    int64 expires; // time_t，这个时间之前不需要验证
+    std::string etag;
+    std::string last_modified;
+
+    bool IsFresh() const;
+    size_t Size() const;
+
+  private:
+    friend class base::RefCountedThreadSafe<HttpCacheEntry>;
+    ~HttpCacheEntry() {}
+  };
+
+  /**
+   * @brief 内存LRU加磁盘目录的HTTP缓存，只能在IO线程使用，磁盘读写在FILE线程
+   */
+  class HttpCache {
+  public:
+    typedef base::Callback<void(const scoped_refptr<HttpCacheEntry>&)> LookupCallback;
+
+    HttpCache(const base::FilePath& disk_path, size_t memory_capacity);
+    ~HttpCache();
+
+    /**
+     * @brief 先查内存再查磁盘，没有缓存时callback的参数为NULL
+     */
+    void Lookup(const std::string& url, const LookupCallback& callback);
+    void Store(const scoped_refptr<HttpCacheEntry>& entry);
+    void Remove(const std::string& url);
+
+    /**
+     * @brief 用响应创建缓存，响应不允许缓存(no-store或者带Vary)时返回NULL
+     */
+    static scoped_refptr<HttpCacheEntry> CreateEntry(const std::string& url,
+                                                     long http_code,
+                                                     const HTTP_HEADERS& headers,
+                                                     const scoped_refptr<base::RefCountedString>& body);
+    /**
+     * @brief 304之后把新的响应头合并进缓存，重新计算过期时间，响应体沿用旧的
+     */
+    static scoped_refptr<HttpCacheEntry> RefreshEntry(const scoped_refptr<HttpCacheEntry>& entry,
+                                                      const HTTP_HEADERS& headers);
+    /**
+     * @brief 按缓存的验证字段加上If-None-Match/If-Modified-Since
+     */
+    static void AddConditionalHeaders(const scoped_refptr<HttpCacheEntry>& entry, HTTP_HEADERS* headers);
+
+  private:
+    // 缓存在磁盘读完之前被替换或者销毁时也要回调，否则等待的请求永远不会完成
+    static void OnDiskLookup(const base::WeakPtr<HttpCache>& cache,
+                             const std::string& url,
+                             const LookupCallback& callback,
+                             scoped_refptr<HttpCacheEntry> entry);
+    void PutMemory(const scoped_refptr<HttpCacheEntry>& entry);
+    void RemoveMemory(const std::string& url);
+    base::FilePath GetDiskPath(const std::string& url) const;
+
+  private:
+    base::FilePath disk_path_;
+    size_t memory_capacity_;
+    size_t memory_size_;
+    typedef std::list<scoped_refptr<HttpCacheEntry> > LRU_LIST;
+    LRU_LIST lru_list_; // 最近使用的在前面
+    std::map<std::string, LRU_LIST::iterator> memory_entries_;
+    base::WeakPtrFactory<HttpCache> weakptr_factory_;
+  };
+}
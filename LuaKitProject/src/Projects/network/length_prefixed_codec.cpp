@@ -0,0 +1,55 @@
+#include "length_prefixed_codec.h"
+#include "net/net_errors.h"
+
+namespace net {
+
+const static size_t DEFAULT_MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+LengthPrefixedCodec::LengthPrefixedCodec()
+    : prefix_bytes(4),
+      big_endian(true),
+      length_includes_prefix(false),
+      max_frame_size(DEFAULT_MAX_FRAME_SIZE) {
+}
+
+bool LengthPrefixedCodec::IsValid() const {
+    return prefix_bytes == 1 || prefix_bytes == 2 || prefix_bytes == 4 || prefix_bytes == 8;
+}
+
+int LengthPrefixedCodec::DecodeLength(const char* header, size_t* length) const {
+    const unsigned char* bytes = (const unsigned char*)header;
+    uint64 value = 0;
+    for (int i = 0; i < prefix_bytes; i++) {
+        int index = big_endian ? i : prefix_bytes - 1 - i;
+        value = (value << 8) | bytes[index];
+    }
+    if (length_includes_prefix) {
+        if (value < (uint64)prefix_bytes) {
+            return ERR_INVALID_RESPONSE;
+        }
+        value -= prefix_bytes;
+    }
+    if (value > max_frame_size) {
+        return ERR_MSG_TOO_BIG;
+    }
+    *length = (size_t)value;
+    return OK;
+}
+
+int LengthPrefixedCodec::Encode(const std::string& payload, std::string* frame) const {
+    uint64 value = payload.size() + (length_includes_prefix ? prefix_bytes : 0);
+    // 前缀放不下的长度也算太大
+    if (payload.size() > max_frame_size ||
+        (prefix_bytes < 8 && (value >> (prefix_bytes * 8)) != 0)) {
+        return ERR_MSG_TOO_BIG;
+    }
+    frame->resize(prefix_bytes + payload.size());
+    for (int i = 0; i < prefix_bytes; i++) {
+        int index = big_endian ? prefix_bytes - 1 - i : i;
+        (*frame)[index] = (char)(value & 0xff);
+        value >>= 8;
+    }
+    frame->replace(prefix_bytes, payload.size(), payload);
+    return OK;
+}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include "base/basictypes.h"
+
+namespace net {
+
+/**
+ * @brief 长度前缀分帧：每帧前面是prefix_bytes字节的长度，后面是数据
+ * @note 纯数据结构，可以按值保存和复制
+ */
+struct LengthPrefixedCodec {
+    LengthPrefixedCodec();
+
+    int prefix_bytes;             // 1、2、4或者8
+    bool big_endian;
+    bool length_includes_prefix;  // 长度字段是否把前缀自己也算进去
+    size_t max_frame_size;        // 数据部分的上限，超过时读写都返回ERR_MSG_TOO_BIG
+
+    bool IsValid() const;
+    // 从header读出数据部分的长度，header至少有prefix_bytes字节；返回net错误码
+    int DecodeLength(const char* header, size_t* length) const;
+    // 在payload前加上长度；返回net错误码
+    int Encode(const std::string& payload, std::string* frame) const;
+};
+}
@@ -0,0 +1,132 @@
+#include "network/length_prefixed_codec.h"
+
+#include "network/net/net_errors.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace net {
+
+namespace {
+
+LengthPrefixedCodec MakeCodec(int prefix_bytes, bool big_endian, bool includes_prefix) {
+    LengthPrefixedCodec codec;
+    codec.prefix_bytes = prefix_bytes;
+    codec.big_endian = big_endian;
+    codec.length_includes_prefix = includes_prefix;
+    return codec;
+}
+
+TEST(LengthPrefixedCodecTest, IsValid) {
+    LengthPrefixedCodec codec;
+    EXPECT_TRUE(codec.IsValid());
+    const int valid[] = {1, 2, 4, 8};
+    for (size_t i = 0; i < arraysize(valid); i++) {
+        codec.prefix_bytes = valid[i];
+        EXPECT_TRUE(codec.IsValid());
+    }
+    const int invalid[] = {0, 3, 5, 16, -1};
+    for (size_t i = 0; i < arraysize(invalid); i++) {
+        codec.prefix_bytes = invalid[i];
+        EXPECT_FALSE(codec.IsValid());
+    }
+}
+
+TEST(LengthPrefixedCodecTest, EncodeBigEndian) {
+    std::string frame;
+    ASSERT_EQ(OK, MakeCodec(4, true, false).Encode("abc", &frame));
+    EXPECT_EQ(std::string("\x00\x00\x00\x03" "abc", 7), frame);
+
+    ASSERT_EQ(OK, MakeCodec(2, true, false).Encode(std::string(0x1234, 'x'), &frame));
+    EXPECT_EQ(std::string("\x12\x34", 2), frame.substr(0, 2));
+    EXPECT_EQ(2u + 0x1234, frame.size());
+}
+
+TEST(LengthPrefixedCodecTest, EncodeLittleEndian) {
+    std::string frame;
+    ASSERT_EQ(OK, MakeCodec(4, false, false).Encode("abc", &frame));
+    EXPECT_EQ(std::string("\x03\x00\x00\x00" "abc", 7), frame);
+}
+
+TEST(LengthPrefixedCodecTest, EncodeIncludesPrefix) {
+    std::string frame;
+    ASSERT_EQ(OK, MakeCodec(2, true, true).Encode("abc", &frame));
+    EXPECT_EQ(std::string("\x00\x05" "abc", 5), frame);
+}
+
+TEST(LengthPrefixedCodecTest, EncodeEmptyPayload) {
+    std::string frame;
+    ASSERT_EQ(OK, MakeCodec(1, true, false).Encode("", &frame));
+    EXPECT_EQ(std::string("\x00", 1), frame);
+}
+
+TEST(LengthPrefixedCodecTest, RoundTrip) {
+    const int prefixes[] = {1, 2, 4, 8};
+    for (size_t i = 0; i < arraysize(prefixes); i++) {
+        for (int big_endian = 0; big_endian < 2; big_endian++) {
+            for (int includes = 0; includes < 2; includes++) {
+                LengthPrefixedCodec codec = MakeCodec(prefixes[i], big_endian != 0, includes != 0);
+                std::string payload(200, 'p');
+                std::string frame;
+                ASSERT_EQ(OK, codec.Encode(payload, &frame));
+                ASSERT_EQ(prefixes[i] + payload.size(), frame.size());
+                size_t length = 0;
+                ASSERT_EQ(OK, codec.DecodeLength(frame.data(), &length));
+                EXPECT_EQ(payload.size(), length);
+                EXPECT_EQ(payload, frame.substr(prefixes[i]));
+            }
+        }
+    }
+}
+
+// 一个字节的前缀放不下256
+TEST(LengthPrefixedCodecTest, EncodeDoesNotFitPrefix) {
+    std::string frame;
+    LengthPrefixedCodec codec = MakeCodec(1, true, false);
+    EXPECT_EQ(OK, codec.Encode(std::string(255, 'x'), &frame));
+    EXPECT_EQ(ERR_MSG_TOO_BIG, codec.Encode(std::string(256, 'x'), &frame));
+
+    // 算上前缀自己之后放不下
+    codec.length_includes_prefix = true;
+    EXPECT_EQ(OK, codec.Encode(std::string(254, 'x'), &frame));
+    EXPECT_EQ(ERR_MSG_TOO_BIG, codec.Encode(std::string(255, 'x'), &frame));
+}
+
+TEST(LengthPrefixedCodecTest, EncodeOverMaxFrameSize) {
+    LengthPrefixedCodec codec;
+    codec.max_frame_size = 8;
+    std::string frame;
+    EXPECT_EQ(OK, codec.Encode(std::string(8, 'x'), &frame));
+    EXPECT_EQ(ERR_MSG_TOO_BIG, codec.Encode(std::string(9, 'x'), &frame));
+}
+
+TEST(LengthPrefixedCodecTest, DecodeOverMaxFrameSize) {
+    LengthPrefixedCodec codec;
+    codec.max_frame_size = 8;
+    size_t length = 0;
+    EXPECT_EQ(OK, codec.DecodeLength("\x00\x00\x00\x08", &length));
+    EXPECT_EQ(8u, length);
+    length = 0;
+    EXPECT_EQ(ERR_MSG_TOO_BIG, codec.DecodeLength("\x00\x00\x00\x09", &length));
+    EXPECT_EQ(0u, length);
+    // 8字节前缀最高位为1的长度不能被截断成小值
+    codec.prefix_bytes = 8;
+    EXPECT_EQ(ERR_MSG_TOO_BIG, codec.DecodeLength("\x80\x00\x00\x00\x00\x00\x00\x01", &length));
+}
+
+TEST(LengthPrefixedCodecTest, DecodeShorterThanPrefix) {
+    LengthPrefixedCodec codec = MakeCodec(4, true, true);
+    size_t length = 0;
+    EXPECT_EQ(OK, codec.DecodeLength("\x00\x00\x00\x04", &length));
+    EXPECT_EQ(0u, length);
+    EXPECT_EQ(ERR_INVALID_RESPONSE, codec.DecodeLength("\x00\x00\x00\x03", &length));
+}
+
+TEST(LengthPrefixedCodecTest, DecodeLittleEndian) {
+    LengthPrefixedCodec codec = MakeCodec(2, false, false);
+    size_t length = 0;
+    ASSERT_EQ(OK, codec.DecodeLength("\x34\x12", &length));
+    EXPECT_EQ(0x1234u, length);
+}
+
+}  // namespace
+
+}  // namespace net
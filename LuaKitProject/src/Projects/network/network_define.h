@@ -6,6 +6,7 @@
 
 #include "base/callback.h"
 #include "base/file_util.h"
+#include "base/memory/ref_counted_memory.h"
 #include "base/memory/weak_ptr.h"
 #include "base/path_service.h"
 #include "base/platform_file.h"
@@ -39,6 +40,8 @@ namespace network {
     typedef base::Callback<void(ProtocolErrorCode)> CompleteCallback;
     typedef base::Callback<void(BaseConnection* connection, int64 dltotal, int64 dlnow, int64 ultotal, int64 ulnow)> ProgressCallback;
     typedef base::Callback<bool()> TaskAbortCallback;
+    // 流式响应的一块数据，consumed必须在IO线程执行，通知connection这块数据已经被消费
+    typedef base::Callback<void(const scoped_refptr<base::RefCountedString>& chunk, const base::Closure& consumed)> DataCallback;
     typedef base::Callback<int(network::ProtocolErrorCode, const HTTP_HEADERS& headers, const std::string& resp)> HandlerCallback;
   
     typedef enum __NetWorkProxyType {
@@ -59,15 +62,33 @@ namespace network {
       NetWorkProxyType type_;
     };
   
+    // 一次请求各阶段的耗时，毫秒
+    struct RequestTiming {
+      RequestTiming() : dns_ms(0), connect_ms(0), tls_ms(0), first_byte_ms(0), total_ms(0),
+                        request_bytes(0), response_bytes(0), connected(false), reused(false) {}
+      int64 dns_ms;        // 域名解析
+      int64 connect_ms;    // TCP连接，不含解析
+      int64 tls_ms;        // TLS握手，http为0
+      int64 first_byte_ms; // 从开始到收到第一个字节
+      int64 total_ms;
+      int64 request_bytes;
+      int64 response_bytes;
+      bool connected;      // 拿到了连接，DNS失败、连接被拒绝等为false
+      bool reused;         // 复用了缓存的连接，只在connected时有意义
+    };
+  
     class NetWorkTask : public base::RefCounted<NetWorkTask> {
     public:
         NetWorkTask(int p, const base::Closure& closure)
-        : priority_(p), closure_(closure) {}
-        NetWorkTask() {}
+        : priority_(p), sequence_(0), canceled_(false), closure_(closure) {}
+        NetWorkTask() : priority_(0), sequence_(0), canceled_(false) {}
         
     public:
         int priority_;
+        int64 sequence_;     // 入队顺序，相同优先级按它决定先进先出还是后进先出
+        bool canceled_;      // 取消后留在堆里，出队时跳过
         base::Closure closure_;
+        base::Closure cancel_closure_; // 排队时被取消执行
     };
     
     class NetWorkBuffer : public base::SupportsWeakPtr<NetWorkBuffer> {
@@ -79,13 +100,20 @@ namespace network {
          */
         virtual void read(char* buffer, size_t& read_length) = 0;
         /**
-         * @brief 将buffer中的内容写入缓存，length为buffer大小
+         * @brief 将buffer中的内容写入缓存，length为buffer大小，写入失败返回false
          */
-        virtual void append(char* buffer, size_t length) = 0;
+        virtual bool append(char* buffer, size_t length) = 0;
         /**
          * @brief 返回缓存内容
          */
         virtual const std::string& getContent() const {return empty_content_;}
+        /**
+         * @brief 取走缓存内容，之后getContent为空，内存缓存不会拷贝数据
+         */
+        virtual scoped_refptr<base::RefCountedString> takeContent() {
+            std::string content(getContent());
+            return make_scoped_refptr(base::RefCountedString::TakeString(&content));
+        }
         /**
          * @brief 获取当前偏移量
          */
@@ -135,13 +163,18 @@ namespace network {
             }
             read_length = 0;
         }
-        virtual void append(char* buffer, size_t length) override {
+        virtual bool append(char* buffer, size_t length) override {
             content_.append(buffer, length);
             completed_size_ += length;
+            return true;
         }
         virtual const std::string& getContent() const override {
             return content_;
         }
+        virtual scoped_refptr<base::RefCountedString> takeContent() override {
+            offset_ = 0;
+            return make_scoped_refptr(base::RefCountedString::TakeString(&content_));
+        }
         virtual uint64_t getOffset() const override {
             return offset_;
         }
@@ -222,14 +255,15 @@ namespace network {
           }
           read_length = 0;
       }
-      virtual void append(char* buffer, size_t length) override {
+      virtual bool append(char* buffer, size_t length) override {
           completed_size_ += length;
           if(platform_file_ == base::kInvalidPlatformFileValue) {
-              return;
+              return true;
           }
           if (!stop_write_) {
               base::WritePlatformFile(platform_file_, 0, buffer, length); // 如果用PLATFORM_FILE_APPEND方式打开文件，那么这个方法忽视offset
           }
+          return true;
       }
       virtual uint64_t getOffset() const override {
           return offset_;
@@ -267,4 +301,76 @@ namespace network {
       int64 file_size_;
       bool stop_write_;
     };
+    
+    // 分段下载时把一段响应写到文件的[offset, limit)，文件大小要事先分配好
+    class NetWorkRangeFileBuffer : public NetWorkBuffer {
+    public:
+      NetWorkRangeFileBuffer(const std::string& path, int64 offset, int64 limit) : NetWorkBuffer() {
+          start_ = offset;
+          write_offset_ = offset;
+          limit_ = limit;
+          rejected_ = false;
+          bool created = false;
+          base::PlatformFileError error;
+          platform_file_ = base::CreatePlatformFile(base::FilePath(path),
+                                                    base::PLATFORM_FILE_OPEN | base::PLATFORM_FILE_WRITE,
+                                                    &created,
+                                                    &error);
+          if(platform_file_ == base::kInvalidPlatformFileValue) {
+              LOG(ERROR) << "Open File failed! error: " << error << " path: " << path;
+          }
+      }
+      virtual ~NetWorkRangeFileBuffer() {
+          clean();
+      }
+      virtual void read(char* buffer, size_t& read_length) override {
+          read_length = 0;
+      }
+      virtual bool append(char* buffer, size_t length) override {
+          completed_size_ += length;
+          if(platform_file_ == base::kInvalidPlatformFileValue) {
+              return false;
+          }
+          if(rejected_ || write_offset_ >= limit_) {
+              return true;
+          }
+          // 超出这一段的数据丢弃，不能覆盖下一段
+          int len = (int)std::min((int64)length, limit_ - write_offset_);
+          int ret = base::WritePlatformFile(platform_file_, write_offset_, buffer, len);
+          if(ret > 0) {
+              write_offset_ += ret;
+          }
+          // 磁盘满或者写失败时让请求失败，不能留下空洞
+          if(ret != len) {
+              LOG(ERROR) << "Write File failed! offset: " << write_offset_ << " ret: " << ret;
+              return false;
+          }
+          return true;
+      }
+      virtual uint64_t getOffset() const override {
+          return write_offset_;
+      }
+      virtual void setOffset(uint64_t offset) override {
+          // CurlConnection发现服务器不支持Range时会从头写，这一段不能再写了
+          if((int64)offset != write_offset_) {
+              rejected_ = true;
+          }
+      }
+      virtual uint64_t getContentSize() const override {
+          return limit_ - start_;
+      }
+      virtual void clean() override {
+          if(platform_file_ != base::kInvalidPlatformFileValue) {
+              base::ClosePlatformFile(platform_file_);
+              platform_file_ = base::kInvalidPlatformFileValue;
+          }
+          completed_size_ = 0;
+      }
+    private:
+      base::PlatformFile platform_file_;
+      int64 start_;
+      int64 write_offset_;
+      int64 limit_;
+      bool rejected_;
+    };
 }
@@ -0,0 +1,78 @@
+#include "network_metrics.h"
+#include <algorithm>
+#include <vector>
+#include "base/metrics/histogram.h"
+#include "base/metrics/histogram_samples.h"
+#include "base/metrics/statistics_recorder.h"
+
+namespace network {
+
+    const static char* METRICS_PREFIX = "Network.";
+    const static char* TIME_METRICS[] = {"DNS", "Connect", "TLS", "FirstByte", "Total"};
+    const static char* BYTES_METRICS[] = {"RequestBytes", "ResponseBytes"};
+    const static char* REUSED_METRIC = "Reused";
+
+    static std::string MetricName(const std::string& host, const char* metric) {
+        return METRICS_PREFIX + host + "." + metric;
+    }
+
+    static void AddTime(const std::string& host, const char* metric, int64 ms) {
+        // 和UMA_HISTOGRAM_TIMES一样的桶，上限放宽到1分钟
+        base::HistogramBase* histogram = base::Histogram::FactoryTimeGet(MetricName(host, metric),
+                                                                         base::TimeDelta::FromMilliseconds(1),
+                                                                         base::TimeDelta::FromMinutes(1),
+                                                                         50,
+                                                                         base::HistogramBase::kNoFlags);
+        histogram->AddTime(base::TimeDelta::FromMilliseconds(ms));
+    }
+
+    static void AddBytes(const std::string& host, const char* metric, int64 bytes) {
+        base::HistogramBase* histogram = base::Histogram::FactoryGet(MetricName(host, metric),
+                                                                     1,
+                                                                     100 * 1024 * 1024,
+                                                                     50,
+                                                                     base::HistogramBase::kNoFlags);
+        histogram->Add((base::HistogramBase::Sample)std::min<int64>(bytes, kint32max));
+    }
+
+    void RecordRequestMetrics(const std::string& host, const RequestTiming& timing) {
+        if(host.empty()) {
+            return;
+        }
+        AddTime(host, TIME_METRICS[0], timing.dns_ms);
+        AddTime(host, TIME_METRICS[1], timing.connect_ms);
+        AddTime(host, TIME_METRICS[2], timing.tls_ms);
+        AddTime(host, TIME_METRICS[3], timing.first_byte_ms);
+        AddTime(host, TIME_METRICS[4], timing.total_ms);
+        AddBytes(host, BYTES_METRICS[0], timing.request_bytes);
+        AddBytes(host, BYTES_METRICS[1], timing.response_bytes);
+        if(timing.connected) {
+            base::BooleanHistogram::FactoryGet(MetricName(host, REUSED_METRIC),
+                                               base::HistogramBase::kNoFlags)->AddBoolean(timing.reused);
+        }
+    }
+
+    std::map<std::string, MetricSummary> GetRequestMetrics(const std::string& host) {
+        std::map<std::string, MetricSummary> result;
+        std::vector<const char*> metrics(TIME_METRICS, TIME_METRICS + arraysize(TIME_METRICS));
+        metrics.insert(metrics.end(), BYTES_METRICS, BYTES_METRICS + arraysize(BYTES_METRICS));
+        metrics.push_back(REUSED_METRIC);
+        for(const char* metric : metrics) {
+            base::HistogramBase* histogram = base::StatisticsRecorder::FindHistogram(MetricName(host, metric));
+            if(!histogram) {
+                continue;
+            }
+            scoped_ptr<base::HistogramSamples> samples = histogram->SnapshotSamples();
+            MetricSummary& summary = result[metric];
+            summary.count = samples->TotalCount();
+            summary.sum = samples->sum();
+        }
+        return result;
+    }
+
+    std::string DumpRequestMetrics(const std::string& host) {
+        std::string output;
+        base::StatisticsRecorder::WriteGraph(host.empty() ? METRICS_PREFIX : METRICS_PREFIX + host + ".", &output);
+        return output;
+    }
+}
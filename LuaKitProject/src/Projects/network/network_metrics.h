@@ -0,0 +1,31 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include "network/network_define.h"
+
+namespace network {
+
+  // 一个直方图的汇总
+  struct MetricSummary {
+    MetricSummary() : count(0), sum(0) {}
+    int count;
+    int64 sum;
+  };
+
+  /**
+   * @brief 把一次请求的耗时和字节数记到base/metrics直方图，名字是Network.<host>.<指标>；没有拿到连接的请求不记Reused
+   */
+  void RecordRequestMetrics(const std::string& host, const RequestTiming& timing);
+
+  /**
+   * @brief 取host各指标的请求数和总和，key是DNS、Connect、TLS、FirstByte、Total、RequestBytes、ResponseBytes、Reused
+   * @note Reused的sum是复用连接的请求数
+   */
+  std::map<std::string, MetricSummary> GetRequestMetrics(const std::string& host);
+
+  /**
+   * @brief 以文本形式输出host的所有直方图，host为空时输出所有host
+   */
+  std::string DumpRequestMetrics(const std::string& host);
+}
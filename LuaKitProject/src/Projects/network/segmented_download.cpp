@@ -0,0 +1,455 @@
+#include "segmented_download.h"
+#include <algorithm>
+#include "base/bind.h"
+#include "base/file_util.h"
+#include "base/pickle.h"
+#include "base/platform_file.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_util.h"
+#include "base/strings/stringprintf.h"
+
+namespace network {
+
+    const static int STATE_FORMAT_VERSION = 1;
+    const static int64 MIN_SEGMENT_BYTES = 1024*1024; // 小于这个大小不再分段
+    const static int MAX_SEGMENT_RETRIES = 3;
+    const static int64 SAVE_STATE_INTERVAL_MS = 1000;
+
+    // 分段下载内部的请求，响应和进度转给SegmentedDownload
+    class DownloadRequestTask : public HttpTask {
+    public:
+        typedef base::Callback<void(const scoped_refptr<HttpResponse>&)> ResponseCallback;
+        typedef base::Callback<void(int64 dlnow)> ProgressCallback;
+
+        DownloadRequestTask(const std::string& name,
+                            const ResponseCallback& response_callback,
+                            const ProgressCallback& progress_callback) :
+        HttpTask(name),
+        response_callback_(response_callback),
+        progress_callback_(progress_callback) {
+            is_post = false;
+            if (progress_callback_.is_null()) {
+                progress_interval_ms = -1;
+            }
+        }
+
+        virtual void ProgressFeedBack(network::BaseConnection* connection, int64 dltotal, int64 dlnow, int64 ultotal, int64 ulnow) override {
+            progress_callback_.Run(dlnow);
+        }
+
+        using HttpTask::OnResponse;
+        virtual int OnResponse(const scoped_refptr<HttpResponse>& response) override {
+            response_callback_.Run(response);
+            return 0;
+        }
+
+    private:
+        virtual ~DownloadRequestTask() {}
+        ResponseCallback response_callback_;
+        ProgressCallback progress_callback_;
+    };
+
+    static bool FindHeader(const HTTP_HEADERS& headers, const char* name, std::string* value) {
+        for(auto& it : headers) {
+            if(LowerCaseEqualsASCII(it.first, name)) {
+                TrimWhitespaceASCII(it.second, TRIM_ALL, value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Content-Range: bytes 0-0/12345，返回12345，未知时返回-1
+    static int64 ParseContentRangeTotal(const HTTP_HEADERS& headers) {
+        std::string value;
+        int64 total = -1;
+        if(!FindHeader(headers, "content-range", &value)) {
+            return -1;
+        }
+        size_t found = value.rfind('/');
+        if(found == std::string::npos || !base::StringToInt64(value.substr(found + 1), &total)) {
+            return -1;
+        }
+        return total;
+    }
+
+    static SegmentedDownload::State* LoadState(const base::FilePath& path) {
+        std::string data;
+        if(!base::ReadFileToString(path, &data)) {
+            return NULL;
+        }
+        Pickle pickle(data.data(), (int)data.size());
+        PickleIterator iter(pickle);
+        scoped_ptr<SegmentedDownload::State> state(new SegmentedDownload::State());
+        int version = 0;
+        int count = 0;
+        if(!iter.ReadInt(&version) || version != STATE_FORMAT_VERSION ||
+           !iter.ReadString(&state->url) ||
+           !iter.ReadInt64(&state->total) ||
+           !iter.ReadString(&state->validator) ||
+           !iter.ReadLength(&count)) {
+            return NULL;
+        }
+        for(int i = 0; i < count; i++) {
+            SegmentedDownload::Segment segment;
+            if(!iter.ReadInt64(&segment.start) ||
+               !iter.ReadInt64(&segment.end) ||
+               !iter.ReadInt64(&segment.done)) {
+                return NULL;
+            }
+            state->segments.push_back(segment);
+        }
+        return state.release();
+    }
+
+    static void WriteState(const base::FilePath& path, const std::string& data) {
+        base::FilePath temp = path.AddExtension("tmp");
+        if(file_util::WriteFile(temp, data.data(), (int)data.size()) != (int)data.size() ||
+           !base::ReplaceFile(temp, path, NULL)) {
+            LOG(ERROR) << "SegmentedDownload save state failed! " << path.value();
+            base::DeleteFile(temp, false);
+        }
+    }
+
+    // 文件大小设成total，续传时已经下载的内容不变
+    static bool AllocateFile(const base::FilePath& path, int64 total) {
+        bool created = false;
+        base::PlatformFileError error;
+        base::PlatformFile file = base::CreatePlatformFile(path,
+                                                           base::PLATFORM_FILE_OPEN_ALWAYS | base::PLATFORM_FILE_WRITE,
+                                                           &created,
+                                                           &error);
+        if(file == base::kInvalidPlatformFileValue) {
+            LOG(ERROR) << "SegmentedDownload open file failed! error: " << error << " path: " << path.value();
+            return false;
+        }
+        bool success = true;
+        base::PlatformFileInfo info;
+        if(!base::GetPlatformFileInfo(file, &info) || info.size != total) {
+            success = base::TruncatePlatformFile(file, total);
+        }
+        base::ClosePlatformFile(file);
+        return success;
+    }
+
+    static void DeleteFiles(const base::FilePath& path, const base::FilePath& state_path) {
+        base::DeleteFile(path, false);
+        base::DeleteFile(state_path, false);
+    }
+
+    SegmentedDownload::SegmentedDownload(HttpCgiTaskDispatcher* dispatcher,
+                                         const scoped_refptr<HttpTask>& task,
+                                         int max_segments) :
+    dispatcher_(dispatcher),
+    task_(task),
+    max_segments_(std::max(max_segments, 1)),
+    generation_(0),
+    restarted_(false),
+    finished_(false) {
+    }
+
+    SegmentedDownload::~SegmentedDownload() {
+    }
+
+    void SegmentedDownload::Start() {
+        DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+        BusinessThread::PostTaskAndReplyWithResult<State*>(
+            BusinessThread::FILE,
+            FROM_HERE,
+            base::Bind(&LoadState, base::FilePath(StatePath())),
+            base::Bind(&SegmentedDownload::OnStateLoaded, this));
+    }
+
+    void SegmentedDownload::Cancel() {
+        DCHECK(BusinessThread::CurrentlyOn(BusinessThread::IO));
+        if(finished_) {
+            return;
+        }
+        StopSegments();
+        SaveState(true);
+        Finish(PEC_ABORTED, 0);
+    }
+
+    void SegmentedDownload::OnStateLoaded(State* loaded) {
+        saved_state_.reset(loaded);
+        if(finished_) {
+            return;
+        }
+        Probe();
+    }
+
+    void SegmentedDownload::Probe() {
+        probe_task_ = new DownloadRequestTask(task_->task_name,
+                                              base::Bind(&SegmentedDownload::OnProbeResponse, this, generation_),
+                                              DownloadRequestTask::ProgressCallback());
+        // 用HEAD探测，服务器不支持Range时不会把整个文件先下载到内存里；忽略了Range的HEAD看Accept-Ranges
+        probe_task_->is_head = true;
+        probe_task_->url = task_->url;
+        probe_task_->headers = task_->headers;
+        probe_task_->headers.push_back(std::make_pair("Range", "bytes=0-0"));
+        probe_task_->socket_watcher_timeout = task_->socket_watcher_timeout;
+        probe_task_->priority = task_->priority;
+        dispatcher_->ScheduleTask(probe_task_);
+    }
+
+    void SegmentedDownload::OnProbeResponse(int generation, const scoped_refptr<HttpResponse>& response) {
+        if(generation != generation_ || finished_) {
+            return;
+        }
+        probe_task_ = NULL;
+        if(response->error_code != PEC_OK) {
+            Finish(response->error_code, response->http_code);
+            return;
+        }
+        int64 total = -1;
+        if(response->http_code == 206) {
+            total = ParseContentRangeTotal(response->headers);
+        } else if(response->http_code == 200) {
+            // HEAD请求的Range可以被忽略，这时看Accept-Ranges和Content-Length
+            std::string accept_ranges;
+            std::string length;
+            if(FindHeader(response->headers, "accept-ranges", &accept_ranges) &&
+               LowerCaseEqualsASCII(accept_ranges, "bytes") &&
+               FindHeader(response->headers, "content-length", &length) &&
+               !base::StringToInt64(length, &total)) {
+                total = -1;
+            }
+        }
+        if(total <= 0) {
+            LOG(WARNING) << "SegmentedDownload 服务器不支持Range，改为普通下载: " << task_->url;
+            FallbackToSingleRequest();
+            return;
+        }
+        // If-Range要求强比较，弱ETag不能用，改用Last-Modified
+        std::string validator;
+        if(!FindHeader(response->headers, "etag", &validator) || StartsWithASCII(validator, "W/", true)) {
+            validator.clear();
+            FindHeader(response->headers, "last-modified", &validator);
+        }
+        if(saved_state_.get() &&
+           saved_state_->url == task_->url &&
+           saved_state_->total == total &&
+           saved_state_->validator == validator &&
+           !validator.empty() &&
+           !saved_state_->segments.empty()) {
+            LOG(INFO) << "SegmentedDownload 从断点继续: " << task_->url;
+            state_ = *saved_state_;
+        } else {
+            state_ = State();
+            state_.url = task_->url;
+            state_.total = total;
+            state_.validator = validator;
+            int count = (int)std::min<int64>(max_segments_, std::max<int64>(total / MIN_SEGMENT_BYTES, 1));
+            int64 size = total / count;
+            for(int i = 0; i < count; i++) {
+                Segment segment;
+                segment.start = i * size;
+                segment.end = i == count - 1 ? total : (i + 1) * size;
+                state_.segments.push_back(segment);
+            }
+        }
+        saved_state_.reset();
+        BusinessThread::PostTaskAndReplyWithResult<bool>(
+            BusinessThread::FILE,
+            FROM_HERE,
+            base::Bind(&AllocateFile, base::FilePath(task_->download_path), total),
+            base::Bind(&SegmentedDownload::OnFileAllocated, this));
+    }
+
+    void SegmentedDownload::OnFileAllocated(bool success) {
+        if(finished_) {
+            return;
+        }
+        if(!success) {
+            Finish(PEC_UNKNOW_ERROR, 0);
+            return;
+        }
+        SaveState(true);
+        ReportProgress();
+        for(size_t i = 0; i < state_.segments.size(); i++) {
+            StartSegment(i);
+        }
+        if(DoneBytes() == state_.total) {
+            BusinessThread::PostTask(BusinessThread::FILE, FROM_HERE,
+                                     base::Bind(base::IgnoreResult(&base::DeleteFile), base::FilePath(StatePath()), false));
+            Finish(PEC_OK, 206);
+        }
+    }
+
+    void SegmentedDownload::StartSegment(size_t index) {
+        Segment& segment = state_.segments[index];
+        int64 offset = segment.start + segment.done;
+        if(offset >= segment.end) {
+            return;
+        }
+        scoped_refptr<HttpTask> task = new DownloadRequestTask(task_->task_name,
+                                                               base::Bind(&SegmentedDownload::OnSegmentResponse, this, generation_, index),
+                                                               base::Bind(&SegmentedDownload::OnSegmentProgress, this, generation_, index));
+        task->url = task_->url;
+        task->headers = task_->headers;
+        task->headers.push_back(std::make_pair("Range", base::StringPrintf("bytes=%lld-%lld", (long long)offset, (long long)segment.end - 1)));
+        if(!state_.validator.empty()) {
+            // 文件变了服务器返回200，不会把新文件的内容写进旧文件
+            task->headers.push_back(std::make_pair("If-Range", state_.validator));
+        }
+        task->download_path = task_->download_path;
+        task->download_offset = offset;
+        task->download_limit = segment.end;
+        task->socket_watcher_timeout = task_->socket_watcher_timeout;
+        task->priority = task_->priority;
+        segment.task = task;
+        dispatcher_->ScheduleTask(task);
+    }
+
+    void SegmentedDownload::OnSegmentProgress(int generation, size_t index, int64 dlnow) {
+        if(generation != generation_ || finished_) {
+            return;
+        }
+        Segment& segment = state_.segments[index];
+        if(!segment.task.get()) {
+            return;
+        }
+        // 进度回调有合并，保存的done不会超过实际写入的字节数
+        segment.done = std::min(segment.task->download_offset + dlnow, segment.end) - segment.start;
+        SaveState(false);
+        ReportProgress();
+    }
+
+    void SegmentedDownload::OnSegmentResponse(int generation, size_t index, const scoped_refptr<HttpResponse>& response) {
+        if(generation != generation_ || finished_) {
+            return;
+        }
+        Segment& segment = state_.segments[index];
+        segment.task = NULL;
+        if(response->error_code == PEC_OK && response->http_code == 206 &&
+           ParseContentRangeTotal(response->headers) == state_.total) {
+            segment.done = segment.end - segment.start;
+            segment.retries = 0;
+            ReportProgress();
+            if(DoneBytes() == state_.total) {
+                BusinessThread::PostTask(BusinessThread::FILE, FROM_HERE,
+                                         base::Bind(base::IgnoreResult(&base::DeleteFile), base::FilePath(StatePath()), false));
+                Finish(PEC_OK, 206);
+            } else {
+                SaveState(false);
+            }
+            return;
+        }
+        if(response->error_code == PEC_OK) {
+            // If-Range不匹配或者大小变了，服务器上的文件已经不是原来的
+            LOG(ERROR) << "SegmentedDownload 服务器上的文件变了: " << task_->url << " http code: " << response->http_code;
+            if(!restarted_) {
+                Restart();
+            } else {
+                StopSegments();
+                Finish(PEC_FAILED_RESPONSE, response->http_code);
+            }
+            return;
+        }
+        if(++segment.retries <= MAX_SEGMENT_RETRIES) {
+            LOG(WARNING) << "SegmentedDownload 分段失败，重试: " << index << " error: " << response->error_code;
+            StartSegment(index);
+            return;
+        }
+        StopSegments();
+        SaveState(true);
+        Finish(response->error_code, response->http_code);
+    }
+
+    void SegmentedDownload::StopSegments() {
+        generation_++;
+        if(probe_task_.get()) {
+            dispatcher_->CancelTask(probe_task_->task_id);
+            probe_task_ = NULL;
+        }
+        for(auto& segment : state_.segments) {
+            if(segment.task.get()) {
+                dispatcher_->CancelTask(segment.task->task_id);
+                segment.task = NULL;
+            }
+        }
+    }
+
+    void SegmentedDownload::Restart() {
+        restarted_ = true;
+        StopSegments();
+        state_ = State();
+        saved_state_.reset();
+        Probe();
+    }
+
+    void SegmentedDownload::FallbackToSingleRequest() {
+        // 普通下载是追加写，先删掉之前分段下载留下的文件
+        BusinessThread::PostTaskAndReply(BusinessThread::FILE,
+                                         FROM_HERE,
+                                         base::Bind(&DeleteFiles, base::FilePath(task_->download_path), base::FilePath(StatePath())),
+                                         base::Bind(&SegmentedDownload::OnOldFilesDeleted, this));
+    }
+
+    void SegmentedDownload::OnOldFilesDeleted() {
+        if(finished_) {
+            return;
+        }
+        finished_ = true;
+        scoped_refptr<SegmentedDownload> self(this);
+        dispatcher_->OnDownloadFinished(task_->task_id);
+        dispatcher_->ScheduleTask(task_);
+    }
+
+    void SegmentedDownload::SaveState(bool force) {
+        if(state_.segments.empty()) {
+            return;
+        }
+        base::TimeTicks now = base::TimeTicks::Now();
+        if(!force && (now - last_save_time_).InMilliseconds() < SAVE_STATE_INTERVAL_MS) {
+            return;
+        }
+        last_save_time_ = now;
+        Pickle pickle;
+        pickle.WriteInt(STATE_FORMAT_VERSION);
+        pickle.WriteString(state_.url);
+        pickle.WriteInt64(state_.total);
+        pickle.WriteString(state_.validator);
+        pickle.WriteInt((int)state_.segments.size());
+        for(auto& segment : state_.segments) {
+            pickle.WriteInt64(segment.start);
+            pickle.WriteInt64(segment.end);
+            pickle.WriteInt64(segment.done);
+        }
+        BusinessThread::PostTask(BusinessThread::FILE, FROM_HERE,
+                                 base::Bind(&WriteState,
+                                            base::FilePath(StatePath()),
+                                            std::string((const char*)pickle.data(), pickle.size())));
+    }
+
+    void SegmentedDownload::ReportProgress() {
+        task_->ReportProgress(NULL, state_.total, DoneBytes(), 0, 0);
+    }
+
+    void SegmentedDownload::Finish(ProtocolErrorCode error_code, long http_code) {
+        if(finished_) {
+            return;
+        }
+        finished_ = true;
+        scoped_refptr<SegmentedDownload> self(this);
+        task_->FlushProgress(NULL);
+        scoped_refptr<HttpResponse> response(new HttpResponse());
+        response->error_code = error_code;
+        response->http_code = http_code;
+        response->body = new base::RefCountedString();
+        dispatcher_->OnDownloadFinished(task_->task_id);
+        task_->OnResponse(response);
+    }
+
+    int64 SegmentedDownload::DoneBytes() const {
+        int64 done = 0;
+        for(auto& segment : state_.segments) {
+            done += segment.done;
+        }
+        return done;
+    }
+
+    std::string SegmentedDownload::StatePath() const {
+        return task_->download_path + ".segments";
+    }
+}
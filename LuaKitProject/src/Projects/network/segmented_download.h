@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "base/memory/ref_counted.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/time/time.h"
+#include "network/async_cgi_task_dispatcher.h"
+
+namespace network {
+
+  /**
+   * @brief 分段并行、可断点续传的下载，只能在IO线程使用
+   * @note 先用HEAD加Range: bytes=0-0探测文件大小和是否支持Range(返回200时看Accept-Ranges: bytes和Content-Length)，预分配文件后各段通过dispatcher并行请求，
+   *       每段写到文件自己的位置；各段进度保存在<download_path>.segments，下次下载同一个url时从断点继续，
+   *       服务器没有强ETag/Last-Modified时无法确认文件没变，从头下载；写文件失败时这一段按失败重试
+   */
+  class SegmentedDownload : public base::RefCountedThreadSafe<SegmentedDownload> {
+  public:
+    struct Segment {
+      Segment() : start(0), end(0), done(0), retries(0) {}
+      int64 start;
+      int64 end;  // 不包含
+      int64 done; // 已经写入的字节数
+      int retries;
+      scoped_refptr<HttpTask> task; // 正在下载时不为空
+    };
+    struct State {
+      State() : total(0) {}
+      std::string url;
+      int64 total;
+      std::string validator; // 强ETag或者Last-Modified，续传时作为If-Range
+      std::vector<Segment> segments;
+    };
+
+    SegmentedDownload(HttpCgiTaskDispatcher* dispatcher, const scoped_refptr<HttpTask>& task, int max_segments);
+
+    void Start();
+    /**
+     * @brief 停止所有分段并保存进度，task收到PEC_ABORTED
+     */
+    void Cancel();
+
+  private:
+    friend class base::RefCountedThreadSafe<SegmentedDownload>;
+    ~SegmentedDownload();
+
+    void OnStateLoaded(State* loaded);
+    void Probe();
+    void OnProbeResponse(int generation, const scoped_refptr<HttpResponse>& response);
+    void OnFileAllocated(bool success);
+    void StartSegment(size_t index);
+    void OnSegmentProgress(int generation, size_t index, int64 dlnow);
+    void OnSegmentResponse(int generation, size_t index, const scoped_refptr<HttpResponse>& response);
+    void StopSegments();
+    void Restart();
+    void FallbackToSingleRequest();
+    void OnOldFilesDeleted();
+    void SaveState(bool force);
+    void ReportProgress();
+    void Finish(ProtocolErrorCode error_code, long http_code);
+    int64 DoneBytes() const;
+    std::string StatePath() const;
+
+  private:
+    scoped_refptr<HttpCgiTaskDispatcher> dispatcher_;
+    scoped_refptr<HttpTask> task_;
+    int max_segments_;
+    State state_;
+    scoped_ptr<State> saved_state_; // 上次中断时保存的进度，探测后确认文件没变才使用
+    scoped_refptr<HttpTask> probe_task_;
+    int generation_; // 重新开始或者取消后加一，之前发出的请求的回调忽略
+    bool restarted_; // 文件在服务器上变了只从头下载一次
+    bool finished_;
+    base::TimeTicks last_save_time_;
+  };
+}
@@ -0,0 +1,220 @@
+#include "socket_stream_reader.h"
+#include <algorithm>
+#include <string.h>
+#include "base/bind.h"
+#include "base/callback_helpers.h"
+#include "net/net_errors.h"
+
+namespace net {
+
+const static size_t READ_CHUNK_SIZE = 8192;
+const static size_t SHRINK_CAPACITY = 64 * 1024; // 读完大数据后缓冲空了就缩回READ_CHUNK_SIZE
+
+SocketStreamReader::SocketStreamReader(AsyncSocket* socket)
+    : socket_(socket),
+      buffer_(new GrowableIOBuffer()),
+      begin_(0),
+      end_(0),
+      scanned_(0),
+      type_(READ_AVAILABLE),
+      length_(0),
+      in_socket_read_(false),
+      sync_result_(ERR_IO_PENDING),
+      weak_factory_(this) {
+}
+
+SocketStreamReader::~SocketStreamReader() {
+}
+
+int SocketStreamReader::ReadAvailable(std::string* data, const ReadCallback& callback) {
+    return StartRequest(READ_AVAILABLE, 0, std::string(), data, callback);
+}
+
+int SocketStreamReader::ReadExactly(size_t length, std::string* data, const ReadCallback& callback) {
+    return StartRequest(READ_EXACTLY, length, std::string(), data, callback);
+}
+
+int SocketStreamReader::ReadUntil(const std::string& delimiter, size_t max_length, std::string* data, const ReadCallback& callback) {
+    if (delimiter.empty()) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    return StartRequest(READ_UNTIL, max_length, delimiter, data, callback);
+}
+
+int SocketStreamReader::ReadLine(size_t max_length, std::string* data, const ReadCallback& callback) {
+    return StartRequest(READ_LINE, max_length, "\n", data, callback);
+}
+
+int SocketStreamReader::ReadFrame(const LengthPrefixedCodec& codec, std::string* data, const ReadCallback& callback) {
+    if (!codec.IsValid()) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    codec_ = codec;
+    return StartRequest(READ_FRAME, 0, std::string(), data, callback);
+}
+
+void SocketStreamReader::Reset() {
+    weak_factory_.InvalidateWeakPtrs();
+    begin_ = end_ = scanned_ = 0;
+    // 没有完成的读回调ERR_CONNECTION_CLOSED，等它的协程才能恢复
+    if (!callback_.is_null()) {
+        base::ResetAndReturn(&callback_).Run(ERR_CONNECTION_CLOSED, std::string());
+    }
+}
+
+int SocketStreamReader::StartRequest(RequestType type, size_t length, const std::string& delimiter,
+                                     std::string* data, const ReadCallback& callback) {
+    if (!callback_.is_null()) {
+        LOG(ERROR) << "SocketStreamReader read while another read is pending";
+        return ERR_UNEXPECTED;
+    }
+    type_ = type;
+    length_ = length;
+    delimiter_ = delimiter;
+    scanned_ = 0;
+    int rv = DoLoop(data);
+    if (rv == ERR_IO_PENDING) {
+        callback_ = callback;
+    }
+    return rv;
+}
+
+// 数据够了、出错或者要等socket时返回
+int SocketStreamReader::DoLoop(std::string* data) {
+    while (true) {
+        int rv = TakeFromBuffer(data);
+        if (rv != ERR_IO_PENDING) {
+            return rv;
+        }
+        PrepareBuffer();
+        // AsyncSocket::read有数据时会同步回调
+        sync_result_ = ERR_IO_PENDING;
+        in_socket_read_ = true;
+        socket_->read(buffer_.get(), buffer_->RemainingCapacity(),
+                      base::Bind(&SocketStreamReader::OnSocketRead, weak_factory_.GetWeakPtr()));
+        in_socket_read_ = false;
+        if (sync_result_ == ERR_IO_PENDING) {
+            return ERR_IO_PENDING;
+        }
+        if (sync_result_ <= 0) {
+            return sync_result_ == 0 ? ERR_CONNECTION_CLOSED : sync_result_;
+        }
+        end_ += sync_result_;
+    }
+}
+
+int SocketStreamReader::TakeFromBuffer(std::string* data) {
+    const char* start = buffer_->StartOfBuffer() + begin_;
+    size_t available = end_ - begin_;
+    size_t take = 0;
+    switch (type_) {
+        case READ_AVAILABLE:
+            take = available;
+            break;
+        case READ_EXACTLY:
+            if (available < length_) {
+                return ERR_IO_PENDING;
+            }
+            take = length_;
+            break;
+        case READ_FRAME: {
+            size_t prefix = codec_.prefix_bytes;
+            if (available < prefix) {
+                return ERR_IO_PENDING;
+            }
+            size_t payload = 0;
+            int rv = codec_.DecodeLength(start, &payload);
+            if (rv != OK) {
+                return rv;
+            }
+            // 记下整帧长度，PrepareBuffer按它一次读够
+            length_ = prefix + payload;
+            if (available < length_) {
+                return ERR_IO_PENDING;
+            }
+            data->assign(start + prefix, payload);
+            begin_ += length_;
+            if (begin_ == end_) {
+                begin_ = end_ = 0;
+            }
+            return OK;
+        }
+        case READ_UNTIL:
+        case READ_LINE: {
+            // 分隔符可能跨两次读取，从上次查找结束前delimiter长度减一的位置接着找
+            size_t from = scanned_ >= delimiter_.size() - 1 ? scanned_ - (delimiter_.size() - 1) : 0;
+            const char* found = std::search(start + from, start + available, delimiter_.begin(), delimiter_.end());
+            if (found == start + available) {
+                scanned_ = available;
+                if (available > length_) {
+                    return ERR_MSG_TOO_BIG;
+                }
+                return ERR_IO_PENDING;
+            }
+            take = found - start + delimiter_.size();
+            if (take > length_ + delimiter_.size()) {
+                return ERR_MSG_TOO_BIG;
+            }
+            break;
+        }
+    }
+    if (take == 0 && type_ != READ_EXACTLY) {
+        return ERR_IO_PENDING;
+    }
+    size_t keep = take;
+    if (type_ == READ_LINE) {
+        keep--;
+        if (keep > 0 && start[keep - 1] == '\r') {
+            keep--;
+        }
+    }
+    data->assign(start, keep);
+    begin_ += take;
+    if (begin_ == end_) {
+        begin_ = end_ = 0;
+    }
+    return OK;
+}
+
+void SocketStreamReader::PrepareBuffer() {
+    size_t want = READ_CHUNK_SIZE;
+    if ((type_ == READ_EXACTLY || type_ == READ_FRAME) && length_ > BufferedBytes() + want) {
+        // 一次读完整个单元，少调几次read
+        want = length_ - BufferedBytes();
+    }
+    size_t capacity = buffer_->capacity();
+    if (begin_ == end_ && capacity > SHRINK_CAPACITY && want <= READ_CHUNK_SIZE) {
+        buffer_->SetCapacity(READ_CHUNK_SIZE);
+        capacity = READ_CHUNK_SIZE;
+    }
+    if (capacity - end_ < want && begin_ > 0) {
+        memmove(buffer_->StartOfBuffer(), buffer_->StartOfBuffer() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+    if (capacity - end_ < want) {
+        buffer_->SetCapacity((int)std::max(capacity * 2, end_ + want));
+    }
+    buffer_->set_offset((int)end_);
+}
+
+void SocketStreamReader::OnSocketRead(int rv) {
+    if (in_socket_read_) {
+        sync_result_ = rv;
+        return;
+    }
+    std::string data;
+    if (rv <= 0) {
+        rv = rv == 0 ? ERR_CONNECTION_CLOSED : rv;
+    } else {
+        end_ += rv;
+        rv = DoLoop(&data);
+        if (rv == ERR_IO_PENDING) {
+            return;
+        }
+    }
+    if (!callback_.is_null()) {
+        base::ResetAndReturn(&callback_).Run(rv, data);
+    }
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include "base/callback.h"
+#include "base/memory/weak_ptr.h"
+#include "network/async_socket.h"
+#include "network/length_prefixed_codec.h"
+#include "network/net/io_buffer.h"
+
+namespace net {
+
+/**
+ * @brief AsyncSocket的接收缓冲，凑够一个完整的单元(n个字节、一个分隔符、一行)才返回
+ * @note 数据读到一块GrowableIOBuffer里，取走的数据在下次读之前整体前移，不够时容量翻倍；
+ *       同一时间只能有一个读请求，数据已经在缓冲里时同步返回OK，否则返回ERR_IO_PENDING，读完后回调
+ */
+class SocketStreamReader {
+public:
+    // rv为OK时data是读到的数据，否则是net错误码，连接关闭是ERR_CONNECTION_CLOSED
+    typedef base::Callback<void(int rv, const std::string& data)> ReadCallback;
+
+    explicit SocketStreamReader(AsyncSocket* socket);
+    ~SocketStreamReader();
+
+    // 缓冲里有数据就全部返回，没有就等socket下一次读到的数据
+    int ReadAvailable(std::string* data, const ReadCallback& callback);
+    int ReadExactly(size_t length, std::string* data, const ReadCallback& callback);
+    // 返回的数据包含delimiter，超过max_length还没有找到时返回ERR_MSG_TOO_BIG
+    int ReadUntil(const std::string& delimiter, size_t max_length, std::string* data, const ReadCallback& callback);
+    // 返回的数据去掉了行尾的\n或者\r\n
+    int ReadLine(size_t max_length, std::string* data, const ReadCallback& callback);
+    // 按codec读一个完整的帧，返回的数据不含长度前缀
+    int ReadFrame(const LengthPrefixedCodec& codec, std::string* data, const ReadCallback& callback);
+
+    // socket断开后调用，丢掉缓冲的数据，没有完成的读同步回调ERR_CONNECTION_CLOSED
+    void Reset();
+
+    size_t BufferedBytes() const { return end_ - begin_; }
+
+private:
+    enum RequestType {
+        READ_AVAILABLE,
+        READ_EXACTLY,
+        READ_UNTIL,
+        READ_LINE,
+        READ_FRAME,
+    };
+
+    int StartRequest(RequestType type, size_t length, const std::string& delimiter,
+                     std::string* data, const ReadCallback& callback);
+    int DoLoop(std::string* data);
+    int TakeFromBuffer(std::string* data);
+    void PrepareBuffer();
+    void OnSocketRead(int rv);
+
+    AsyncSocket* socket_;
+    scoped_refptr<GrowableIOBuffer> buffer_;
+    size_t begin_;   // 未取走数据的开始，相对StartOfBuffer
+    size_t end_;     // 未取走数据的结束
+    size_t scanned_; // READ_UNTIL已经查找过的字节数，避免每次从头找
+
+    RequestType type_;
+    size_t length_;  // READ_EXACTLY的长度或者READ_UNTIL的上限
+    std::string delimiter_;
+    LengthPrefixedCodec codec_;
+    ReadCallback callback_;
+    bool in_socket_read_;
+    int sync_result_;
+
+    base::WeakPtrFactory<SocketStreamReader> weak_factory_;
+
+    DISALLOW_COPY_AND_ASSIGN(SocketStreamReader);
+};
+}
@@ -0,0 +1,284 @@
+#include "network/socket_stream_reader.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include "base/bind.h"
+#include "base/message_loop/message_loop.h"
+#include "base/run_loop.h"
+#include "network/net/net_errors.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace net {
+
+namespace {
+
+// socketpair的一端包成AsyncSocket交给reader，测试从另一端写原始字节
+class SocketStreamReaderTest : public testing::Test {
+protected:
+    SocketStreamReaderTest() : peer_fd_(-1), callback_count_(0), result_(ERR_IO_PENDING) {}
+
+    virtual void SetUp() OVERRIDE {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        peer_fd_ = fds[1];
+        socket_.reset(new AsyncSocket(fds[0], sockaddr_data()));
+        reader_.reset(new SocketStreamReader(socket_.get()));
+    }
+
+    virtual void TearDown() OVERRIDE {
+        reader_.reset();
+        socket_.reset();
+        ClosePeer();
+    }
+
+    void Write(const std::string& data) {
+        ASSERT_EQ((ssize_t)data.size(), ::write(peer_fd_, data.data(), data.size()));
+    }
+
+    void ClosePeer() {
+        if (peer_fd_ >= 0) {
+            close(peer_fd_);
+            peer_fd_ = -1;
+        }
+    }
+
+    SocketStreamReader::ReadCallback Callback() {
+        return base::Bind(&SocketStreamReaderTest::OnRead, base::Unretained(this));
+    }
+
+    void OnRead(int rv, const std::string& data) {
+        callback_count_++;
+        result_ = rv;
+        data_ = data;
+        if (!quit_closure_.is_null()) {
+            quit_closure_.Run();
+        }
+    }
+
+    // 处理已经就绪的读事件，但不等新数据
+    void RunPending() {
+        base::RunLoop().RunUntilIdle();
+    }
+
+    void WaitForCallback() {
+        if (callback_count_ > 0) {
+            return;
+        }
+        base::RunLoop run_loop;
+        quit_closure_ = run_loop.QuitClosure();
+        run_loop.Run();
+        quit_closure_.Reset();
+    }
+
+    base::MessageLoopForIO message_loop_;
+    scoped_ptr<AsyncSocket> socket_;
+    scoped_ptr<SocketStreamReader> reader_;
+    int peer_fd_;
+
+    base::Closure quit_closure_;
+    int callback_count_;
+    int result_;
+    std::string data_;
+};
+
+TEST_F(SocketStreamReaderTest, ReadExactlyBuffered) {
+    Write("abcdef");
+    std::string data;
+    EXPECT_EQ(OK, reader_->ReadExactly(4, &data, Callback()));
+    EXPECT_EQ("abcd", data);
+    EXPECT_EQ(2u, reader_->BufferedBytes());
+    EXPECT_EQ(OK, reader_->ReadExactly(2, &data, Callback()));
+    EXPECT_EQ("ef", data);
+    EXPECT_EQ(0u, reader_->BufferedBytes());
+    EXPECT_EQ(0, callback_count_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadExactlySplitAcrossWrites) {
+    std::string data;
+    Write("ab");
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadExactly(5, &data, Callback()));
+    Write("cd");
+    RunPending();
+    EXPECT_EQ(0, callback_count_);
+    Write("efg");
+    WaitForCallback();
+    EXPECT_EQ(1, callback_count_);
+    EXPECT_EQ(OK, result_);
+    EXPECT_EQ("abcde", data_);
+    EXPECT_EQ(2u, reader_->BufferedBytes());
+}
+
+TEST_F(SocketStreamReaderTest, ReadExactlyLargerThanChunk) {
+    std::string payload(100 * 1024, 'x');
+    payload[payload.size() - 1] = 'y';
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadExactly(payload.size(), &data, Callback()));
+    // 分小块写，避免socketpair的发送缓冲写满
+    for (size_t i = 0; i < payload.size(); i += 4096) {
+        Write(payload.substr(i, 4096));
+        RunPending();
+    }
+    WaitForCallback();
+    EXPECT_EQ(OK, result_);
+    EXPECT_EQ(payload, data_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadUntilDelimiterSplitAcrossReads) {
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadUntil("\r\n\r\n", 1024, &data, Callback()));
+    Write("HTTP/1.1 101\r\n\r");
+    RunPending();
+    EXPECT_EQ(0, callback_count_);
+    Write("\nrest");
+    WaitForCallback();
+    EXPECT_EQ(OK, result_);
+    EXPECT_EQ("HTTP/1.1 101\r\n\r\n", data_);
+    EXPECT_EQ(4u, reader_->BufferedBytes());
+}
+
+TEST_F(SocketStreamReaderTest, ReadUntilDelimiterOneByteAtATime) {
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadUntil("--end--", 1024, &data, Callback()));
+    std::string input = "body--en-d---end--";
+    for (size_t i = 0; i < input.size(); i++) {
+        Write(input.substr(i, 1));
+        RunPending();
+    }
+    WaitForCallback();
+    EXPECT_EQ(OK, result_);
+    EXPECT_EQ(input, data_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadUntilTooLong) {
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadUntil("\n", 8, &data, Callback()));
+    Write("0123456789");
+    WaitForCallback();
+    EXPECT_EQ(ERR_MSG_TOO_BIG, result_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadUntilFoundPastMaxLength) {
+    Write("0123456789\n");
+    std::string data;
+    EXPECT_EQ(ERR_MSG_TOO_BIG, reader_->ReadUntil("\n", 8, &data, Callback()));
+}
+
+TEST_F(SocketStreamReaderTest, ReadUntilEmptyDelimiter) {
+    std::string data;
+    EXPECT_EQ(ERR_INVALID_ARGUMENT, reader_->ReadUntil("", 8, &data, Callback()));
+}
+
+TEST_F(SocketStreamReaderTest, ReadLine) {
+    Write("first\r\nsecond\nthird");
+    std::string data;
+    EXPECT_EQ(OK, reader_->ReadLine(64, &data, Callback()));
+    EXPECT_EQ("first", data);
+    EXPECT_EQ(OK, reader_->ReadLine(64, &data, Callback()));
+    EXPECT_EQ("second", data);
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadLine(64, &data, Callback()));
+    Write("\r");
+    RunPending();
+    EXPECT_EQ(0, callback_count_);
+    Write("\n");
+    WaitForCallback();
+    EXPECT_EQ(OK, result_);
+    EXPECT_EQ("third", data_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadAvailable) {
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadAvailable(&data, Callback()));
+    Write("xyz");
+    WaitForCallback();
+    EXPECT_EQ(OK, result_);
+    EXPECT_EQ("xyz", data_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadFrameBackToBack) {
+    LengthPrefixedCodec codec;
+    std::string first, second;
+    ASSERT_EQ(OK, codec.Encode("hello", &first));
+    ASSERT_EQ(OK, codec.Encode("", &second));
+    std::string third;
+    ASSERT_EQ(OK, codec.Encode("world", &third));
+    Write(first + second + third);
+
+    std::string data;
+    EXPECT_EQ(OK, reader_->ReadFrame(codec, &data, Callback()));
+    EXPECT_EQ("hello", data);
+    EXPECT_EQ(OK, reader_->ReadFrame(codec, &data, Callback()));
+    EXPECT_EQ("", data);
+    EXPECT_EQ(OK, reader_->ReadFrame(codec, &data, Callback()));
+    EXPECT_EQ("world", data);
+    EXPECT_EQ(0u, reader_->BufferedBytes());
+}
+
+// 前缀本身也被拆开
+TEST_F(SocketStreamReaderTest, ReadFrameSplitAcrossWrites) {
+    LengthPrefixedCodec codec;
+    codec.prefix_bytes = 2;
+    codec.big_endian = false;
+    std::string frame;
+    ASSERT_EQ(OK, codec.Encode("payload", &frame));
+
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadFrame(codec, &data, Callback()));
+    Write(frame.substr(0, 1));
+    RunPending();
+    Write(frame.substr(1, 4));
+    RunPending();
+    EXPECT_EQ(0, callback_count_);
+    Write(frame.substr(5));
+    WaitForCallback();
+    EXPECT_EQ(OK, result_);
+    EXPECT_EQ("payload", data_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadFrameOverLengthPrefix) {
+    LengthPrefixedCodec codec;
+    codec.max_frame_size = 16;
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadFrame(codec, &data, Callback()));
+    // 只要前缀到了就报错，不等数据
+    Write(std::string("\x00\x00\x00\x11", 4));
+    WaitForCallback();
+    EXPECT_EQ(ERR_MSG_TOO_BIG, result_);
+}
+
+TEST_F(SocketStreamReaderTest, ReadFrameInvalidCodec) {
+    LengthPrefixedCodec codec;
+    codec.prefix_bytes = 3;
+    std::string data;
+    EXPECT_EQ(ERR_INVALID_ARGUMENT, reader_->ReadFrame(codec, &data, Callback()));
+}
+
+TEST_F(SocketStreamReaderTest, EndOfStream) {
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadExactly(4, &data, Callback()));
+    Write("ab");
+    RunPending();
+    ClosePeer();
+    WaitForCallback();
+    EXPECT_EQ(ERR_CONNECTION_CLOSED, result_);
+}
+
+TEST_F(SocketStreamReaderTest, SecondReadWhilePending) {
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadExactly(4, &data, Callback()));
+    EXPECT_EQ(ERR_UNEXPECTED, reader_->ReadLine(64, &data, Callback()));
+}
+
+TEST_F(SocketStreamReaderTest, ResetRunsPendingCallback) {
+    std::string data;
+    ASSERT_EQ(ERR_IO_PENDING, reader_->ReadExactly(4, &data, Callback()));
+    Write("ab");
+    RunPending();
+    reader_->Reset();
+    EXPECT_EQ(1, callback_count_);
+    EXPECT_EQ(ERR_CONNECTION_CLOSED, result_);
+    EXPECT_EQ(0u, reader_->BufferedBytes());
+}
+
+}  // namespace
+
+}  // namespace net
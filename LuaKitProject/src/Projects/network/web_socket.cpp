@@ -0,0 +1,852 @@
+#include "web_socket.h"
+#include <algorithm>
+#include <map>
+#include <string.h>
+#include <zlib.h>
+#include "base/bind.h"
+#include "base/callback_helpers.h"
+#include "base/rand_util.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/strings/string_util.h"
+#include "modp_b64/modp_b64.h"
+#include "net/net_errors.h"
+
+namespace net {
+
+const static char* WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const static size_t MAX_HANDSHAKE_RESPONSE_SIZE = 16 * 1024;
+const static size_t MAX_CONTROL_PAYLOAD = 125;
+const static size_t DEFLATE_MIN_SIZE = 64;      // 太短的消息压缩后反而变长，不压缩
+const static size_t INFLATE_CHUNK_SIZE = 16 * 1024;
+const static int HANDSHAKE_TIMEOUT_SECONDS = 30;
+const static int CLOSE_TIMEOUT_SECONDS = 3;
+const static char DEFLATE_TRAILER[] = {'\x00', '\x00', '\xff', '\xff'};
+
+enum Opcode {
+    OPCODE_CONTINUATION = 0x0,
+    OPCODE_TEXT = 0x1,
+    OPCODE_BINARY = 0x2,
+    OPCODE_CLOSE = 0x8,
+    OPCODE_PING = 0x9,
+    OPCODE_PONG = 0xa,
+};
+
+enum CloseCode {
+    CLOSE_NORMAL = 1000,
+    CLOSE_PROTOCOL_ERROR = 1002,
+    CLOSE_NO_STATUS = 1005,
+    CLOSE_ABNORMAL = 1006,
+    CLOSE_INVALID_DATA = 1007,
+    CLOSE_MESSAGE_TOO_BIG = 1009,
+};
+
+const static size_t SHA1_DIGEST_LENGTH = 20;
+
+static std::string Base64Encode(const unsigned char* data, size_t length) {
+    std::string output(modp_b64_encode_len(length), '\0');
+    size_t written = modp_b64_encode(&output[0], (const char*)data, length);
+    output.resize(written == (size_t)-1 ? 0 : written);
+    return output;
+}
+
+// RFC 6455 7.4：1005/1006/1015不能出现在关闭帧里，1016-2999保留，1004没有定义
+static bool IsValidCloseCode(int code) {
+    if (code >= 3000 && code <= 4999) {
+        return true;
+    }
+    return code >= CLOSE_NORMAL && code <= 1014 &&
+           code != 1004 && code != CLOSE_NO_STATUS && code != CLOSE_ABNORMAL;
+}
+
+static inline uint32 RotateLeft(uint32 value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// 只用来算Sec-WebSocket-Accept，不需要为这个链接libcrypto
+static void Sha1(const std::string& data, unsigned char digest[SHA1_DIGEST_LENGTH]) {
+    uint32 h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string message(data);
+    uint64 bit_length = (uint64)data.size() * 8;
+    message.push_back('\x80');
+    while (message.size() % 64 != 56) {
+        message.push_back('\0');
+    }
+    for (int i = 7; i >= 0; i--) {
+        message.push_back((char)(bit_length >> (i * 8)));
+    }
+    for (size_t block = 0; block < message.size(); block += 64) {
+        const unsigned char* p = (const unsigned char*)message.data() + block;
+        uint32 w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32)p[i * 4] << 24) | ((uint32)p[i * 4 + 1] << 16) |
+                   ((uint32)p[i * 4 + 2] << 8) | (uint32)p[i * 4 + 3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32 a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32 f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32 temp = RotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = RotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (unsigned char)(h[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(h[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(h[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)h[i];
+    }
+}
+
+// ws://host[:port][/path][?query]，IPv6地址写在[]里
+static int ParseUrl(const std::string& url, std::string* host, std::string* host_header,
+                    uint16_t* port, std::string* resource) {
+    size_t scheme_end = url.find("://");
+    if (scheme_end == std::string::npos) {
+        return ERR_INVALID_URL;
+    }
+    // AsyncSocket没有TLS，wss://不支持
+    if (!LowerCaseEqualsASCII(url.begin(), url.begin() + scheme_end, "ws")) {
+        return ERR_DISALLOWED_URL_SCHEME;
+    }
+    size_t authority_begin = scheme_end + 3;
+    size_t path_begin = url.find_first_of("/?#", authority_begin);
+    std::string authority = url.substr(authority_begin, path_begin == std::string::npos ? std::string::npos
+                                                                                         : path_begin - authority_begin);
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos) {
+        authority.erase(0, at + 1);
+    }
+    *resource = path_begin == std::string::npos ? std::string() : url.substr(path_begin);
+    size_t fragment = resource->find('#');
+    if (fragment != std::string::npos) {
+        resource->erase(fragment);
+    }
+    if (resource->empty() || (*resource)[0] != '/') {
+        resource->insert(0, "/");
+    }
+
+    size_t port_separator = std::string::npos;
+    if (!authority.empty() && authority[0] == '[') {
+        size_t bracket = authority.find(']');
+        if (bracket == std::string::npos) {
+            return ERR_INVALID_URL;
+        }
+        *host = authority.substr(1, bracket - 1);
+        if (bracket + 1 < authority.size()) {
+            if (authority[bracket + 1] != ':') {
+                return ERR_INVALID_URL;
+            }
+            port_separator = bracket + 1;
+        }
+    } else {
+        port_separator = authority.rfind(':');
+        *host = authority.substr(0, port_separator);
+    }
+    int port_value = 80;
+    if (port_separator != std::string::npos &&
+        (!base::StringToInt(authority.substr(port_separator + 1), &port_value) || port_value <= 0 || port_value > 65535)) {
+        return ERR_INVALID_URL;
+    }
+    if (host->empty()) {
+        return ERR_INVALID_URL;
+    }
+    *host_header = authority;
+    *port = (uint16_t)port_value;
+    return OK;
+}
+
+// 按4字节的掩码循环异或，一次处理8个字节
+static void MaskPayload(char* data, size_t length, const char mask[4]) {
+    char mask_bytes[8];
+    for (int i = 0; i < 8; i++) {
+        mask_bytes[i] = mask[i % 4];
+    }
+    uint64 mask_word;
+    memcpy(&mask_word, mask_bytes, sizeof(mask_word));
+    size_t i = 0;
+    for (; i + sizeof(mask_word) <= length; i += sizeof(mask_word)) {
+        uint64 word;
+        memcpy(&word, data + i, sizeof(word));
+        word ^= mask_word;
+        memcpy(data + i, &word, sizeof(word));
+    }
+    for (; i < length; i++) {
+        data[i] ^= mask[i % 4];
+    }
+}
+
+WebSocket::Options::Options()
+    : permessage_deflate(true),
+      max_message_size(16 * 1024 * 1024),
+      fragment_size(0),
+      ping_interval_ms(0) {
+}
+
+WebSocket::WebSocket(const std::string& url, const Options& options)
+    : port_(0),
+      options_(options),
+      state_(STATE_NONE),
+      read_state_(READ_HEADER),
+      read_want_(2),
+      frame_fin_(false),
+      frame_compressed_(false),
+      frame_opcode_(0),
+      frame_length_(0),
+      message_opcode_(0),
+      message_compressed_(false),
+      deflate_enabled_(false),
+      client_no_context_takeover_(false),
+      server_no_context_takeover_(false),
+      client_window_bits_(15),
+      close_write_pending_(false),
+      alive_(true),
+      weak_factory_(this) {
+    url_error_ = ParseUrl(url, &host_, &host_header_, &port_, &resource_);
+    if (url_error_ == OK) {
+        socket_.reset(new AsyncSocket(host_, port_));
+        reader_.reset(new SocketStreamReader(socket_.get()));
+    }
+}
+
+WebSocket::~WebSocket() {
+    if (deflater_) {
+        deflateEnd(deflater_.get());
+    }
+    if (inflater_) {
+        inflateEnd(inflater_.get());
+    }
+    // reader_引用socket_，先删除
+    reader_.reset();
+}
+
+int WebSocket::open(const CompletionCallback& callback) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    if (url_error_ != OK) {
+        return url_error_;
+    }
+    if (state_ != STATE_NONE) {
+        return ERR_UNEXPECTED;
+    }
+    state_ = STATE_CONNECTING;
+    open_callback_ = callback;
+    timeout_timer_.Start(FROM_HERE, base::TimeDelta::FromSeconds(HANDSHAKE_TIMEOUT_SECONDS), this, &WebSocket::OnTimeout);
+    // AsyncSocket::connect失败时可能同步回调，放到下一个任务里保证open不会同步回调
+    base::MessageLoop::current()->PostTask(FROM_HERE, base::Bind(&WebSocket::DoConnect, weak_factory_.GetWeakPtr()));
+    return ERR_IO_PENDING;
+}
+
+void WebSocket::setMessageCallback(const MessageCallback& callback) {
+    message_callback_ = callback;
+}
+
+void WebSocket::setCloseCallback(const CloseCallback& callback) {
+    close_callback_ = callback;
+}
+
+void WebSocket::DoConnect() {
+    if (state_ != STATE_CONNECTING) {
+        return;
+    }
+    socket_->connect(base::Bind(&WebSocket::OnConnected, weak_factory_.GetWeakPtr()));
+}
+
+void WebSocket::OnConnected(int rv) {
+    if (state_ != STATE_CONNECTING) {
+        return;
+    }
+    if (rv != OK) {
+        FinishOpen(rv);
+        return;
+    }
+    unsigned char nonce[16];
+    base::RandBytes(nonce, sizeof(nonce));
+    key_ = Base64Encode(nonce, sizeof(nonce));
+
+    scoped_ptr<std::string> request(new std::string());
+    request->append("GET " + resource_ + " HTTP/1.1\r\n");
+    request->append("Host: " + host_header_ + "\r\n");
+    request->append("Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Version: 13\r\n");
+    request->append("Sec-WebSocket-Key: " + key_ + "\r\n");
+    if (!options_.protocols.empty()) {
+        request->append("Sec-WebSocket-Protocol: ");
+        for (size_t i = 0; i < options_.protocols.size(); i++) {
+            request->append(i == 0 ? "" : ", ");
+            request->append(options_.protocols[i]);
+        }
+        request->append("\r\n");
+    }
+    if (options_.permessage_deflate) {
+        request->append("Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n");
+    }
+    for (auto& header : options_.headers) {
+        request->append(header.first + ": " + header.second + "\r\n");
+    }
+    request->append("\r\n");
+    size_t length = request->size();
+    scoped_refptr<IOBuffer> buffer(new StringIOBuffer(request.Pass()));
+    socket_->write(buffer.get(), length, CompletionCallback());
+
+    // 写失败时socket被关闭，读会返回错误
+    std::string response;
+    rv = reader_->ReadUntil("\r\n\r\n", MAX_HANDSHAKE_RESPONSE_SIZE, &response,
+                            base::Bind(&WebSocket::OnHandshakeResponse, weak_factory_.GetWeakPtr()));
+    if (rv != ERR_IO_PENDING) {
+        OnHandshakeResponse(rv, response);
+    }
+}
+
+void WebSocket::OnHandshakeResponse(int rv, const std::string& response) {
+    if (state_ != STATE_CONNECTING) {
+        return;
+    }
+    if (rv == OK) {
+        rv = ValidateHandshake(response);
+    } else if (rv == ERR_MSG_TOO_BIG) {
+        rv = ERR_INVALID_RESPONSE;
+    }
+    if (rv == OK && deflate_enabled_) {
+        deflater_.reset(new z_stream());
+        inflater_.reset(new z_stream());
+        // zlib的raw deflate不支持8位窗口，和8位兼容的最小值是9
+        if (deflateInit2(deflater_.get(), Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -std::max(client_window_bits_, 9), 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            deflater_.reset();
+            rv = ERR_INSUFFICIENT_RESOURCES;
+        }
+        // 15位窗口可以解压任何窗口大小的数据
+        if (inflateInit2(inflater_.get(), -MAX_WBITS) != Z_OK) {
+            inflater_.reset();
+            rv = ERR_INSUFFICIENT_RESOURCES;
+        }
+    }
+    if (rv != OK) {
+        FinishOpen(rv);
+        return;
+    }
+    timeout_timer_.Stop();
+    state_ = STATE_OPEN;
+    read_state_ = READ_HEADER;
+    read_want_ = 2;
+    if (options_.ping_interval_ms > 0) {
+        ping_timer_.Start(FROM_HERE, base::TimeDelta::FromMilliseconds(options_.ping_interval_ms), this, &WebSocket::OnPingTimer);
+    }
+    base::WeakPtr<WebSocket> self = weak_factory_.GetWeakPtr();
+    if (!open_callback_.is_null()) {
+        base::ResetAndReturn(&open_callback_).Run(OK);
+    }
+    if (self) {
+        DoReadLoop();
+    }
+}
+
+std::string WebSocket::ComputeAcceptKey(const std::string& key) {
+    unsigned char digest[SHA1_DIGEST_LENGTH];
+    Sha1(key + WEBSOCKET_GUID, digest);
+    return Base64Encode(digest, sizeof(digest));
+}
+
+int WebSocket::ValidateHandshake(const std::string& response) {
+    std::vector<std::string> lines;
+    base::SplitStringUsingSubstr(response, "\r\n", &lines);
+    if (lines.empty()) {
+        return ERR_INVALID_RESPONSE;
+    }
+    // HTTP/1.1 101 Switching Protocols
+    std::vector<std::string> status;
+    base::SplitString(lines[0], ' ', &status);
+    if (status.size() < 2 || !StartsWithASCII(status[0], "HTTP/", true) || status[1] != "101") {
+        LOG(ERROR) << "WebSocket handshake failed: " << lines[0];
+        return ERR_INVALID_RESPONSE;
+    }
+    std::map<std::string, std::string> headers;
+    for (size_t i = 1; i < lines.size(); i++) {
+        size_t colon = lines[i].find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name, value;
+        TrimWhitespaceASCII(lines[i].substr(0, colon), TRIM_ALL, &name);
+        TrimWhitespaceASCII(lines[i].substr(colon + 1), TRIM_ALL, &value);
+        std::string& merged = headers[StringToLowerASCII(name)];
+        merged += merged.empty() ? value : ", " + value;
+    }
+
+    if (!LowerCaseEqualsASCII(headers["upgrade"], "websocket")) {
+        return ERR_INVALID_RESPONSE;
+    }
+    std::vector<std::string> connection;
+    base::SplitString(headers["connection"], ',', &connection);
+    bool upgrade = false;
+    for (auto& token : connection) {
+        upgrade = upgrade || LowerCaseEqualsASCII(token, "upgrade");
+    }
+    if (!upgrade) {
+        return ERR_INVALID_RESPONSE;
+    }
+
+    if (headers["sec-websocket-accept"] != ComputeAcceptKey(key_)) {
+        return ERR_INVALID_RESPONSE;
+    }
+
+    protocol_ = headers["sec-websocket-protocol"];
+    if (!protocol_.empty() &&
+        std::find(options_.protocols.begin(), options_.protocols.end(), protocol_) == options_.protocols.end()) {
+        return ERR_INVALID_RESPONSE;
+    }
+    return ParseExtensions(headers["sec-websocket-extensions"]);
+}
+
+// 只接受我们提出的permessage-deflate
+int WebSocket::ParseExtensions(const std::string& extensions) {
+    if (extensions.empty()) {
+        return OK;
+    }
+    std::vector<std::string> params;
+    base::SplitString(extensions, ';', &params);
+    if (!options_.permessage_deflate || params.empty() || params[0] != "permessage-deflate") {
+        return ERR_INVALID_RESPONSE;
+    }
+    for (size_t i = 1; i < params.size(); i++) {
+        std::string name = params[i];
+        std::string value;
+        size_t equals = name.find('=');
+        if (equals != std::string::npos) {
+            TrimWhitespaceASCII(name.substr(equals + 1), TRIM_ALL, &value);
+            TrimWhitespaceASCII(name.substr(0, equals), TRIM_ALL, &name);
+            base::TrimString(value, "\"", &value);
+        }
+        int bits = 0;
+        if (name == "server_no_context_takeover" && value.empty()) {
+            server_no_context_takeover_ = true;
+        } else if (name == "client_no_context_takeover" && value.empty()) {
+            client_no_context_takeover_ = true;
+        } else if (name == "server_max_window_bits" &&
+                   base::StringToInt(value, &bits) && bits >= 8 && bits <= 15) {
+            // 解压总是用15位窗口
+        } else if (name == "client_max_window_bits" &&
+                   base::StringToInt(value, &bits) && bits >= 8 && bits <= 15) {
+            client_window_bits_ = bits;
+        } else {
+            return ERR_INVALID_RESPONSE;
+        }
+    }
+    deflate_enabled_ = true;
+    return OK;
+}
+
+void WebSocket::FinishOpen(int rv) {
+    state_ = STATE_CLOSED;
+    timeout_timer_.Stop();
+    reader_->Reset();
+    socket_->disconnect();
+    if (!open_callback_.is_null()) {
+        base::ResetAndReturn(&open_callback_).Run(rv);
+    }
+}
+
+// 帧头、扩展长度、数据依次用ReadExactly读，缓冲里已经有的帧同步处理
+void WebSocket::DoReadLoop() {
+    while (state_ == STATE_OPEN || state_ == STATE_CLOSING) {
+        std::string data;
+        int rv = reader_->ReadExactly(read_want_, &data,
+                                      base::Bind(&WebSocket::OnReadComplete, weak_factory_.GetWeakPtr()));
+        if (rv == ERR_IO_PENDING) {
+            return;
+        }
+        if (rv != OK) {
+            FinishClose(rv, CLOSE_ABNORMAL, std::string());
+            return;
+        }
+        if (!HandleRead(data)) {
+            return;
+        }
+    }
+}
+
+void WebSocket::OnReadComplete(int rv, const std::string& data) {
+    if (rv != OK) {
+        FinishClose(rv, CLOSE_ABNORMAL, std::string());
+        return;
+    }
+    if (HandleRead(data)) {
+        DoReadLoop();
+    }
+}
+
+// 返回false表示连接已经关闭或者WebSocket已经被删除，不再继续读
+bool WebSocket::HandleRead(const std::string& data) {
+    const unsigned char* bytes = (const unsigned char*)data.data();
+    switch (read_state_) {
+        case READ_HEADER: {
+            alive_ = true;
+            frame_fin_ = (bytes[0] & 0x80) != 0;
+            frame_compressed_ = (bytes[0] & 0x40) != 0;
+            frame_opcode_ = bytes[0] & 0x0f;
+            bool reserved = (bytes[0] & 0x30) != 0;
+            bool masked = (bytes[1] & 0x80) != 0;
+            frame_length_ = bytes[1] & 0x7f;
+            bool control = (frame_opcode_ & 0x08) != 0;
+            bool valid = !reserved && !masked;
+            if (control) {
+                valid = valid && frame_fin_ && !frame_compressed_ && frame_length_ <= MAX_CONTROL_PAYLOAD &&
+                        frame_opcode_ <= OPCODE_PONG;
+            } else if (frame_opcode_ == OPCODE_CONTINUATION) {
+                valid = valid && message_opcode_ != 0 && !frame_compressed_;
+            } else {
+                valid = valid && message_opcode_ == 0 && frame_opcode_ <= OPCODE_BINARY &&
+                        (!frame_compressed_ || deflate_enabled_);
+            }
+            if (!valid) {
+                Fail(ERR_WS_PROTOCOL_ERROR, CLOSE_PROTOCOL_ERROR, "invalid frame header");
+                return false;
+            }
+            if (frame_length_ >= 126) {
+                read_state_ = READ_LENGTH;
+                read_want_ = frame_length_ == 126 ? 2 : 8;
+                return true;
+            }
+            return BeginPayload();
+        }
+        case READ_LENGTH: {
+            frame_length_ = 0;
+            for (size_t i = 0; i < data.size(); i++) {
+                frame_length_ = (frame_length_ << 8) | bytes[i];
+            }
+            if (frame_length_ >> 63) {
+                Fail(ERR_WS_PROTOCOL_ERROR, CLOSE_PROTOCOL_ERROR, "invalid frame length");
+                return false;
+            }
+            return BeginPayload();
+        }
+        case READ_PAYLOAD:
+            read_state_ = READ_HEADER;
+            read_want_ = 2;
+            return HandleFrame(data);
+    }
+    return false;
+}
+
+bool WebSocket::BeginPayload() {
+    // 压缩的消息解压后还会再检查一次
+    if (frame_length_ > options_.max_message_size - std::min(message_.size(), options_.max_message_size)) {
+        Fail(ERR_MSG_TOO_BIG, CLOSE_MESSAGE_TOO_BIG, "message too big");
+        return false;
+    }
+    read_state_ = READ_PAYLOAD;
+    read_want_ = (size_t)frame_length_;
+    return true;
+}
+
+bool WebSocket::HandleFrame(const std::string& payload) {
+    switch (frame_opcode_) {
+        case OPCODE_CLOSE: {
+            if (payload.size() == 1) {
+                Fail(ERR_WS_PROTOCOL_ERROR, CLOSE_PROTOCOL_ERROR, "invalid close frame");
+                return false;
+            }
+            int code = CLOSE_NO_STATUS;
+            std::string reason;
+            if (payload.size() >= 2) {
+                code = ((unsigned char)payload[0] << 8) | (unsigned char)payload[1];
+                reason = payload.substr(2);
+                if (!IsValidCloseCode(code)) {
+                    Fail(ERR_WS_PROTOCOL_ERROR, CLOSE_PROTOCOL_ERROR, "invalid close code");
+                    return false;
+                }
+            }
+            if (!IsStringUTF8(reason)) {
+                Fail(ERR_WS_PROTOCOL_ERROR, CLOSE_INVALID_DATA, "invalid UTF-8");
+                return false;
+            }
+            if (state_ == STATE_OPEN) {
+                // 对方发起的关闭，回复同样的关闭码
+                SendClose(code == CLOSE_NO_STATUS ? 0 : code, std::string());
+            }
+            FinishClose(OK, code, reason);
+            return false;
+        }
+        case OPCODE_PING:
+            if (state_ == STATE_OPEN) {
+                WriteFrame(OPCODE_PONG, true, false, payload.data(), payload.size(), CompletionCallback());
+            }
+            return true;
+        case OPCODE_PONG:
+            return true;
+        default:
+            break;
+    }
+
+    if (frame_opcode_ != OPCODE_CONTINUATION) {
+        message_opcode_ = frame_opcode_;
+        message_compressed_ = frame_compressed_;
+    }
+    message_.append(payload);
+    if (!frame_fin_) {
+        return true;
+    }
+    std::string message;
+    message.swap(message_);
+    MessageType type = (MessageType)message_opcode_;
+    message_opcode_ = 0;
+    if (message_compressed_) {
+        int rv = Inflate(&message);
+        if (rv != OK) {
+            Fail(rv, rv == ERR_MSG_TOO_BIG ? CLOSE_MESSAGE_TOO_BIG : CLOSE_INVALID_DATA, "inflate failed");
+            return false;
+        }
+    }
+    // 文本消息必须是合法的UTF-8，以1007关闭
+    if (type == MESSAGE_TEXT && !IsStringUTF8(message)) {
+        Fail(ERR_WS_PROTOCOL_ERROR, CLOSE_INVALID_DATA, "invalid UTF-8");
+        return false;
+    }
+    // 关闭握手期间收到的消息丢掉
+    if (state_ != STATE_OPEN || message_callback_.is_null()) {
+        return true;
+    }
+    base::WeakPtr<WebSocket> self = weak_factory_.GetWeakPtr();
+    message_callback_.Run(type, message);
+    return self && (state_ == STATE_OPEN || state_ == STATE_CLOSING);
+}
+
+int WebSocket::Deflate(const std::string& data, std::string* output) {
+    deflater_->next_in = (Bytef*)data.data();
+    deflater_->avail_in = (uInt)data.size();
+    output->resize(deflateBound(deflater_.get(), (uLong)data.size()) + sizeof(DEFLATE_TRAILER));
+    size_t written = 0;
+    do {
+        if (written == output->size()) {
+            output->resize(output->size() * 2);
+        }
+        deflater_->next_out = (Bytef*)&(*output)[written];
+        deflater_->avail_out = (uInt)(output->size() - written);
+        int zrv = deflate(deflater_.get(), Z_SYNC_FLUSH);
+        if (zrv != Z_OK && zrv != Z_BUF_ERROR) {
+            return ERR_UNEXPECTED;
+        }
+        written = output->size() - deflater_->avail_out;
+    } while (deflater_->avail_out == 0);
+    // Z_SYNC_FLUSH的结尾是00 00 ff ff，RFC 7692要求去掉
+    if (written >= sizeof(DEFLATE_TRAILER) &&
+        memcmp(output->data() + written - sizeof(DEFLATE_TRAILER), DEFLATE_TRAILER, sizeof(DEFLATE_TRAILER)) == 0) {
+        written -= sizeof(DEFLATE_TRAILER);
+    }
+    output->resize(written);
+    if (client_no_context_takeover_) {
+        deflateReset(deflater_.get());
+    }
+    return OK;
+}
+
+int WebSocket::Inflate(std::string* data) {
+    std::string input;
+    input.swap(*data);
+    input.append(DEFLATE_TRAILER, sizeof(DEFLATE_TRAILER));
+    inflater_->next_in = (Bytef*)input.data();
+    inflater_->avail_in = (uInt)input.size();
+    char chunk[INFLATE_CHUNK_SIZE];
+    while (true) {
+        inflater_->next_out = (Bytef*)chunk;
+        inflater_->avail_out = sizeof(chunk);
+        int zrv = inflate(inflater_.get(), Z_SYNC_FLUSH);
+        if (zrv != Z_OK && zrv != Z_STREAM_END && zrv != Z_BUF_ERROR) {
+            return ERR_CONTENT_DECODING_FAILED;
+        }
+        data->append(chunk, sizeof(chunk) - inflater_->avail_out);
+        if (data->size() > options_.max_message_size) {
+            return ERR_MSG_TOO_BIG;
+        }
+        if (zrv == Z_STREAM_END) {
+            // 对方用BFINAL结束了流，下一条消息从新的流开始
+            inflateReset(inflater_.get());
+            break;
+        }
+        if (zrv == Z_BUF_ERROR || (inflater_->avail_in == 0 && inflater_->avail_out != 0)) {
+            break;
+        }
+    }
+    if (server_no_context_takeover_) {
+        inflateReset(inflater_.get());
+    }
+    return OK;
+}
+
+int WebSocket::send(MessageType type, const std::string& data) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    if (state_ != STATE_OPEN) {
+        return ERR_SOCKET_NOT_CONNECTED;
+    }
+    const std::string* payload = &data;
+    std::string compressed;
+    bool use_deflate = deflate_enabled_ && data.size() >= DEFLATE_MIN_SIZE;
+    if (use_deflate) {
+        int rv = Deflate(data, &compressed);
+        if (rv != OK) {
+            return rv;
+        }
+        payload = &compressed;
+    }
+    size_t fragment_size = options_.fragment_size > 0 ? options_.fragment_size : payload->size();
+    size_t offset = 0;
+    int opcode = type;
+    do {
+        size_t length = std::min(fragment_size, payload->size() - offset);
+        bool fin = offset + length == payload->size();
+        // RSV1只在第一帧上设置
+        WriteFrame(opcode, fin, use_deflate && opcode != OPCODE_CONTINUATION,
+                   payload->data() + offset, length, CompletionCallback());
+        opcode = OPCODE_CONTINUATION;
+        offset += length;
+    } while (offset < payload->size());
+    return OK;
+}
+
+int WebSocket::ping(const std::string& payload) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    if (state_ != STATE_OPEN) {
+        return ERR_SOCKET_NOT_CONNECTED;
+    }
+    if (payload.size() > MAX_CONTROL_PAYLOAD) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    WriteFrame(OPCODE_PING, true, false, payload.data(), payload.size(), CompletionCallback());
+    return OK;
+}
+
+void WebSocket::close(int code, const std::string& reason) {
+    DCHECK(thread_checker_.CalledOnValidThread());
+    if (url_error_ != OK) {
+        return;
+    }
+    if (state_ == STATE_NONE || state_ == STATE_CONNECTING) {
+        FinishOpen(ERR_ABORTED);
+        return;
+    }
+    if (state_ != STATE_OPEN) {
+        return;
+    }
+    SendClose(code, reason);
+    state_ = STATE_CLOSING;
+    ping_timer_.Stop();
+    timeout_timer_.Start(FROM_HERE, base::TimeDelta::FromSeconds(CLOSE_TIMEOUT_SECONDS), this, &WebSocket::OnTimeout);
+}
+
+// 客户端发出的帧必须加掩码，帧头、掩码和数据拼成一块写入
+void WebSocket::WriteFrame(int opcode, bool fin, bool compressed, const char* data, size_t length,
+                           const CompletionCallback& callback) {
+    scoped_ptr<std::string> frame(new std::string());
+    frame->reserve(length + 14);
+    frame->push_back((char)((fin ? 0x80 : 0) | (compressed ? 0x40 : 0) | opcode));
+    if (length < 126) {
+        frame->push_back((char)(0x80 | length));
+    } else if (length <= 0xffff) {
+        frame->push_back((char)(0x80 | 126));
+        frame->push_back((char)(length >> 8));
+        frame->push_back((char)length);
+    } else {
+        frame->push_back((char)(0x80 | 127));
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame->push_back((char)((uint64)length >> shift));
+        }
+    }
+    uint32 mask_value = (uint32)base::RandUint64();
+    char mask[4];
+    memcpy(mask, &mask_value, sizeof(mask));
+    frame->append(mask, sizeof(mask));
+    size_t header_length = frame->size();
+    frame->append(data, length);
+    MaskPayload(&(*frame)[header_length], length, mask);
+    size_t frame_length = frame->size();
+    scoped_refptr<IOBuffer> buffer(new StringIOBuffer(frame.Pass()));
+    socket_->write(buffer.get(), frame_length, callback);
+}
+
+void WebSocket::SendClose(int code, const std::string& reason) {
+    std::string payload;
+    if (code > 0) {
+        payload.push_back((char)(code >> 8));
+        payload.push_back((char)code);
+        payload.append(reason.substr(0, MAX_CONTROL_PAYLOAD - 2));
+    }
+    close_write_pending_ = true;
+    WriteFrame(OPCODE_CLOSE, true, false, payload.data(), payload.size(),
+               base::Bind(&WebSocket::OnCloseFrameWritten, weak_factory_.GetWeakPtr()));
+}
+
+void WebSocket::OnCloseFrameWritten(int rv) {
+    close_write_pending_ = false;
+    if (state_ == STATE_CLOSED) {
+        socket_->disconnect();
+    }
+}
+
+void WebSocket::OnPingTimer() {
+    if (!alive_) {
+        FinishClose(ERR_TIMED_OUT, CLOSE_ABNORMAL, std::string());
+        return;
+    }
+    alive_ = false;
+    WriteFrame(OPCODE_PING, true, false, NULL, 0, CompletionCallback());
+}
+
+void WebSocket::OnTimeout() {
+    if (state_ == STATE_CONNECTING) {
+        FinishOpen(ERR_TIMED_OUT);
+    } else if (state_ == STATE_CLOSING) {
+        FinishClose(ERR_TIMED_OUT, CLOSE_ABNORMAL, std::string());
+    }
+}
+
+// 协议错误时先告诉对方原因再断开
+void WebSocket::Fail(int rv, int code, const std::string& reason) {
+    if (state_ == STATE_OPEN) {
+        SendClose(code, reason);
+    }
+    // close callback的code和reason只来自对方的关闭帧，本地出错时按没有收到关闭帧报1006
+    FinishClose(rv, CLOSE_ABNORMAL, std::string());
+}
+
+void WebSocket::FinishClose(int rv, int code, const std::string& reason) {
+    if (state_ == STATE_CLOSED) {
+        return;
+    }
+    state_ = STATE_CLOSED;
+    ping_timer_.Stop();
+    timeout_timer_.Stop();
+    reader_->Reset();
+    message_.clear();
+    if (!close_write_pending_) {
+        socket_->disconnect();
+    }
+    if (!close_callback_.is_null()) {
+        base::ResetAndReturn(&close_callback_).Run(rv, code, reason);
+    }
+}
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "base/callback.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/memory/weak_ptr.h"
+#include "base/threading/thread_checker.h"
+#include "base/timer/timer.h"
+#include "network/async_socket.h"
+#include "network/socket_stream_reader.h"
+
+typedef struct z_stream_s z_stream;
+
+namespace net {
+
+/**
+ * @brief RFC 6455 WebSocket客户端，跑在当前线程的AsyncSocket上，只支持ws://
+ * @note 分片的消息收齐(需要时解压)后整条回调，数据是原样的字节，文本消息不是合法UTF-8时以1007关闭；发出的帧都加掩码，超过fragment_size时分片；
+ *       自动回复ping，ping_interval_ms不为0时定时ping，下一次ping前没有收到任何帧就断开；
+ *       permessage-deflate(RFC 7692)在服务器同意时启用
+ */
+class WebSocket {
+public:
+    enum MessageType {
+        MESSAGE_TEXT = 1,
+        MESSAGE_BINARY = 2,
+    };
+    struct Options {
+        Options();
+        std::vector<std::string> protocols;                         // Sec-WebSocket-Protocol
+        std::vector<std::pair<std::string, std::string> > headers;  // 握手时附加的请求头
+        bool permessage_deflate;
+        size_t max_message_size;  // 收到的消息(解压后)超过时以1009关闭
+        size_t fragment_size;     // 发送时每帧最多的数据字节，0表示不分片
+        int ping_interval_ms;     // 0表示不主动ping
+    };
+    typedef base::Callback<void(MessageType type, const std::string& data)> MessageCallback;
+    // rv为OK表示完成了关闭握手，否则是net错误码；code和reason是对方的关闭帧，没有时code为1005或者1006
+    typedef base::Callback<void(int rv, int code, const std::string& reason)> CloseCallback;
+
+    WebSocket(const std::string& url, const Options& options);
+    ~WebSocket();
+
+    // 连接并握手，返回ERR_IO_PENDING，之后回调OK或者net错误码，不会同步回调；url不合法时同步返回错误
+    int open(const CompletionCallback& callback);
+    void setMessageCallback(const MessageCallback& callback);
+    // 只在open成功之后的关闭时调用
+    void setCloseCallback(const CloseCallback& callback);
+    // 编码后放进socket的写队列，返回OK或者net错误码
+    int send(MessageType type, const std::string& data);
+    int ping(const std::string& payload);
+    // 发起关闭握手，对方回复或者超时后断开并调用close callback；还没有打开时直接断开，open回调ERR_ABORTED
+    void close(int code, const std::string& reason);
+
+    bool isOpen() const { return state_ == STATE_OPEN; }
+    const std::string& protocol() const { return protocol_; }
+    bool deflateEnabled() const { return deflate_enabled_; }
+    AsyncSocket* socket() const { return socket_.get(); }
+
+    // 握手响应里Sec-WebSocket-Accept应有的值
+    static std::string ComputeAcceptKey(const std::string& key);
+
+private:
+    enum State {
+        STATE_NONE,
+        STATE_CONNECTING,
+        STATE_OPEN,
+        STATE_CLOSING,  // 发出了关闭帧，等对方回复
+        STATE_CLOSED,
+    };
+    enum ReadState {
+        READ_HEADER,
+        READ_LENGTH,
+        READ_PAYLOAD,
+    };
+
+    void DoConnect();
+    void OnConnected(int rv);
+    void OnHandshakeResponse(int rv, const std::string& response);
+    int ValidateHandshake(const std::string& response);
+    int ParseExtensions(const std::string& extensions);
+    void FinishOpen(int rv);
+
+    void DoReadLoop();
+    void OnReadComplete(int rv, const std::string& data);
+    bool HandleRead(const std::string& data);
+    bool BeginPayload();
+    bool HandleFrame(const std::string& payload);
+
+    int Deflate(const std::string& data, std::string* output);
+    int Inflate(std::string* data);
+    void WriteFrame(int opcode, bool fin, bool compressed, const char* data, size_t length,
+                    const CompletionCallback& callback);
+    void SendClose(int code, const std::string& reason);
+    void OnCloseFrameWritten(int rv);
+    void OnPingTimer();
+    void OnTimeout();
+    void Fail(int rv, int code, const std::string& reason);
+    void FinishClose(int rv, int code, const std::string& reason);
+
+    std::string host_;
+    std::string host_header_;
+    std::string resource_;
+    uint16_t port_;
+    int url_error_;
+    Options options_;
+
+    scoped_ptr<AsyncSocket> socket_;
+    scoped_ptr<SocketStreamReader> reader_;
+    State state_;
+    std::string key_;
+    std::string protocol_;
+    CompletionCallback open_callback_;
+    MessageCallback message_callback_;
+    CloseCallback close_callback_;
+
+    ReadState read_state_;
+    size_t read_want_;
+    bool frame_fin_;
+    bool frame_compressed_;
+    int frame_opcode_;
+    uint64 frame_length_;
+    int message_opcode_;       // 正在收的分片消息的类型，0表示没有
+    bool message_compressed_;
+    std::string message_;
+
+    bool deflate_enabled_;
+    bool client_no_context_takeover_;
+    bool server_no_context_takeover_;
+    int client_window_bits_;
+    scoped_ptr<z_stream> deflater_;
+    scoped_ptr<z_stream> inflater_;
+
+    bool close_write_pending_;  // 关闭帧还在写队列里，写完再断开
+    bool alive_;                // 上一次ping之后收到过帧
+    base::RepeatingTimer<WebSocket> ping_timer_;
+    base::OneShotTimer<WebSocket> timeout_timer_;  // 握手和关闭握手的超时
+
+    base::ThreadChecker thread_checker_;
+    base::WeakPtrFactory<WebSocket> weak_factory_;
+
+    DISALLOW_COPY_AND_ASSIGN(WebSocket);
+};
+}
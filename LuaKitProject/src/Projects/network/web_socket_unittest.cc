@@ -0,0 +1,354 @@
+#include "network/web_socket.h"
+
+#include "base/bind.h"
+#include "base/message_loop/message_loop.h"
+#include "base/run_loop.h"
+#include "base/strings/string_number_conversions.h"
+#include "network/async_server_socket.h"
+#include "network/net/net_errors.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace net {
+
+namespace {
+
+const int OPCODE_CONTINUATION = 0x0;
+const int OPCODE_TEXT = 0x1;
+const int OPCODE_BINARY = 0x2;
+const int OPCODE_CLOSE = 0x8;
+const int OPCODE_PING = 0x9;
+const int OPCODE_PONG = 0xa;
+
+struct Frame {
+    Frame() : fin(false), opcode(0), masked(false) {}
+    bool fin;
+    int opcode;
+    bool masked;
+    std::string payload;  // 已经去掉掩码
+};
+
+// 服务器发出的帧，不加掩码
+std::string EncodeServerFrame(int opcode, bool fin, const std::string& payload) {
+    std::string frame;
+    frame.push_back((char)((fin ? 0x80 : 0) | opcode));
+    if (payload.size() < 126) {
+        frame.push_back((char)payload.size());
+    } else if (payload.size() <= 0xffff) {
+        frame.push_back((char)126);
+        frame.push_back((char)(payload.size() >> 8));
+        frame.push_back((char)payload.size());
+    } else {
+        frame.push_back((char)127);
+        for (int i = 7; i >= 0; i--) {
+            frame.push_back((char)((uint64)payload.size() >> (i * 8)));
+        }
+    }
+    return frame + payload;
+}
+
+// 本机的服务器端：accept一个连接，完成握手后按帧收发
+class WebSocketTest : public testing::Test {
+protected:
+    WebSocketTest()
+        : open_result_(ERR_IO_PENDING), open_done_(false),
+          close_result_(ERR_IO_PENDING), close_code_(0), close_done_(false),
+          accepted_(false), server_read_done_(false), server_read_result_(ERR_IO_PENDING) {}
+
+    virtual void SetUp() OVERRIDE {
+        ASSERT_EQ(OK, server_.listen("127.0.0.1", 0, 8));
+        ASSERT_EQ(OK, server_.startAccepting(base::Bind(&WebSocketTest::OnAccept, base::Unretained(this))));
+    }
+
+    virtual void TearDown() OVERRIDE {
+        web_socket_.reset();
+        server_reader_.reset();
+        server_socket_.reset();
+        server_.close();
+    }
+
+    void Quit() {
+        if (!quit_closure_.is_null()) {
+            quit_closure_.Run();
+        }
+    }
+
+    void WaitUntil(const bool* done) {
+        while (!*done) {
+            base::RunLoop run_loop;
+            quit_closure_ = run_loop.QuitClosure();
+            run_loop.Run();
+            quit_closure_.Reset();
+        }
+    }
+
+    void OnAccept(AsyncSocket* socket, const sockaddr_data& peer) {
+        server_socket_.reset(socket);
+        server_reader_.reset(new SocketStreamReader(socket));
+        accepted_ = true;
+        Quit();
+    }
+
+    void OnOpen(int rv) {
+        open_result_ = rv;
+        open_done_ = true;
+        Quit();
+    }
+
+    void OnMessage(WebSocket::MessageType type, const std::string& data) {
+        messages_.push_back(std::make_pair(type, data));
+        Quit();
+    }
+
+    void OnClose(int rv, int code, const std::string& reason) {
+        close_result_ = rv;
+        close_code_ = code;
+        close_done_ = true;
+        Quit();
+    }
+
+    void OnServerRead(int rv, const std::string& data) {
+        server_read_result_ = rv;
+        server_read_data_ = data;
+        server_read_done_ = true;
+        Quit();
+    }
+
+    // 连接、握手，直到open回调OK
+    void Open(const WebSocket::Options& options) {
+        std::string url = "ws://127.0.0.1:" + base::IntToString(server_.localPort()) + "/chat";
+        web_socket_.reset(new WebSocket(url, options));
+        web_socket_->setMessageCallback(base::Bind(&WebSocketTest::OnMessage, base::Unretained(this)));
+        web_socket_->setCloseCallback(base::Bind(&WebSocketTest::OnClose, base::Unretained(this)));
+        ASSERT_EQ(ERR_IO_PENDING, web_socket_->open(base::Bind(&WebSocketTest::OnOpen, base::Unretained(this))));
+        WaitUntil(&accepted_);
+
+        std::string request = ServerReadUntil("\r\n\r\n");
+        const std::string key_header = "Sec-WebSocket-Key: ";
+        size_t start = request.find(key_header);
+        ASSERT_NE(std::string::npos, start);
+        start += key_header.size();
+        std::string key = request.substr(start, request.find("\r\n", start) - start);
+        ServerWrite("HTTP/1.1 101 Switching Protocols\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Accept: " + WebSocket::ComputeAcceptKey(key) + "\r\n\r\n");
+        WaitUntil(&open_done_);
+        ASSERT_EQ(OK, open_result_);
+        ASSERT_TRUE(web_socket_->isOpen());
+    }
+
+    void ServerWrite(const std::string& data) {
+        scoped_refptr<IOBuffer> buffer(new StringIOBuffer(data));
+        server_socket_->write(buffer.get(), data.size(), CompletionCallback());
+        base::RunLoop().RunUntilIdle();
+    }
+
+    // 读没有同步完成时等回调
+    std::string FinishServerRead(int rv, const std::string& data) {
+        if (rv != ERR_IO_PENDING) {
+            EXPECT_EQ(OK, rv);
+            return data;
+        }
+        WaitUntil(&server_read_done_);
+        server_read_done_ = false;
+        EXPECT_EQ(OK, server_read_result_);
+        return server_read_data_;
+    }
+
+    std::string ServerReadExactly(size_t length) {
+        std::string data;
+        int rv = server_reader_->ReadExactly(length, &data, base::Bind(&WebSocketTest::OnServerRead, base::Unretained(this)));
+        return FinishServerRead(rv, data);
+    }
+
+    std::string ServerReadUntil(const std::string& delimiter) {
+        std::string data;
+        int rv = server_reader_->ReadUntil(delimiter, 16 * 1024, &data, base::Bind(&WebSocketTest::OnServerRead, base::Unretained(this)));
+        return FinishServerRead(rv, data);
+    }
+
+    void WaitForMessages(size_t count) {
+        while (messages_.size() < count && !close_done_) {
+            base::RunLoop run_loop;
+            quit_closure_ = run_loop.QuitClosure();
+            run_loop.Run();
+            quit_closure_.Reset();
+        }
+    }
+
+    // 读客户端发来的一帧并去掉掩码
+    Frame ServerReadFrame() {
+        Frame frame;
+        std::string header = ServerReadExactly(2);
+        if (header.size() != 2) {
+            return frame;
+        }
+        frame.fin = (header[0] & 0x80) != 0;
+        frame.opcode = header[0] & 0x0f;
+        frame.masked = (header[1] & 0x80) != 0;
+        uint64 length = header[1] & 0x7f;
+        if (length >= 126) {
+            std::string extended = ServerReadExactly(length == 126 ? 2 : 8);
+            length = 0;
+            for (size_t i = 0; i < extended.size(); i++) {
+                length = (length << 8) | (unsigned char)extended[i];
+            }
+        }
+        std::string mask = frame.masked ? ServerReadExactly(4) : std::string();
+        frame.payload = length > 0 ? ServerReadExactly((size_t)length) : std::string();
+        for (size_t i = 0; i < frame.payload.size() && mask.size() == 4; i++) {
+            frame.payload[i] ^= mask[i % 4];
+        }
+        return frame;
+    }
+
+    base::MessageLoopForIO message_loop_;
+    base::Closure quit_closure_;
+
+    AsyncServerSocket server_;
+    scoped_ptr<AsyncSocket> server_socket_;
+    scoped_ptr<SocketStreamReader> server_reader_;
+    scoped_ptr<WebSocket> web_socket_;
+
+    int open_result_;
+    bool open_done_;
+    std::vector<std::pair<WebSocket::MessageType, std::string> > messages_;
+    int close_result_;
+    int close_code_;
+    bool close_done_;
+
+    bool accepted_;
+    bool server_read_done_;
+    int server_read_result_;
+    std::string server_read_data_;
+};
+
+TEST(WebSocketAcceptKeyTest, Rfc6455Example) {
+    // RFC 6455 1.3的例子
+    EXPECT_EQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", WebSocket::ComputeAcceptKey("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+// 各种长度都覆盖到：7位、16位、64位长度，以及掩码按8字节处理后剩下的尾巴
+TEST_F(WebSocketTest, MaskedFramesRoundTrip) {
+    Open(WebSocket::Options());
+    const size_t sizes[] = {0, 1, 7, 9, 125, 126, 127, 300, 65535, 65536, 70001};
+    for (size_t i = 0; i < arraysize(sizes); i++) {
+        std::string payload(sizes[i], '\0');
+        for (size_t j = 0; j < payload.size(); j++) {
+            payload[j] = (char)(j * 31 + i);
+        }
+        ASSERT_EQ(OK, web_socket_->send(WebSocket::MESSAGE_BINARY, payload));
+        Frame frame = ServerReadFrame();
+        EXPECT_TRUE(frame.fin);
+        EXPECT_EQ(OPCODE_BINARY, frame.opcode);
+        EXPECT_TRUE(frame.masked);
+        EXPECT_EQ(payload, frame.payload) << "size " << sizes[i];
+    }
+}
+
+TEST_F(WebSocketTest, FragmentedSend) {
+    WebSocket::Options options;
+    options.fragment_size = 4;
+    Open(options);
+    ASSERT_EQ(OK, web_socket_->send(WebSocket::MESSAGE_TEXT, "abcdefghij"));
+
+    Frame first = ServerReadFrame();
+    EXPECT_FALSE(first.fin);
+    EXPECT_EQ(OPCODE_TEXT, first.opcode);
+    EXPECT_EQ("abcd", first.payload);
+    Frame second = ServerReadFrame();
+    EXPECT_FALSE(second.fin);
+    EXPECT_EQ(OPCODE_CONTINUATION, second.opcode);
+    EXPECT_EQ("efgh", second.payload);
+    Frame last = ServerReadFrame();
+    EXPECT_TRUE(last.fin);
+    EXPECT_EQ(OPCODE_CONTINUATION, last.opcode);
+    EXPECT_EQ("ij", last.payload);
+    EXPECT_TRUE(first.masked && second.masked && last.masked);
+}
+
+// 分片之间插入的ping要先回复，消息收齐后整条回调
+TEST_F(WebSocketTest, FragmentedReceive) {
+    Open(WebSocket::Options());
+    ServerWrite(EncodeServerFrame(OPCODE_TEXT, false, "Hel") +
+                EncodeServerFrame(OPCODE_PING, true, "p") +
+                EncodeServerFrame(OPCODE_CONTINUATION, true, "lo"));
+
+    Frame pong = ServerReadFrame();
+    EXPECT_EQ(OPCODE_PONG, pong.opcode);
+    EXPECT_TRUE(pong.masked);
+    EXPECT_EQ("p", pong.payload);
+
+    WaitForMessages(1);
+    ASSERT_EQ(1u, messages_.size());
+    EXPECT_EQ(WebSocket::MESSAGE_TEXT, messages_[0].first);
+    EXPECT_EQ("Hello", messages_[0].second);
+}
+
+// 一次写入多个帧，以及一个帧被拆成单个字节写入
+TEST_F(WebSocketTest, FrameBoundaries) {
+    Open(WebSocket::Options());
+    std::string large(300, 'L');
+    ServerWrite(EncodeServerFrame(OPCODE_TEXT, true, "one") +
+                EncodeServerFrame(OPCODE_BINARY, true, large));
+    std::string split = EncodeServerFrame(OPCODE_TEXT, true, "three");
+    for (size_t i = 0; i < split.size(); i++) {
+        ServerWrite(split.substr(i, 1));
+    }
+    ServerWrite(EncodeServerFrame(OPCODE_BINARY, true, ""));
+
+    WaitForMessages(4);
+    ASSERT_EQ(4u, messages_.size());
+    EXPECT_EQ(WebSocket::MESSAGE_TEXT, messages_[0].first);
+    EXPECT_EQ("one", messages_[0].second);
+    EXPECT_EQ(WebSocket::MESSAGE_BINARY, messages_[1].first);
+    EXPECT_EQ(large, messages_[1].second);
+    EXPECT_EQ("three", messages_[2].second);
+    EXPECT_EQ("", messages_[3].second);
+}
+
+// 服务器发来的帧不能加掩码，客户端以1002关闭，本地回调按没有收到关闭帧报1006
+TEST_F(WebSocketTest, MaskedServerFrame) {
+    Open(WebSocket::Options());
+    std::string frame = EncodeServerFrame(OPCODE_TEXT, true, "x");
+    frame[1] |= 0x80;
+    frame.insert(2, std::string(4, '\0'));
+    ServerWrite(frame);
+
+    Frame close = ServerReadFrame();
+    EXPECT_EQ(OPCODE_CLOSE, close.opcode);
+    ASSERT_GE(close.payload.size(), 2u);
+    EXPECT_EQ(1002, ((unsigned char)close.payload[0] << 8) | (unsigned char)close.payload[1]);
+    WaitUntil(&close_done_);
+    EXPECT_EQ(ERR_WS_PROTOCOL_ERROR, close_result_);
+    EXPECT_EQ(1006, close_code_);
+}
+
+TEST_F(WebSocketTest, InvalidUTF8Text) {
+    Open(WebSocket::Options());
+    ServerWrite(EncodeServerFrame(OPCODE_TEXT, true, "\xc3\x28"));
+
+    Frame close = ServerReadFrame();
+    EXPECT_EQ(OPCODE_CLOSE, close.opcode);
+    ASSERT_GE(close.payload.size(), 2u);
+    EXPECT_EQ(1007, ((unsigned char)close.payload[0] << 8) | (unsigned char)close.payload[1]);
+    WaitUntil(&close_done_);
+    EXPECT_TRUE(messages_.empty());
+}
+
+// 对方发起关闭，回复同样的关闭码，close callback带对方的code和reason
+TEST_F(WebSocketTest, ServerInitiatedClose) {
+    Open(WebSocket::Options());
+    ServerWrite(EncodeServerFrame(OPCODE_CLOSE, true, std::string("\x03\xe8" "bye", 5)));
+
+    Frame close = ServerReadFrame();
+    EXPECT_EQ(OPCODE_CLOSE, close.opcode);
+    EXPECT_EQ(std::string("\x03\xe8", 2), close.payload);
+    WaitUntil(&close_done_);
+    EXPECT_EQ(OK, close_result_);
+    EXPECT_EQ(1000, close_code_);
+}
+
+}  // namespace
+
+}  // namespace net